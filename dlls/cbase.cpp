@@ -153,6 +153,9 @@ int DispatchSpawn(edict_t* pent)
 
 		pEntity->Spawn();
 
+		// Spawn() is where entities become monsters
+		UTIL_InvalidateEntityIndex();
+
 		// Try to get the pointer again, in case the spawn function deleted the entity.
 		// UNDONE: Spawn() should really return a code to ask that the entity be deleted, but
 		// that would touch too much code for me to do that right now.
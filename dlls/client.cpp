@@ -209,6 +209,9 @@ void ClientPutInServer(edict_t* pEntity)
 	// Allocate a CBasePlayer for pev, and call spawn
 	pPlayer->Spawn();
 
+	// The player is a client now
+	UTIL_InvalidateEntityIndex();
+
 	// Reset interpolation during first frame
 	pPlayer->pev->effects |= EF_NOINTERP;
 
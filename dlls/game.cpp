@@ -18,6 +18,8 @@
 #include "client.h"
 #include "game.h"
 #include "filesystem_utils.h"
+#include "cbase.h"
+#include "nodes.h"
 
 cvar_t displaysoundlist = {"displaysoundlist", "0"};
 
@@ -47,6 +49,8 @@ cvar_t mp_chattime = {"mp_chattime", "10", FCVAR_SERVER};
 
 cvar_t sv_allowbunnyhopping = {"sv_allowbunnyhopping", "0", FCVAR_SERVER};
 
+cvar_t sv_entity_index_check = {"sv_entity_index_check", "0"};
+
 //CVARS FOR SKILL LEVEL SETTINGS
 // Agrunt
 cvar_t sk_agrunt_health1 = {"sk_agrunt_health1", "0"};
@@ -498,6 +502,8 @@ void GameDLLInit()
 
 	CVAR_REGISTER(&sv_allowbunnyhopping);
 
+	CVAR_REGISTER(&sv_entity_index_check);
+
 	// REGISTER CVARS FOR SKILL LEVEL STUFF
 	// Agrunt
 	CVAR_REGISTER(&sk_agrunt_health1); // {"sk_agrunt_health1","0"};
@@ -905,6 +911,8 @@ void GameDLLInit()
 	// END REGISTER CVARS FOR SKILL LEVEL STUFF
 
 	InitMapLoadingUtils();
+	InitNodeGraphCommands();
+	InitMaterialCommands();
 
 	SERVER_COMMAND("exec skill.cfg\n");
 }
@@ -16,9 +16,13 @@
 // nodes.cpp - AI node tree stuff.
 //=========================================================
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <limits>
+#include <queue>
 #include <string>
+#include <vector>
 
 #include "extdll.h"
 #include "util.h"
@@ -41,6 +45,81 @@ Vector VecBModelOrigin(entvars_t* pevBModel);
 
 CGraph WorldGraph;
 
+//=========================================================
+// The last path found with landmarks, so that walking a
+// route one node at a time with NextNodeInRoute doesn't
+// search again at every step.
+//=========================================================
+static struct LandmarkRouteCache
+{
+	std::vector<int> path;
+	int iDest;
+	int iHull;
+	int iCap;
+
+	void Clear() { path.clear(); }
+} g_LandmarkRouteCache;
+
+//=========================================================
+// The nodes the current landmark search has reached. A node
+// has been reached when its mark equals the search's
+// generation, so a new search doesn't have to reset every
+// node first.
+//=========================================================
+static struct LandmarkSearchMarks
+{
+	std::vector<unsigned int> marks;
+	unsigned int generation = 0;
+
+	void Begin(int cNodes)
+	{
+		if ((int)marks.size() != cNodes || ++generation == 0)
+		{
+			marks.assign(cNodes, 0);
+			generation = 1;
+		}
+	}
+
+	bool Reached(int iNode) const { return marks[iNode] == generation; }
+	void Reach(int iNode) { marks[iNode] = generation; }
+} g_LandmarkSearchMarks;
+
+//=========================================================
+// A grid of the nodes, so FindNearestNode can visit them
+// nearest first and stop at the first one it can see. It is
+// built from the node positions the first time it's needed
+// after the graph changes.
+//=========================================================
+#define NODE_GRID_CELL_SIZE 256.0f // smallest cell size
+#define NODE_GRID_MAX_CELLS 32	   // most cells along each axis
+
+static struct NodeGrid
+{
+	bool fBuilt;
+	Vector vecMins;
+	float flCellSize;
+	int dims[3];
+	std::vector<int> cellStart; // index of each cell's first node in cellNodes, one more than the number of cells
+	std::vector<int> cellNodes;
+
+	void Clear()
+	{
+		fBuilt = false;
+		cellStart.clear();
+		cellNodes.clear();
+	}
+
+	int CellCoord(float flPos, int iAxis) const
+	{
+		return (int)floor((flPos - vecMins[iAxis]) / flCellSize);
+	}
+
+	int CellIndex(int x, int y, int z) const
+	{
+		return (z * dims[1] + y) * dims[0] + x;
+	}
+} g_NodeGrid;
+
 LINK_ENTITY_TO_CLASS(info_node, CNodeEnt);
 LINK_ENTITY_TO_CLASS(info_node_air, CNodeEnt);
 
@@ -94,11 +173,21 @@ void CGraph::InitGraph()
 		m_pHashLinks = NULL;
 	}
 
+	if (m_pLandmarkDist)
+	{
+		free(m_pLandmarkDist);
+		m_pLandmarkDist = NULL;
+	}
+
 	// Zero node and link counts
 	//
 	m_cNodes = 0;
 	m_cLinks = 0;
 	m_nRouteInfo = 0;
+	m_nLandmarkDist = 0;
+	m_iRouteMode = NODE_ROUTE_TABLES;
+	g_LandmarkRouteCache.Clear();
+	g_NodeGrid.Clear();
 
 	m_iLastActiveIdleSearch = 0;
 	m_iLastCoverSearch = 0;
@@ -477,6 +566,17 @@ float CGraph::PathLength(int iStart, int iDest, int iHull, int afCapMask)
 	int iCurrentNode = iStart;
 	int iCap = CapIndex(afCapMask);
 
+	if (m_iRouteMode == NODE_ROUTE_LANDMARKS)
+	{
+		// the search adds up the weights itself, and walking the route
+		// would replace the route cache with a path from each new start
+		int iFirst;
+		if (iStart == iDest || !FindLandmarkPath(&iFirst, 1, iStart, iDest, iHull, iCap ? (bits_CAP_OPEN_DOORS | bits_CAP_AUTO_DOORS | bits_CAP_USE) : 0, &distance))
+			return 0;
+
+		return distance;
+	}
+
 	while (iCurrentNode != iDest)
 	{
 		if (iMaxLoop-- <= 0)
@@ -512,6 +612,35 @@ float CGraph::PathLength(int iStart, int iDest, int iHull, int afCapMask)
 // Parse the routing table at iCurrentNode for the next node on the shortest path to iDest
 int CGraph::NextNodeInRoute(int iCurrentNode, int iDest, int iHull, int iCap)
 {
+	if (m_iRouteMode == NODE_ROUTE_LANDMARKS)
+	{
+		if (iCurrentNode == iDest)
+			return iDest;
+
+		LandmarkRouteCache& cache = g_LandmarkRouteCache;
+
+		// any part of a shortest path is itself a shortest path
+		if (cache.iDest == iDest && cache.iHull == iHull && cache.iCap == iCap)
+		{
+			for (int i = 0; i < (int)cache.path.size() - 1; i++)
+			{
+				if (cache.path[i] == iCurrentNode)
+					return cache.path[i + 1];
+			}
+		}
+
+		cache.path.resize(m_cNodes);
+		cache.path.resize(FindLandmarkPath(cache.path.data(), m_cNodes, iCurrentNode, iDest, iHull, iCap ? (bits_CAP_OPEN_DOORS | bits_CAP_AUTO_DOORS | bits_CAP_USE) : 0));
+		cache.iDest = iDest;
+		cache.iHull = iHull;
+		cache.iCap = iCap;
+
+		if (cache.path.size() < 2)
+			return iCurrentNode;
+
+		return cache.path[1];
+	}
+
 	int iNext = iCurrentNode;
 	int nCount = iDest + 1;
 	char* pRoute = m_pRouteInfo + m_pNodes[iCurrentNode].m_pNextBestNode[iHull][iCap];
@@ -603,7 +732,11 @@ int CGraph::FindShortestPath(int* piPath, int iStart, int iDest, int iHull, int
 
 	// Is routing information present.
 	//
-	if (0 != m_fRoutingComplete)
+	if (0 != m_fRoutingComplete && m_iRouteMode == NODE_ROUTE_LANDMARKS)
+	{
+		iNumPathNodes = FindLandmarkPath(piPath, MAX_PATH_SIZE, iStart, iDest, iHull, afCapMask);
+	}
+	else if (0 != m_fRoutingComplete)
 	{
 		int iCap = CapIndex(afCapMask);
 
@@ -782,21 +915,6 @@ inline unsigned int Hash(void* p, int len)
 	return CRC32_FINAL(ulCrc);
 }
 
-void inline CalcBounds(int& Lower, int& Upper, int Goal, int Best)
-{
-	int Temp = 2 * Goal - Best;
-	if (Best > Goal)
-	{
-		Lower = V_max(0, Temp);
-		Upper = Best;
-	}
-	else
-	{
-		Upper = V_min(255, Temp);
-		Lower = Best;
-	}
-}
-
 // Convert from [-8192,8192] to [0, 255]
 //
 inline int CALC_RANGE(int x, int lower, int upper)
@@ -805,53 +923,98 @@ inline int CALC_RANGE(int x, int lower, int upper)
 }
 
 
-void inline UpdateRange(int& minValue, int& maxValue, int Goal, int Best)
+//=========================================================
+// Counters for FindNearestNode, shown by sv_node_stats
+//=========================================================
+static struct NearestNodeStats
 {
-	int Lower, Upper;
-	CalcBounds(Lower, Upper, Goal, Best);
-	if (Upper < maxValue)
-		maxValue = Upper;
-	if (minValue < Lower)
-		minValue = Lower;
-}
+	int cQueries;
+	int cCacheHits;
+	int cTraces;
+	int cFailures;
+	double flTotalTime; // seconds
+	double flMaxTime;
+
+	void Clear()
+	{
+		*this = NearestNodeStats{};
+	}
+} g_NearestNodeStats;
 
-void CGraph::CheckNode(Vector vecOrigin, int iNode)
+static void BuildNodeGrid(CGraph& graph)
 {
-	// Have we already seen this point before?.
-	//
-	if (m_di[iNode].m_CheckedEvent == m_CheckedCounter)
-		return;
-	m_di[iNode].m_CheckedEvent = m_CheckedCounter;
+	NodeGrid& grid = g_NodeGrid;
 
-	float flDist = (vecOrigin - m_pNodes[iNode].m_vecOriginPeek).Length();
+	grid.Clear();
 
-	if (flDist < m_flShortest)
+	Vector vecMaxs;
+	for (int i = 0; i < graph.m_cNodes; i++)
 	{
-		TraceResult tr;
-
-		// make sure that vecOrigin can trace to this node!
-		UTIL_TraceLine(vecOrigin, m_pNodes[iNode].m_vecOriginPeek, ignore_monsters, 0, &tr);
+		const Vector& pos = graph.m_pNodes[i].m_vecOriginPeek;
 
-		if (tr.flFraction == 1.0)
+		for (int a = 0; a < 3; a++)
 		{
-			m_iNearest = iNode;
-			m_flShortest = flDist;
+			if (0 == i || pos[a] < grid.vecMins[a])
+				grid.vecMins[a] = pos[a];
+			if (0 == i || pos[a] > vecMaxs[a])
+				vecMaxs[a] = pos[a];
+		}
+	}
 
-			UpdateRange(m_minX, m_maxX, CALC_RANGE(vecOrigin.x, m_RegionMin[0], m_RegionMax[0]), m_pNodes[iNode].m_Region[0]);
-			UpdateRange(m_minY, m_maxY, CALC_RANGE(vecOrigin.y, m_RegionMin[1], m_RegionMax[1]), m_pNodes[iNode].m_Region[1]);
-			UpdateRange(m_minZ, m_maxZ, CALC_RANGE(vecOrigin.z, m_RegionMin[2], m_RegionMax[2]), m_pNodes[iNode].m_Region[2]);
+	grid.flCellSize = NODE_GRID_CELL_SIZE;
+	for (int a = 0; a < 3; a++)
+		grid.flCellSize = V_max(grid.flCellSize, (vecMaxs[a] - grid.vecMins[a]) / (NODE_GRID_MAX_CELLS - 1));
 
-			// From maxCircle, calculate maximum bounds box. All points must be
-			// simultaneously inside all bounds of the box.
-			//
-			m_minBoxX = CALC_RANGE(vecOrigin.x - flDist, m_RegionMin[0], m_RegionMax[0]);
-			m_maxBoxX = CALC_RANGE(vecOrigin.x + flDist, m_RegionMin[0], m_RegionMax[0]);
-			m_minBoxY = CALC_RANGE(vecOrigin.y - flDist, m_RegionMin[1], m_RegionMax[1]);
-			m_maxBoxY = CALC_RANGE(vecOrigin.y + flDist, m_RegionMin[1], m_RegionMax[1]);
-			m_minBoxZ = CALC_RANGE(vecOrigin.z - flDist, m_RegionMin[2], m_RegionMax[2]);
-			m_maxBoxZ = CALC_RANGE(vecOrigin.z + flDist, m_RegionMin[2], m_RegionMax[2]);
-		}
+	for (int a = 0; a < 3; a++)
+		grid.dims[a] = V_min(grid.CellCoord(vecMaxs[a], a) + 1, NODE_GRID_MAX_CELLS);
+
+	// count the nodes in each cell, then place them
+	const int cCells = grid.dims[0] * grid.dims[1] * grid.dims[2];
+	std::vector<int> nodeCell(graph.m_cNodes);
+	grid.cellStart.assign(cCells + 1, 0);
+
+	for (int i = 0; i < graph.m_cNodes; i++)
+	{
+		const Vector& pos = graph.m_pNodes[i].m_vecOriginPeek;
+
+		int c[3];
+		for (int a = 0; a < 3; a++)
+			c[a] = std::clamp(grid.CellCoord(pos[a], a), 0, grid.dims[a] - 1);
+
+		nodeCell[i] = grid.CellIndex(c[0], c[1], c[2]);
+		grid.cellStart[nodeCell[i] + 1]++;
 	}
+
+	for (int i = 0; i < cCells; i++)
+		grid.cellStart[i + 1] += grid.cellStart[i];
+
+	std::vector<int> fill(grid.cellStart.begin(), grid.cellStart.end() - 1);
+	grid.cellNodes.resize(graph.m_cNodes);
+	for (int i = 0; i < graph.m_cNodes; i++)
+		grid.cellNodes[fill[nodeCell[i]]++] = i;
+
+	grid.fBuilt = true;
+}
+
+static void NodeStats()
+{
+	const NearestNodeStats& stats = g_NearestNodeStats;
+	const int cSearches = stats.cQueries - stats.cCacheHits;
+
+	ALERT(at_console, "FindNearestNode: %d queries, %d cache hits (%.1f%%), %d failed\n",
+		stats.cQueries, stats.cCacheHits, (stats.cQueries > 0) ? 100.0 * stats.cCacheHits / stats.cQueries : 0.0, stats.cFailures);
+	ALERT(at_console, "  %d traces (%.2f per search), %.1f us average, %.1f us max\n",
+		stats.cTraces, (cSearches > 0) ? (double)stats.cTraces / cSearches : 0.0,
+		(cSearches > 0) ? 1000000.0 * stats.flTotalTime / cSearches : 0.0, 1000000.0 * stats.flMaxTime);
+
+	// "sv_node_stats reset" starts counting again
+	if (CMD_ARGC() == 2 && FStrEq(CMD_ARGV(1), "reset"))
+		g_NearestNodeStats.Clear();
+}
+
+void InitNodeGraphCommands()
+{
+	g_engfuncs.pfnAddServerCommand("sv_node_stats", &NodeStats);
 }
 
 //=========================================================
@@ -866,7 +1029,6 @@ int CGraph::FindNearestNode(const Vector& vecOrigin, CBaseEntity* pEntity)
 
 int CGraph::FindNearestNode(const Vector& vecOrigin, int afNodeTypes)
 {
-	int i;
 	TraceResult tr;
 
 	if (0 == m_fGraphPresent || 0 == m_fGraphPointersSet)
@@ -875,12 +1037,15 @@ int CGraph::FindNearestNode(const Vector& vecOrigin, int afNodeTypes)
 		return -1;
 	}
 
+	g_NearestNodeStats.cQueries++;
+
 	// Check with the cache
 	//
 	unsigned int iHash = (CACHE_SIZE - 1) & Hash((void*)(const float*)vecOrigin, sizeof(vecOrigin));
 	if (m_Cache[iHash].v == vecOrigin)
 	{
 		//ALERT(at_aiconsole, "Cache Hit.\n");
+		g_NearestNodeStats.cCacheHits++;
 		return m_Cache[iHash].n;
 	}
 	else
@@ -888,182 +1053,113 @@ int CGraph::FindNearestNode(const Vector& vecOrigin, int afNodeTypes)
 		//ALERT(at_aiconsole, "Cache Miss.\n");
 	}
 
-	// Mark all points as unchecked.
-	//
-	m_CheckedCounter++;
-	if (m_CheckedCounter == 0)
-	{
-		for (int i = 0; i < m_cNodes; i++)
-		{
-			m_di[i].m_CheckedEvent = 0;
-		}
-		m_CheckedCounter++;
-	}
+	const auto startTime = std::chrono::steady_clock::now();
+
+	if (!g_NodeGrid.fBuilt)
+		BuildNodeGrid(*this);
+
+	const NodeGrid& grid = g_NodeGrid;
 
 	m_iNearest = -1;
-	m_flShortest = 999999.0; // just a big number.
 
-	// If we can find a visible point, then let CalcBounds set the limits, but if
-	// we have no visible point at all to start with, then don't restrict the limits.
+	// Visit the cells in shells of growing size around the cell vecOrigin is in. Once a shell has
+	// been visited, every node that hasn't been seen yet is at least as far away as the nearest side
+	// of the shell, so every candidate closer than that can be traced, nearest first.
 	//
-#if 1
-	m_minX = 0;
-	m_maxX = 255;
-	m_minY = 0;
-	m_maxY = 255;
-	m_minZ = 0;
-	m_maxZ = 255;
-	m_minBoxX = 0;
-	m_maxBoxX = 255;
-	m_minBoxY = 0;
-	m_maxBoxY = 255;
-	m_minBoxZ = 0;
-	m_maxBoxZ = 255;
-#else
-	m_minBoxX = CALC_RANGE(vecOrigin.x - flDist, m_RegionMin[0], m_RegionMax[0]);
-	m_maxBoxX = CALC_RANGE(vecOrigin.x + flDist, m_RegionMin[0], m_RegionMax[0]);
-	m_minBoxY = CALC_RANGE(vecOrigin.y - flDist, m_RegionMin[1], m_RegionMax[1]);
-	m_maxBoxY = CALC_RANGE(vecOrigin.y + flDist, m_RegionMin[1], m_RegionMax[1]);
-	m_minBoxZ = CALC_RANGE(vecOrigin.z - flDist, m_RegionMin[2], m_RegionMax[2]);
-	m_maxBoxZ = CALC_RANGE(vecOrigin.z + flDist, m_RegionMin[2], m_RegionMax[2])
-		CalcBounds(m_minX, m_maxX, CALC_RANGE(vecOrigin.x, m_RegionMin[0], m_RegionMax[0]), m_pNodes[m_iNearest].m_Region[0]);
-	CalcBounds(m_minY, m_maxY, CALC_RANGE(vecOrigin.y, m_RegionMin[1], m_RegionMax[1]), m_pNodes[m_iNearest].m_Region[1]);
-	CalcBounds(m_minZ, m_maxZ, CALC_RANGE(vecOrigin.z, m_RegionMin[2], m_RegionMax[2]), m_pNodes[m_iNearest].m_Region[2]);
-#endif
+	typedef std::pair<float, int> Candidate;
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates;
 
-	int halfX = (m_minX + m_maxX) / 2;
-	int halfY = (m_minY + m_maxY) / 2;
-	int halfZ = (m_minZ + m_maxZ) / 2;
+	int c[3];
+	for (int a = 0; a < 3; a++)
+		c[a] = grid.CellCoord(vecOrigin[a], a);
 
-	int j;
-
-	for (i = halfX; i >= m_minX; i--)
+	for (int iShell = 0; m_iNearest == -1; iShell++)
 	{
-		for (j = m_RangeStart[0][i]; j <= m_RangeEnd[0][i]; j++)
+		int lo[3], hi[3];
+		bool fCoversGrid = true;
+		for (int a = 0; a < 3; a++)
 		{
-			if ((m_pNodes[m_di[j].m_SortedBy[0]].m_afNodeInfo & afNodeTypes) == 0)
-				continue;
-
-			int rgY = m_pNodes[m_di[j].m_SortedBy[0]].m_Region[1];
-			if (rgY > m_maxBoxY)
-				break;
-			if (rgY < m_minBoxY)
-				continue;
+			lo[a] = V_max(c[a] - iShell, 0);
+			hi[a] = V_min(c[a] + iShell, grid.dims[a] - 1);
 
-			int rgZ = m_pNodes[m_di[j].m_SortedBy[0]].m_Region[2];
-			if (rgZ < m_minBoxZ)
-				continue;
-			if (rgZ > m_maxBoxZ)
-				continue;
-			CheckNode(vecOrigin, m_di[j].m_SortedBy[0]);
+			if (c[a] - iShell > 0 || c[a] + iShell < grid.dims[a] - 1)
+				fCoversGrid = false;
 		}
-	}
 
-	for (i = V_max(m_minY, halfY + 1); i <= m_maxY; i++)
-	{
-		for (j = m_RangeStart[1][i]; j <= m_RangeEnd[1][i]; j++)
+		auto addCell = [&](int x, int y, int z)
 		{
-			if ((m_pNodes[m_di[j].m_SortedBy[1]].m_afNodeInfo & afNodeTypes) == 0)
-				continue;
+			const int iCell = grid.CellIndex(x, y, z);
+			for (int j = grid.cellStart[iCell]; j < grid.cellStart[iCell + 1]; j++)
+			{
+				const int iNode = grid.cellNodes[j];
 
-			int rgZ = m_pNodes[m_di[j].m_SortedBy[1]].m_Region[2];
-			if (rgZ > m_maxBoxZ)
-				break;
-			if (rgZ < m_minBoxZ)
-				continue;
-			int rgX = m_pNodes[m_di[j].m_SortedBy[1]].m_Region[0];
-			if (rgX < m_minBoxX)
-				continue;
-			if (rgX > m_maxBoxX)
-				continue;
-			CheckNode(vecOrigin, m_di[j].m_SortedBy[1]);
-		}
-	}
+				if ((m_pNodes[iNode].m_afNodeInfo & afNodeTypes) == 0)
+					continue;
 
-	for (i = V_min(m_maxZ, halfZ); i >= m_minZ; i--)
-	{
-		for (j = m_RangeStart[2][i]; j <= m_RangeEnd[2][i]; j++)
-		{
-			if ((m_pNodes[m_di[j].m_SortedBy[2]].m_afNodeInfo & afNodeTypes) == 0)
-				continue;
+				candidates.push(Candidate((vecOrigin - m_pNodes[iNode].m_vecOriginPeek).Length(), iNode));
+			}
+		};
 
-			int rgX = m_pNodes[m_di[j].m_SortedBy[2]].m_Region[0];
-			if (rgX > m_maxBoxX)
-				break;
-			if (rgX < m_minBoxX)
-				continue;
-			int rgY = m_pNodes[m_di[j].m_SortedBy[2]].m_Region[1];
-			if (rgY < m_minBoxY)
-				continue;
-			if (rgY > m_maxBoxY)
-				continue;
-			CheckNode(vecOrigin, m_di[j].m_SortedBy[2]);
+		for (int z = lo[2]; z <= hi[2]; z++)
+		{
+			for (int y = lo[1]; y <= hi[1]; y++)
+			{
+				if (abs(z - c[2]) == iShell || abs(y - c[1]) == iShell)
+				{
+					for (int x = lo[0]; x <= hi[0]; x++)
+						addCell(x, y, z);
+				}
+				else
+				{
+					// inside the shell, only the two ends of the row are new
+					if (c[0] - iShell >= 0 && c[0] - iShell < grid.dims[0])
+						addCell(c[0] - iShell, y, z);
+					if (c[0] + iShell >= 0 && c[0] + iShell < grid.dims[0])
+						addCell(c[0] + iShell, y, z);
+				}
+			}
 		}
-	}
 
-	for (i = V_max(m_minX, halfX + 1); i <= m_maxX; i++)
-	{
-		for (j = m_RangeStart[0][i]; j <= m_RangeEnd[0][i]; j++)
+		// how far the nearest node not yet seen could be
+		float flUnseen = 999999.0;
+		if (!fCoversGrid)
 		{
-			if ((m_pNodes[m_di[j].m_SortedBy[0]].m_afNodeInfo & afNodeTypes) == 0)
-				continue;
-
-			int rgY = m_pNodes[m_di[j].m_SortedBy[0]].m_Region[1];
-			if (rgY > m_maxBoxY)
-				break;
-			if (rgY < m_minBoxY)
-				continue;
+			for (int a = 0; a < 3; a++)
+			{
+				const float flLow = grid.vecMins[a] + (c[a] - iShell) * grid.flCellSize;
+				const float flHigh = grid.vecMins[a] + (c[a] + iShell + 1) * grid.flCellSize;
 
-			int rgZ = m_pNodes[m_di[j].m_SortedBy[0]].m_Region[2];
-			if (rgZ < m_minBoxZ)
-				continue;
-			if (rgZ > m_maxBoxZ)
-				continue;
-			CheckNode(vecOrigin, m_di[j].m_SortedBy[0]);
+				flUnseen = V_min(flUnseen, V_min(vecOrigin[a] - flLow, flHigh - vecOrigin[a]));
+			}
 		}
-	}
 
-	for (i = V_min(m_maxY, halfY); i >= m_minY; i--)
-	{
-		for (j = m_RangeStart[1][i]; j <= m_RangeEnd[1][i]; j++)
+		while (!candidates.empty() && candidates.top().first <= flUnseen)
 		{
-			if ((m_pNodes[m_di[j].m_SortedBy[1]].m_afNodeInfo & afNodeTypes) == 0)
-				continue;
+			const int iNode = candidates.top().second;
+			candidates.pop();
 
-			int rgZ = m_pNodes[m_di[j].m_SortedBy[1]].m_Region[2];
-			if (rgZ > m_maxBoxZ)
+			// make sure that vecOrigin can trace to this node!
+			g_NearestNodeStats.cTraces++;
+			UTIL_TraceLine(vecOrigin, m_pNodes[iNode].m_vecOriginPeek, ignore_monsters, 0, &tr);
+
+			if (tr.flFraction == 1.0)
+			{
+				m_iNearest = iNode;
+				m_flShortest = (vecOrigin - m_pNodes[iNode].m_vecOriginPeek).Length();
 				break;
-			if (rgZ < m_minBoxZ)
-				continue;
-			int rgX = m_pNodes[m_di[j].m_SortedBy[1]].m_Region[0];
-			if (rgX < m_minBoxX)
-				continue;
-			if (rgX > m_maxBoxX)
-				continue;
-			CheckNode(vecOrigin, m_di[j].m_SortedBy[1]);
+			}
 		}
+
+		if (fCoversGrid)
+			break;
 	}
 
-	for (i = V_max(m_minZ, halfZ + 1); i <= m_maxZ; i++)
-	{
-		for (j = m_RangeStart[2][i]; j <= m_RangeEnd[2][i]; j++)
-		{
-			if ((m_pNodes[m_di[j].m_SortedBy[2]].m_afNodeInfo & afNodeTypes) == 0)
-				continue;
+	if (m_iNearest == -1)
+		g_NearestNodeStats.cFailures++;
 
-			int rgX = m_pNodes[m_di[j].m_SortedBy[2]].m_Region[0];
-			if (rgX > m_maxBoxX)
-				break;
-			if (rgX < m_minBoxX)
-				continue;
-			int rgY = m_pNodes[m_di[j].m_SortedBy[2]].m_Region[1];
-			if (rgY < m_minBoxY)
-				continue;
-			if (rgY > m_maxBoxY)
-				continue;
-			CheckNode(vecOrigin, m_di[j].m_SortedBy[2]);
-		}
-	}
+	const double flTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	g_NearestNodeStats.flTotalTime += flTime;
+	g_NearestNodeStats.flMaxTime = V_max(g_NearestNodeStats.flMaxTime, flTime);
 
 #if 0
 	// Verify our answers.
@@ -1071,7 +1167,7 @@ int CGraph::FindNearestNode(const Vector& vecOrigin, int afNodeTypes)
 	int iNearestCheck = -1;
 	m_flShortest = 8192;// find nodes within this radius
 
-	for ( i = 0 ; i < m_cNodes ; i++ )
+	for ( int i = 0 ; i < m_cNodes ; i++ )
 	{
 		float flDist = ( vecOrigin - m_pNodes[ i ].m_vecOriginPeek ).Length();
 
@@ -2055,10 +2151,14 @@ void CTestHull::BuildNodeGraph()
 	WorldGraph.m_fGraphPresent = 1;		//graph is in memory.
 	WorldGraph.m_fGraphPointersSet = 1; // since the graph was generated, the pointers are ready
 	WorldGraph.m_fRoutingComplete = 0;	// Optimal routes aren't computed, yet.
+	g_NodeGrid.Clear();					// the nodes have moved
 
 	// Compute and compress the routing information.
 	//
-	WorldGraph.ComputeStaticRoutingTables();
+	if (WorldGraph.m_iRouteMode == NODE_ROUTE_LANDMARKS)
+		WorldGraph.ComputeLandmarkRoutes();
+	else
+		WorldGraph.ComputeStaticRoutingTables();
 
 	// save the node graph for this level
 	WorldGraph.FSaveGraph(STRING(gpGlobals->mapname));
@@ -2362,6 +2462,29 @@ bool CGraph::FLoadGraph(const char* szMapName)
 	length -= sizeof(CGraph);
 	if (length < 0)
 		return false;
+
+	// Check the file's header before it replaces this graph, so a
+	// rejected file leaves the graph empty and ready to be built.
+	//
+	alignas(CGraph) byte header[sizeof(CGraph)];
+	memcpy(header, pMemFile, sizeof(CGraph));
+	const CGraph* pFileGraph = reinterpret_cast<const CGraph*>(header);
+
+	// The map asks for a different kind of routing than the file has.
+	//
+	if (pFileGraph->m_iRouteMode != m_iRouteMode)
+	{
+		ALERT(at_aiconsole, "Graph routing mode is %d, expected %d\n", pFileGraph->m_iRouteMode, m_iRouteMode);
+		return false;
+	}
+
+	const int nLandmarkDist = (m_iRouteMode == NODE_ROUTE_LANDMARKS) ? NODE_LANDMARK_DIST_COUNT(pFileGraph->m_cNodes) : 0;
+	if (pFileGraph->m_cNodes < 0 || pFileGraph->m_nLandmarkDist != nLandmarkDist)
+	{
+		ALERT(at_aiconsole, "**ERROR** Graph has %d landmark distances, expected %d\n", pFileGraph->m_nLandmarkDist, nLandmarkDist);
+		return false;
+	}
+
 	memcpy(this, pMemFile, sizeof(CGraph));
 	pMemFile += sizeof(CGraph);
 
@@ -2372,6 +2495,7 @@ bool CGraph::FLoadGraph(const char* szMapName)
 	m_di = NULL;
 	m_pRouteInfo = NULL;
 	m_pHashLinks = NULL;
+	m_pLandmarkDist = NULL;
 
 
 	// Malloc for the nodes
@@ -2428,10 +2552,10 @@ bool CGraph::FLoadGraph(const char* szMapName)
 	memcpy(m_di, pMemFile, sizeof(DIST_INFO) * m_cNodes);
 	pMemFile += sizeof(DIST_INFO) * m_cNodes;
 
-	// Malloc for the routing info.
+	// Malloc for the routing info. Graphs routed with landmarks have none.
 	//
 	m_fRoutingComplete = 0;
-	m_pRouteInfo = (char*)calloc(sizeof(char), m_nRouteInfo);
+	m_pRouteInfo = (char*)calloc(sizeof(char), V_max(m_nRouteInfo, 1));
 	if (!m_pRouteInfo)
 	{
 		ALERT(at_aiconsole, "***ERROR**\nCounldn't malloc %d route bytes!\n", m_nRouteInfo);
@@ -2469,6 +2593,26 @@ bool CGraph::FLoadGraph(const char* szMapName)
 	memcpy(m_pHashLinks, pMemFile, sizeof(short) * m_nHashLinks);
 	pMemFile += sizeof(short) * m_nHashLinks;
 
+	// Read in the landmark distances
+	//
+	if (0 != m_nLandmarkDist)
+	{
+		m_pLandmarkDist = (unsigned short*)calloc(sizeof(unsigned short), m_nLandmarkDist);
+		if (!m_pLandmarkDist)
+		{
+			ALERT(at_aiconsole, "***ERROR**\nCouldn't malloc %d landmark distances!\n", m_nLandmarkDist);
+			return false;
+		}
+
+		length -= sizeof(unsigned short) * m_nLandmarkDist;
+		if (length < 0)
+			return false;
+		memcpy(m_pLandmarkDist, pMemFile, sizeof(unsigned short) * m_nLandmarkDist);
+		pMemFile += sizeof(unsigned short) * m_nLandmarkDist;
+	}
+	g_LandmarkRouteCache.Clear();
+	g_NodeGrid.Clear();
+
 	// Set the graph present flag, clear the pointers set flag
 	//
 	m_fGraphPresent = 1;
@@ -2535,6 +2679,11 @@ bool CGraph::FSaveGraph(const char* szMapName)
 	{
 		file.Write(m_pHashLinks, sizeof(short) * m_nHashLinks);
 	}
+
+	if (m_pLandmarkDist && 0 != m_nLandmarkDist)
+	{
+		file.Write(m_pLandmarkDist, sizeof(unsigned short) * m_nLandmarkDist);
+	}
 	return true;
 }
 
@@ -3323,6 +3472,380 @@ void CGraph::ComputeStaticRoutingTables()
 	m_fRoutingComplete = 1;
 }
 
+//=========================================================
+// Landmark routing
+//
+// Instead of storing the next node from every node to
+// every other node, a few landmark nodes are picked and
+// the distance to and from each of them is stored for
+// every node. Because of the triangle inequality, these
+// give a lower bound of the distance between any two nodes,
+// which guides an A* search at run time. Building needs
+// one shortest path search per landmark instead of one
+// per node, and the stored data grows linearly with the
+// number of nodes.
+//=========================================================
+struct RouteQueueEntry
+{
+	int iNode;
+	float flDistance; // distance from the start
+	float flEstimate; // distance from the start plus the estimate of the distance left
+
+	// std::priority_queue puts the largest first, we want the smallest estimate first
+	bool operator<(const RouteQueueEntry& other) const { return flEstimate > other.flEstimate; }
+};
+
+static int HullLinkMask(int iHull)
+{
+	switch (iHull)
+	{
+	case NODE_SMALL_HULL:
+		return bits_LINK_SMALL_HULL;
+	case NODE_HUMAN_HULL:
+		return bits_LINK_HUMAN_HULL;
+	case NODE_LARGE_HULL:
+		return bits_LINK_LARGE_HULL;
+	case NODE_FLY_HULL:
+		return bits_LINK_FLY_HULL;
+	}
+	return 0;
+}
+
+//=========================================================
+// Shortest distance from iSource to every node, or from
+// every node to iSource if fToSource is set. -1 if there
+// is no path. Only links flagged in usable are followed.
+//=========================================================
+static void NodeDistances(CGraph& graph, int iSource, bool fToSource, const std::vector<char>& usable,
+	const std::vector<int>& reverseStart, const std::vector<int>& reverseLinks, std::vector<float>& dist)
+{
+	dist.assign(graph.m_cNodes, -1.0f);
+
+	std::priority_queue<RouteQueueEntry> queue;
+
+	dist[iSource] = 0;
+	queue.push({iSource, 0, 0});
+
+	while (!queue.empty())
+	{
+		const RouteQueueEntry entry = queue.top();
+		queue.pop();
+
+		// a shorter distance was found since this was queued
+		if (entry.flDistance > dist[entry.iNode])
+			continue;
+
+		int cLinks;
+		if (fToSource)
+			cLinks = reverseStart[entry.iNode + 1] - reverseStart[entry.iNode];
+		else
+			cLinks = graph.m_pNodes[entry.iNode].m_cNumLinks;
+
+		for (int i = 0; i < cLinks; i++)
+		{
+			int iLink;
+			if (fToSource)
+				iLink = reverseLinks[reverseStart[entry.iNode] + i];
+			else
+				iLink = graph.m_pNodes[entry.iNode].m_iFirstLink + i;
+
+			if (0 == usable[iLink])
+				continue;
+
+			const CLink& link = graph.m_pLinkPool[iLink];
+			const int iVisitNode = fToSource ? link.m_iSrcNode : link.m_iDestNode;
+			const float flOurDistance = entry.flDistance + link.m_flWeight;
+
+			if (dist[iVisitNode] < -0.5 || flOurDistance < dist[iVisitNode])
+			{
+				dist[iVisitNode] = flOurDistance;
+				queue.push({iVisitNode, flOurDistance, flOurDistance});
+			}
+		}
+	}
+}
+
+static void StoreLandmarkDistances(const std::vector<float>& dist, unsigned short* pDist)
+{
+	for (std::size_t i = 0; i < dist.size(); i++)
+	{
+		if (dist[i] < -0.5)
+			pDist[i] = NODE_LANDMARK_UNREACHABLE;
+		else
+			pDist[i] = (unsigned short)V_min(dist[i], (float)NODE_LANDMARK_MAXDIST);
+	}
+}
+
+void CGraph::ComputeLandmarkRoutes()
+{
+	g_LandmarkRouteCache.Clear();
+
+	if (m_pLandmarkDist)
+	{
+		free(m_pLandmarkDist);
+		m_pLandmarkDist = NULL;
+	}
+	m_nLandmarkDist = 0;
+
+	if (m_cNodes <= 0)
+	{
+		m_fRoutingComplete = 1;
+		return;
+	}
+
+	m_nLandmarkDist = NODE_LANDMARK_DIST_COUNT(m_cNodes);
+	m_pLandmarkDist = (unsigned short*)calloc(sizeof(unsigned short), m_nLandmarkDist);
+	if (!m_pLandmarkDist)
+	{
+		ALERT(at_aiconsole, "***ERROR**\nCouldn't malloc %d landmark distances!\n", m_nLandmarkDist);
+		m_nLandmarkDist = 0;
+		return;
+	}
+
+	// The links that arrive at each node, so distances to a landmark can be found.
+	//
+	std::vector<int> reverseStart(m_cNodes + 1, 0);
+	std::vector<int> reverseLinks(m_cLinks);
+
+	int i;
+	for (i = 0; i < m_cLinks; i++)
+		reverseStart[m_pLinkPool[i].m_iDestNode + 1]++;
+
+	for (i = 0; i < m_cNodes; i++)
+		reverseStart[i + 1] += reverseStart[i];
+
+	std::vector<int> fill(reverseStart.begin(), reverseStart.end() - 1);
+	for (i = 0; i < m_cLinks; i++)
+		reverseLinks[fill[m_pLinkPool[i].m_iDestNode]++] = i;
+
+	std::vector<char> usable(m_cLinks);
+	std::vector<float> distFrom;
+	std::vector<float> distTo;
+	std::vector<float> closest(m_cNodes);
+
+	for (int iHull = 0; iHull < MAX_NODE_HULLS; iHull++)
+	{
+		const int iHullMask = HullLinkMask(iHull);
+
+		for (int iCap = 0; iCap < 2; iCap++)
+		{
+			const int iCapMask = (0 != iCap) ? (bits_CAP_OPEN_DOORS | bits_CAP_AUTO_DOORS | bits_CAP_USE) : 0;
+
+			// Which links this hull and capability can use, with the same tests as FindShortestPath.
+			//
+			for (i = 0; i < m_cLinks; i++)
+			{
+				const CLink& link = m_pLinkPool[i];
+
+				usable[i] = (link.m_afLinkInfo & iHullMask) == iHullMask &&
+							(link.m_pLinkEnt == NULL || HandleLinkEnt(link.m_iSrcNode, link.m_pLinkEnt, iCapMask, NODEGRAPH_STATIC));
+			}
+
+			// The first landmark is the node farthest from node 0, and each one after that is the node
+			// farthest from all of the landmarks so far. Nodes no landmark can reach come first, so each
+			// separate part of the graph gets a landmark.
+			//
+			NodeDistances(*this, 0, false, usable, reverseStart, reverseLinks, distFrom);
+			for (i = 0; i < m_cNodes; i++)
+				closest[i] = (distFrom[i] < -0.5) ? -1.0f : 0.0f;
+			closest[0] = 0;
+
+			for (int iLandmark = 0; iLandmark < NODE_LANDMARKS; iLandmark++)
+			{
+				int iBest = 0;
+				float flBest = -2;
+				for (i = 0; i < m_cNodes; i++)
+				{
+					float flScore;
+					if (closest[i] < -0.5)
+					{
+						// only worth a landmark if the node goes somewhere
+						flScore = (m_pNodes[i].m_cNumLinks > 0) ? std::numeric_limits<float>::max() : -1.0f;
+					}
+					else if (0 == iLandmark)
+					{
+						flScore = distFrom[i];
+					}
+					else
+					{
+						flScore = closest[i];
+					}
+
+					if (flScore > flBest)
+					{
+						flBest = flScore;
+						iBest = i;
+					}
+				}
+
+				NodeDistances(*this, iBest, false, usable, reverseStart, reverseLinks, distFrom);
+				NodeDistances(*this, iBest, true, usable, reverseStart, reverseLinks, distTo);
+
+				StoreLandmarkDistances(distFrom, LandmarkDist(iHull, iCap, iLandmark, false));
+				StoreLandmarkDistances(distTo, LandmarkDist(iHull, iCap, iLandmark, true));
+
+				for (i = 0; i < m_cNodes; i++)
+				{
+					float flDist = distFrom[i];
+					if (flDist < -0.5 || (distTo[i] > -0.5 && distTo[i] < flDist))
+						flDist = distTo[i];
+
+					if (flDist < -0.5)
+						continue;
+
+					if (0 == iLandmark || closest[i] < -0.5 || flDist < closest[i])
+						closest[i] = flDist;
+				}
+			}
+		}
+	}
+
+	ALERT(at_aiconsole, "Size of Landmark Routes = %d\n", (int)(sizeof(unsigned short) * m_nLandmarkDist));
+
+	m_fRoutingComplete = 1;
+}
+
+//=========================================================
+// CGraph - LandmarkEstimate - returns a lower bound of the
+// distance from iNode to iDest, or -1 if the landmarks show
+// that there is no path from iNode to iDest.
+//=========================================================
+float CGraph::LandmarkEstimate(int iNode, int iDest, int iHull, int iCap)
+{
+	int iBest = 0;
+
+	for (int iLandmark = 0; iLandmark < NODE_LANDMARKS; iLandmark++)
+	{
+		// d(L, dest) <= d(L, node) + d(node, dest)
+		const unsigned short* pFrom = LandmarkDist(iHull, iCap, iLandmark, false);
+		if (pFrom[iNode] != NODE_LANDMARK_UNREACHABLE)
+		{
+			if (pFrom[iDest] == NODE_LANDMARK_UNREACHABLE)
+				return -1;
+
+			if (pFrom[iNode] != NODE_LANDMARK_MAXDIST && pFrom[iDest] != NODE_LANDMARK_MAXDIST)
+				iBest = V_max(iBest, pFrom[iDest] - pFrom[iNode]);
+		}
+
+		// d(node, L) <= d(node, dest) + d(dest, L)
+		const unsigned short* pTo = LandmarkDist(iHull, iCap, iLandmark, true);
+		if (pTo[iDest] != NODE_LANDMARK_UNREACHABLE)
+		{
+			if (pTo[iNode] == NODE_LANDMARK_UNREACHABLE)
+				return -1;
+
+			if (pTo[iNode] != NODE_LANDMARK_MAXDIST && pTo[iDest] != NODE_LANDMARK_MAXDIST)
+				iBest = V_max(iBest, pTo[iNode] - pTo[iDest]);
+		}
+	}
+
+	// distances are stored rounded down, so the difference of two may be one unit too long
+	return V_max(iBest - 1, 0);
+}
+
+//=========================================================
+// CGraph - FindLandmarkPath - A* search from iStart to iDest,
+// following the same links FindShortestPath would. Copies
+// at most cMaxPath nodes from the start of the path into
+// piPath and returns the number copied, or 0 if there is
+// no path. The length of the path goes in pflDistance.
+//=========================================================
+int CGraph::FindLandmarkPath(int* piPath, int cMaxPath, int iStart, int iDest, int iHull, int afCapMask, float* pflDistance)
+{
+	if (!m_pLandmarkDist || iDest < 0 || iDest >= m_cNodes)
+		return 0;
+
+	const int iCap = CapIndex(afCapMask);
+	const int iHullMask = HullLinkMask(iHull);
+
+	float flEstimate = LandmarkEstimate(iStart, iDest, iHull, iCap);
+	if (flEstimate < 0)
+		return 0;
+
+	// Every node starts out unvisited.
+	//
+	int i;
+	LandmarkSearchMarks& search = g_LandmarkSearchMarks;
+	search.Begin(m_cNodes);
+
+	std::priority_queue<RouteQueueEntry> queue;
+
+	search.Reach(iStart);
+	m_pNodes[iStart].m_flClosestSoFar = 0.0;
+	m_pNodes[iStart].m_iPreviousNode = iStart;
+	queue.push({iStart, 0, flEstimate});
+
+	while (!queue.empty())
+	{
+		const RouteQueueEntry entry = queue.top();
+		queue.pop();
+
+		const int iCurrentNode = entry.iNode;
+		CNode* pCurrentNode = &m_pNodes[iCurrentNode];
+
+		// a shorter distance was found since this was queued
+		if (entry.flDistance > pCurrentNode->m_flClosestSoFar)
+			continue;
+
+		if (iCurrentNode == iDest)
+			break;
+
+		for (i = 0; i < pCurrentNode->m_cNumLinks; i++)
+		{
+			CLink& link = NodeLink(*pCurrentNode, i);
+
+			if ((link.m_afLinkInfo & iHullMask) != iHullMask)
+				continue;
+
+			if (link.m_pLinkEnt != NULL && !HandleLinkEnt(iCurrentNode, link.m_pLinkEnt, afCapMask, NODEGRAPH_STATIC))
+				continue;
+
+			CNode* pVisitNode = &m_pNodes[link.m_iDestNode];
+			float flOurDistance = entry.flDistance + link.m_flWeight;
+
+			if (!search.Reached(link.m_iDestNode) || flOurDistance < pVisitNode->m_flClosestSoFar - 0.001)
+			{
+				flEstimate = LandmarkEstimate(link.m_iDestNode, iDest, iHull, iCap);
+				if (flEstimate < 0)
+					continue;
+
+				search.Reach(link.m_iDestNode);
+				pVisitNode->m_flClosestSoFar = flOurDistance;
+				pVisitNode->m_iPreviousNode = iCurrentNode;
+				queue.push({link.m_iDestNode, flOurDistance, flOurDistance + flEstimate});
+			}
+		}
+	}
+
+	if (!search.Reached(iDest))
+	{ // Destination is unreachable, no path found.
+		return 0;
+	}
+
+	if (pflDistance)
+		*pflDistance = m_pNodes[iDest].m_flClosestSoFar;
+
+	// walk backwards through m_iPreviousNode to count the nodes in the path, then copy the start of it
+	int iCurrentNode = iDest;
+	int iNumPathNodes = 1;
+
+	while (iCurrentNode != iStart)
+	{
+		iNumPathNodes++;
+		iCurrentNode = m_pNodes[iCurrentNode].m_iPreviousNode;
+	}
+
+	iCurrentNode = iDest;
+	for (i = iNumPathNodes - 1; i >= 0; i--)
+	{
+		if (i < cMaxPath)
+			piPath[i] = iCurrentNode;
+		iCurrentNode = m_pNodes[iCurrentNode].m_iPreviousNode;
+	}
+
+	return V_min(iNumPathNodes, cMaxPath);
+}
+
 // Test those routing tables. Doesn't really work, yet.
 //
 void CGraph::TestRoutingTables()
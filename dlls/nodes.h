@@ -108,7 +108,17 @@ typedef struct
 //=========================================================
 // CGraph
 //=========================================================
-#define GRAPH_VERSION (int)16 // !!!increment this whever graph/node/link classes change, to obsolesce older disk files.
+#define GRAPH_VERSION (int)17 // !!!increment this whever graph/node/link classes change, to obsolesce older disk files.
+
+// How the graph answers routing queries. Chosen per map with the worldspawn "noderouting" key.
+#define NODE_ROUTE_TABLES 0	   // compressed table of the next node from every node to every node. Quadratic to build.
+#define NODE_ROUTE_LANDMARKS 1 // A* search guided by the distances to and from a few landmark nodes. Linear to build.
+
+#define NODE_LANDMARKS 4					 // landmarks per hull and capability
+#define NODE_LANDMARK_UNREACHABLE 0xFFFF // landmark distance of a node that can't reach/be reached
+#define NODE_LANDMARK_MAXDIST 0xFFFE	 // landmark distances are clamped to this, and are then not used as a bound
+#define NODE_LANDMARK_DIST_COUNT(cNodes) (MAX_NODE_HULLS * 2 * NODE_LANDMARKS * 2 * (cNodes)) // entries in m_pLandmarkDist
+
 class CGraph
 {
 public:
@@ -125,7 +135,14 @@ public:
 	int m_cLinks;	  // total number of links
 	int m_nRouteInfo; // size of m_pRouteInfo in bytes.
 
-	// Tables for making nearest node lookup faster. SortedBy provided nodes in a
+	int m_iRouteMode;				 // NODE_ROUTE_TABLES or NODE_ROUTE_LANDMARKS
+	unsigned short* m_pLandmarkDist; // whole-unit distances from and to each landmark, for each hull and capability (NODE_ROUTE_LANDMARKS only)
+	int m_nLandmarkDist;			 // number of entries in m_pLandmarkDist
+
+	// Tables that used to make nearest node lookup faster. FindNearestNode now uses
+	// a grid of the nodes that isn't saved, but these are still built and saved.
+	//
+	// SortedBy provided nodes in a
 	// order of a particular coordinate. Instead of doing a binary search, RangeStart
 	// and RangeEnd let you get to the part of SortedBy that you are interested in.
 	//
@@ -188,12 +205,21 @@ public:
 	bool FLoadGraph(const char* szMapName);
 	bool FSaveGraph(const char* szMapName);
 	bool FSetGraphPointers();
-	void CheckNode(Vector vecOrigin, int iNode);
 
 	void BuildRegionTables();
 	void ComputeStaticRoutingTables();
+	void ComputeLandmarkRoutes();
 	void TestRoutingTables();
 
+	int FindLandmarkPath(int* piPath, int cMaxPath, int iStart, int iDest, int iHull, int afCapMask, float* pflDistance = NULL);
+	float LandmarkEstimate(int iNode, int iDest, int iHull, int iCap); // lower bound of the distance from iNode to iDest, or -1 if there is no path
+
+	// landmark distances for the given hull, capability and landmark. m_cNodes long.
+	inline unsigned short* LandmarkDist(int iHull, int iCap, int iLandmark, bool fToLandmark)
+	{
+		return m_pLandmarkDist + ((((iHull * 2 + iCap) * NODE_LANDMARKS + iLandmark) * 2 + (fToLandmark ? 1 : 0)) * m_cNodes);
+	}
+
 	void HashInsert(int iSrcNode, int iDestNode, int iKey);
 	void HashSearch(int iSrcNode, int iDestNode, int& iKey);
 	void HashChoosePrimes(int TableSize);
@@ -376,3 +402,5 @@ enum
 };
 
 extern CGraph WorldGraph;
+
+void InitNodeGraphCommands();
@@ -16,6 +16,8 @@
 // sound.cpp
 //=========================================================
 
+#include <chrono>
+
 #include "extdll.h"
 #include "util.h"
 #include "cbase.h"
@@ -1490,16 +1492,6 @@ void EMIT_GROUPNAME_SUIT(edict_t* entity, const char* groupname)
 // texture name to a material type.  Play footstep sound based
 // on material type.
 
-bool fTextureTypeInit = false;
-
-int gcTextures = 0;
-char grgszTextureName[CTEXTURESMAX][CBTEXTURENAMEMAX]; // texture names
-char grgchTextureType[CTEXTURESMAX];				   // parallel array of texture types
-
-// open materials.txt,  get size, alloc space,
-// save in array.  Only works first time called,
-// ignored on subsequent calls.
-
 static char* memfgets(byte* pMemFile, int fileSize, int& filePos, char* pBuffer, int bufferSize)
 {
 	// Bullet-proofing
@@ -1549,87 +1541,96 @@ static char* memfgets(byte* pMemFile, int fileSize, int& filePos, char* pBuffer,
 }
 
 
+// open materials.txt and load the material table shared with
+// pm_shared.  Only works first time called, ignored on subsequent
+// calls, or if player movement already loaded it.
+
 void TEXTURETYPE_Init()
 {
-	char buffer[512];
-	int i, j;
 	byte* pMemFile;
-	int fileSize, filePos = 0;
+	int fileSize;
 
-	if (fTextureTypeInit)
+	if (PM_MaterialsLoaded())
 		return;
 
-	memset(&(grgszTextureName[0][0]), 0, CTEXTURESMAX * CBTEXTURENAMEMAX);
-	memset(grgchTextureType, 0, CTEXTURESMAX);
-
-	gcTextures = 0;
-	memset(buffer, 0, 512);
-
 	pMemFile = g_engfuncs.pfnLoadFileForMe("sound/materials.txt", &fileSize);
 	if (!pMemFile)
 		return;
 
-	// for each line in the file...
-	while (memfgets(pMemFile, fileSize, filePos, buffer, 511) != NULL && (gcTextures < CTEXTURESMAX))
-	{
-		// skip whitespace
-		i = 0;
-		while ('\0' != buffer[i] && 0 != isspace(buffer[i]))
-			i++;
+	PM_LoadMaterials(pMemFile, fileSize);
 
-		if ('\0' == buffer[i])
-			continue;
-
-		// skip comment lines
-		if (buffer[i] == '/' || 0 == isalpha(buffer[i]))
-			continue;
-
-		// get texture type
-		grgchTextureType[gcTextures] = toupper(buffer[i++]);
+	g_engfuncs.pfnFreeFile(pMemFile);
+}
 
-		// skip whitespace
-		while ('\0' != buffer[i] && 0 != isspace(buffer[i]))
-			i++;
+// given texture name, find texture type
+// if not found, return type 'concrete'
 
-		if ('\0' == buffer[i])
-			continue;
+char TEXTURETYPE_Find(char* name)
+{
+	return PM_FindMaterialType(name);
+}
 
-		// get sentence name
-		j = i;
-		while ('\0' != buffer[j] && 0 == isspace(buffer[j]))
-			j++;
+// time material lookups against the linear scan the table replaced
 
-		if ('\0' == buffer[j])
-			continue;
+static void MaterialBenchmark()
+{
+	const int count = CMD_ARGC() > 1 ? V_max(atoi(CMD_ARGV(1)), 1) : 1000000;
+	const int cMaterials = PM_MaterialCount();
+	char rgszQuery[2 * CTEXTURESMAX][CBTEXTURENAMEMAX];
+	int cQueries = 0;
 
-		// null-terminate name and save in sentences array
-		j = V_min(j, CBTEXTURENAMEMAX - 1 + i);
-		buffer[j] = 0;
-		strcpy(&(grgszTextureName[gcTextures++][0]), &(buffer[i]));
+	if (0 == cMaterials)
+	{
+		ALERT(at_console, "No materials loaded\n");
+		return;
 	}
 
-	g_engfuncs.pfnFreeFile(pMemFile);
-
-	fTextureTypeInit = true;
-}
+	// every name in another case, and as many names that aren't listed
+	for (int i = 0; i < cMaterials; i++)
+	{
+		strcpy(rgszQuery[cQueries], PM_MaterialName(i));
+		for (char* p = rgszQuery[cQueries]; '\0' != *p; p++)
+			*p = isupper(*p) ? tolower(*p) : toupper(*p);
+		cQueries++;
 
-// given texture name, find texture type
-// if not found, return type 'concrete'
+		strcpy(rgszQuery[cQueries], PM_MaterialName(i));
+		rgszQuery[cQueries][0] = '#';
+		cQueries++;
+	}
 
-// NOTE: this routine should ONLY be called if the
-// current texture under the player changes!
+	int checksum = 0;
 
-char TEXTURETYPE_Find(char* name)
-{
-	// CONSIDER: pre-sort texture names and perform faster binary search here
+	auto startTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < count; i++)
+		checksum += PM_FindMaterialType(rgszQuery[i % cQueries]);
+	const double flHashed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
 
-	for (int i = 0; i < gcTextures; i++)
+	startTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < count; i++)
 	{
-		if (!strnicmp(name, &(grgszTextureName[i][0]), CBTEXTURENAMEMAX - 1))
-			return (grgchTextureType[i]);
+		char chType = CHAR_TEX_CONCRETE;
+		for (int j = 0; j < cMaterials; j++)
+		{
+			if (0 == strnicmp(rgszQuery[i % cQueries], PM_MaterialName(j), CBTEXTURENAMEMAX - 1))
+			{
+				chType = PM_MaterialType(j);
+				break;
+			}
+		}
+		checksum -= chType;
 	}
+	const double flLinear = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
 
-	return CHAR_TEX_CONCRETE;
+	ALERT(at_console, "%d materials, %d lookups, half of them misses\n", cMaterials, count);
+	ALERT(at_console, "  hashed: %.0f lookups/sec\n", count / V_max(flHashed, 1e-9));
+	ALERT(at_console, "  linear: %.0f lookups/sec\n", count / V_max(flLinear, 1e-9));
+	if (0 != checksum)
+		ALERT(at_console, "  lookups disagree!\n");
+}
+
+void InitMaterialCommands()
+{
+	g_engfuncs.pfnAddServerCommand("sv_material_bench", &MaterialBenchmark);
 }
 
 // play a strike sound based on the texture that was hit by the attack traceline.  VecSrc/VecEnd are the
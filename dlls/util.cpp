@@ -31,6 +31,10 @@
 #include "weapons.h"
 #include "gamerules.h"
 #include "UserMessages.h"
+#include "game.h"
+
+#include <algorithm>
+#include <vector>
 
 float UTIL_WeaponTimeBase()
 {
@@ -415,98 +419,160 @@ void UTIL_MoveToOrigin(edict_t* pent, const Vector& vecGoal, float flDist, int i
 }
 
 
-int UTIL_EntitiesInBox(CBaseEntity** pList, int listMax, const Vector& mins, const Vector& maxs, int flagMask)
+//=========================================================
+// Entity index
+//
+// Almost every box/sphere query only wants clients and
+// monsters, which are a small fraction of the edicts in use.
+// The index is a list of the edicts that had FL_CLIENT or
+// FL_MONSTER set, in edict order, so walking it visits the
+// same entities in the same order as walking the edict list.
+//
+// Entities are moved by the engine without telling us, so
+// the index does not hold positions: bounds, flags and the
+// free state are always tested on the live edict. It only has
+// to know which edicts to look at. It is rebuilt on the first
+// query of each server frame (g_ulFrameCount, bumped in
+// StartFrame), and again after anything spawns, since that is
+// where FL_CLIENT and FL_MONSTER get set.
+//
+// Set sv_entity_index_check to 1 to run the full scan next to
+// every indexed query and report any difference.
+//=========================================================
+#define ENTITY_INDEX_FLAGS (FL_CLIENT | FL_MONSTER)
+
+extern unsigned int g_ulFrameCount;
+
+static std::vector<edict_t*> g_EntityIndex;
+static unsigned int g_ulEntityIndexFrame = 0;
+static bool g_fEntityIndexDirty = true;
+
+void UTIL_InvalidateEntityIndex()
 {
-	edict_t* pEdict = UTIL_GetEntityList();
-	CBaseEntity* pEntity;
-	int count;
+	g_fEntityIndexDirty = true;
+}
 
-	count = 0;
+static void UTIL_UpdateEntityIndex()
+{
+	if (!g_fEntityIndexDirty && g_ulEntityIndexFrame == g_ulFrameCount)
+		return;
+
+	g_fEntityIndexDirty = false;
+	g_ulEntityIndexFrame = g_ulFrameCount;
+	g_EntityIndex.clear();
 
+	edict_t* pEdict = UTIL_GetEntityList();
 	if (!pEdict)
-		return count;
+		return;
 
 	// Ignore world.
 	++pEdict;
 
 	for (int i = 1; i < gpGlobals->maxEntities; i++, pEdict++)
 	{
-		if (0 != pEdict->free) // Not in use
-			continue;
-
-		if (0 != flagMask && (pEdict->v.flags & flagMask) == 0) // Does it meet the criteria?
-			continue;
-
-		if (mins.x > pEdict->v.absmax.x ||
-			mins.y > pEdict->v.absmax.y ||
-			mins.z > pEdict->v.absmax.z ||
-			maxs.x < pEdict->v.absmin.x ||
-			maxs.y < pEdict->v.absmin.y ||
-			maxs.z < pEdict->v.absmin.z)
-			continue;
+		if (0 == pEdict->free && (pEdict->v.flags & ENTITY_INDEX_FLAGS) != 0)
+			g_EntityIndex.push_back(pEdict);
+	}
+}
 
-		pEntity = CBaseEntity::Instance(pEdict);
-		if (!pEntity)
-			continue;
+// Is this edict one the query wants? Returns false for free edicts.
+static bool UTIL_EntityInBox(edict_t* pEdict, const Vector& mins, const Vector& maxs, int flagMask)
+{
+	if (0 != pEdict->free) // Not in use
+		return false;
 
-		pList[count] = pEntity;
-		count++;
+	if (0 != flagMask && (pEdict->v.flags & flagMask) == 0) // Does it meet the criteria?
+		return false;
 
-		if (count >= listMax)
-			return count;
-	}
+	if (mins.x > pEdict->v.absmax.x ||
+		mins.y > pEdict->v.absmax.y ||
+		mins.z > pEdict->v.absmax.z ||
+		maxs.x < pEdict->v.absmin.x ||
+		maxs.y < pEdict->v.absmin.y ||
+		maxs.z < pEdict->v.absmin.z)
+		return false;
 
-	return count;
+	return true;
 }
 
-
-int UTIL_MonstersInSphere(CBaseEntity** pList, int listMax, const Vector& center, float radius)
+static bool UTIL_MonsterInSphere(edict_t* pEdict, const Vector& center, float radiusSquared)
 {
-	edict_t* pEdict = UTIL_GetEntityList();
-	CBaseEntity* pEntity;
-	int count;
 	float distance, delta;
 
-	count = 0;
-	float radiusSquared = radius * radius;
+	if (0 != pEdict->free) // Not in use
+		return false;
 
-	if (!pEdict)
-		return count;
+	if ((pEdict->v.flags & (FL_CLIENT | FL_MONSTER)) == 0) // Not a client/monster ?
+		return false;
 
-	// Ignore world.
-	++pEdict;
+	// Use origin for X & Y since they are centered for all monsters
+	// Now X
+	delta = center.x - pEdict->v.origin.x; //(pEdict->v.absmin.x + pEdict->v.absmax.x)*0.5;
+	delta *= delta;
 
-	for (int i = 1; i < gpGlobals->maxEntities; i++, pEdict++)
+	if (delta > radiusSquared)
+		return false;
+	distance = delta;
+
+	// Now Y
+	delta = center.y - pEdict->v.origin.y; //(pEdict->v.absmin.y + pEdict->v.absmax.y)*0.5;
+	delta *= delta;
+
+	distance += delta;
+	if (distance > radiusSquared)
+		return false;
+
+	// Now Z
+	delta = center.z - (pEdict->v.absmin.z + pEdict->v.absmax.z) * 0.5;
+	delta *= delta;
+
+	distance += delta;
+	if (distance > radiusSquared)
+		return false;
+
+	return true;
+}
+
+// Collect the entities that pass the test, either from the index or from every edict
+template <typename Test>
+static int UTIL_CollectEntities(CBaseEntity** pList, int listMax, bool fUseIndex, const Test& test)
+{
+	CBaseEntity* pEntity;
+	int count = 0;
+
+	if (fUseIndex)
 	{
-		if (0 != pEdict->free) // Not in use
-			continue;
+		UTIL_UpdateEntityIndex();
 
-		if ((pEdict->v.flags & (FL_CLIENT | FL_MONSTER)) == 0) // Not a client/monster ?
-			continue;
+		for (size_t i = 0; i < g_EntityIndex.size(); i++)
+		{
+			if (!test(g_EntityIndex[i]))
+				continue;
 
-		// Use origin for X & Y since they are centered for all monsters
-		// Now X
-		delta = center.x - pEdict->v.origin.x; //(pEdict->v.absmin.x + pEdict->v.absmax.x)*0.5;
-		delta *= delta;
+			pEntity = CBaseEntity::Instance(g_EntityIndex[i]);
+			if (!pEntity)
+				continue;
 
-		if (delta > radiusSquared)
-			continue;
-		distance = delta;
+			pList[count] = pEntity;
+			count++;
 
-		// Now Y
-		delta = center.y - pEdict->v.origin.y; //(pEdict->v.absmin.y + pEdict->v.absmax.y)*0.5;
-		delta *= delta;
+			if (count >= listMax)
+				return count;
+		}
 
-		distance += delta;
-		if (distance > radiusSquared)
-			continue;
+		return count;
+	}
 
-		// Now Z
-		delta = center.z - (pEdict->v.absmin.z + pEdict->v.absmax.z) * 0.5;
-		delta *= delta;
+	edict_t* pEdict = UTIL_GetEntityList();
+	if (!pEdict)
+		return count;
+
+	// Ignore world.
+	++pEdict;
 
-		distance += delta;
-		if (distance > radiusSquared)
+	for (int i = 1; i < gpGlobals->maxEntities; i++, pEdict++)
+	{
+		if (!test(pEdict))
 			continue;
 
 		pEntity = CBaseEntity::Instance(pEdict);
@@ -520,11 +586,59 @@ int UTIL_MonstersInSphere(CBaseEntity** pList, int listMax, const Vector& center
 			return count;
 	}
 
+	return count;
+}
+
+// Run an indexed query, and if asked, the full scan too, complaining if they disagree
+template <typename Test>
+static int UTIL_IndexedQuery(const char* pszQuery, CBaseEntity** pList, int listMax, const Test& test)
+{
+	const int count = UTIL_CollectEntities(pList, listMax, true, test);
+
+	if (0 == sv_entity_index_check.value)
+		return count;
+
+	std::vector<CBaseEntity*> check(V_max(listMax, 1));
+	const int checkCount = UTIL_CollectEntities(check.data(), listMax, false, test);
+
+	if (checkCount != count || !std::equal(pList, pList + count, check.data()))
+	{
+		ALERT(at_console, "%s: entity index found %d entities, full scan found %d\n", pszQuery, count, checkCount);
+
+		// Trust the scan, and start over next time
+		std::copy(check.data(), check.data() + checkCount, pList);
+		UTIL_InvalidateEntityIndex();
+		return checkCount;
+	}
 
 	return count;
 }
 
 
+int UTIL_EntitiesInBox(CBaseEntity** pList, int listMax, const Vector& mins, const Vector& maxs, int flagMask)
+{
+	auto test = [&](edict_t* pEdict)
+	{ return UTIL_EntityInBox(pEdict, mins, maxs, flagMask); };
+
+	// The index only holds clients and monsters, so anything else has to look at every edict
+	if (0 == flagMask || (flagMask & ~ENTITY_INDEX_FLAGS) != 0)
+		return UTIL_CollectEntities(pList, listMax, false, test);
+
+	return UTIL_IndexedQuery("UTIL_EntitiesInBox", pList, listMax, test);
+}
+
+
+int UTIL_MonstersInSphere(CBaseEntity** pList, int listMax, const Vector& center, float radius)
+{
+	float radiusSquared = radius * radius;
+
+	auto test = [&](edict_t* pEdict)
+	{ return UTIL_MonsterInSphere(pEdict, center, radiusSquared); };
+
+	return UTIL_IndexedQuery("UTIL_MonstersInSphere", pList, listMax, test);
+}
+
+
 CBaseEntity* UTIL_FindEntityInSphere(CBaseEntity* pStartEntity, const Vector& vecCenter, float flRadius)
 {
 	edict_t* pentEntity;
@@ -242,6 +242,8 @@ extern void UTIL_MakeVectors(const Vector& vecAngles);
 // Pass in an array of pointers and an array size, it fills the array and returns the number inserted
 extern int UTIL_MonstersInSphere(CBaseEntity** pList, int listMax, const Vector& center, float radius);
 extern int UTIL_EntitiesInBox(CBaseEntity** pList, int listMax, const Vector& mins, const Vector& maxs, int flagMask);
+// Call when an entity may have become a client or monster, so the queries above see it this frame
+extern void UTIL_InvalidateEntityIndex();
 
 inline void UTIL_MakeVectorsPrivate(const Vector& vecAngles, float* p_vForward, float* p_vRight, float* p_vUp)
 {
@@ -498,6 +500,7 @@ int SENTENCEG_Lookup(const char* sample, char* sentencenum);
 void TEXTURETYPE_Init();
 char TEXTURETYPE_Find(char* name);
 float TEXTURETYPE_PlaySound(TraceResult* ptr, Vector vecSrc, Vector vecEnd, int iBulletType);
+void InitMaterialCommands();
 
 // NOTE: use EMIT_SOUND_DYN to set the pitch of a sound. Pitch of 100
 // is no pitch shift.  Pitch > 100 up to 255 is a higher pitch, pitch < 100
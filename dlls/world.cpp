@@ -471,6 +471,7 @@ LINK_ENTITY_TO_CLASS(worldspawn, CWorld);
 #define SF_WORLD_DARK 0x0001	  // Fade from black at startup
 #define SF_WORLD_TITLE 0x0002	  // Display game title at startup
 #define SF_WORLD_FORCETEAM 0x0004 // Force teams
+#define SF_WORLD_NODE_LANDMARKS 0x0008 // Route the node graph with landmarks instead of routing tables
 
 CWorld::CWorld()
 {
@@ -638,6 +639,7 @@ void CWorld::Precache()
 
 	// init the WorldGraph.
 	WorldGraph.InitGraph();
+	WorldGraph.m_iRouteMode = (pev->spawnflags & SF_WORLD_NODE_LANDMARKS) != 0 ? NODE_ROUTE_LANDMARKS : NODE_ROUTE_TABLES;
 
 	// make sure the .NOD file is newer than the .BSP file.
 	if (!WorldGraph.CheckNODFile((char*)STRING(gpGlobals->mapname)))
@@ -755,6 +757,13 @@ bool CWorld::KeyValue(KeyValueData* pkvd)
 		pev->team = ALLOC_STRING(pkvd->szValue);
 		return true;
 	}
+	else if (FStrEq(pkvd->szKeyName, "noderouting"))
+	{
+		// 0 = routing tables, 1 = landmarks (for maps with many nodes)
+		if (0 != atoi(pkvd->szValue))
+			pev->spawnflags |= SF_WORLD_NODE_LANDMARKS;
+		return true;
+	}
 	else if (FStrEq(pkvd->szKeyName, "defaultteam"))
 	{
 		if (0 != atoi(pkvd->szValue))
@@ -24,6 +24,7 @@
 #include "bot.h"
 #include "bot_manager.h"
 #include "nav_area.h"
+#include "nav_path.h"
 #include "bot_util.h"
 #include "hostage.h"
 
@@ -65,10 +66,61 @@ GameEventType NameToGameEvent( const char *name )
 }
 
 
+cvar_t cv_bot_path_budget = { "bot_path_budget", "0", FCVAR_SERVER };	///< microseconds of path requests to compute each frame, zero for all of them - only affects code that uses TheNavPathQueue
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * bot_nav_analyze [threads] [compact] - re-analyze the nav file of the current map and save it,
+ * in the compact layout if 'compact' is nonzero
+ */
+static void BotNavAnalyzeCommand( void )
+{
+	int threadCount = (CMD_ARGC() > 1) ? atoi( CMD_ARGV( 1 ) ) : 0;
+	bool compactFormat = (CMD_ARGC() > 2) && atoi( CMD_ARGV( 2 ) ) != 0;
+
+	AnalyzeNavigationMap( threadCount, compactFormat );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * bot_nav_benchmark [count] [seed] [hierarchical] - time paths between pseudo-random pairs of areas,
+ * found with NavAreaBuildHierarchicalPath() instead of NavAreaBuildPath() if 'hierarchical' is nonzero
+ */
+static void BotNavBenchmarkCommand( void )
+{
+	int count = (CMD_ARGC() > 1) ? atoi( CMD_ARGV( 1 ) ) : 0;
+	unsigned int seed = (CMD_ARGC() > 2) ? strtoul( CMD_ARGV( 2 ), NULL, 10 ) : 0;
+	bool hierarchical = (CMD_ARGC() > 3) && atoi( CMD_ARGV( 3 ) ) != 0;
+
+	BenchmarkNavAreaBuildPath( count, seed, hierarchical );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * bot_nav_layout [repeat] - compare the memory and traversal time of the list and compact nav mesh layouts
+ */
+static void BotNavLayoutCommand( void )
+{
+	TheNavCompactMesh.ReportLayout( (CMD_ARGC() > 1) ? atoi( CMD_ARGV( 1 ) ) : 0 );
+}
+
 //--------------------------------------------------------------------------------------------------------------
 CBotManager::CBotManager()
 {
 	InitBotTrig();
+
+	// the engine only takes each cvar and command once, but there may be a manager for each map
+	static bool isFirstTime = true;
+	if (isFirstTime)
+	{
+		isFirstTime = false;
+
+		CVAR_REGISTER( &cv_bot_path_budget );
+
+		(*g_engfuncs.pfnAddServerCommand)( "bot_nav_analyze", BotNavAnalyzeCommand );
+		(*g_engfuncs.pfnAddServerCommand)( "bot_nav_benchmark", BotNavBenchmarkCommand );
+		(*g_engfuncs.pfnAddServerCommand)( "bot_nav_layout", BotNavLayoutCommand );
+	}
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -157,6 +209,11 @@ void CBotManager::StartFrame( void )
 	}
 
 
+	//
+	// Compute the paths requested last frame, within this frame's budget
+	//
+	TheNavPathQueue.Update( cv_bot_path_budget.value );
+
 	//
 	// Process each active bot
 	//
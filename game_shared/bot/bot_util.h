@@ -50,6 +50,7 @@ extern cvar_t cv_bot_zombie;
 extern cvar_t cv_bot_defer_to_human;
 extern cvar_t cv_bot_chatter;
 extern cvar_t cv_bot_profile_db;
+extern cvar_t cv_bot_path_budget;
 
 #ifdef TERRORSTRIKE
 extern cvar_t cv_zombie_near_spawn;
@@ -0,0 +1,207 @@
+// nav_analyze.cpp
+// Analysis of the navigation mesh, with the work that needs no traces spread across worker threads
+
+#pragma warning( disable : 4530 )					// STL uses exceptions, but we are not compiling with them - ignore warning
+#pragma warning( disable : 4786 )					// long STL names get truncated in browse info.
+
+#include <list>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include "extdll.h"
+#include "util.h"
+#include "cbase.h"
+#include "bot_util.h"
+#include "perf_counter.h"
+
+#include "nav.h"
+#include "nav_area.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+//
+// The engine is not reentrant, and its traces may only be made from the main thread. Most of the analysis
+// is traces whose endpoints depend on the results of the traces before them, so the hiding spot, encounter
+// and sniper passes all trace on the main thread, in area order.
+//
+// The one part worth spreading across threads is finding, for each path thru each area, the hiding spots
+// that can possibly be seen from it. That is a scan of the master hiding spot list per path, and it makes
+// no traces. It is run as "jobs", one per nav area, each writing only to a result slot owned by its area,
+// so jobs may run on any thread, in any order. The traces along those paths are then made on the main thread.
+// Nothing the workers compute depends on scheduling, so the results are identical regardless of the number
+// of threads.
+//
+
+/**
+ * Trace a line for the analysis passes. Must only be called from the main thread.
+ */
+void NavAnalysisTraceLine( const Vector &start, const Vector &end, IGNORE_MONSTERS igmon, IGNORE_GLASS ignoreGlass, TraceResult *result )
+{
+	UTIL_TraceLine( start, end, igmon, ignoreGlass, NULL, result );
+}
+
+typedef void (*NavAnalysisJob)( CNavArea *area, unsigned int index, void *context );
+
+/**
+ * Run the given job for each of the areas [first, last), spread across 'threadCount' threads (including this one).
+ * Jobs are given the index of their area relative to 'first'.
+ */
+static void RunNavAnalysisJobs( const std::vector<CNavArea *> &areas, unsigned int first, unsigned int last, NavAnalysisJob job, void *context, int threadCount )
+{
+	std::atomic<unsigned int> nextIndex( first );
+
+	auto worker = [&]()
+	{
+		while( true )
+		{
+			unsigned int index = nextIndex++;
+			if (index >= last)
+				break;
+
+			job( areas[ index ], index - first, context );
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for( int t=1; t<threadCount; ++t )
+		threads.emplace_back( worker );
+
+	// this thread works too
+	worker();
+
+	for( std::vector<std::thread>::iterator iter = threads.begin(); iter != threads.end(); ++iter )
+		(*iter).join();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+static void FindSpotEncountersJob( CNavArea *area, unsigned int index, void *context )
+{
+	std::vector<SpotEncounterCandidateList> *candidates = static_cast<std::vector<SpotEncounterCandidateList> *>( context );
+
+	area->FindSpotEncounters( &(*candidates)[ index ] );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Compute hiding spots, approach areas, spot encounters, and sniper spots for all areas.
+ * Only the search for the spots near each encounter path uses more than one thread.
+ * If 'threadCount' is zero or less, one thread per processor is used.
+ */
+void AnalyzeNavigationMesh( int threadCount )
+{
+	if (threadCount <= 0)
+	{
+		threadCount = std::thread::hardware_concurrency();
+		if (threadCount <= 0)
+			threadCount = 1;
+	}
+
+	// jobs refer to areas by their index in the master list
+	std::vector<CNavArea *> areas( TheNavAreaList.begin(), TheNavAreaList.end() );
+
+	CONSOLE_ECHO( "Analyzing %d navigation areas using %d threads...\n", (int)areas.size(), threadCount );
+
+	static CPerformanceCounter perfCounter;
+	double startTime = perfCounter.GetCurTime();
+	double passTime = startTime;
+	double now;
+
+	//
+	// Hiding spots are mostly traces, so they are found on this thread
+	//
+	unsigned int i;
+	for( i=0; i<areas.size(); ++i )
+		areas[i]->ComputeHidingSpots();
+
+	now = perfCounter.GetCurTime();
+	CONSOLE_ECHO( "  hiding spots:    %d spots in %.3f seconds\n", (int)TheHidingSpotList.size(), now - passTime );
+	passTime = now;
+
+	//
+	// Approach areas use the shared pathfinding state, so they are computed on this thread
+	//
+	ApproachAreaAnalysisPrep();
+
+	for( i=0; i<areas.size(); ++i )
+		areas[i]->ComputeApproachAreas();
+
+	CleanupApproachAreaAnalysisPrep();
+
+	now = perfCounter.GetCurTime();
+	CONSOLE_ECHO( "  approach areas:  %.3f seconds\n", now - passTime );
+	passTime = now;
+
+	//
+	// The spots near each encounter path are found in parallel, a batch of areas at a time to bound the
+	// memory they use, and the traces along each path are then made on this thread in area order.
+	// The workers only read the hiding spots, which are not changed until the sniper pass.
+	//
+	const unsigned int encounterBatchSize = 256;
+	std::vector<SpotEncounterCandidateList> encounters( encounterBatchSize );
+
+	for( unsigned int first=0; first<areas.size(); first += encounterBatchSize )
+	{
+		unsigned int last = first + encounterBatchSize;
+		if (last > areas.size())
+			last = areas.size();
+
+		RunNavAnalysisJobs( areas, first, last, FindSpotEncountersJob, &encounters, threadCount );
+
+		for( i=first; i<last; ++i )
+			areas[i]->AddSpotEncounters( &encounters[ i - first ] );
+	}
+
+	now = perfCounter.GetCurTime();
+	CONSOLE_ECHO( "  spot encounters: %.3f seconds\n", now - passTime );
+	passTime = now;
+
+	//
+	// Sniper classification is all traces, so it is done on this thread
+	//
+	for( i=0; i<areas.size(); ++i )
+		areas[i]->ComputeSniperSpots();
+
+	now = perfCounter.GetCurTime();
+	CONSOLE_ECHO( "  sniper spots:    %.3f seconds\n", now - passTime );
+
+	CONSOLE_ECHO( "Analysis complete in %.3f seconds.\n", now - startTime );
+
+	// the compact mesh holds a copy of the analysis data
+	TheNavCompactMesh.Invalidate();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Load the nav file of the current map, discard its analysis, analyze it again, and save it.
+ * This is meant to be run once per map by something that loads each map of a rotation in turn,
+ * so that nav files can be brought up to date in a batch.
+ * If 'compactFormat' is true, the file is saved in the compact layout.
+ */
+NavErrorType AnalyzeNavigationMap( int threadCount, bool compactFormat )
+{
+	NavErrorType result = LoadNavigationMap();
+	if (result != NAV_OK)
+	{
+		CONSOLE_ECHO( "ERROR: Cannot load navigation map for '%s'.\n", STRING( gpGlobals->mapname ) );
+		return result;
+	}
+
+	StripNavigationAreas();
+	DestroyHidingSpots();
+
+	AnalyzeNavigationMesh( threadCount );
+
+	char filename[256];
+	sprintf( filename, "maps\\%s.nav", STRING( gpGlobals->mapname ) );
+
+	if (!SaveNavigationMap( filename, compactFormat ))
+	{
+		CONSOLE_ECHO( "ERROR: Cannot save navigation map '%s'.\n", filename );
+		return NAV_CANT_ACCESS_FILE;
+	}
+
+	CONSOLE_ECHO( "Navigation map '%s' saved.\n", filename );
+
+	return NAV_OK;
+}
@@ -29,6 +29,7 @@
 #include "player.h"
 #include "gamerules.h"
 #include "bot_util.h"
+#include "perf_counter.h"
 
 /// @todo Abstract hostages and cs-bots out of here
 #include "cs_bot.h"
@@ -49,7 +50,8 @@ NavAreaList TheNavAreaList;
 NavLadderList TheNavLadderList;
 
 unsigned int CNavArea::m_masterMarker = 1;
-CNavArea *CNavArea::m_openList = NULL;
+std::vector<CNavArea *> CNavArea::m_openList;
+unsigned int CNavArea::m_openSequence = 0;
 
 bool CNavArea::m_isReset = false;
 static float lastDrawTimestamp = 0.0f;
@@ -145,6 +147,17 @@ void HidingSpot::Load( SteamFile *file, unsigned int version )
 		m_nextID = m_id+1;
 }
 
+void HidingSpot::Load( const NavCompactHidingSpot *data )
+{
+	m_id = data->id;
+	m_pos = data->pos;
+	m_flags = (unsigned char)data->flags;
+
+	// update next ID to avoid ID collisions by later spots
+	if (m_id >= m_nextID)
+		m_nextID = m_id+1;
+}
+
 /**
  * Given a HidingSpot ID, return the associated HidingSpot
  */
@@ -169,6 +182,9 @@ HidingSpot *GetHidingSpotByID( unsigned int id )
 void CNavArea::Initialize( void )
 {
 	m_marker = 0;
+	m_openMarker = 0;
+	m_openIndex = -1;
+	m_openOrder = 0;
 	m_parent = NULL;
 	m_parentHow = GO_NORTH;
 	m_attributeFlags = 0;
@@ -189,6 +205,13 @@ void CNavArea::Initialize( void )
 
 	m_prevHash = NULL;
 	m_nextHash = NULL;
+
+	m_compactIndex = NAV_INVALID_INDEX;
+	m_clusterID = NAV_INVALID_INDEX;
+
+	// a new area changes the mesh
+	TheNavCompactMesh.Invalidate();
+	TheNavAreaClusters.MarkDirty( this );
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -298,6 +321,9 @@ CNavArea::~CNavArea()
 	if (m_isReset)
 		return;
 
+	TheNavCompactMesh.Invalidate();
+	TheNavAreaClusters.MarkDirty( this );
+
 	// tell the other areas we are going away
 	NavAreaList::iterator iter;
 	for( iter = TheNavAreaList.begin(); iter != TheNavAreaList.end(); ++iter )
@@ -355,6 +381,9 @@ void CNavArea::ConnectTo( CNavArea *area, NavDirType dir )
 	con.area = area;
 	m_connect[ dir ].push_back( con );
 
+	TheNavCompactMesh.Invalidate();
+	TheNavAreaClusters.MarkDirty( this );
+
 	//static char *dirName[] = { "NORTH", "EAST", "SOUTH", "WEST" };
 	//CONSOLE_ECHO( "  Connected area #%d to #%d, %s\n", m_id, area->m_id, dirName[ dir ] );
 }
@@ -370,6 +399,9 @@ void CNavArea::Disconnect( CNavArea *area )
 
 	for( int dir = 0; dir<NUM_DIRECTIONS; dir++ )
 		m_connect[ dir ].remove( connect );
+
+	TheNavCompactMesh.Invalidate();
+	TheNavAreaClusters.MarkDirty( this );
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -506,6 +538,10 @@ void CNavArea::AssignNodes( CNavArea *area )
  */
 bool CNavArea::SplitEdit( bool splitAlongX, float splitEdge, CNavArea **outAlpha, CNavArea **outBeta )
 {
+	// the area geometry or connectivity is about to change
+	TheNavCompactMesh.Invalidate();
+	TheNavAreaClusters.MarkDirty( this );
+
 	CNavArea *alpha = NULL;
 	CNavArea *beta = NULL;
 
@@ -744,6 +780,11 @@ void CNavArea::FinishSplitEdit( CNavArea *newArea, NavDirType ignoreEdge )
  */
 bool CNavArea::SpliceEdit( CNavArea *other )
 {
+	// the area geometry or connectivity is about to change
+	TheNavCompactMesh.Invalidate();
+	TheNavAreaClusters.MarkDirty( this );
+	TheNavAreaClusters.MarkDirty( other );
+
 	CNavArea *newArea = NULL;
 	Vector nw, ne, se, sw;
 
@@ -910,6 +951,11 @@ bool CNavArea::SpliceEdit( CNavArea *other )
  */
 bool CNavArea::MergeEdit( CNavArea *adj )
 {
+	// the area geometry or connectivity is about to change
+	TheNavCompactMesh.Invalidate();
+	TheNavAreaClusters.MarkDirty( this );
+	TheNavAreaClusters.MarkDirty( adj );
+
 	// can only merge if attributes of both areas match
 
 
@@ -985,6 +1031,8 @@ void DestroyLadders( void )
 		TheNavLadderList.pop_front();
 		delete ladder;
 	}
+	TheNavCompactMesh.Invalidate();
+	TheNavAreaClusters.Invalidate();
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -1022,6 +1070,13 @@ void DestroyNavigationMap( void )
 
 	// reset the grid
 	TheNavAreaGrid.Reset();
+
+	// discard the compact copy of the mesh, and its clusters
+	TheNavCompactMesh.Reset();
+	TheNavAreaClusters.Reset();
+
+	// queued paths refer to the areas being destroyed
+	TheNavPathQueue.Reset();
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -1854,6 +1909,10 @@ void BuildLadders( void )
 
 		entity = UTIL_FindEntityByClassname( entity, "func_ladder" );
 	}
+
+	// areas now refer to the new ladders
+	TheNavCompactMesh.Invalidate();
+	TheNavAreaClusters.Invalidate();
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -2629,96 +2688,123 @@ void CNavArea::DrawMarkedCorner( NavCornerType corner, byte red, byte green, byt
 
 //--------------------------------------------------------------------------------------------------------------
 /**
- * Add to open list in decreasing value order
+ * Return true if 'area' must come off the open list before 'other'.
+ * Ties in cost are broken by the order in which the areas were added or updated.
  */
-void CNavArea::AddToOpenList( void )
+inline bool CNavArea::IsOpenBefore( const CNavArea *area, const CNavArea *other )
 {
-	// mark as being on open list for quick check
-	m_openMarker = m_masterMarker;
+	if (area->GetTotalCost() < other->GetTotalCost())
+		return true;
 
-	// if list is empty, add and return
-	if (m_openList == NULL)
-	{
-		m_openList = this;
-		this->m_prevOpen = NULL;
-		this->m_nextOpen = NULL;
-		return;
-	}
+	if (area->GetTotalCost() > other->GetTotalCost())
+		return false;
+
+	return (area->m_openOrder < other->m_openOrder) ? true : false;
+}
 
-	// insert self in ascending cost order
-	CNavArea *area, *last = NULL;
-	for( area = m_openList; area; area = area->m_nextOpen )
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Move the area at the given heap index toward the top of the heap until its parent is cheaper
+ */
+void CNavArea::SiftUpOpenList( int index )
+{
+	CNavArea *area = m_openList[ index ];
+
+	while( index > 0 )
 	{
-		if (this->GetTotalCost() < area->GetTotalCost())
+		int parent = (index - 1) / 2;
+		CNavArea *parentArea = m_openList[ parent ];
+
+		if (!IsOpenBefore( area, parentArea ))
 			break;
 
-		last = area;
+		m_openList[ index ] = parentArea;
+		parentArea->m_openIndex = index;
+		index = parent;
 	}
 
-	if (area)
-	{
-		// insert before this area
-		this->m_prevOpen = area->m_prevOpen;
-		if (this->m_prevOpen)
-			this->m_prevOpen->m_nextOpen = this;
-		else
-			m_openList = this;
+	m_openList[ index ] = area;
+	area->m_openIndex = index;
+}
 
-		this->m_nextOpen = area;
-		area->m_prevOpen = this;
-	}
-	else
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Move the area at the given heap index toward the bottom of the heap until its children are more expensive
+ */
+void CNavArea::SiftDownOpenList( int index )
+{
+	int count = m_openList.size();
+	CNavArea *area = m_openList[ index ];
+
+	while( true )
 	{
-		// append to end of list
-		last->m_nextOpen = this;
+		int child = 2 * index + 1;
+		if (child >= count)
+			break;
+
+		// pick the cheaper of the two children
+		if (child + 1 < count && IsOpenBefore( m_openList[ child + 1 ], m_openList[ child ] ))
+			++child;
 
-		this->m_prevOpen = last;
-		this->m_nextOpen = NULL;
+		CNavArea *childArea = m_openList[ child ];
+		if (!IsOpenBefore( childArea, area ))
+			break;
+
+		m_openList[ index ] = childArea;
+		childArea->m_openIndex = index;
+		index = child;
 	}
+
+	m_openList[ index ] = area;
+	area->m_openIndex = index;
 }
 
 //--------------------------------------------------------------------------------------------------------------
 /**
- * A smaller value has been found, update this area on the open list
- * @todo "bubbling" does unnecessary work, since the order of all other nodes will be unchanged - only this node is altered
+ * Add to open list, keeping the cheapest area at the top
  */
-void CNavArea::UpdateOnOpenList( void )
+void CNavArea::AddToOpenList( void )
 {
-	// since value can only decrease, bubble this area up from current spot
-	while( m_prevOpen && 
-				 this->GetTotalCost() < m_prevOpen->GetTotalCost() )
-	{
-		// swap position with predecessor
-		CNavArea *other = m_prevOpen;
-		CNavArea *before = other->m_prevOpen;
-		CNavArea *after  = this->m_nextOpen;
-
-		this->m_nextOpen = other;
-		this->m_prevOpen = before;
+	// mark as being on open list for quick check
+	m_openMarker = m_masterMarker;
+	m_openOrder = m_openSequence++;
 
-		other->m_prevOpen = this;
-		other->m_nextOpen = after;
+	m_openList.push_back( this );
+	SiftUpOpenList( m_openList.size() - 1 );
+}
 
-		if (before)
-			before->m_nextOpen = this;
-		else
-			m_openList = this;
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A smaller value has been found, update this area on the open list
+ */
+void CNavArea::UpdateOnOpenList( void )
+{
+	// an updated area is ordered behind any others that already have the same cost
+	m_openOrder = m_openSequence++;
 
-		if (after)
-			after->m_prevOpen = other;
-	}
+	// since value can only decrease, sift this area up from current spot
+	SiftUpOpenList( m_openIndex );
 }
 
 //--------------------------------------------------------------------------------------------------------------
 void CNavArea::RemoveFromOpenList( void )
 {
-	if (m_prevOpen)
-		m_prevOpen->m_nextOpen = m_nextOpen;
-	else
-		m_openList = m_nextOpen;
+	int index = m_openIndex;
+
+	// move the last area into our slot and restore heap order around it
+	CNavArea *last = m_openList.back();
+	m_openList.pop_back();
+
+	if (last != this)
+	{
+		m_openList[ index ] = last;
+		last->m_openIndex = index;
 
-	if (m_nextOpen)
-		m_nextOpen->m_prevOpen = m_prevOpen;
+		if (index > 0 && IsOpenBefore( last, m_openList[ (index - 1) / 2 ] ))
+			SiftUpOpenList( index );
+		else
+			SiftDownOpenList( index );
+	}
 
 	// zero is an invalid marker
 	m_openMarker = 0;
@@ -2733,7 +2819,9 @@ void CNavArea::ClearSearchLists( void )
 	// effectively clears all open list pointers and closed flags
 	CNavArea::MakeNewMarker();
 
-	m_openList = NULL;
+	// keep the heap's storage around for the next search
+	m_openList.clear();
+	m_openSequence = 0;
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -2788,6 +2876,22 @@ bool CNavArea::IsHidingSpotCollision( const Vector *pos ) const
 	return false;
 }
 
+/**
+ * Returns true if an existing hiding spot or one of the given candidates is too close to given position
+ */
+bool CNavArea::IsHidingSpotCollision( const Vector *pos, const HidingSpotCandidateList *candidates ) const
+{
+	const float collisionRange = 30.0f;
+
+	for( HidingSpotCandidateList::const_iterator iter = candidates->begin(); iter != candidates->end(); ++iter )
+	{
+		if (((*iter).pos - *pos).IsLengthLessThan( collisionRange ))
+			return true;
+	}
+
+	return IsHidingSpotCollision( pos );
+}
+
 //--------------------------------------------------------------------------------------------------------------
 bool IsHidingSpotInCover( const Vector *spot )
 {
@@ -2801,7 +2905,7 @@ bool IsHidingSpotInCover( const Vector *spot )
 
 	// if we are crouched underneath something, that counts as good cover
 	to = from + Vector( 0, 0, 20.0f );
-	UTIL_TraceLine( from, to, ignore_monsters, NULL, &result );
+	NavAnalysisTraceLine( from, to, ignore_monsters, dont_ignore_glass, &result );
 	if (result.flFraction != 1.0f)
 		return true;
 
@@ -2812,7 +2916,7 @@ bool IsHidingSpotInCover( const Vector *spot )
 	{
 		to = from + Vector( coverRange * cos(angle), coverRange * sin(angle), HalfHumanHeight );
 
-		UTIL_TraceLine( from, to, ignore_monsters, NULL, &result );
+		NavAnalysisTraceLine( from, to, ignore_monsters, dont_ignore_glass, &result );
 
 		// if traceline hit something, it hit "cover"
 		if (result.flFraction != 1.0f)
@@ -2832,6 +2936,29 @@ bool IsHidingSpotInCover( const Vector *spot )
  * Analyze local area neighborhood to find "hiding spots" for this area
  */
 void CNavArea::ComputeHidingSpots( void )
+{
+	HidingSpotCandidateList candidates;
+	FindHidingSpots( &candidates );
+	AddHidingSpots( &candidates );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Create the hiding spots found by FindHidingSpots().
+ * Spots are given IDs in the order they are added, so candidates must be added in a fixed order.
+ */
+void CNavArea::AddHidingSpots( const HidingSpotCandidateList *candidates )
+{
+	for( HidingSpotCandidateList::const_iterator iter = candidates->begin(); iter != candidates->end(); ++iter )
+		m_hidingSpotList.push_back( new HidingSpot( &(*iter).pos, (*iter).flags ) );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Find the "hiding spots" for this area, without creating them.
+ * Traces, so it must be called from the main thread.
+ */
+void CNavArea::FindHidingSpots( HidingSpotCandidateList *candidates ) const
 {
 	struct
 	{
@@ -2857,7 +2984,7 @@ void CNavArea::ComputeHidingSpots( void )
 
 		bool isHoriz = (d == NORTH || d == SOUTH) ? true : false;
 
-		for( NavConnectList::iterator iter = m_connect[d].begin(); iter != m_connect[d].end(); ++iter )
+		for( NavConnectList::const_iterator iter = m_connect[d].begin(); iter != m_connect[d].end(); ++iter )
 		{
 			NavConnect connect = *iter;
 
@@ -2931,28 +3058,38 @@ void CNavArea::ComputeHidingSpots( void )
 	{
 		Vector pos = *GetCorner( NORTH_WEST ) + Vector(  offset,  offset, 0.0f );
 
-		m_hidingSpotList.push_back( new HidingSpot( &pos, (IsHidingSpotInCover( &pos )) ? HidingSpot::IN_COVER : 0 ) );
+		HidingSpotCandidate candidate = { pos, (unsigned char)((IsHidingSpotInCover( &pos )) ? HidingSpot::IN_COVER : 0) };
+		candidates->push_back( candidate );
 	}
 
 	if (cornerCount[ NORTH_EAST ] == 2)
 	{
 		Vector pos = *GetCorner( NORTH_EAST ) + Vector( -offset,  offset, 0.0f );
-		if (!IsHidingSpotCollision( &pos ))
-			m_hidingSpotList.push_back( new HidingSpot( &pos, (IsHidingSpotInCover( &pos )) ? HidingSpot::IN_COVER : 0 ) );
+		if (!IsHidingSpotCollision( &pos, candidates ))
+		{
+			HidingSpotCandidate candidate = { pos, (unsigned char)((IsHidingSpotInCover( &pos )) ? HidingSpot::IN_COVER : 0) };
+			candidates->push_back( candidate );
+		}
 	}
 
 	if (cornerCount[ SOUTH_WEST ] == 2)
 	{
 		Vector pos = *GetCorner( SOUTH_WEST ) + Vector(  offset, -offset, 0.0f );
-		if (!IsHidingSpotCollision( &pos ))
-			m_hidingSpotList.push_back( new HidingSpot( &pos, (IsHidingSpotInCover( &pos )) ? HidingSpot::IN_COVER : 0 ) );
+		if (!IsHidingSpotCollision( &pos, candidates ))
+		{
+			HidingSpotCandidate candidate = { pos, (unsigned char)((IsHidingSpotInCover( &pos )) ? HidingSpot::IN_COVER : 0) };
+			candidates->push_back( candidate );
+		}
 	}
 
 	if (cornerCount[ SOUTH_EAST ] == 2)
 	{
 		Vector pos = *GetCorner( SOUTH_EAST ) + Vector( -offset, -offset, 0.0f );
-		if (!IsHidingSpotCollision( &pos ))
-			m_hidingSpotList.push_back( new HidingSpot( &pos, (IsHidingSpotInCover( &pos )) ? HidingSpot::IN_COVER : 0 ) );
+		if (!IsHidingSpotCollision( &pos, candidates ))
+		{
+			HidingSpotCandidate candidate = { pos, (unsigned char)((IsHidingSpotInCover( &pos )) ? HidingSpot::IN_COVER : 0) };
+			candidates->push_back( candidate );
+		}
 	}
 }
 
@@ -2985,7 +3122,7 @@ void ClassifySniperSpot( HidingSpot *spot )
 				walkable.z = area->GetZ( &walkable ) + HalfHumanHeight;
 				
 				// check line of sight
-				UTIL_TraceLine( eye, walkable, ignore_monsters, ignore_glass, NULL, &result );
+				NavAnalysisTraceLine( eye, walkable, ignore_monsters, ignore_glass, &result );
 
 				if (result.flFraction == 1.0f && !result.fStartSolid)
 				{
@@ -3083,11 +3220,12 @@ SpotEncounter *CNavArea::GetSpotEncounter( const CNavArea *from, const CNavArea
 
 //--------------------------------------------------------------------------------------------------------------
 /**
- * Add spot encounter data when moving from area to area
+ * Find the path segment when moving from area to area, and the spots that may be seen along it.
+ * Makes no traces and only reads the mesh and the hiding spots, so it may run on an analysis worker thread.
  */
-void CNavArea::AddSpotEncounters( const CNavArea *from, NavDirType fromDir, const CNavArea *to, NavDirType toDir )
+void CNavArea::FindSpotEncounter( const CNavArea *from, NavDirType fromDir, const CNavArea *to, NavDirType toDir, SpotEncounterCandidate *candidate ) const
 {
-	SpotEncounter e;
+	SpotEncounter &e = candidate->encounter;
 
 	e.from.area = const_cast<CNavArea *>( from );
 	e.fromDir = fromDir;
@@ -3103,12 +3241,54 @@ void CNavArea::AddSpotEncounters( const CNavArea *from, NavDirType fromDir, cons
 	e.path.from.z = from->GetZ( &e.path.from ) + eyeHeight;
 	e.path.to.z = to->GetZ( &e.path.to ) + eyeHeight;
 
-	// step along ray and track which spots can be seen
 	Vector dir = e.path.to - e.path.from;
 	float length = dir.NormalizeInPlace();
 
-	// create unique marker to flag used spots
-	HidingSpot::ChangeMasterMarker();
+	const float seeSpotRange = 2000.0f;	// 3000
+	const float nearbyRange = seeSpotRange + length + 1.0f;
+
+	Vector delta;
+	HidingSpot *spot;
+
+	// collect the spots with cover that can possibly be in range of the path, in master list order
+	candidate->nearbySpots.clear();
+
+	for( HidingSpotList::iterator iter = TheHidingSpotList.begin(); iter != TheHidingSpotList.end(); ++iter )
+	{
+		spot = *iter;
+
+		// only look at spots with cover (others are out in the open and easily seen)
+		if (!spot->HasGoodCover())
+			continue;
+
+		const Vector *spotPos = spot->GetPosition();
+
+		delta.x = spotPos->x - e.path.from.x;
+		delta.y = spotPos->y - e.path.from.y;
+		delta.z = (spotPos->z + eyeHeight) - e.path.from.z;
+
+		if (delta.IsLengthGreaterThan( nearbyRange ))
+			continue;
+
+		candidate->nearbySpots.push_back( spot );
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Add spot encounter data when moving from area to area, tracing which of the spots found by
+ * FindSpotEncounter() become visible along the path. Must be called from the main thread.
+ */
+void CNavArea::AddSpotEncounter( const SpotEncounterCandidate *candidate )
+{
+	SpotEncounter e = candidate->encounter;
+	const std::vector<HidingSpot *> &nearbySpots = candidate->nearbySpots;
+
+	const float eyeHeight = HalfHumanHeight;
+
+	// step along ray and track which spots can be seen
+	Vector dir = e.path.to - e.path.from;
+	float length = dir.NormalizeInPlace();
 
 	const float stepSize = 25.0f;		// 50
 	const float seeSpotRange = 2000.0f;	// 3000
@@ -3118,6 +3298,9 @@ void CNavArea::AddSpotEncounters( const CNavArea *from, NavDirType fromDir, cons
 	HidingSpot *spot;
 	SpotOrder spotOrder;
 
+	// spots are flagged in a local list rather than with HidingSpot::Mark(), as the spots were found ahead of time
+	std::vector<bool> isEncountered( nearbySpots.size(), false );
+
 	// step along path thru this area
 	bool done = false;
 	for( float along = 0.0f; !done; along += stepSize )
@@ -3133,16 +3316,12 @@ void CNavArea::AddSpotEncounters( const CNavArea *from, NavDirType fromDir, cons
 		eye = e.path.from + along * dir;
 
 		// check each hiding spot for visibility
-		for( HidingSpotList::iterator iter = TheHidingSpotList.begin(); iter != TheHidingSpotList.end(); ++iter )
+		for( unsigned int i=0; i<nearbySpots.size(); ++i )
 		{
-			spot = *iter;
-
-			// only look at spots with cover (others are out in the open and easily seen)
-			if (!spot->HasGoodCover())
+			if (isEncountered[i])
 				continue;
 
-			if (spot->IsMarked())
-				continue;
+			spot = nearbySpots[i];
 
 			const Vector *spotPos = spot->GetPosition();
 
@@ -3155,7 +3334,7 @@ void CNavArea::AddSpotEncounters( const CNavArea *from, NavDirType fromDir, cons
 				continue;
 
 			// check if we have LOS
-			UTIL_TraceLine( eye, Vector( spotPos->x, spotPos->y, spotPos->z + HalfHumanHeight ), ignore_monsters, ignore_glass, NULL, &result );
+			NavAnalysisTraceLine( eye, Vector( spotPos->x, spotPos->y, spotPos->z + HalfHumanHeight ), ignore_monsters, ignore_glass, &result );
 			if (result.flFraction != 1.0f)
 				continue;
 
@@ -3176,7 +3355,7 @@ void CNavArea::AddSpotEncounters( const CNavArea *from, NavDirType fromDir, cons
 			}
 
 			// mark spot as encountered
-			spot->Mark();
+			isEncountered[i] = true;
 		}
 	}
 
@@ -3190,31 +3369,57 @@ void CNavArea::AddSpotEncounters( const CNavArea *from, NavDirType fromDir, cons
  * for each possible path thru a nav area.
  */
 void CNavArea::ComputeSpotEncounters( void )
+{
+	SpotEncounterCandidateList candidates;
+	FindSpotEncounters( &candidates );
+	AddSpotEncounters( &candidates );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Add the encounters found by FindSpotEncounters(), tracing the spots seen along each path.
+ * Must be called from the main thread.
+ */
+void CNavArea::AddSpotEncounters( const SpotEncounterCandidateList *candidates )
 {
 	m_spotEncounterList.clear();
 
+	for( SpotEncounterCandidateList::const_iterator iter = candidates->begin(); iter != candidates->end(); ++iter )
+		AddSpotEncounter( &(*iter) );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Find each path thru this area, and the hiding spots that may be seen along it, without making any traces.
+ * Only reads the mesh and the hiding spots, so it may run on an analysis worker thread.
+ */
+void CNavArea::FindSpotEncounters( SpotEncounterCandidateList *candidates ) const
+{
+	candidates->clear();
+
 	if (cv_bot_quicksave.value > 0.0f)
 		return;
 
 	// for each adjacent area
 	for( int fromDir=0; fromDir<NUM_DIRECTIONS; ++fromDir )
 	{
-		for( NavConnectList::iterator fromIter = m_connect[ fromDir ].begin(); fromIter != m_connect[ fromDir ].end(); ++fromIter )
+		for( NavConnectList::const_iterator fromIter = m_connect[ fromDir ].begin(); fromIter != m_connect[ fromDir ].end(); ++fromIter )
 		{
-			NavConnect *fromCon = &(*fromIter);
+			const NavConnect *fromCon = &(*fromIter);
 
 			// compute encounter data for path to each adjacent area
 			for( int toDir=0; toDir<NUM_DIRECTIONS; ++toDir )
 			{
-				for( NavConnectList::iterator toIter = m_connect[ toDir ].begin(); toIter != m_connect[ toDir ].end(); ++toIter )
+				for( NavConnectList::const_iterator toIter = m_connect[ toDir ].begin(); toIter != m_connect[ toDir ].end(); ++toIter )
 				{
-					NavConnect *toCon = &(*toIter);
+					const NavConnect *toCon = &(*toIter);
 
 					if (toCon == fromCon)
 						continue;
 
 					// just do our direction, as we'll loop around for other direction
-					AddSpotEncounters( fromCon->area, (NavDirType)fromDir, toCon->area, (NavDirType)toDir );
+					candidates->push_back( SpotEncounterCandidate() );
+					FindSpotEncounter( fromCon->area, (NavDirType)fromDir, toCon->area, (NavDirType)toDir, &candidates->back() );
 				}
 			}
 		}
@@ -3936,6 +4141,9 @@ void CNavArea::DrawConnectedAreas( void )
  */
 void CNavArea::RaiseCorner( NavCornerType corner, int amount )
 {
+	// the area geometry or connectivity is about to change
+	TheNavCompactMesh.Invalidate();
+
 	if ( corner == NUM_CORNERS )
 	{
 		m_extent.lo.z += amount;
@@ -4936,6 +5144,82 @@ void CNavArea::ComputeApproachAreas( void )
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Cost functor for BenchmarkNavAreaBuildPath() - shortest path cost that counts how many areas were evaluated
+ */
+class BenchmarkPathCost
+{
+public:
+	BenchmarkPathCost( void )
+	{
+		m_evaluated = 0;
+	}
+
+	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder )
+	{
+		++m_evaluated;
+		return m_cost( area, fromArea, ladder );
+	}
+
+	ShortestPathCost m_cost;
+	unsigned int m_evaluated;
+};
+
+/**
+ * Compute paths between 'count' pseudo-random pairs of areas on the loaded nav mesh and report the throughput.
+ * The pairs are generated from 'seed' so that the same pairs are used from build to build, allowing
+ * the results before and after a pathfinding change to be compared directly.
+ */
+void BenchmarkNavAreaBuildPath( int count, unsigned int seed, bool hierarchical )
+{
+	if (TheNavAreaList.empty())
+	{
+		CONSOLE_ECHO( "No navigation mesh loaded.\n" );
+		return;
+	}
+
+	if (count <= 0)
+		count = 1000;
+
+	// snapshot the area list so we can pick areas by index
+	std::vector<CNavArea *> areaVector( TheNavAreaList.begin(), TheNavAreaList.end() );
+	unsigned int areaCount = areaVector.size();
+
+	BenchmarkPathCost cost;
+	int foundCount = 0;
+
+	static CPerformanceCounter perfCounter;
+	double startTime = perfCounter.GetCurTime();
+
+	for( int i=0; i<count; ++i )
+	{
+		// simple LCG, so the pairs don't depend on the engine's random number generator
+		seed = seed * 1103515245 + 12345;
+		CNavArea *startArea = areaVector[ (seed >> 8) % areaCount ];
+
+		seed = seed * 1103515245 + 12345;
+		CNavArea *goalArea = areaVector[ (seed >> 8) % areaCount ];
+
+		bool found;
+		if (hierarchical)
+			found = NavAreaBuildHierarchicalPath( startArea, goalArea, NULL, cost );
+		else
+			found = NavAreaBuildPath( startArea, goalArea, NULL, cost );
+
+		if (found)
+			++foundCount;
+	}
+
+	double elapsed = perfCounter.GetCurTime() - startTime;
+
+	CONSOLE_ECHO( "Nav path benchmark: %d paths (%d found) over %d areas in %3.3f seconds\n", count, foundCount, areaCount, elapsed );
+	if (hierarchical)
+		CONSOLE_ECHO( "  hierarchical search over %d clusters\n", TheNavAreaClusters.GetClusterCount() );
+	CONSOLE_ECHO( "  %3.1f paths/second, %3.1f areas evaluated per path\n", (elapsed > 0.0) ? count / elapsed : 0.0, (float)cost.m_evaluated / (float)count );
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 
 /**
@@ -5074,6 +5358,46 @@ void CNavAreaGrid::RemoveNavArea( CNavArea *area )
 	--m_areaCount;
 }
 
+/**
+ * Append the areas that overlap the given area to 'list'.
+ * Each overlapping area is found in the cell containing the low corner of the overlap, so it is only added once.
+ */
+void CNavAreaGrid::GetOverlappingAreas( const CNavArea *area, NavAreaList *list ) const
+{
+	if (m_grid == NULL)
+		return;
+
+	const Extent *extent = area->GetExtent();
+
+	int loX = WorldToGridX( extent->lo.x );
+	int loY = WorldToGridY( extent->lo.y );
+	int hiX = WorldToGridX( extent->hi.x );
+	int hiY = WorldToGridY( extent->hi.y );
+
+	for( int y = loY; y <= hiY; ++y )
+	{
+		for( int x = loX; x <= hiX; ++x )
+		{
+			const NavAreaList *cell = &m_grid[ x + y*m_gridSizeX ];
+
+			for( NavAreaList::const_iterator iter = cell->begin(); iter != cell->end(); ++iter )
+			{
+				CNavArea *other = *iter;
+
+				if (other == area || !area->IsOverlapping( other ))
+					continue;
+
+				const Extent *otherExtent = other->GetExtent();
+				float overlapX = max( extent->lo.x, otherExtent->lo.x );
+				float overlapY = max( extent->lo.y, otherExtent->lo.y );
+
+				if (WorldToGridX( overlapX ) == x && WorldToGridY( overlapY ) == y)
+					list->push_back( other );
+			}
+		}
+	}
+}
+
 /**
  * Given a position, return the nav area that IsOverlapping and is *immediately* beneath it
  */
@@ -5124,11 +5448,37 @@ CNavArea *CNavAreaGrid::GetNavArea( const Vector *pos, float beneathLimit ) cons
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A candidate area for GetNearestNavArea(), along with the closest point on it to the source position
+ */
+struct NearestAreaCandidate
+{
+	float distSq;
+	CNavArea *area;
+	Vector areaPos;
+
+	bool operator<( const NearestAreaCandidate &other ) const
+	{
+		if (distSq != other.distSq)
+			return (distSq < other.distSq) ? true : false;
+
+		// break ties consistently
+		return (area->GetID() < other.area->GetID()) ? true : false;
+	}
+};
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Given a position in the world, return the nav area that is closest
  * and at the same height, or beneath it.
  * Used to find initial area if we start off of the mesh.
+ *
+ * The grid is searched in square rings of cells expanding outward from the cell containing the position.
+ * Each area is considered only in the cell that contains its closest point to the position, so once a ring
+ * has been searched, no unvisited area can be closer than the distance to the edge of the rings searched
+ * so far. Candidates inside that bound are checked for LOS in order of increasing distance, so traces are
+ * only done for the few closest areas instead of for every closer area found while scanning the whole map.
  */
 CNavArea *CNavAreaGrid::GetNearestNavArea( const Vector *pos, bool anyZ ) const
 {
@@ -5136,7 +5486,6 @@ CNavArea *CNavAreaGrid::GetNearestNavArea( const Vector *pos, bool anyZ ) const
 		return NULL;
 
 	CNavArea *close = NULL;
-	float closeDistSq = 99999999.9f;
 
 	// quick check
 	close = GetNavArea( pos );
@@ -5152,36 +5501,100 @@ CNavArea *CNavAreaGrid::GetNearestNavArea( const Vector *pos, bool anyZ ) const
 
 	source.z += HalfHumanHeight;
 
-	/// @todo Step incrementally using grid for speed
+	// find the (unclamped) grid cell containing the source position
+	float localX = source.x - m_minX;
+	float localY = source.y - m_minY;
+	int centerX = (int)floor( localX / m_cellSize );
+	int centerY = (int)floor( localY / m_cellSize );
 
-	// find closest nav area
-	for( NavAreaList::iterator iter = TheNavAreaList.begin(); iter != TheNavAreaList.end(); ++iter )
+	// skip the rings that lie entirely outside of the grid
+	int ring = 0;
+	ring = max( ring, -centerX );
+	ring = max( ring, centerX - (m_gridSizeX-1) );
+	ring = max( ring, -centerY );
+	ring = max( ring, centerY - (m_gridSizeY-1) );
+
+	std::vector<NearestAreaCandidate> candidateVector;
+
+	while( true )
 	{
-		CNavArea *area = *iter;
+		int loX = centerX - ring;
+		int hiX = centerX + ring;
+		int loY = centerY - ring;
+		int hiY = centerY + ring;
+
+		// collect areas whose closest point lies in the cells of this ring
+		for( int y = max( loY, 0 ); y <= min( hiY, m_gridSizeY-1 ); ++y )
+		{
+			// interior rows only contribute their two end cells
+			int step = (y == loY || y == hiY) ? 1 : hiX - loX;
+			if (step <= 0)
+				step = 1;
+
+			for( int x = loX; x <= hiX; x += step )
+			{
+				if (x < 0 || x >= m_gridSizeX)
+					continue;
 
-		Vector areaPos;
-		area->GetClosestPointOnArea( &source, &areaPos );
+				const NavAreaList *list = &m_grid[ x + y*m_gridSizeX ];
 
-		float distSq = (areaPos - source).LengthSquared();
+				for( NavAreaList::const_iterator iter = list->begin(); iter != list->end(); ++iter )
+				{
+					NearestAreaCandidate candidate;
+					candidate.area = *iter;
+					candidate.area->GetClosestPointOnArea( &source, &candidate.areaPos );
+
+					// areas span many cells - only consider each area in the cell containing its closest point
+					if (WorldToGridX( candidate.areaPos.x ) != x || WorldToGridY( candidate.areaPos.y ) != y)
+						continue;
 
-		// keep the closest area
-		if (distSq < closeDistSq)
+					candidate.distSq = (candidate.areaPos - source).LengthSquared();
+					candidateVector.push_back( candidate );
+				}
+			}
+		}
+
+		// if the rings cover the whole grid, every area has been collected
+		bool isFinalRing = (loX <= 0 && hiX >= m_gridSizeX-1 && loY <= 0 && hiY >= m_gridSizeY-1);
+
+		// no unvisited area can be closer than the edge of the rings searched so far
+		float bound = min( min( localX - loX * m_cellSize, (hiX+1) * m_cellSize - localX ), 
+						   min( localY - loY * m_cellSize, (hiY+1) * m_cellSize - localY ) );
+		float boundSq = bound * bound;
+
+		std::sort( candidateVector.begin(), candidateVector.end() );
+
+		// check the candidates that are known to be the closest, nearest first
+		unsigned int tested = 0;
+		for( ; tested < candidateVector.size(); ++tested )
 		{
+			const NearestAreaCandidate &candidate = candidateVector[ tested ];
+
+			if (!isFinalRing && candidate.distSq >= boundSq)
+				break;
+
 			// check LOS to area
 			if (!anyZ)
 			{
 				TraceResult result;
-				UTIL_TraceLine( source, areaPos + Vector( 0, 0, HalfHumanHeight ), ignore_monsters, ignore_glass, NULL, &result );
+				UTIL_TraceLine( source, candidate.areaPos + Vector( 0, 0, HalfHumanHeight ), ignore_monsters, ignore_glass, NULL, &result );
 				if (result.flFraction != 1.0f)
 					continue;
 			}
-					
-			closeDistSq = distSq;
-			close = area;
+
+			return candidate.area;
 		}
+
+		if (isFinalRing)
+			break;
+
+		// these candidates failed LOS - don't trace them again
+		candidateVector.erase( candidateVector.begin(), candidateVector.begin() + tested );
+
+		++ring;
 	}
 
-	return close;
+	return NULL;
 }
 
 //--------------------------------------------------------------------------------------------------------------
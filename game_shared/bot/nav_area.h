@@ -6,14 +6,19 @@
 #define _NAV_AREA_H_
 
 #include <list>
+#include <vector>
+#include <map>
+#include <set>
 #include "nav.h"
 #include "steam_util.h"
 
 class CNavArea;
+struct NavCompactHidingSpot;
+struct NavCompactData;
 
 void DestroyHidingSpots( void );
 void StripNavigationAreas( void );
-bool SaveNavigationMap( const char *filename );
+bool SaveNavigationMap( const char *filename, bool compactFormat = false );
 NavErrorType LoadNavigationMap( void );
 void DestroyNavigationMap( void );
 
@@ -132,6 +137,7 @@ public:
 
 	void Save( int fd, unsigned int version ) const;
 	void Load( SteamFile *file, unsigned int version );
+	void Load( const NavCompactHidingSpot *data );		///< load from a compact nav file record
 
 	const Vector *GetPosition( void ) const		{ return &m_pos; }	///< get the position of the hiding spot
 	unsigned int GetID( void ) const			{ return m_id; }
@@ -155,6 +161,16 @@ private:
 typedef std::list<HidingSpot *> HidingSpotList;
 extern HidingSpotList TheHidingSpotList;
 
+/**
+ * A hiding spot found by analysis, before it has been given an ID and added to the master list
+ */
+struct HidingSpotCandidate
+{
+	Vector pos;
+	unsigned char flags;
+};
+typedef std::vector<HidingSpotCandidate> HidingSpotCandidateList;
+
 extern HidingSpot *GetHidingSpotByID( unsigned int id );
 
 //--------------------------------------------------------------------------------------------------------------
@@ -187,6 +203,16 @@ struct SpotEncounter
 };
 typedef std::list<SpotEncounter> SpotEncounterList;
 
+/**
+ * A path segment thru a CNavArea and the spots it might see, found by analysis before any traces are made
+ */
+struct SpotEncounterCandidate
+{
+	SpotEncounter encounter;							///< the path segment, with an empty spot list
+	std::vector<HidingSpot *> nearbySpots;				///< spots with cover that can possibly be in range of the path, in master list order
+};
+typedef std::vector<SpotEncounterCandidate> SpotEncounterCandidateList;
+
 
 //-------------------------------------------------------------------------------------------------------------------
 /**
@@ -209,8 +235,12 @@ public:
 	void Save( int fd, unsigned int version );
 	void Load( SteamFile *file, unsigned int version );
 	NavErrorType PostLoad( void );
+	void Load( const NavCompactData *data, unsigned int index, HidingSpot * const *spotTable );	///< load from the compact data of a mapped nav file
+	NavErrorType PostLoad( const NavCompactData *data, CNavArea * const *areaTable, HidingSpot * const *spotTable );	///< convert loaded indices to pointers
 
 	unsigned int GetID( void ) const						{ return m_id; }
+	unsigned int GetCompactIndex( void ) const				{ return m_compactIndex; }	///< index of this area in TheNavCompactMesh - only valid while the compact mesh is valid
+	unsigned int GetClusterID( void ) const					{ return m_clusterID; }	///< the cluster of this area in TheNavAreaClusters - only valid after an update
 
 	void SetAttributes( unsigned char bits )		{ m_attributeFlags = bits; }
 	unsigned char GetAttributes( void ) const		{ return m_attributeFlags; }
@@ -254,10 +284,14 @@ public:
 	//- hiding spots ------------------------------------------------------------------------------------
 	const HidingSpotList *GetHidingSpotList( void ) const	{ return &m_hidingSpotList; }
 	void ComputeHidingSpots( void );							///< analyze local area neighborhood to find "hiding spots" in this area - for map learning
+	void FindHidingSpots( HidingSpotCandidateList *candidates ) const;	///< find the hiding spots of this area without creating them
+	void AddHidingSpots( const HidingSpotCandidateList *candidates );	///< create hiding spots found by FindHidingSpots(), assigning IDs in order
 	void ComputeSniperSpots( void );							///< analyze local area neighborhood to find "sniper spots" in this area - for map learning
 
 	SpotEncounter *GetSpotEncounter( const CNavArea *from, const CNavArea *to );	///< given the areas we are moving between, return the spots we will encounter
 	void ComputeSpotEncounters( void );							///< compute spot encounter data - for map learning
+	void FindSpotEncounters( SpotEncounterCandidateList *candidates ) const;	///< find the paths thru this area and the spots near them, without tracing - safe to use from analysis worker threads
+	void AddSpotEncounters( const SpotEncounterCandidateList *candidates );	///< trace the spots seen along paths found by FindSpotEncounters(), and add the encounters
 
 	//- "danger" ----------------------------------------------------------------------------------------
 	void IncreaseDanger( int teamID, float amount );			///< increase the danger of this area for the given team
@@ -292,7 +326,7 @@ public:
 	NavTraverseType GetParentHow( void ) const	{ return m_parentHow; }
 
 	bool IsOpen( void ) const;								///< true if on "open list"
-	void AddToOpenList( void );								///< add to open list in decreasing value order
+	void AddToOpenList( void );								///< add to open list, keyed by total cost
 	void UpdateOnOpenList( void );							///< a smaller value has been found, update this area on the open list
 	void RemoveFromOpenList( void );
 	static bool IsOpenListEmpty( void );
@@ -327,12 +361,14 @@ private:
 	friend void ConnectGeneratedAreas( void );
 	friend void MergeGeneratedAreas( void );
 	friend void MarkJumpAreas( void );
-	friend bool SaveNavigationMap( const char *filename );
+	friend bool SaveNavigationMap( const char *filename, bool compactFormat );
 	friend NavErrorType LoadNavigationMap( void );
 	friend void DestroyNavigationMap( void );
 	friend void DestroyHidingSpots( void );
 	friend void StripNavigationAreas( void );
 	friend class CNavAreaGrid;
+	friend class CNavCompactMesh;
+	friend class CNavAreaClusters;
 	friend class CCSBotManager;
 
 	void Initialize( void );								///< to keep constructors consistent
@@ -362,10 +398,12 @@ private:
 	//- hiding spots ------------------------------------------------------------------------------------
 	HidingSpotList m_hidingSpotList;
 	bool IsHidingSpotCollision( const Vector *pos ) const;	///< returns true if an existing hiding spot is too close to given position
+	bool IsHidingSpotCollision( const Vector *pos, const HidingSpotCandidateList *candidates ) const;	///< also check the given candidates
 
 	//- encounter spots ---------------------------------------------------------------------------------
 	SpotEncounterList m_spotEncounterList;					///< list of possible ways to move thru this area, and the spots to look at as we do
-	void AddSpotEncounters( const CNavArea *from, NavDirType fromDir, const CNavArea *to, NavDirType toDir );	///< add spot encounter data when moving from area to area
+	void FindSpotEncounter( const CNavArea *from, NavDirType fromDir, const CNavArea *to, NavDirType toDir, SpotEncounterCandidate *candidate ) const;	///< find the path from area to area, and the spots near it
+	void AddSpotEncounter( const SpotEncounterCandidate *candidate );	///< add spot encounter data when moving from area to area
 
 	//- approach areas ----------------------------------------------------------------------------------
 	enum { MAX_APPROACH_AREAS = 16 };
@@ -382,10 +420,21 @@ private:
 	float m_totalCost;										///< the distance so far plus an estimate of the distance left
 	float m_costSoFar;										///< distance travelled so far
 
-	static CNavArea *m_openList;
-	CNavArea *m_nextOpen, *m_prevOpen;						///< only valid if m_openMarker == m_masterMarker
+	/**
+	 * The open list is a binary min-heap of areas ordered by total cost, stored in a flat array that is
+	 * reused from search to search. Areas of equal cost are ordered by the time they were added or
+	 * updated, which preserves the first-in-first-out behavior of breadth-first searches.
+	 */
+	static std::vector<CNavArea *> m_openList;
+	static unsigned int m_openSequence;						///< incremented each time an area is added to or updated on the open list
+	int m_openIndex;										///< our position in the open list heap - only valid if m_openMarker == m_masterMarker
+	unsigned int m_openOrder;								///< sequence number used to break ties between equal costs
 	unsigned int m_openMarker;								///< if this equals the current marker value, we are on the open list
 
+	static bool IsOpenBefore( const CNavArea *area, const CNavArea *other );	///< return true if 'area' must be popped before 'other'
+	static void SiftUpOpenList( int index );				///< move the area at 'index' toward the top of the heap until ordered
+	static void SiftDownOpenList( int index );				///< move the area at 'index' toward the bottom of the heap until ordered
+
 	//- connections to adjacent areas -------------------------------------------------------------------
 	NavConnectList m_connect[ NUM_DIRECTIONS ];				///< a list of adjacent areas for each direction
 	NavLadderList m_ladder[ NUM_LADDER_DIRECTIONS ];		///< list of ladders leading up and down from this area
@@ -404,6 +453,9 @@ private:
 	void OnDestroyNotify( CNavArea *dead );					///< invoked when given area is going away
 
 	CNavArea *m_prevHash, *m_nextHash;						///< for hash table in CNavAreaGrid
+
+	unsigned int m_compactIndex;							///< index of this area in CNavCompactMesh
+	unsigned int m_clusterID;								///< the cluster this area belongs to in CNavAreaClusters
 };
 
 typedef std::list<CNavArea *> NavAreaList;
@@ -439,14 +491,14 @@ inline bool CNavArea::IsOpen( void ) const
 
 inline bool CNavArea::IsOpenListEmpty( void )
 {
-	return (m_openList) ? false : true;
+	return m_openList.empty();
 }
 
 inline CNavArea *CNavArea::PopOpenList( void )
 {
-	if (m_openList)
+	if (!m_openList.empty())
 	{
-		CNavArea *area = m_openList;
+		CNavArea *area = m_openList.front();
 	
 		// disconnect from list
 		area->RemoveFromOpenList();
@@ -496,7 +548,8 @@ public:
 
 	CNavArea *GetNavArea( const Vector *pos, float beneathLimt = 120.0f ) const;	///< given a position, return the nav area that IsOverlapping and is *immediately* beneath it
 	CNavArea *GetNavAreaByID( unsigned int id ) const;
-	CNavArea *GetNearestNavArea( const Vector *pos, bool anyZ = false ) const;
+	CNavArea *GetNearestNavArea( const Vector *pos, bool anyZ = false ) const;	///< search outward from 'pos' through the grid for the closest area with LOS
+	void GetOverlappingAreas( const CNavArea *area, NavAreaList *list ) const;	///< append the areas that overlap the given area to 'list'
 
 	Place GetPlace( const Vector *pos ) const;				///< return radio chatter place for given coordinate
 
@@ -542,6 +595,331 @@ private:
 
 extern CNavAreaGrid TheNavAreaGrid;
 
+//--------------------------------------------------------------------------------------------------------------
+
+#define NAV_INVALID_INDEX 0xFFFFFFFF					///< "no area" in the index-based data of the compact mesh
+
+/**
+ * Compact record of a CNavArea.
+ * All references to other records are indices into the arrays of the CNavCompactMesh.
+ */
+struct NavCompactArea
+{
+	unsigned int id;
+	unsigned int attributes;
+	Place place;
+	Extent extent;
+	float neZ;
+	float swZ;
+	Vector center;
+
+	unsigned int firstHidingSpot;						///< hiding spots of this area are [firstHidingSpot, firstHidingSpot + hidingSpotCount)
+	unsigned int hidingSpotCount;
+	unsigned int firstEncounter;						///< spot encounters of this area are [firstEncounter, firstEncounter + encounterCount)
+	unsigned int encounterCount;
+	unsigned int firstApproach;							///< approach info of this area is [firstApproach, firstApproach + approachCount)
+	unsigned int approachCount;
+};
+
+struct NavCompactLadder
+{
+	Vector top;
+	Vector bottom;
+	float length;
+	unsigned int dir;
+	unsigned int isDangling;
+	unsigned int topForwardArea;
+	unsigned int topLeftArea;
+	unsigned int topRightArea;
+	unsigned int topBehindArea;
+	unsigned int bottomArea;
+};
+
+struct NavCompactHidingSpot
+{
+	Vector pos;
+	unsigned int id;
+	unsigned int flags;
+};
+
+struct NavCompactSpotOrder
+{
+	float t;
+	unsigned int spot;									///< index of hiding spot, or NAV_INVALID_INDEX if not analyzed
+};
+
+struct NavCompactEncounter
+{
+	unsigned int from;
+	unsigned int fromDir;
+	unsigned int to;
+	unsigned int toDir;
+	Ray path;
+	unsigned int firstSpot;								///< spot orders of this encounter are [firstSpot, firstSpot + spotCount)
+	unsigned int spotCount;
+};
+
+struct NavCompactApproach
+{
+	unsigned int here;
+	unsigned int prev;
+	unsigned int prevToHereHow;
+	unsigned int next;
+	unsigned int hereToNextHow;
+};
+
+/**
+ * Pointers to the arrays of compact nav data, and their lengths.
+ * All records are fixed-size and built from 32-bit fields only, so they can be written to and
+ * used directly from a nav file.
+ */
+struct NavCompactData
+{
+	const NavCompactArea *area;
+	unsigned int areaCount;
+
+	const unsigned int *connectOffset;					///< NUM_DIRECTIONS entries per area, plus one
+	const unsigned int *connect;						///< adjacent area indices, grouped by area then direction
+	unsigned int connectCount;
+
+	const NavCompactHidingSpot *hidingSpot;
+	unsigned int hidingSpotCount;
+
+	const NavCompactEncounter *encounter;
+	unsigned int encounterCount;
+
+	const NavCompactSpotOrder *spotOrder;
+	unsigned int spotOrderCount;
+
+	const NavCompactApproach *approach;
+	unsigned int approachCount;
+};
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Layout of a compact nav file (version NAV_COMPACT_VERSION).
+ * The header is followed by "lumps", each of which is an array of one of the compact records above, so
+ * that the file can be mapped into memory and used in place by the CNavCompactMesh.
+ */
+#define NAV_COMPACT_VERSION 6
+
+enum NavCompactLumpType
+{
+	NAV_LUMP_PLACES = 0,								///< the place directory, stored as in earlier nav file versions
+	NAV_LUMP_AREAS,
+	NAV_LUMP_CONNECT_OFFSETS,
+	NAV_LUMP_CONNECTS,
+	NAV_LUMP_HIDING_SPOTS,
+	NAV_LUMP_ENCOUNTERS,
+	NAV_LUMP_SPOT_ORDERS,
+	NAV_LUMP_APPROACHES,
+
+	NUM_NAV_LUMPS
+};
+
+struct NavCompactLump
+{
+	unsigned int offset;								///< byte offset of the lump from the start of the file, 4-byte aligned
+	unsigned int count;									///< number of records in the lump
+	unsigned int recordSize;							///< size of each record, to detect layout changes
+};
+
+struct NavCompactFileHeader
+{
+	unsigned int magic;									///< NAV_MAGIC_NUMBER
+	unsigned int version;								///< NAV_COMPACT_VERSION
+	unsigned int bspSize;								///< size of source bsp file, to verify nav data correlation
+	unsigned int headerSize;							///< sizeof(NavCompactFileHeader)
+	NavCompactLump lump[ NUM_NAV_LUMPS ];
+};
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A nav file mapped into memory.
+ * The mapping is private, so the data may be modified in place without affecting the file on disk.
+ * If the file cannot be mapped (ie: it is inside a pak), it is read into memory instead.
+ */
+class CNavMappedFile
+{
+public:
+	CNavMappedFile( void );
+	~CNavMappedFile();
+
+	bool Open( const char *filename );						///< map the given game directory relative file
+	void Close( void );
+
+	byte *GetData( void ) const						{ return m_data; }
+	unsigned int GetSize( void ) const				{ return m_size; }
+	bool IsMapped( void ) const						{ return m_isMapped; }	///< true if mapped, false if read into memory
+
+private:
+	byte *m_data;
+	unsigned int m_size;
+	bool m_isMapped;
+
+#ifdef _WIN32
+	void *m_fileHandle;
+	void *m_mappingHandle;
+#endif
+};
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The CNavCompactMesh is a flattened copy of the navigation mesh, built from TheNavAreaList once
+ * it is loaded or generated. Areas, ladders, hiding spots, and encounters are stored in contiguous arrays,
+ * and the adjacency of each area is stored per direction in compressed sparse row form, so that
+ * traversing the mesh does not chase list nodes all over the heap.
+ *
+ * CNavArea and its lists remain the authoritative data used for editing. Any change to the areas or
+ * their connections invalidates the compact mesh, and it is rebuilt the next time it is needed.
+ * Analysis data (hiding spots, encounters, approach areas) is captured as of the last Build().
+ *
+ * The compact data either lives in arrays owned by the mesh, or is attached directly from a mapped nav file.
+ */
+class CNavCompactMesh
+{
+public:
+	CNavCompactMesh( void );
+	~CNavCompactMesh();
+
+	void Reset( void );										///< discard all compact data
+	void Build( void );										///< rebuild the compact data from TheNavAreaList
+	void Attach( CNavMappedFile *file, const NavCompactData *data );	///< use compact data from a loaded nav file - TheNavAreaList must be in the same order
+	void Invalidate( void )							{ m_isValid = false; }	///< the nav mesh has changed
+	bool IsValid( void ) const						{ return m_isValid; }
+	void Update( void )								{ if (!m_isValid) Build(); }	///< rebuild if the nav mesh has changed
+
+	const NavCompactData *GetData( void ) const		{ return &m_data; }
+
+	unsigned int GetAreaCount( void ) const			{ return m_data.areaCount; }
+	const NavCompactArea *GetArea( unsigned int index ) const	{ return &m_data.area[ index ]; }
+	CNavArea *GetNavArea( unsigned int index ) const	{ return m_navArea[ index ]; }	///< return the editable area for the given index
+	CNavArea * const *GetNavAreaArray( void ) const	{ return (m_navArea.empty()) ? NULL : &m_navArea[0]; }
+
+	/// adjacent areas of the given area in the given direction are the indices in [ GetAdjacentBegin(), GetAdjacentEnd() )
+	const unsigned int *GetAdjacentBegin( unsigned int index, int dir ) const	{ return m_data.connect + m_data.connectOffset[ index * NUM_DIRECTIONS + dir ]; }
+	const unsigned int *GetAdjacentEnd( unsigned int index, int dir ) const		{ return m_data.connect + m_data.connectOffset[ index * NUM_DIRECTIONS + dir + 1 ]; }
+
+	/// ladders of the given area in the given direction are the indices in [ GetLadderBegin(), GetLadderEnd() )
+	const unsigned int *GetLadderBegin( unsigned int index, LadderDirectionType dir ) const	{ return m_ladderRef.data() + m_ladderOffset[ index * NUM_LADDER_DIRECTIONS + dir ]; }
+	const unsigned int *GetLadderEnd( unsigned int index, LadderDirectionType dir ) const	{ return m_ladderRef.data() + m_ladderOffset[ index * NUM_LADDER_DIRECTIONS + dir + 1 ]; }
+
+	unsigned int GetLadderCount( void ) const					{ return m_ladder.size(); }
+	const NavCompactLadder *GetLadder( unsigned int index ) const	{ return &m_ladder[ index ]; }
+
+	unsigned int GetHidingSpotCount( void ) const				{ return m_data.hidingSpotCount; }
+	const NavCompactHidingSpot *GetHidingSpot( unsigned int index ) const	{ return &m_data.hidingSpot[ index ]; }
+
+	unsigned int GetEncounterCount( void ) const				{ return m_data.encounterCount; }
+	const NavCompactEncounter *GetEncounter( unsigned int index ) const	{ return &m_data.encounter[ index ]; }
+	const NavCompactSpotOrder *GetSpotOrder( unsigned int index ) const	{ return &m_data.spotOrder[ index ]; }
+
+	const NavCompactApproach *GetApproach( unsigned int index ) const	{ return &m_data.approach[ index ]; }
+
+	unsigned int GetMemoryUsage( void ) const;				///< return number of bytes used by the compact data
+	void ReportLayout( int repeatCount = 100 );				///< compare memory and traversal time of the list and compact layouts
+
+private:
+	bool m_isValid;
+
+	NavCompactData m_data;									///< the compact data in use, either from the arrays below or from m_file
+	CNavMappedFile *m_file;									///< the nav file the compact data is attached to, if any
+
+	std::vector<CNavArea *> m_navArea;						///< the CNavArea each compact area corresponds to
+
+	std::vector<NavCompactArea> m_area;
+	std::vector<unsigned int> m_connectOffset;
+	std::vector<unsigned int> m_connect;
+	std::vector<NavCompactHidingSpot> m_hidingSpot;
+	std::vector<NavCompactEncounter> m_encounter;
+	std::vector<NavCompactSpotOrder> m_spotOrder;
+	std::vector<NavCompactApproach> m_approach;
+
+	// ladders are always built at load time, so they are never part of a nav file
+	std::vector<NavCompactLadder> m_ladder;
+	std::vector<unsigned int> m_ladderOffset;				///< NUM_LADDER_DIRECTIONS entries per area, plus one
+	std::vector<unsigned int> m_ladderRef;					///< ladder indices, grouped by area then direction
+
+	void AssignIndices( void );								///< fill m_navArea from TheNavAreaList and index each area
+	void BuildLadders( void );								///< build the compact ladder data from TheNavLadderList
+	void UseOwnedData( void );								///< point m_data at the arrays owned by the mesh
+	unsigned int GetIndex( const CNavArea *area ) const;	///< return compact index of area, or NAV_INVALID_INDEX
+};
+
+extern CNavCompactMesh TheNavCompactMesh;
+
+//--------------------------------------------------------------------------------------------------------------
+#define NAV_CLUSTER_SIZE 512.0f							///< width of the square regions areas are clustered within
+
+/**
+ * The CNavAreaClusters is an abstraction of the navigation mesh used by NavAreaBuildHierarchicalPath().
+ * The world is divided into square regions, and the areas of each region (by center) are grouped into
+ * clusters of areas that are connected to each other within the region. Two clusters are adjacent if
+ * an area of one connects to an area of the other, on the floor or by ladder.
+ *
+ * A path is found by first searching the (small) cluster graph, and then searching the areas
+ * of the clusters along the way - the "corridor" - with the actual cost functor.
+ *
+ * Edits to the mesh mark the regions of the changed areas as dirty, and only the clusters of
+ * dirty regions are rebuilt, so the cluster IDs of the rest of the mesh are unchanged.
+ *
+ * Bot paths (CNavPath::Compute()) do not use the clusters - only bot_nav_benchmark does, to compare
+ * the two searches on the same area pairs.
+ */
+class CNavAreaClusters
+{
+public:
+	CNavAreaClusters( void );
+
+	void Reset( void );										///< discard all clusters
+	void Invalidate( void )							{ m_isBuilt = false; }	///< rebuild all clusters when next needed
+	void MarkDirty( const CNavArea *area );					///< the given area is about to change
+	void Update( void );									///< rebuild the clusters of regions that have changed
+
+	bool BuildCorridor( const CNavArea *startArea, const CNavArea *goalArea );	///< search the cluster graph and mark the clusters on the way from start to goal
+	bool IsInCorridor( unsigned int clusterID ) const	{ return clusterID < m_cluster.size() && m_cluster[ clusterID ].corridorMarker == m_corridorMarker; }
+
+	unsigned int GetClusterCount( void ) const		{ return m_cluster.size() - m_freeCluster.size(); }
+	unsigned int GetCorridorLength( void ) const	{ return m_corridorLength; }	///< number of clusters in the last corridor built
+
+private:
+	struct Cluster
+	{
+		unsigned int region;
+		bool isFree;
+		Vector center;										///< average of the centers of the areas of the cluster
+		unsigned int areaCount;
+		std::vector<unsigned int> adjacent;					///< clusters reachable from an area of this cluster
+
+		unsigned int corridorMarker;
+
+		// for the cluster graph search
+		unsigned int searchMarker;
+		bool isClosed;
+		float costSoFar;
+		unsigned int parent;
+	};
+
+	std::vector<Cluster> m_cluster;
+	std::vector<unsigned int> m_freeCluster;				///< IDs of unused entries of m_cluster
+	std::map< unsigned int, std::vector<unsigned int> > m_region;	///< the clusters of each region
+	std::set<unsigned int> m_dirtyRegion;
+
+	bool m_isBuilt;
+	bool m_needsScan;										///< an area may have been added or moved to another region
+
+	unsigned int m_corridorMarker;
+	unsigned int m_corridorLength;
+	unsigned int m_searchMarker;
+
+	bool IsLiveCluster( unsigned int clusterID ) const	{ return clusterID < m_cluster.size() && !m_cluster[ clusterID ].isFree; }
+	void FreeRegion( unsigned int region );
+	unsigned int AllocateCluster( unsigned int region );
+	void BuildAdjacency( void );
+};
+
+extern CNavAreaClusters TheNavAreaClusters;
+
 //--------------------------------------------------------------------------------------------------------------
 //
 // Function prototypes
@@ -554,6 +932,10 @@ extern void SanityCheckNavigationMap( const char *mapName );	///< Performs a lig
 extern void ApproachAreaAnalysisPrep( void );
 extern void CleanupApproachAreaAnalysisPrep( void );
 
+extern void NavAnalysisTraceLine( const Vector &start, const Vector &end, IGNORE_MONSTERS igmon, IGNORE_GLASS ignoreGlass, TraceResult *result );	///< trace used by the analysis passes - main thread only
+extern void AnalyzeNavigationMesh( int threadCount = 0 );	///< compute hiding spots, approach areas, encounters, and sniper spots for all areas
+extern NavErrorType AnalyzeNavigationMap( int threadCount = 0, bool compactFormat = false );	///< re-analyze and save the nav file of the current map
+
 extern void BuildLadders( void );
 
 extern bool TestArea( CNavNode *node, int width, int height );
@@ -576,6 +958,8 @@ extern const Vector *FindNearbyRetreatSpot( CBaseEntity *me, const Vector *start
 /// return true if moving from "start" to "finish" will cross a player's line of fire.
 extern bool IsCrossingLineOfFire( const Vector &start, const Vector &finish, CBaseEntity *ignore = NULL, int ignoreTeam = 0 );
 
+extern void BenchmarkNavAreaBuildPath( int count, unsigned int seed = 0, bool hierarchical = false );	///< time NavAreaBuildPath() (or NavAreaBuildHierarchicalPath()) between random area pairs and report paths/second
+
 extern void IncreaseDangerNearby( int teamID, float amount, CNavArea *area, const Vector *pos, float maxRadius );
 extern void DrawDanger( void );
 
@@ -709,6 +1093,9 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	// determine actual goal position
 	Vector actualGoalPos = (goalPos) ? *goalPos : *goalArea->GetCenter();
 
+	// make sure the compact adjacency reflects any edits
+	TheNavCompactMesh.Update();
+
 	// start search
 	CNavArea::ClearSearchLists();
 
@@ -746,8 +1133,9 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 		// search adjacent areas
 		bool searchFloor = true;
 		int dir = NORTH;
-		const NavConnectList *floorList = area->GetAdjacentList( NORTH );
-		NavConnectList::const_iterator floorIter = floorList->begin();
+		unsigned int areaIndex = area->GetCompactIndex();
+		const unsigned int *floorIter = TheNavCompactMesh.GetAdjacentBegin( areaIndex, NORTH );
+		const unsigned int *floorEnd = TheNavCompactMesh.GetAdjacentEnd( areaIndex, NORTH );
 
 		bool ladderUp = true;
 		const NavLadderList *ladderList = NULL;
@@ -767,7 +1155,7 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 			if (searchFloor)
 			{
 				// if exhausted adjacent connections in current direction, begin checking next direction
-				if (floorIter == floorList->end())
+				if (floorIter == floorEnd)
 				{
 					++dir;
 
@@ -782,15 +1170,14 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 					}
 					else
 					{
-						// start next direction
-						floorList = area->GetAdjacentList( (NavDirType)dir );
-						floorIter = floorList->begin();
+						// start next direction - adjacent indices for each direction follow the previous one
+						floorEnd = TheNavCompactMesh.GetAdjacentEnd( areaIndex, dir );
 					}
 
 					continue;
 				}
 
-				newArea = (*floorIter).area;
+				newArea = TheNavCompactMesh.GetNavArea( *floorIter );
 				how = (NavTraverseType)dir;
 				++floorIter;
 			}
@@ -906,6 +1293,57 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Cost functor that restricts another cost functor to the areas of the current cluster corridor
+ */
+template< typename CostFunctor >
+class NavCorridorCost
+{
+public:
+	NavCorridorCost( CostFunctor &costFunc ) : m_costFunc( costFunc )
+	{
+	}
+
+	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder )
+	{
+		if (fromArea && !TheNavAreaClusters.IsInCorridor( area->GetClusterID() ))
+			return -1.0f;
+
+		return m_costFunc( area, fromArea, ladder );
+	}
+
+private:
+	CostFunctor &m_costFunc;
+};
+
+/**
+ * Find path from startArea to goalArea like NavAreaBuildPath(), but only search the areas of the clusters
+ * along the way, as found by a search of the cluster graph.
+ * The path found may be slightly longer than the one NavAreaBuildPath() would find.
+ * If the corridor is blocked for the given cost functor, or there is no goal area, the whole mesh is searched.
+ * A blocked corridor therefore costs the corridor search plus a full NavAreaBuildPath(), which is why
+ * CNavPath::Compute() does not use this.
+ */
+template< typename CostFunctor >
+bool NavAreaBuildHierarchicalPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL )
+{
+	if (startArea && goalArea)
+	{
+		TheNavAreaClusters.Update();
+
+		if (TheNavAreaClusters.BuildCorridor( startArea, goalArea ))
+		{
+			NavCorridorCost< CostFunctor > corridorCost( costFunc );
+			if (NavAreaBuildPath( startArea, goalArea, goalPos, corridorCost, closestArea ))
+				return true;
+		}
+	}
+
+	return NavAreaBuildPath( startArea, goalArea, goalPos, costFunc, closestArea );
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Compute distance between two areas. Return -1 if can't reach 'endArea' from 'startArea'.
@@ -1030,6 +1468,8 @@ void SearchSurroundingAreas( CNavArea *startArea, const Vector *startPos, Functo
 	if (startArea == NULL || startPos == NULL)
 		return;
 
+	TheNavCompactMesh.Update();
+
 	CNavArea::MakeNewMarker();
 	CNavArea::ClearSearchLists();
 
@@ -1047,16 +1487,14 @@ void SearchSurroundingAreas( CNavArea *startArea, const Vector *startPos, Functo
 		// invoke functor on area
 		if (func( area ))
 		{
-			// explore adjacent floor areas
-			for( int dir=0; dir<NUM_DIRECTIONS; ++dir )
+			// explore adjacent floor areas - the adjacency of all directions is contiguous
+			unsigned int areaIndex = area->GetCompactIndex();
+			const unsigned int *adjEnd = TheNavCompactMesh.GetAdjacentEnd( areaIndex, NUM_DIRECTIONS-1 );
+			for( const unsigned int *adj = TheNavCompactMesh.GetAdjacentBegin( areaIndex, NORTH ); adj != adjEnd; ++adj )
 			{
-				int count = area->GetAdjacentCount( (NavDirType)dir );
-				for( int i=0; i<count; ++i )
-				{
-					CNavArea *adjArea = area->GetAdjacentArea( (NavDirType)dir, i );
-					
-					AddAreaToOpenList( adjArea, area, startPos, maxRange );
-				}
+				CNavArea *adjArea = TheNavCompactMesh.GetNavArea( *adj );
+
+				AddAreaToOpenList( adjArea, area, startPos, maxRange );
 			}
 
 
@@ -1108,6 +1546,17 @@ void SearchSurroundingAreas( CNavArea *startArea, const Vector *startPos, Functo
 template < typename Functor >
 void ForAllAreas( Functor &func )
 {
+	if (TheNavCompactMesh.IsValid())
+	{
+		// walk the contiguous area array instead of the list
+		CNavArea * const *areaArray = TheNavCompactMesh.GetNavAreaArray();
+		unsigned int count = TheNavCompactMesh.GetAreaCount();
+		for( unsigned int i=0; i<count; ++i )
+			func( areaArray[i] );
+
+		return;
+	}
+
 	NavAreaList::iterator iter;
 	for( iter = TheNavAreaList.begin(); iter != TheNavAreaList.end(); ++iter )
 	{
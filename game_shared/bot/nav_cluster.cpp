@@ -0,0 +1,449 @@
+// nav_cluster.cpp
+// Clusters of navigation areas, for hierarchical pathfinding
+
+#pragma warning( disable : 4530 )					// STL uses exceptions, but we are not compiling with them - ignore warning
+#pragma warning( disable : 4786 )					// long STL names get truncated in browse info.
+
+#include <list>
+#include <vector>
+#include <map>
+#include <set>
+#include <queue>
+#include <algorithm>
+#include <math.h>
+
+#include "extdll.h"
+#include "util.h"
+#include "cbase.h"
+#include "bot_util.h"
+
+#include "nav.h"
+#include "nav_area.h"
+
+/**
+ * The singleton cluster abstraction of the mesh
+ */
+CNavAreaClusters TheNavAreaClusters;
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavAreaClusters::CNavAreaClusters( void )
+{
+	m_corridorMarker = 1;
+	m_searchMarker = 1;
+
+	Reset();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Discard all clusters
+ */
+void CNavAreaClusters::Reset( void )
+{
+	m_cluster.clear();
+	m_freeCluster.clear();
+	m_region.clear();
+	m_dirtyRegion.clear();
+
+	m_isBuilt = false;
+	m_needsScan = false;
+	m_corridorLength = 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the key of the region containing the given position
+ */
+inline unsigned int GetClusterRegion( const Vector *pos )
+{
+	int x = (int)floor( pos->x / NAV_CLUSTER_SIZE );
+	int y = (int)floor( pos->y / NAV_CLUSTER_SIZE );
+
+	return (unsigned int)(x & 0xFFFF) | ((unsigned int)(y & 0xFFFF) << 16);
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The given area is about to change, so its cluster must be rebuilt.
+ * New areas, and areas that move to another region, are found by the next Update().
+ */
+void CNavAreaClusters::MarkDirty( const CNavArea *area )
+{
+	if (!m_isBuilt)
+		return;
+
+	if (IsLiveCluster( area->m_clusterID ))
+		m_dirtyRegion.insert( m_cluster[ area->m_clusterID ].region );
+
+	m_needsScan = true;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Release the clusters of the given region.
+ * The areas of these clusters are not touched, since some of them may have been deleted.
+ */
+void CNavAreaClusters::FreeRegion( unsigned int region )
+{
+	std::map< unsigned int, std::vector<unsigned int> >::iterator iter = m_region.find( region );
+	if (iter == m_region.end())
+		return;
+
+	for( std::vector<unsigned int>::iterator citer = iter->second.begin(); citer != iter->second.end(); ++citer )
+	{
+		Cluster *cluster = &m_cluster[ *citer ];
+
+		cluster->isFree = true;
+		cluster->adjacent.clear();
+
+		m_freeCluster.push_back( *citer );
+	}
+
+	m_region.erase( iter );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the ID of a new, empty cluster in the given region
+ */
+unsigned int CNavAreaClusters::AllocateCluster( unsigned int region )
+{
+	unsigned int id;
+
+	if (m_freeCluster.empty())
+	{
+		id = m_cluster.size();
+		m_cluster.push_back( Cluster() );
+	}
+	else
+	{
+		id = m_freeCluster.back();
+		m_freeCluster.pop_back();
+	}
+
+	Cluster *cluster = &m_cluster[ id ];
+	cluster->region = region;
+	cluster->isFree = false;
+	cluster->center = Vector( 0, 0, 0 );
+	cluster->areaCount = 0;
+	cluster->adjacent.clear();
+	cluster->corridorMarker = 0;
+	cluster->searchMarker = 0;
+	cluster->isClosed = false;
+	cluster->costSoFar = 0.0f;
+	cluster->parent = NAV_INVALID_INDEX;
+
+	m_region[ region ].push_back( id );
+
+	return id;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Invoke the functor for each area reachable from the given area in one step, the same way
+ * NavAreaBuildPath() traverses the mesh
+ */
+template < typename Functor >
+void ForEachNeighborArea( CNavArea *area, const NavConnectList *connect, const NavLadderList *ladderUp, const NavLadderList *ladderDown, Functor &func )
+{
+	for( int d=0; d<NUM_DIRECTIONS; ++d )
+		for( NavConnectList::const_iterator iter = connect[d].begin(); iter != connect[d].end(); ++iter )
+			func( (*iter).area );
+
+	NavLadderList::const_iterator liter;
+	for( liter = ladderUp->begin(); liter != ladderUp->end(); ++liter )
+	{
+		const CNavLadder *ladder = *liter;
+
+		if (ladder->m_isDangling)
+			continue;
+
+		if (ladder->m_topForwardArea)
+			func( ladder->m_topForwardArea );
+		if (ladder->m_topLeftArea)
+			func( ladder->m_topLeftArea );
+		if (ladder->m_topRightArea)
+			func( ladder->m_topRightArea );
+	}
+
+	for( liter = ladderDown->begin(); liter != ladderDown->end(); ++liter )
+	{
+		if ((*liter)->m_bottomArea)
+			func( (*liter)->m_bottomArea );
+	}
+}
+
+/**
+ * Collects the unassigned neighbors of an area that lie in the region being clustered
+ */
+class CollectClusterNeighbors
+{
+public:
+	CollectClusterNeighbors( std::vector<CNavArea *> *open, unsigned int region ) : m_open( open ), m_region( region )
+	{
+	}
+
+	void operator() ( CNavArea *area )
+	{
+		// unassigned areas of the region being clustered are pending
+		if (area->GetClusterID() == NAV_INVALID_INDEX && GetClusterRegion( area->GetCenter() ) == m_region)
+			m_open->push_back( area );
+	}
+
+	std::vector<CNavArea *> *m_open;
+	unsigned int m_region;
+};
+
+/**
+ * Collects the clusters adjacent to an area
+ */
+class CollectAdjacentClusters
+{
+public:
+	CollectAdjacentClusters( std::vector<unsigned int> *adjacent, unsigned int clusterID ) : m_adjacent( adjacent ), m_clusterID( clusterID )
+	{
+	}
+
+	void operator() ( CNavArea *area )
+	{
+		if (area->GetClusterID() != m_clusterID && area->GetClusterID() != NAV_INVALID_INDEX)
+			m_adjacent->push_back( area->GetClusterID() );
+	}
+
+	std::vector<unsigned int> *m_adjacent;
+	unsigned int m_clusterID;
+};
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Rebuild the adjacency of all clusters.
+ * This is a single pass over the connections of the mesh, which is cheap compared to regrouping areas.
+ */
+void CNavAreaClusters::BuildAdjacency( void )
+{
+	unsigned int c;
+	for( c=0; c<m_cluster.size(); ++c )
+		m_cluster[c].adjacent.clear();
+
+	for( NavAreaList::iterator iter = TheNavAreaList.begin(); iter != TheNavAreaList.end(); ++iter )
+	{
+		CNavArea *area = *iter;
+
+		if (!IsLiveCluster( area->m_clusterID ))
+			continue;
+
+		CollectAdjacentClusters collect( &m_cluster[ area->m_clusterID ].adjacent, area->m_clusterID );
+		ForEachNeighborArea( area, area->m_connect, &area->m_ladder[ LADDER_UP ], &area->m_ladder[ LADDER_DOWN ], collect );
+	}
+
+	for( c=0; c<m_cluster.size(); ++c )
+	{
+		std::vector<unsigned int> *adjacent = &m_cluster[c].adjacent;
+
+		std::sort( adjacent->begin(), adjacent->end() );
+		adjacent->erase( std::unique( adjacent->begin(), adjacent->end() ), adjacent->end() );
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Rebuild the clusters of regions that have changed, or all of them if the mesh has been replaced
+ */
+void CNavAreaClusters::Update( void )
+{
+	if (!m_isBuilt)
+	{
+		Reset();
+
+		for( NavAreaList::iterator iter = TheNavAreaList.begin(); iter != TheNavAreaList.end(); ++iter )
+			(*iter)->m_clusterID = NAV_INVALID_INDEX;
+
+		m_isBuilt = true;
+		m_needsScan = true;
+	}
+
+	if (m_dirtyRegion.empty() && !m_needsScan)
+		return;
+
+	NavAreaList::iterator iter;
+
+	//
+	// Release the clusters of the dirty regions. An area whose cluster is released, or that has no
+	// cluster yet, makes the region its center is now in dirty as well. Repeat until no more
+	// regions are affected.
+	//
+	std::set<unsigned int> rebuiltRegions;
+
+	while( !m_dirtyRegion.empty() )
+	{
+		std::set<unsigned int>::iterator riter;
+		for( riter = m_dirtyRegion.begin(); riter != m_dirtyRegion.end(); ++riter )
+		{
+			FreeRegion( *riter );
+			rebuiltRegions.insert( *riter );
+		}
+		m_dirtyRegion.clear();
+
+		for( iter = TheNavAreaList.begin(); iter != TheNavAreaList.end(); ++iter )
+		{
+			CNavArea *area = *iter;
+
+			if (IsLiveCluster( area->m_clusterID ))
+				continue;
+
+			unsigned int region = GetClusterRegion( area->GetCenter() );
+			if (rebuiltRegions.find( region ) == rebuiltRegions.end())
+				m_dirtyRegion.insert( region );
+		}
+	}
+
+	//
+	// Gather the areas to be clustered, by region
+	//
+	std::map< unsigned int, std::vector<CNavArea *> > pending;
+
+	for( iter = TheNavAreaList.begin(); iter != TheNavAreaList.end(); ++iter )
+	{
+		CNavArea *area = *iter;
+
+		if (IsLiveCluster( area->m_clusterID ))
+			continue;
+
+		area->m_clusterID = NAV_INVALID_INDEX;
+		pending[ GetClusterRegion( area->GetCenter() ) ].push_back( area );
+	}
+
+	//
+	// Group the areas of each region into clusters of connected areas
+	//
+	std::vector<CNavArea *> open;
+
+	for( std::map< unsigned int, std::vector<CNavArea *> >::iterator piter = pending.begin(); piter != pending.end(); ++piter )
+	{
+		unsigned int region = piter->first;
+		std::vector<CNavArea *> *areas = &piter->second;
+
+		for( std::vector<CNavArea *>::iterator aiter = areas->begin(); aiter != areas->end(); ++aiter )
+		{
+			CNavArea *seed = *aiter;
+
+			if (seed->m_clusterID != NAV_INVALID_INDEX)
+				continue;
+
+			unsigned int clusterID = AllocateCluster( region );
+			Cluster *cluster = &m_cluster[ clusterID ];
+
+			CollectClusterNeighbors collect( &open, region );
+
+			open.push_back( seed );
+
+			// flood fill the areas connected to the seed within the region
+			while( !open.empty() )
+			{
+				CNavArea *area = open.back();
+				open.pop_back();
+
+				// an area may be reached more than once before it is visited
+				if (area->m_clusterID != NAV_INVALID_INDEX)
+					continue;
+
+				area->m_clusterID = clusterID;
+
+				cluster->center = cluster->center + *area->GetCenter();
+				++cluster->areaCount;
+
+				ForEachNeighborArea( area, area->m_connect, &area->m_ladder[ LADDER_UP ], &area->m_ladder[ LADDER_DOWN ], collect );
+			}
+
+			cluster->center = cluster->center / (float)cluster->areaCount;
+		}
+	}
+
+	m_needsScan = false;
+
+	BuildAdjacency();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Search the cluster graph for the shortest way from the cluster of startArea to the cluster of goalArea,
+ * and mark the clusters on the way as the current corridor.
+ * Return false if there is no way between the clusters.
+ */
+bool CNavAreaClusters::BuildCorridor( const CNavArea *startArea, const CNavArea *goalArea )
+{
+	unsigned int start = startArea->m_clusterID;
+	unsigned int goal = goalArea->m_clusterID;
+
+	if (!IsLiveCluster( start ) || !IsLiveCluster( goal ))
+		return false;
+
+	++m_corridorMarker;
+	++m_searchMarker;
+	m_corridorLength = 0;
+
+	// open list of ( estimated total cost, cluster ) - entries made stale by cheaper costs are skipped when popped
+	typedef std::pair< float, unsigned int > OpenEntry;
+	std::priority_queue< OpenEntry, std::vector<OpenEntry>, std::greater<OpenEntry> > openList;
+
+	const Vector &goalCenter = m_cluster[ goal ].center;
+
+	Cluster *cluster = &m_cluster[ start ];
+	cluster->searchMarker = m_searchMarker;
+	cluster->isClosed = false;
+	cluster->costSoFar = 0.0f;
+	cluster->parent = NAV_INVALID_INDEX;
+	openList.push( OpenEntry( (cluster->center - goalCenter).Length(), start ) );
+
+	bool found = false;
+	while( !openList.empty() )
+	{
+		unsigned int id = openList.top().second;
+		openList.pop();
+
+		cluster = &m_cluster[ id ];
+		if (cluster->isClosed)
+			continue;
+
+		if (id == goal)
+		{
+			found = true;
+			break;
+		}
+
+		cluster->isClosed = true;
+
+		for( std::vector<unsigned int>::iterator iter = cluster->adjacent.begin(); iter != cluster->adjacent.end(); ++iter )
+		{
+			Cluster *adj = &m_cluster[ *iter ];
+
+			float costSoFar = cluster->costSoFar + (adj->center - cluster->center).Length();
+
+			if (adj->searchMarker == m_searchMarker)
+			{
+				if (adj->isClosed || adj->costSoFar <= costSoFar)
+					continue;
+			}
+
+			adj->searchMarker = m_searchMarker;
+			adj->isClosed = false;
+			adj->costSoFar = costSoFar;
+			adj->parent = id;
+
+			openList.push( OpenEntry( costSoFar + (adj->center - goalCenter).Length(), *iter ) );
+		}
+	}
+
+	if (!found)
+		return false;
+
+	// mark the corridor
+	for( unsigned int id = goal; id != NAV_INVALID_INDEX; id = m_cluster[ id ].parent )
+	{
+		m_cluster[ id ].corridorMarker = m_corridorMarker;
+		++m_corridorLength;
+	}
+
+	return true;
+}
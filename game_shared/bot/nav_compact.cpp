@@ -0,0 +1,475 @@
+// nav_compact.cpp
+// Compact, index-based copy of the navigation mesh
+
+#pragma warning( disable : 4530 )					// STL uses exceptions, but we are not compiling with them - ignore warning
+#pragma warning( disable : 4786 )					// long STL names get truncated in browse info.
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include "extdll.h"
+#include "util.h"
+#include "cbase.h"
+#include "bot_util.h"
+#include "perf_counter.h"
+
+#include "nav.h"
+#include "nav_area.h"
+
+/**
+ * The singleton compact mesh
+ */
+CNavCompactMesh TheNavCompactMesh;
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavCompactMesh::CNavCompactMesh( void )
+{
+	m_file = NULL;
+	Reset();
+}
+
+CNavCompactMesh::~CNavCompactMesh()
+{
+	Reset();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Discard all compact data
+ */
+void CNavCompactMesh::Reset( void )
+{
+	m_navArea.clear();
+	m_area.clear();
+	m_connectOffset.clear();
+	m_connect.clear();
+	m_hidingSpot.clear();
+	m_encounter.clear();
+	m_spotOrder.clear();
+	m_approach.clear();
+	m_ladder.clear();
+	m_ladderOffset.clear();
+	m_ladderRef.clear();
+
+	// release the nav file we were attached to
+	if (m_file)
+	{
+		delete m_file;
+		m_file = NULL;
+	}
+
+	UseOwnedData();
+
+	m_isValid = false;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Point the compact data at the arrays owned by the mesh
+ */
+void CNavCompactMesh::UseOwnedData( void )
+{
+	m_data.area = m_area.data();
+	m_data.areaCount = m_area.size();
+	m_data.connectOffset = m_connectOffset.data();
+	m_data.connect = m_connect.data();
+	m_data.connectCount = m_connect.size();
+	m_data.hidingSpot = m_hidingSpot.data();
+	m_data.hidingSpotCount = m_hidingSpot.size();
+	m_data.encounter = m_encounter.data();
+	m_data.encounterCount = m_encounter.size();
+	m_data.spotOrder = m_spotOrder.data();
+	m_data.spotOrderCount = m_spotOrder.size();
+	m_data.approach = m_approach.data();
+	m_data.approachCount = m_approach.size();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the compact index of the given area, or NAV_INVALID_INDEX if it has none.
+ * Only valid once indices have been assigned.
+ */
+unsigned int CNavCompactMesh::GetIndex( const CNavArea *area ) const
+{
+	if (area == NULL)
+		return NAV_INVALID_INDEX;
+
+	unsigned int index = area->m_compactIndex;
+	if (index >= m_navArea.size() || m_navArea[ index ] != area)
+		return NAV_INVALID_INDEX;
+
+	return index;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Areas are indexed in the order of TheNavAreaList
+ */
+void CNavCompactMesh::AssignIndices( void )
+{
+	m_navArea.clear();
+	m_navArea.reserve( TheNavAreaList.size() );
+
+	unsigned int index = 0;
+	for( NavAreaList::iterator iter = TheNavAreaList.begin(); iter != TheNavAreaList.end(); ++iter, ++index )
+	{
+		CNavArea *area = *iter;
+		area->m_compactIndex = index;
+		m_navArea.push_back( area );
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Build the compact ladder data from TheNavLadderList and the ladder lists of the areas.
+ * Ladders are compacted in the order of TheNavLadderList.
+ */
+void CNavCompactMesh::BuildLadders( void )
+{
+	m_ladder.clear();
+	m_ladderOffset.clear();
+	m_ladderRef.clear();
+
+	// the ladders each area refers to are compacted in the order of TheNavLadderList
+	std::map< const CNavLadder *, unsigned int > ladderIndexMap;
+	unsigned int ladderIndex = 0;
+	for( NavLadderList::iterator liter = TheNavLadderList.begin(); liter != TheNavLadderList.end(); ++liter, ++ladderIndex )
+	{
+		const CNavLadder *ladder = *liter;
+
+		NavCompactLadder compact;
+		compact.top = ladder->m_top;
+		compact.bottom = ladder->m_bottom;
+		compact.length = ladder->m_length;
+		compact.dir = ladder->m_dir;
+		compact.isDangling = ladder->m_isDangling;
+		compact.topForwardArea = GetIndex( ladder->m_topForwardArea );
+		compact.topLeftArea = GetIndex( ladder->m_topLeftArea );
+		compact.topRightArea = GetIndex( ladder->m_topRightArea );
+		compact.topBehindArea = GetIndex( ladder->m_topBehindArea );
+		compact.bottomArea = GetIndex( ladder->m_bottomArea );
+
+		m_ladder.push_back( compact );
+		ladderIndexMap[ ladder ] = ladderIndex;
+	}
+
+	m_ladderOffset.reserve( m_navArea.size() * NUM_LADDER_DIRECTIONS + 1 );
+
+	for( unsigned int index = 0; index < m_navArea.size(); ++index )
+	{
+		const CNavArea *area = m_navArea[ index ];
+
+		for( int l=0; l<NUM_LADDER_DIRECTIONS; ++l )
+		{
+			m_ladderOffset.push_back( m_ladderRef.size() );
+
+			for( NavLadderList::const_iterator liter = area->m_ladder[l].begin(); liter != area->m_ladder[l].end(); ++liter )
+			{
+				std::map< const CNavLadder *, unsigned int >::const_iterator found = ladderIndexMap.find( *liter );
+				if (found != ladderIndexMap.end())
+					m_ladderRef.push_back( found->second );
+			}
+		}
+	}
+
+	m_ladderOffset.push_back( m_ladderRef.size() );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Rebuild the compact data from TheNavAreaList.
+ * Areas are stored in list order, so indices are stable as long as the mesh is not edited.
+ */
+void CNavCompactMesh::Build( void )
+{
+	Reset();
+
+	unsigned int areaCount = TheNavAreaList.size();
+
+	m_area.reserve( areaCount );
+	m_connectOffset.reserve( areaCount * NUM_DIRECTIONS + 1 );
+
+	// assign indices first, so connections can be resolved in a single pass
+	AssignIndices();
+	BuildLadders();
+
+	unsigned int index;
+	for( index = 0; index < areaCount; ++index )
+	{
+		const CNavArea *area = m_navArea[ index ];
+
+		NavCompactArea compact;
+		compact.id = area->m_id;
+		compact.attributes = area->m_attributeFlags;
+		compact.place = area->m_place;
+		compact.extent = area->m_extent;
+		compact.neZ = area->m_neZ;
+		compact.swZ = area->m_swZ;
+		compact.center = area->m_center;
+
+		// adjacency, in direction order
+		for( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			m_connectOffset.push_back( m_connect.size() );
+
+			for( NavConnectList::const_iterator citer = area->m_connect[d].begin(); citer != area->m_connect[d].end(); ++citer )
+			{
+				// connections to areas that are not in the master list cannot be represented
+				unsigned int adjIndex = GetIndex( (*citer).area );
+				if (adjIndex != NAV_INVALID_INDEX)
+					m_connect.push_back( adjIndex );
+			}
+		}
+
+		// hiding spots of each area are stored together
+		compact.firstHidingSpot = m_hidingSpot.size();
+		for( HidingSpotList::const_iterator hiter = area->m_hidingSpotList.begin(); hiter != area->m_hidingSpotList.end(); ++hiter )
+		{
+			const HidingSpot *spot = *hiter;
+
+			NavCompactHidingSpot compactSpot;
+			compactSpot.pos = *spot->GetPosition();
+			compactSpot.id = spot->GetID();
+			compactSpot.flags = spot->GetFlags();
+
+			m_hidingSpot.push_back( compactSpot );
+		}
+		compact.hidingSpotCount = m_hidingSpot.size() - compact.firstHidingSpot;
+
+		// approach areas
+		compact.firstApproach = m_approach.size();
+		for( int a=0; a<area->m_approachCount; ++a )
+		{
+			const CNavArea::ApproachInfo *info = &area->m_approach[a];
+
+			NavCompactApproach approach;
+			approach.here = GetIndex( info->here.area );
+			approach.prev = GetIndex( info->prev.area );
+			approach.prevToHereHow = info->prevToHereHow;
+			approach.next = GetIndex( info->next.area );
+			approach.hereToNextHow = info->hereToNextHow;
+
+			m_approach.push_back( approach );
+		}
+		compact.approachCount = m_approach.size() - compact.firstApproach;
+
+		// encounters are resolved below, once all hiding spots have been compacted
+		compact.firstEncounter = 0;
+		compact.encounterCount = 0;
+
+		m_area.push_back( compact );
+	}
+
+	m_connectOffset.push_back( m_connect.size() );
+
+	// map hiding spot IDs to compact indices
+	std::vector<unsigned int> spotIndexByID;
+	for( unsigned int s=0; s<m_hidingSpot.size(); ++s )
+	{
+		unsigned int id = m_hidingSpot[s].id;
+		if (id >= spotIndexByID.size())
+			spotIndexByID.resize( id+1, NAV_INVALID_INDEX );
+
+		spotIndexByID[ id ] = s;
+	}
+
+	// spot encounters of each area, and the spot orders of each encounter, are stored together
+	for( index = 0; index < areaCount; ++index )
+	{
+		const CNavArea *area = m_navArea[ index ];
+		NavCompactArea *compact = &m_area[ index ];
+
+		compact->firstEncounter = m_encounter.size();
+
+		for( SpotEncounterList::const_iterator eiter = area->m_spotEncounterList.begin(); eiter != area->m_spotEncounterList.end(); ++eiter )
+		{
+			const SpotEncounter *e = &(*eiter);
+
+			NavCompactEncounter encounter;
+			encounter.from = GetIndex( e->from.area );
+			encounter.fromDir = e->fromDir;
+			encounter.to = GetIndex( e->to.area );
+			encounter.toDir = e->toDir;
+			encounter.path = e->path;
+			encounter.firstSpot = m_spotOrder.size();
+
+			for( SpotOrderList::const_iterator oiter = e->spotList.begin(); oiter != e->spotList.end(); ++oiter )
+			{
+				NavCompactSpotOrder order;
+				order.t = (*oiter).t;
+				order.spot = NAV_INVALID_INDEX;
+
+				// the spot may be NULL if the mesh has been edited but not re-analyzed
+				const HidingSpot *spot = (*oiter).spot;
+				if (spot && spot->GetID() < spotIndexByID.size())
+					order.spot = spotIndexByID[ spot->GetID() ];
+
+				m_spotOrder.push_back( order );
+			}
+
+			encounter.spotCount = m_spotOrder.size() - encounter.firstSpot;
+
+			m_encounter.push_back( encounter );
+		}
+
+		compact->encounterCount = m_encounter.size() - compact->firstEncounter;
+	}
+
+	UseOwnedData();
+
+	m_isValid = true;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Use the compact data loaded from a nav file in place, instead of building it.
+ * TheNavAreaList must hold the areas created from this data, in the same order.
+ * The mesh takes ownership of 'file', which is released by Reset().
+ */
+void CNavCompactMesh::Attach( CNavMappedFile *file, const NavCompactData *data )
+{
+	Reset();
+
+	m_file = file;
+	m_data = *data;
+
+	AssignIndices();
+	BuildLadders();
+
+	m_isValid = true;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return number of bytes used by the compact data
+ */
+unsigned int CNavCompactMesh::GetMemoryUsage( void ) const
+{
+	unsigned int bytes = sizeof(CNavCompactMesh);
+
+	bytes += m_data.areaCount * sizeof(NavCompactArea);
+	bytes += (m_data.areaCount * NUM_DIRECTIONS + 1) * sizeof(unsigned int);
+	bytes += m_data.connectCount * sizeof(unsigned int);
+	bytes += m_data.hidingSpotCount * sizeof(NavCompactHidingSpot);
+	bytes += m_data.encounterCount * sizeof(NavCompactEncounter);
+	bytes += m_data.spotOrderCount * sizeof(NavCompactSpotOrder);
+	bytes += m_data.approachCount * sizeof(NavCompactApproach);
+
+	bytes += m_navArea.capacity() * sizeof(CNavArea *);
+	bytes += m_ladder.capacity() * sizeof(NavCompactLadder);
+	bytes += m_ladderOffset.capacity() * sizeof(unsigned int);
+	bytes += m_ladderRef.capacity() * sizeof(unsigned int);
+
+	return bytes;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the approximate size of a std::list node holding a T (two links plus the value)
+ */
+template < typename T >
+inline unsigned int ListNodeSize( void )
+{
+	return 2 * sizeof(void *) + sizeof(T);
+}
+
+/**
+ * Compare the memory use and traversal time of the list-based and compact layouts of the current nav mesh.
+ * Heap allocator overhead is not included in the list layout size, so the real difference is larger.
+ */
+void CNavCompactMesh::ReportLayout( int repeatCount )
+{
+	if (TheNavAreaList.empty())
+	{
+		CONSOLE_ECHO( "No navigation mesh loaded.\n" );
+		return;
+	}
+
+	Update();
+
+	if (repeatCount <= 0)
+		repeatCount = 100;
+
+	//
+	// Memory
+	//
+	unsigned int listBytes = 0;
+	unsigned int connectCount = 0;
+
+	listBytes += TheNavAreaList.size() * (ListNodeSize<CNavArea *>() + sizeof(CNavArea));
+	listBytes += TheNavLadderList.size() * (ListNodeSize<CNavLadder *>() + sizeof(CNavLadder));
+	listBytes += TheHidingSpotList.size() * (ListNodeSize<HidingSpot *>() + sizeof(HidingSpot));
+
+	NavAreaList::iterator iter;
+	for( iter = TheNavAreaList.begin(); iter != TheNavAreaList.end(); ++iter )
+	{
+		const CNavArea *area = *iter;
+
+		for( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			connectCount += area->GetAdjacentCount( (NavDirType)d );
+			listBytes += area->GetAdjacentCount( (NavDirType)d ) * ListNodeSize<NavConnect>();
+		}
+
+		for( int l=0; l<NUM_LADDER_DIRECTIONS; ++l )
+			listBytes += area->GetLadderList( (LadderDirectionType)l )->size() * ListNodeSize<CNavLadder *>();
+
+		listBytes += area->GetHidingSpotList()->size() * ListNodeSize<HidingSpot *>();
+
+		for( SpotEncounterList::const_iterator eiter = area->m_spotEncounterList.begin(); eiter != area->m_spotEncounterList.end(); ++eiter )
+			listBytes += ListNodeSize<SpotEncounter>() + (*eiter).spotList.size() * ListNodeSize<SpotOrder>();
+	}
+
+	unsigned int compactBytes = GetMemoryUsage();
+
+	CONSOLE_ECHO( "Nav mesh layout: %d areas, %d connections, %d ladders, %d hiding spots, %d encounters\n",
+					GetAreaCount(), connectCount, GetLadderCount(), GetHidingSpotCount(), GetEncounterCount() );
+	CONSOLE_ECHO( "  List layout:    %u bytes (excluding allocator overhead)\n", listBytes );
+	CONSOLE_ECHO( "  Compact layout: %u bytes (plus the list layout, which is kept for editing)\n", compactBytes );
+
+	//
+	// Traversal latency - visit every connection of every area, as A* and ForAllAreas-style loops do
+	//
+	static CPerformanceCounter perfCounter;
+	float sum = 0.0f;
+
+	double startTime = perfCounter.GetCurTime();
+	for( int r=0; r<repeatCount; ++r )
+	{
+		for( iter = TheNavAreaList.begin(); iter != TheNavAreaList.end(); ++iter )
+		{
+			const CNavArea *area = *iter;
+
+			for( int d=0; d<NUM_DIRECTIONS; ++d )
+			{
+				const NavConnectList *list = area->GetAdjacentList( (NavDirType)d );
+				for( NavConnectList::const_iterator citer = list->begin(); citer != list->end(); ++citer )
+					sum += (*citer).area->GetCenter()->z;
+			}
+		}
+	}
+	double listTime = perfCounter.GetCurTime() - startTime;
+
+	startTime = perfCounter.GetCurTime();
+	unsigned int areaCount = GetAreaCount();
+	for( int r=0; r<repeatCount; ++r )
+	{
+		for( unsigned int i=0; i<areaCount; ++i )
+		{
+			const unsigned int *adjEnd = GetAdjacentEnd( i, NUM_DIRECTIONS-1 );
+			for( const unsigned int *adj = GetAdjacentBegin( i, NORTH ); adj != adjEnd; ++adj )
+				sum -= m_data.area[ *adj ].center.z;
+		}
+	}
+	double compactTime = perfCounter.GetCurTime() - startTime;
+
+	double visits = (double)repeatCount * (double)connectCount;
+	if (visits < 1.0)
+		visits = 1.0;
+
+	CONSOLE_ECHO( "  Traversing all connections %d times (checksum %g):\n", repeatCount, sum );
+	CONSOLE_ECHO( "  List layout:    %3.3f seconds, %3.1f ns per connection\n", listTime, 1.0e9 * listTime / visits );
+	CONSOLE_ECHO( "  Compact layout: %3.3f seconds, %3.1f ns per connection\n", compactTime, 1.0e9 * compactTime / visits );
+}
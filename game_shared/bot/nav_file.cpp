@@ -18,8 +18,10 @@
 
 #else
 #include <unistd.h>
+#include <sys/mman.h>
 #define _write write
 #define _close close
+#define _lseek lseek
 #define MAX_OSPATH PATH_MAX
 #endif
 
@@ -29,6 +31,10 @@
 #include "player.h"
 #include "gamerules.h"
 
+#ifdef _WIN32
+#include "PlatformHeaders.h"
+#endif
+
 #include "bot_util.h"
 
 /// @todo Abstract these out of here (TheBotPhrases)
@@ -159,6 +165,54 @@ public:
 		}
 	}
 
+	/// return the number of bytes Save() will write
+	unsigned int GetSaveSize( void ) const
+	{
+		unsigned int size = sizeof(EntryType);
+
+		std::vector<Place>::const_iterator it;
+		for( it = m_directory.begin(); it != m_directory.end(); ++it )
+			size += sizeof(unsigned short) + strlen( TheBotPhrases->IDToName( *it ) )+1;
+
+		return size;
+	}
+
+	/// load the directory from memory, as stored by Save()
+	bool Load( const byte *data, unsigned int size )
+	{
+		const byte *end = data + size;
+
+		// read number of entries
+		EntryType count;
+		if (data + sizeof(EntryType) > end)
+			return false;
+		memcpy( &count, data, sizeof(EntryType) );
+		data += sizeof(EntryType);
+
+		m_directory.reserve( count );
+
+		// read each entry
+		char placeName[256];
+		unsigned short len;
+		for( int i=0; i<count; ++i )
+		{
+			if (data + sizeof(unsigned short) > end)
+				return false;
+			memcpy( &len, data, sizeof(unsigned short) );
+			data += sizeof(unsigned short);
+
+			if (len == 0 || len > sizeof(placeName) || data + len > end)
+				return false;
+			memcpy( placeName, data, len );
+			placeName[ len-1 ] = '\0';
+			data += len;
+
+			AddPlace( TheBotPhrases->NameToID( placeName ) );
+		}
+
+		return true;
+	}
+
 private:
 	std::vector<Place> m_directory;
 };
@@ -669,6 +723,134 @@ NavErrorType CNavArea::PostLoad( void )
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Load a navigation area from the compact data of a nav file.
+ * The hiding spots of all areas must already have been created, in the order of the compact data.
+ */
+void CNavArea::Load( const NavCompactData *data, unsigned int index, HidingSpot * const *spotTable )
+{
+	const NavCompactArea *compact = &data->area[ index ];
+
+	m_id = compact->id;
+	m_compactIndex = index;
+
+	// update nextID to avoid collisions
+	if (m_id >= m_nextID)
+		m_nextID = m_id+1;
+
+	m_attributeFlags = (unsigned char)compact->attributes;
+	m_extent = compact->extent;
+	m_center = compact->center;
+	m_neZ = compact->neZ;
+	m_swZ = compact->swZ;
+
+	// the place was converted from a directory entry when the file was loaded
+	SetPlace( compact->place );
+
+	for( unsigned int h=0; h<compact->hidingSpotCount; ++h )
+		m_hidingSpotList.push_back( spotTable[ compact->firstHidingSpot + h ] );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Convert the indices of the compact data to pointers.
+ * Unlike the IDs of older nav files, indices are resolved directly and encounter paths are stored,
+ * so no searching or portal computation is needed.
+ * Make sure all indices are converted, even if corrupt data is encountered.
+ */
+NavErrorType CNavArea::PostLoad( const NavCompactData *data, CNavArea * const *areaTable, HidingSpot * const *spotTable )
+{
+	NavErrorType error = NAV_OK;
+
+	const NavCompactArea *compact = &data->area[ m_compactIndex ];
+
+	// connect areas together
+	for( int d=0; d<NUM_DIRECTIONS; d++ )
+	{
+		unsigned int begin = data->connectOffset[ m_compactIndex * NUM_DIRECTIONS + d ];
+		unsigned int end = data->connectOffset[ m_compactIndex * NUM_DIRECTIONS + d + 1 ];
+
+		for( unsigned int c=begin; c<end; ++c )
+		{
+			if (data->connect[c] >= data->areaCount)
+			{
+				CONSOLE_ECHO( "ERROR: Corrupt navigation data. Cannot connect Navigation Areas.\n" );
+				error = NAV_CORRUPT_DATA;
+				continue;
+			}
+
+			NavConnect connect;
+			connect.area = areaTable[ data->connect[c] ];
+			m_connect[d].push_back( connect );
+		}
+	}
+
+	// resolve approach area indices
+	m_approachCount = 0;
+	for( unsigned int a=0; a<compact->approachCount && a<MAX_APPROACH_AREAS; ++a )
+	{
+		const NavCompactApproach *approach = &data->approach[ compact->firstApproach + a ];
+
+		if ((approach->here != NAV_INVALID_INDEX && approach->here >= data->areaCount) ||
+			(approach->prev != NAV_INVALID_INDEX && approach->prev >= data->areaCount) ||
+			(approach->next != NAV_INVALID_INDEX && approach->next >= data->areaCount))
+		{
+			CONSOLE_ECHO( "ERROR: Corrupt navigation data. Missing Approach Area.\n" );
+			error = NAV_CORRUPT_DATA;
+			continue;
+		}
+
+		ApproachInfo *info = &m_approach[ m_approachCount++ ];
+		info->here.area = (approach->here == NAV_INVALID_INDEX) ? NULL : areaTable[ approach->here ];
+		info->prev.area = (approach->prev == NAV_INVALID_INDEX) ? NULL : areaTable[ approach->prev ];
+		info->prevToHereHow = (NavTraverseType)approach->prevToHereHow;
+		info->next.area = (approach->next == NAV_INVALID_INDEX) ? NULL : areaTable[ approach->next ];
+		info->hereToNextHow = (NavTraverseType)approach->hereToNextHow;
+	}
+
+	// resolve spot encounter indices
+	for( unsigned int e=0; e<compact->encounterCount; ++e )
+	{
+		const NavCompactEncounter *compactEncounter = &data->encounter[ compact->firstEncounter + e ];
+
+		if (compactEncounter->from >= data->areaCount || compactEncounter->to >= data->areaCount)
+		{
+			CONSOLE_ECHO( "ERROR: Corrupt navigation data. Missing Navigation Area for Encounter Spot.\n" );
+			error = NAV_CORRUPT_DATA;
+			continue;
+		}
+
+		SpotEncounter encounter;
+		encounter.from.area = areaTable[ compactEncounter->from ];
+		encounter.fromDir = (NavDirType)compactEncounter->fromDir;
+		encounter.to.area = areaTable[ compactEncounter->to ];
+		encounter.toDir = (NavDirType)compactEncounter->toDir;
+		encounter.path = compactEncounter->path;
+
+		// resolve HidingSpot indices
+		for( unsigned int o=0; o<compactEncounter->spotCount; ++o )
+		{
+			const NavCompactSpotOrder *compactOrder = &data->spotOrder[ compactEncounter->firstSpot + o ];
+
+			// spots may be missing if the mesh was edited but not re-analyzed before it was saved
+			SpotOrder order;
+			order.t = compactOrder->t;
+			order.spot = (compactOrder->spot < data->hidingSpotCount) ? spotTable[ compactOrder->spot ] : NULL;
+
+			encounter.spotList.push_back( order );
+		}
+
+		m_spotEncounterList.push_back( encounter );
+	}
+
+	// build overlap list
+	TheNavAreaGrid.GetOverlappingAreas( this, &m_overlapList );
+
+	return error;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /*
 ============
@@ -696,29 +878,222 @@ inline void COM_FixSlashes( char *pname )
 #endif
 }
 
+//--------------------------------------------------------------------------------------------------------------
+CNavMappedFile::CNavMappedFile( void )
+{
+	m_data = NULL;
+	m_size = 0;
+	m_isMapped = false;
+
+#ifdef _WIN32
+	m_fileHandle = INVALID_HANDLE_VALUE;
+	m_mappingHandle = NULL;
+#endif
+}
+
+CNavMappedFile::~CNavMappedFile()
+{
+	Close();
+}
+
 /**
- * Store AI navigation data to a file
+ * Map the given game directory relative file into memory.
+ * If the file cannot be mapped, fall back to reading it through the engine.
  */
-bool SaveNavigationMap( const char *filename )
+bool CNavMappedFile::Open( const char *filename )
 {
-	if (filename == NULL)
-		return false;
+	Close();
 
-	//
-	// Store the NAV file
-	//
-	COM_FixSlashes( const_cast<char *>(filename) );
+	char gameDir[ MAX_OSPATH ];
+	GET_GAME_DIR( gameDir );
 
-#ifdef WIN32
-	int fd = _open( filename, _O_BINARY | _O_CREAT | _O_WRONLY, _S_IREAD | _S_IWRITE );
+	char path[ MAX_OSPATH ];
+	snprintf( path, sizeof(path), "%s/%s", gameDir, filename );
+	COM_FixSlashes( path );
+
+#ifdef _WIN32
+	m_fileHandle = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if (m_fileHandle != INVALID_HANDLE_VALUE)
+	{
+		m_size = GetFileSize( m_fileHandle, NULL );
+
+		// copy-on-write, so the data can be fixed up in place
+		m_mappingHandle = CreateFileMappingA( m_fileHandle, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+		if (m_mappingHandle)
+			m_data = (byte *)MapViewOfFile( m_mappingHandle, FILE_MAP_COPY, 0, 0, 0 );
+
+		if (m_data)
+		{
+			m_isMapped = true;
+			return true;
+		}
+
+		Close();
+	}
 #else
-#define _write write
-	int fd = creat( filename, S_IRUSR | S_IWUSR | S_IRGRP );
+	int fd = open( path, O_RDONLY );
+	if (fd >= 0)
+	{
+		struct stat info;
+		if (fstat( fd, &info ) == 0 && info.st_size > 0)
+		{
+			// private mapping, so the data can be fixed up in place
+			void *data = mmap( NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+			if (data != MAP_FAILED)
+			{
+				m_data = (byte *)data;
+				m_size = info.st_size;
+				m_isMapped = true;
+			}
+		}
+
+		// the mapping remains valid after the descriptor is closed
+		_close( fd );
+
+		if (m_isMapped)
+			return true;
+	}
 #endif
 
-	if (fd < 0)
+	// the file may be inside a pak or elsewhere in the search path
+	int length = 0;
+	m_data = (byte *)LOAD_FILE_FOR_ME( const_cast<char *>( filename ), &length );
+	if (m_data == NULL)
 		return false;
 
+	m_size = length;
+	m_isMapped = false;
+
+	return true;
+}
+
+/**
+ * Unmap or free the file data
+ */
+void CNavMappedFile::Close( void )
+{
+	if (m_data)
+	{
+		if (m_isMapped)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile( m_data );
+#else
+			munmap( m_data, m_size );
+#endif
+		}
+		else
+		{
+			FREE_FILE( m_data );
+		}
+	}
+
+#ifdef _WIN32
+	if (m_mappingHandle)
+		CloseHandle( m_mappingHandle );
+
+	if (m_fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle( m_fileHandle );
+
+	m_fileHandle = INVALID_HANDLE_VALUE;
+	m_mappingHandle = NULL;
+#endif
+
+	m_data = NULL;
+	m_size = 0;
+	m_isMapped = false;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Write 'count' records of the given size as the given lump of a compact nav file, padded to 4 bytes.
+ * 'offset' is the current write position, and is advanced past the lump.
+ */
+static void WriteNavLump( int fd, NavCompactFileHeader *header, NavCompactLumpType type, const void *data, unsigned int count, unsigned int recordSize, unsigned int *offset )
+{
+	header->lump[ type ].offset = *offset;
+	header->lump[ type ].count = count;
+	header->lump[ type ].recordSize = recordSize;
+
+	unsigned int size = count * recordSize;
+	if (size)
+		_write( fd, data, size );
+
+	const unsigned int zero = 0;
+	unsigned int pad = (4 - (size & 3)) & 3;
+	if (pad)
+		_write( fd, &zero, pad );
+
+	*offset += size + pad;
+}
+
+/**
+ * Store the navigation mesh as a compact nav file, which can be mapped and used in place when loaded.
+ * The header is written first with empty lumps, and rewritten once the lump offsets are known.
+ */
+static void SaveCompactNavigationMap( int fd, unsigned int bspSize )
+{
+	TheNavCompactMesh.Build();
+
+	const NavCompactData *data = TheNavCompactMesh.GetData();
+
+	NavCompactFileHeader header;
+	memset( &header, 0, sizeof(NavCompactFileHeader) );
+	header.magic = NAV_MAGIC_NUMBER;
+	header.version = NAV_COMPACT_VERSION;
+	header.bspSize = bspSize;
+	header.headerSize = sizeof(NavCompactFileHeader);
+
+	_write( fd, &header, sizeof(NavCompactFileHeader) );
+
+	unsigned int offset = sizeof(NavCompactFileHeader);
+
+	// the place directory is stored as in legacy nav files, one byte per "record"
+	unsigned int placeSize = placeDirectory.GetSaveSize();
+	header.lump[ NAV_LUMP_PLACES ].offset = offset;
+	header.lump[ NAV_LUMP_PLACES ].count = placeSize;
+	header.lump[ NAV_LUMP_PLACES ].recordSize = 1;
+	placeDirectory.Save( fd );
+
+	// pad the directory so the following lumps are aligned
+	const unsigned int zero = 0;
+	unsigned int pad = (4 - (placeSize & 3)) & 3;
+	if (pad)
+		_write( fd, &zero, pad );
+	offset += placeSize + pad;
+
+	// areas store their place as a directory entry, so the file does not depend on the order of place IDs
+	header.lump[ NAV_LUMP_AREAS ].offset = offset;
+	header.lump[ NAV_LUMP_AREAS ].count = data->areaCount;
+	header.lump[ NAV_LUMP_AREAS ].recordSize = sizeof(NavCompactArea);
+	for( unsigned int i=0; i<data->areaCount; ++i )
+	{
+		NavCompactArea area = data->area[i];
+		area.place = placeDirectory.GetEntry( area.place );
+		_write( fd, &area, sizeof(NavCompactArea) );
+	}
+	offset += data->areaCount * sizeof(NavCompactArea);
+
+	WriteNavLump( fd, &header, NAV_LUMP_CONNECT_OFFSETS, data->connectOffset, data->areaCount * NUM_DIRECTIONS + 1, sizeof(unsigned int), &offset );
+	WriteNavLump( fd, &header, NAV_LUMP_CONNECTS, data->connect, data->connectCount, sizeof(unsigned int), &offset );
+	WriteNavLump( fd, &header, NAV_LUMP_HIDING_SPOTS, data->hidingSpot, data->hidingSpotCount, sizeof(NavCompactHidingSpot), &offset );
+	WriteNavLump( fd, &header, NAV_LUMP_ENCOUNTERS, data->encounter, data->encounterCount, sizeof(NavCompactEncounter), &offset );
+	WriteNavLump( fd, &header, NAV_LUMP_SPOT_ORDERS, data->spotOrder, data->spotOrderCount, sizeof(NavCompactSpotOrder), &offset );
+	WriteNavLump( fd, &header, NAV_LUMP_APPROACHES, data->approach, data->approachCount, sizeof(NavCompactApproach), &offset );
+
+	// now that the lumps are known, store the header again
+	_lseek( fd, 0, SEEK_SET );
+	_write( fd, &header, sizeof(NavCompactFileHeader) );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Store the navigation mesh in the version 5 nav file layout, readable by older builds
+ */
+static void SaveLegacyNavigationMap( int fd, unsigned int bspSize )
+{
 	// store "magic number" to help identify this kind of file
 	unsigned int magic = NAV_MAGIC_NUMBER;
 	_write( fd, &magic, sizeof(unsigned int) );
@@ -730,9 +1105,48 @@ bool SaveNavigationMap( const char *filename )
 	// 4 = Includes size of source bsp file to verify nav data correlation
 	// ---- Beta Release at V4 -----
 	// 5 = Added Place info
+	// 6 = Compact memory-mappable layout (NAV_COMPACT_VERSION), see SaveCompactNavigationMap()
 	unsigned int version = 5;
 	_write( fd, &version, sizeof(unsigned int) );
 
+	_write( fd, &bspSize, sizeof(unsigned int) );
+
+	placeDirectory.Save( fd );
+
+
+	//
+	// Store navigation areas
+	//
+
+	// store number of areas
+	unsigned int count = TheNavAreaList.size();
+	_write( fd, &count, sizeof(unsigned int) );
+
+	// store each area
+	for( NavAreaList::iterator it = TheNavAreaList.begin(); it != TheNavAreaList.end(); ++it )
+	{
+		CNavArea *area = *it;
+
+		area->Save( fd, version );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Store AI navigation data to a file.
+ * If 'compactFormat' is true, the file is written in the compact, memory-mappable layout,
+ * otherwise in the original layout that older builds can still read.
+ */
+bool SaveNavigationMap( const char *filename, bool compactFormat )
+{
+	if (filename == NULL)
+		return false;
+
+	//
+	// Store the NAV file
+	//
+	COM_FixSlashes( const_cast<char *>(filename) );
 
 	// get size of source bsp file and store it in the nav file
 	// so we can test if the bsp changed since the nav file was made
@@ -743,7 +1157,15 @@ bool SaveNavigationMap( const char *filename )
 	unsigned int bspSize = (unsigned int)GET_FILE_SIZE( bspFilename );
 	CONSOLE_ECHO( "Size of bsp file '%s' is %u bytes.\n", bspFilename, bspSize );
 
-	_write( fd, &bspSize, sizeof(unsigned int) );
+#ifdef WIN32
+	int fd = _open( filename, _O_BINARY | _O_CREAT | _O_TRUNC | _O_WRONLY, _S_IREAD | _S_IWRITE );
+#else
+#define _write write
+	int fd = creat( filename, S_IRUSR | S_IWUSR | S_IRGRP );
+#endif
+
+	if (fd < 0)
+		return false;
 
 
 	//
@@ -764,24 +1186,10 @@ bool SaveNavigationMap( const char *filename )
 		}
 	}
 
-	placeDirectory.Save( fd );
-
-
-	//
-	// Store navigation areas
-	//
-
-	// store number of areas
-	unsigned int count = TheNavAreaList.size();
-	_write( fd, &count, sizeof(unsigned int) );
-
-	// store each area
-	for( it = TheNavAreaList.begin(); it != TheNavAreaList.end(); ++it )
-	{
-		CNavArea *area = *it;
-
-		area->Save( fd, version );
-	}
+	if (compactFormat)
+		SaveCompactNavigationMap( fd, bspSize );
+	else
+		SaveLegacyNavigationMap( fd, bspSize );
 
 	_close( fd );
 
@@ -909,7 +1317,7 @@ void SanityCheckNavigationMap( const char *mapName )
 	// read file version number
 	unsigned int version;
 	result = navFile.Read( &version, sizeof(unsigned int) );
-	if (!result || version > 5)
+	if (!result || version > NAV_COMPACT_VERSION)
 	{
 		CONSOLE_ECHO( "ERROR: Unknown version in navigation file %s.\n", navFilename );
 		return;
@@ -940,6 +1348,253 @@ void SanityCheckNavigationMap( const char *mapName )
 	CONSOLE_ECHO( "navigation file %s passes the sanity check.\n", navFilename );
 }
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Warn if the bsp file has changed since the nav file was made.
+ * Return false if there is no bsp file for the given nav file.
+ */
+static bool CheckNavBspSize( const char *filename, unsigned int saveBspSize )
+{
+	// verify size
+	char *bspFilename = GetBspFilename( filename );
+	if (bspFilename == NULL)
+		return false;
+
+	unsigned int bspSize = (unsigned int)GET_FILE_SIZE( bspFilename );
+
+	if (bspSize != saveBspSize)
+	{
+		// this nav file is out of date for this bsp file
+		char *msg = "*** WARNING ***\nThe AI navigation data is from a different version of this map.\nThe CPU players will likely not perform well.\n";
+		HintMessageToAllPlayers( msg );
+		CONSOLE_ECHO( "\n-----------------\n" );
+		CONSOLE_ECHO( msg );
+		CONSOLE_ECHO( "-----------------\n\n" );
+	}
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return true if the index ranges and area indices of the compact data are consistent, so the data can be
+ * traversed safely. The mesh is traversed from the file data directly, so every area index is checked here.
+ * Hiding spot indices may be missing (see CNavArea::PostLoad()), and are checked as they are resolved.
+ */
+static bool IsValidCompactData( const NavCompactData *data )
+{
+	unsigned int offsetCount = data->areaCount * NUM_DIRECTIONS + 1;
+
+	if (data->connectOffset[0] != 0)
+		return false;
+
+	for( unsigned int o=1; o<offsetCount; ++o )
+		if (data->connectOffset[o] < data->connectOffset[o-1] || data->connectOffset[o] > data->connectCount)
+			return false;
+
+	for( unsigned int c=0; c<data->connectCount; ++c )
+		if (data->connect[c] >= data->areaCount)
+			return false;
+
+	for( unsigned int i=0; i<data->areaCount; ++i )
+	{
+		const NavCompactArea *area = &data->area[i];
+
+		if (area->firstHidingSpot > data->hidingSpotCount || area->hidingSpotCount > data->hidingSpotCount - area->firstHidingSpot)
+			return false;
+
+		if (area->firstApproach > data->approachCount || area->approachCount > data->approachCount - area->firstApproach)
+			return false;
+
+		if (area->firstEncounter > data->encounterCount || area->encounterCount > data->encounterCount - area->firstEncounter)
+			return false;
+	}
+
+	for( unsigned int e=0; e<data->encounterCount; ++e )
+	{
+		const NavCompactEncounter *encounter = &data->encounter[e];
+
+		if (encounter->firstSpot > data->spotOrderCount || encounter->spotCount > data->spotOrderCount - encounter->firstSpot)
+			return false;
+
+		if (encounter->from >= data->areaCount || encounter->to >= data->areaCount)
+			return false;
+	}
+
+	for( unsigned int a=0; a<data->approachCount; ++a )
+	{
+		const NavCompactApproach *approach = &data->approach[a];
+
+		if ((approach->here != NAV_INVALID_INDEX && approach->here >= data->areaCount) ||
+			(approach->prev != NAV_INVALID_INDEX && approach->prev >= data->areaCount) ||
+			(approach->next != NAV_INVALID_INDEX && approach->next >= data->areaCount))
+			return false;
+	}
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Load a compact nav file, using its data in place.
+ * The CNavAreas are created from the mapped records, and the file is then attached to TheNavCompactMesh,
+ * which takes ownership of it.
+ */
+static NavErrorType LoadCompactNavigationMap( const char *filename, CNavMappedFile *file )
+{
+	byte *base = file->GetData();
+	unsigned int size = file->GetSize();
+	const NavCompactFileHeader *header = reinterpret_cast<const NavCompactFileHeader *>( base );
+
+	if (size < sizeof(NavCompactFileHeader) || header->headerSize != sizeof(NavCompactFileHeader))
+	{
+		CONSOLE_ECHO( "ERROR: Invalid navigation file '%s'.\n", filename );
+		delete file;
+		return NAV_INVALID_FILE;
+	}
+
+	// a different record size means the file was written with a different layout
+	static const unsigned int recordSize[ NUM_NAV_LUMPS ] =
+	{
+		1,
+		sizeof(NavCompactArea),
+		sizeof(unsigned int),
+		sizeof(unsigned int),
+		sizeof(NavCompactHidingSpot),
+		sizeof(NavCompactEncounter),
+		sizeof(NavCompactSpotOrder),
+		sizeof(NavCompactApproach)
+	};
+
+	for( int l=0; l<NUM_NAV_LUMPS; ++l )
+	{
+		const NavCompactLump *lump = &header->lump[l];
+
+		if (lump->recordSize != recordSize[l] || (lump->offset & 3) || lump->offset > size || lump->count > (size - lump->offset) / recordSize[l])
+		{
+			CONSOLE_ECHO( "ERROR: Corrupt navigation data. Bad lump #%d in '%s'.\n", l, filename );
+			delete file;
+			return NAV_CORRUPT_DATA;
+		}
+	}
+
+	NavCompactData data;
+	data.area = reinterpret_cast<const NavCompactArea *>( base + header->lump[ NAV_LUMP_AREAS ].offset );
+	data.areaCount = header->lump[ NAV_LUMP_AREAS ].count;
+	data.connectOffset = reinterpret_cast<const unsigned int *>( base + header->lump[ NAV_LUMP_CONNECT_OFFSETS ].offset );
+	data.connect = reinterpret_cast<const unsigned int *>( base + header->lump[ NAV_LUMP_CONNECTS ].offset );
+	data.connectCount = header->lump[ NAV_LUMP_CONNECTS ].count;
+	data.hidingSpot = reinterpret_cast<const NavCompactHidingSpot *>( base + header->lump[ NAV_LUMP_HIDING_SPOTS ].offset );
+	data.hidingSpotCount = header->lump[ NAV_LUMP_HIDING_SPOTS ].count;
+	data.encounter = reinterpret_cast<const NavCompactEncounter *>( base + header->lump[ NAV_LUMP_ENCOUNTERS ].offset );
+	data.encounterCount = header->lump[ NAV_LUMP_ENCOUNTERS ].count;
+	data.spotOrder = reinterpret_cast<const NavCompactSpotOrder *>( base + header->lump[ NAV_LUMP_SPOT_ORDERS ].offset );
+	data.spotOrderCount = header->lump[ NAV_LUMP_SPOT_ORDERS ].count;
+	data.approach = reinterpret_cast<const NavCompactApproach *>( base + header->lump[ NAV_LUMP_APPROACHES ].offset );
+	data.approachCount = header->lump[ NAV_LUMP_APPROACHES ].count;
+
+	if (header->lump[ NAV_LUMP_CONNECT_OFFSETS ].count != data.areaCount * NUM_DIRECTIONS + 1 || !IsValidCompactData( &data ))
+	{
+		CONSOLE_ECHO( "ERROR: Corrupt navigation data in '%s'.\n", filename );
+		delete file;
+		return NAV_CORRUPT_DATA;
+	}
+
+	if (!CheckNavBspSize( filename, header->bspSize ))
+	{
+		delete file;
+		return NAV_INVALID_FILE;
+	}
+
+	// load Place directory
+	if (!placeDirectory.Load( base + header->lump[ NAV_LUMP_PLACES ].offset, header->lump[ NAV_LUMP_PLACES ].count ))
+	{
+		CONSOLE_ECHO( "ERROR: Corrupt navigation data. Bad place directory in '%s'.\n", filename );
+		delete file;
+		return NAV_CORRUPT_DATA;
+	}
+
+	// convert place directory entries to actual Places - the mapping is private, so this does not change the file
+	NavCompactArea *mutableArea = reinterpret_cast<NavCompactArea *>( base + header->lump[ NAV_LUMP_AREAS ].offset );
+	unsigned int i;
+	for( i=0; i<data.areaCount; ++i )
+		mutableArea[i].place = placeDirectory.EntryToPlace( (PlaceDirectory::EntryType)mutableArea[i].place );
+
+	// create the hiding spots in the order they are referenced by index
+	std::vector<HidingSpot *> spotTable( data.hidingSpotCount );
+	for( i=0; i<data.hidingSpotCount; ++i )
+	{
+		HidingSpot *spot = new HidingSpot;
+		spot->Load( &data.hidingSpot[i] );
+		spotTable[i] = spot;
+	}
+
+	Extent extent;
+	extent.lo.x = 9999999999.9f;
+	extent.lo.y = 9999999999.9f;
+	extent.hi.x = -9999999999.9f;
+	extent.hi.y = -9999999999.9f;
+
+	// load the areas and compute total extent
+	std::vector<CNavArea *> areaTable( data.areaCount );
+	for( i=0; i<data.areaCount; ++i )
+	{
+		CNavArea *area = new CNavArea;
+		area->Load( &data, i, (spotTable.empty()) ? NULL : &spotTable[0] );
+		TheNavAreaList.push_back( area );
+		areaTable[i] = area;
+
+		const Extent *areaExtent = area->GetExtent();
+
+		// check validity of nav area
+		if (areaExtent->lo.x >= areaExtent->hi.x || areaExtent->lo.y >= areaExtent->hi.y)
+			CONSOLE_ECHO( "WARNING: Degenerate Navigation Area #%d at ( %g, %g, %g )\n", 
+											area->GetID(), area->GetCenter()->x, area->GetCenter()->y, area->GetCenter()->z );
+
+		if (areaExtent->lo.x < extent.lo.x)
+			extent.lo.x = areaExtent->lo.x;
+		if (areaExtent->lo.y < extent.lo.y)
+			extent.lo.y = areaExtent->lo.y;
+		if (areaExtent->hi.x > extent.hi.x)
+			extent.hi.x = areaExtent->hi.x;
+		if (areaExtent->hi.y > extent.hi.y)
+			extent.hi.y = areaExtent->hi.y;
+	}
+
+	// add the areas to the grid - overlaps are found through it
+	TheNavAreaGrid.Initialize( extent.lo.x, extent.hi.x, extent.lo.y, extent.hi.y );
+
+	for( i=0; i<data.areaCount; ++i )
+		TheNavAreaGrid.AddNavArea( areaTable[i] );
+
+	// allow areas to connect to each other, etc
+	NavErrorType error = NAV_OK;
+	for( i=0; i<data.areaCount; ++i )
+		if (areaTable[i]->PostLoad( &data, &areaTable[0], (spotTable.empty()) ? NULL : &spotTable[0] ) != NAV_OK)
+			error = NAV_CORRUPT_DATA;
+
+	if (error != NAV_OK)
+	{
+		CONSOLE_ECHO( "ERROR: Corrupt navigation data in '%s'.\n", filename );
+		DestroyNavigationMap();
+		placeDirectory.Reset();
+		delete file;
+		return error;
+	}
+
+	//
+	// Set up all the ladders
+	//
+	BuildLadders();
+
+	// traverse the mesh directly from the file data
+	TheNavCompactMesh.Attach( file, &data );
+
+	CONSOLE_ECHO( "Loaded %d navigation areas from %s nav file '%s'.\n", data.areaCount, (file->IsMapped()) ? "mapped" : "buffered", filename );
+
+	return NAV_OK;
+}
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Load AI navigation data from a file
@@ -962,6 +1617,17 @@ NavErrorType LoadNavigationMap( void )
 
 	CNavArea::m_nextID = 1;
 
+	// compact nav files are used in place
+	CNavMappedFile *mappedFile = new CNavMappedFile;
+	if (mappedFile->Open( filename ))
+	{
+		const NavCompactFileHeader *header = reinterpret_cast<const NavCompactFileHeader *>( mappedFile->GetData() );
+
+		if (mappedFile->GetSize() >= 2*sizeof(unsigned int) && header->magic == NAV_MAGIC_NUMBER && header->version == NAV_COMPACT_VERSION)
+			return LoadCompactNavigationMap( filename, mappedFile );
+	}
+	delete mappedFile;
+
 	SteamFile navFile( filename );
 
 	if (!navFile.IsValid())
@@ -992,22 +1658,8 @@ NavErrorType LoadNavigationMap( void )
 		unsigned int saveBspSize;
 		navFile.Read( &saveBspSize, sizeof(unsigned int) );
 
-		// verify size
-		char *bspFilename = GetBspFilename( filename );
-		if (bspFilename == NULL)
+		if (!CheckNavBspSize( filename, saveBspSize ))
 			return NAV_INVALID_FILE;
-
-		unsigned int bspSize = (unsigned int)GET_FILE_SIZE( bspFilename );
-
-		if (bspSize != saveBspSize)
-		{
-			// this nav file is out of date for this bsp file
-			char *msg = "*** WARNING ***\nThe AI navigation data is from a different version of this map.\nThe CPU players will likely not perform well.\n";
-			HintMessageToAllPlayers( msg );
-			CONSOLE_ECHO( "\n-----------------\n" );
-			CONSOLE_ECHO( msg );
-			CONSOLE_ECHO( "-----------------\n\n" );
-		}
 	}
 
 	// load Place directory
@@ -1076,5 +1728,8 @@ NavErrorType LoadNavigationMap( void )
 	//
 	BuildLadders();
 
+	// build the contiguous, index-based copy of the mesh used for traversal
+	TheNavCompactMesh.Build();
+
 	return NAV_OK;
 }
@@ -11,6 +11,7 @@
 #include "player.h"
 #include "client.h"
 #include "cmd.h"
+#include "perf_counter.h"
 
 #include "nav.h"
 #include "nav_path.h"
@@ -427,6 +428,157 @@ return;
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------------------
+
+CNavPathQueue TheNavPathQueue;
+
+CNavPathQueue::CNavPathQueue( void )
+{
+	m_nextTicket = NAV_INVALID_PATH_TICKET;
+}
+
+CNavPathQueue::~CNavPathQueue()
+{
+	Reset();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Discard all requests
+ */
+void CNavPathQueue::Reset( void )
+{
+	RequestList::iterator iter;
+
+	for( iter = m_pendingList.begin(); iter != m_pendingList.end(); ++iter )
+		delete *iter;
+	m_pendingList.clear();
+
+	for( iter = m_doneList.begin(); iter != m_doneList.end(); ++iter )
+		delete *iter;
+	m_doneList.clear();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Queue the given request, and return its ticket
+ */
+NavPathTicket CNavPathQueue::Add( CNavPathRequest *request )
+{
+	if (++m_nextTicket == NAV_INVALID_PATH_TICKET)
+		++m_nextTicket;
+
+	request->m_ticket = m_nextTicket;
+	m_pendingList.push_back( request );
+
+	return request->m_ticket;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+CNavPathQueue::RequestList::iterator CNavPathQueue::Find( RequestList *list, NavPathTicket ticket )
+{
+	RequestList::iterator iter;
+	for( iter = list->begin(); iter != list->end(); ++iter )
+		if ((*iter)->m_ticket == ticket)
+			break;
+
+	return iter;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the status of the given request
+ */
+NavPathStatus CNavPathQueue::GetStatus( NavPathTicket ticket ) const
+{
+	RequestList::const_iterator iter;
+
+	for( iter = m_pendingList.begin(); iter != m_pendingList.end(); ++iter )
+		if ((*iter)->m_ticket == ticket)
+			return NAV_PATH_PENDING;
+
+	for( iter = m_doneList.begin(); iter != m_doneList.end(); ++iter )
+		if ((*iter)->m_ticket == ticket)
+			return ((*iter)->m_isFound) ? NAV_PATH_READY : NAV_PATH_FAILED;
+
+	return NAV_PATH_UNKNOWN;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * If the given request is done, copy its path into 'path' (if one was found) and release the ticket.
+ * Returns the status of the request.
+ */
+NavPathStatus CNavPathQueue::GetResult( NavPathTicket ticket, CNavPath *path )
+{
+	RequestList::iterator iter = Find( &m_doneList, ticket );
+	if (iter == m_doneList.end())
+		return (Find( &m_pendingList, ticket ) != m_pendingList.end()) ? NAV_PATH_PENDING : NAV_PATH_UNKNOWN;
+
+	CNavPathRequest *request = *iter;
+	m_doneList.erase( iter );
+
+	NavPathStatus status = NAV_PATH_FAILED;
+	if (request->m_isFound)
+	{
+		*path = request->m_path;
+		status = NAV_PATH_READY;
+	}
+
+	delete request;
+
+	return status;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Discard the given request, whether it has been computed or not
+ */
+void CNavPathQueue::Cancel( NavPathTicket ticket )
+{
+	RequestList::iterator iter = Find( &m_pendingList, ticket );
+	if (iter != m_pendingList.end())
+	{
+		delete *iter;
+		m_pendingList.erase( iter );
+		return;
+	}
+
+	iter = Find( &m_doneList, ticket );
+	if (iter != m_doneList.end())
+	{
+		delete *iter;
+		m_doneList.erase( iter );
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Compute waiting paths, oldest first, until 'budget' microseconds have elapsed.
+ * At least one path is computed each frame so that requests always make progress, even if a
+ * single path takes longer than the budget. If 'budget' is zero or less, all waiting paths are computed.
+ */
+void CNavPathQueue::Update( float budget )
+{
+	if (m_pendingList.empty())
+		return;
+
+	static CPerformanceCounter perfCounter;
+	double endTime = perfCounter.GetCurTime() + budget / 1000000.0f;
+
+	do
+	{
+		CNavPathRequest *request = m_pendingList.front();
+		m_pendingList.pop_front();
+
+		request->Compute();
+		m_doneList.push_back( request );
+	}
+	while( !m_pendingList.empty() && (budget <= 0.0f || perfCounter.GetCurTime() < endTime) );
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------------------
 
@@ -437,6 +589,7 @@ CNavPathFollower::CNavPathFollower( void )
 {
 	m_improv = NULL;
 	m_path = NULL;
+	m_pathRequest = NAV_INVALID_PATH_TICKET;
 
 	m_segmentIndex = 0;
 	m_isLadderStarted = false;
@@ -444,6 +597,11 @@ CNavPathFollower::CNavPathFollower( void )
 	m_isDebug = false;
 }
 
+CNavPathFollower::~CNavPathFollower()
+{
+	CancelPathRequest();
+}
+
 void CNavPathFollower::Reset( void )
 {
 	m_segmentIndex = 1;
@@ -452,12 +610,74 @@ void CNavPathFollower::Reset( void )
 	m_stuckMonitor.Reset();
 }
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Follow the path of the given request once it has been computed. Until then, the current path
+ * (if any) is followed. Any previous request is discarded.
+ */
+void CNavPathFollower::SetPathRequest( NavPathTicket ticket )
+{
+	CancelPathRequest();
+	m_pathRequest = ticket;
+}
+
+void CNavPathFollower::CancelPathRequest( void )
+{
+	if (m_pathRequest != NAV_INVALID_PATH_TICKET)
+	{
+		TheNavPathQueue.Cancel( m_pathRequest );
+		m_pathRequest = NAV_INVALID_PATH_TICKET;
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * If the requested path is ready, start following it
+ */
+void CNavPathFollower::UpdatePathRequest( void )
+{
+	if (m_pathRequest == NAV_INVALID_PATH_TICKET)
+		return;
+
+	// with no path to copy the result into, the request can never be collected
+	if (m_path == NULL)
+	{
+		CancelPathRequest();
+		return;
+	}
+
+	// don't switch paths halfway up a ladder
+	if (m_isLadderStarted && m_path->IsValid())
+		return;
+
+	switch( TheNavPathQueue.GetResult( m_pathRequest, m_path ) )
+	{
+		case NAV_PATH_PENDING:
+			return;
+
+		case NAV_PATH_READY:
+			// the new path starts where we were when it was requested
+			m_segmentIndex = 1;
+			m_isLadderStarted = false;
+			break;
+
+		case NAV_PATH_FAILED:
+		case NAV_PATH_UNKNOWN:
+			// keep following the old path - if there was one, it is better than nothing
+			break;
+	}
+
+	m_pathRequest = NAV_INVALID_PATH_TICKET;
+}
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Move improv along path
  */
 void CNavPathFollower::Update( float deltaT, bool avoidObstacles )
 {
+	UpdatePathRequest();
+
 	if (m_path == NULL || m_path->IsValid() == false)
 		return;
 
@@ -7,6 +7,8 @@
 
 #pragma warning( disable : 4530 )					// STL uses exceptions, but we are not compiling with them - ignore warning
 
+#include <list>
+
 #include "nav_area.h"
 #include "bot_util.h"
 
@@ -86,6 +88,7 @@ public:
 
 		//
 		// Compute shortest path to goal
+		// (not NavAreaBuildHierarchicalPath() - a blocked corridor would search the mesh twice)
 		//
 		CNavArea *closestArea;
 		bool pathToGoalExists = NavAreaBuildPath( startArea, goalArea, goal, costFunc, &closestArea );
@@ -153,6 +156,106 @@ private:
 	int FindNextOccludedNode( int anchor );		///< used by Optimize()
 };
 
+//--------------------------------------------------------------------------------------------------------
+typedef unsigned int NavPathTicket;							///< identifies a path request made to TheNavPathQueue
+#define NAV_INVALID_PATH_TICKET 0
+
+enum NavPathStatus
+{
+	NAV_PATH_PENDING,										///< the path has not been computed yet
+	NAV_PATH_READY,											///< the path has been computed
+	NAV_PATH_FAILED,										///< no path could be computed
+	NAV_PATH_UNKNOWN										///< the ticket does not refer to a request (it was collected or cancelled)
+};
+
+/**
+ * A path waiting to be computed by TheNavPathQueue
+ */
+class CNavPathRequest
+{
+public:
+	virtual ~CNavPathRequest() { }
+
+	virtual void Compute( void ) = 0;						///< compute m_path, and set m_isFound
+
+	NavPathTicket m_ticket;
+	Vector m_start;
+	Vector m_goal;
+	bool m_isFound;											///< only valid once the request is done
+	CNavPath m_path;
+};
+
+template< typename CostFunctor >
+class CNavPathRequestImpl : public CNavPathRequest
+{
+public:
+	CNavPathRequestImpl( const CostFunctor &costFunc ) : m_costFunc( costFunc ) { }
+
+	virtual void Compute( void )
+	{
+		m_isFound = m_path.Compute( &m_start, &m_goal, m_costFunc );
+	}
+
+private:
+	CostFunctor m_costFunc;									///< a copy of the cost functor given to the request
+};
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * The CNavPathQueue class spreads path computation across frames.
+ * Instead of computing a path immediately, a request is made and a ticket is returned. Each frame,
+ * Update() computes waiting paths, in the order they were requested, until the frame's time budget
+ * is used up. The owner of the ticket collects the path with GetResult() when it is ready.
+ *
+ * Each path is still computed in one piece on the main thread, since cost functors read game state.
+ * There is no worker thread mode.
+ * A copy of the cost functor is kept until the path is computed, so anything it refers to must
+ * outlive the request - cancel the request if it does not.
+ *
+ * This is infrastructure only: nothing in this tree makes requests yet. The bot and hostage code that
+ * rebuilds paths (CNavPath::Compute() followed by CNavPathFollower::SetPath()) is not part of this SDK,
+ * and must call CNavPathFollower::RequestPath() instead before bot_path_budget has any effect.
+ */
+class CNavPathQueue
+{
+public:
+	CNavPathQueue( void );
+	~CNavPathQueue();
+
+	/// request a path from 'start' to 'goal', returning a ticket used to collect it
+	template< typename CostFunctor >
+	NavPathTicket Request( const Vector &start, const Vector &goal, const CostFunctor &costFunc )
+	{
+		CNavPathRequest *request = new CNavPathRequestImpl< CostFunctor >( costFunc );
+		request->m_start = start;
+		request->m_goal = goal;
+		request->m_isFound = false;
+
+		return Add( request );
+	}
+
+	NavPathStatus GetStatus( NavPathTicket ticket ) const;	///< return the status of the given request
+	NavPathStatus GetResult( NavPathTicket ticket, CNavPath *path );	///< if the request is done, copy its path (if found) and release the ticket
+	void Cancel( NavPathTicket ticket );					///< discard the given request
+
+	void Update( float budget );							///< compute waiting paths until 'budget' microseconds have elapsed - if zero or less, compute all of them
+	void Reset( void );										///< discard all requests
+
+	int GetPendingCount( void ) const			{ return (int)m_pendingList.size(); }
+
+private:
+	typedef std::list< CNavPathRequest * > RequestList;
+	RequestList m_pendingList;								///< requests waiting to be computed, oldest first
+	RequestList m_doneList;									///< computed requests waiting to be collected
+
+	NavPathTicket m_nextTicket;
+
+	NavPathTicket Add( CNavPathRequest *request );
+	RequestList::iterator Find( RequestList *list, NavPathTicket ticket );
+};
+
+extern CNavPathQueue TheNavPathQueue;
+
 //--------------------------------------------------------------------------------------------------------
 /**
  * Monitor improv movement and determine if it becomes stuck
@@ -189,10 +292,24 @@ class CNavPathFollower
 {
 public:
 	CNavPathFollower( void );
+	~CNavPathFollower();
 
 	void SetImprov( CImprov *improv ) { m_improv = improv; }
 	void SetPath( CNavPath *path ) { m_path = path; }
 
+	/// follow the path of the given TheNavPathQueue request once it is ready - the current path is followed until then
+	void SetPathRequest( NavPathTicket ticket );
+
+	/// rebuild the path from 'start' to 'goal' through TheNavPathQueue, following the current path until it is ready
+	template< typename CostFunctor >
+	void RequestPath( const Vector &start, const Vector &goal, const CostFunctor &costFunc )
+	{
+		SetPathRequest( TheNavPathQueue.Request( start, goal, costFunc ) );
+	}
+
+	void CancelPathRequest( void );
+	bool IsWaitingForPath( void ) const	{ return (m_pathRequest != NAV_INVALID_PATH_TICKET); }
+
 	void Reset( void );
 
 	#define DONT_AVOID_OBSTACLES false
@@ -209,6 +326,9 @@ private:
 	CImprov *m_improv;												///< who is doing the path following
 
 	CNavPath *m_path;												///< the path being followed
+	NavPathTicket m_pathRequest;									///< the path that will replace m_path when it is ready
+
+	void UpdatePathRequest( void );									///< switch to the requested path if it is ready
 
 	int m_segmentIndex;												///< the point on the path the improv is moving towards
 	int m_behindIndex;												///< index of the node on the path just behind us
@@ -0,0 +1,267 @@
+/***
+*
+*	Copyright (c) 1996-2002, Valve LLC. All rights reserved.
+*
+*	This product contains software technology licensed from Id
+*	Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc.
+*	All Rights Reserved.
+*
+*   Use, distribution, and modification of this source code and/or resulting
+*   object code is restricted to non-commercial enhancements to products from
+*   Valve LLC.  All other use, distribution, or modification is prohibited
+*   without written permission from Valve LLC.
+*
+****/
+// pm_materials.cpp -- texture name to material type table, parsed once from
+// sound/materials.txt for the player movement code and the rest of the dll
+
+#include <algorithm>
+
+#include "Platform.h"
+#include "pm_materials.h"
+
+#define MATERIAL_TABLE_SIZE 1024 // slots, a power of two at least twice CTEXTURESMAX
+#define MATERIAL_BUCKETS 256	 // power of two
+#define MATERIAL_MAX_SEEDS 16
+
+static bool gfMaterialsLoaded = false;
+
+static int gcMaterials = 0;
+static char grgszMaterialName[CTEXTURESMAX][CBTEXTURENAMEMAX];
+static char grgchMaterialType[CTEXTURESMAX];
+
+// Perfect hash built at load: a name's hash picks a bucket, and each bucket
+// has a displacement that moves all of its names into free slots, so a lookup
+// is one hash and one name compare.
+static bool gfMaterialsHashed = false;
+static unsigned int gMaterialSeed;
+static unsigned short grgMaterialDisplacement[MATERIAL_BUCKETS];
+static short grgMaterialSlot[MATERIAL_TABLE_SIZE]; // index into the names, -1 if empty
+
+// names match on their first CBTEXTURENAMEMAX - 1 characters, ignoring case
+static unsigned int PM_MaterialHash(const char* name, unsigned int seed)
+{
+	unsigned int hash = 2166136261u ^ seed;
+
+	for (int i = 0; i < CBTEXTURENAMEMAX - 1 && '\0' != name[i]; i++)
+		hash = (hash ^ (unsigned char)tolower(name[i])) * 16777619u;
+
+	return hash;
+}
+
+static int PM_MaterialSlot(unsigned int hash, int displacement)
+{
+	hash += displacement * 0x9e3779b9u;
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+
+	return hash & (MATERIAL_TABLE_SIZE - 1);
+}
+
+static bool PM_HashMaterials(unsigned int seed)
+{
+	unsigned int hashes[CTEXTURESMAX];
+	int sorted[CTEXTURESMAX];
+	int first[MATERIAL_BUCKETS + 1];
+	int order[MATERIAL_BUCKETS];
+	int i, j, k, b, d;
+
+	// sort the names by bucket, keeping file order within each bucket
+	memset(first, 0, sizeof(first));
+	for (i = 0; i < gcMaterials; i++)
+	{
+		hashes[i] = PM_MaterialHash(grgszMaterialName[i], seed);
+		first[(hashes[i] & (MATERIAL_BUCKETS - 1)) + 1]++;
+	}
+	for (b = 0; b < MATERIAL_BUCKETS; b++)
+		first[b + 1] += first[b];
+	for (i = 0; i < gcMaterials; i++)
+	{
+		b = hashes[i] & (MATERIAL_BUCKETS - 1);
+		sorted[first[b]++] = i;
+	}
+	for (b = MATERIAL_BUCKETS; b > 0; b--)
+		first[b] = first[b - 1];
+	first[0] = 0;
+
+	// place the fullest buckets first while the table is emptiest
+	for (b = 0; b < MATERIAL_BUCKETS; b++)
+		order[b] = b;
+	std::sort(order, order + MATERIAL_BUCKETS, [&](int l, int r)
+		{ return first[l + 1] - first[l] > first[r + 1] - first[r]; });
+
+	memset(grgMaterialSlot, -1, sizeof(grgMaterialSlot));
+	memset(grgMaterialDisplacement, 0, sizeof(grgMaterialDisplacement));
+
+	for (k = 0; k < MATERIAL_BUCKETS; k++)
+	{
+		b = order[k];
+		if (first[b] == first[b + 1])
+			break;
+
+		for (d = 0; d < 65536; d++)
+		{
+			for (i = first[b]; i < first[b + 1]; i++)
+			{
+				int slot = PM_MaterialSlot(hashes[sorted[i]], d);
+				if (-1 != grgMaterialSlot[slot])
+					break;
+				grgMaterialSlot[slot] = sorted[i];
+			}
+			if (i == first[b + 1])
+				break;
+
+			// take back the names placed with this displacement
+			for (j = first[b]; j < i; j++)
+				grgMaterialSlot[PM_MaterialSlot(hashes[sorted[j]], d)] = -1;
+		}
+		if (d == 65536)
+			return false;
+
+		grgMaterialDisplacement[b] = d;
+	}
+
+	gMaterialSeed = seed;
+	return true;
+}
+
+// same as the engine's memfgets, so long lines split where they always have
+static const char* PM_MaterialLine(const byte* pMemFile, int fileSize, int& filePos, char* pBuffer, int bufferSize)
+{
+	int i = filePos;
+	int last = fileSize;
+
+	if (filePos >= fileSize)
+		return NULL;
+
+	if (last - filePos > (bufferSize - 1))
+		last = filePos + (bufferSize - 1);
+
+	while (i < last)
+	{
+		if (pMemFile[i++] == '\n')
+			break;
+	}
+
+	memcpy(pBuffer, pMemFile + filePos, i - filePos);
+	pBuffer[i - filePos] = '\0';
+	filePos = i;
+
+	return pBuffer;
+}
+
+void PM_LoadMaterials(const byte* pMemFile, int fileSize)
+{
+	char buffer[512];
+	int i, j, k;
+	int filePos = 0;
+
+	if (gfMaterialsLoaded || !pMemFile)
+		return;
+
+	memset(&(grgszMaterialName[0][0]), 0, CTEXTURESMAX * CBTEXTURENAMEMAX);
+	memset(grgchMaterialType, 0, CTEXTURESMAX);
+
+	gcMaterials = 0;
+	memset(buffer, 0, 512);
+
+	// for each line in the file...
+	while (PM_MaterialLine(pMemFile, fileSize, filePos, buffer, 511) != NULL && (gcMaterials < CTEXTURESMAX))
+	{
+		// skip whitespace
+		i = 0;
+		while ('\0' != buffer[i] && 0 != isspace(buffer[i]))
+			i++;
+
+		if ('\0' == buffer[i])
+			continue;
+
+		// skip comment lines
+		if (buffer[i] == '/' || 0 == isalpha(buffer[i]))
+			continue;
+
+		// get texture type
+		grgchMaterialType[gcMaterials] = toupper(buffer[i++]);
+
+		// skip whitespace
+		while ('\0' != buffer[i] && 0 != isspace(buffer[i]))
+			i++;
+
+		if ('\0' == buffer[i])
+			continue;
+
+		// get texture name
+		j = i;
+		while ('\0' != buffer[j] && 0 == isspace(buffer[j]))
+			j++;
+
+		if ('\0' == buffer[j])
+			continue;
+
+		// null-terminate name
+		j = V_min(j, CBTEXTURENAMEMAX - 1 + i);
+		buffer[j] = 0;
+
+		// the first line for a name wins, as it always did on the server
+		for (k = 0; k < gcMaterials; k++)
+		{
+			if (0 == strnicmp(&(buffer[i]), grgszMaterialName[k], CBTEXTURENAMEMAX - 1))
+				break;
+		}
+		if (k < gcMaterials)
+			continue;
+
+		strcpy(&(grgszMaterialName[gcMaterials++][0]), &(buffer[i]));
+	}
+
+	// no seed building the table is all but impossible at this load factor,
+	// but if it happens lookups just scan the names
+	gfMaterialsHashed = false;
+	for (unsigned int seed = 0; seed < MATERIAL_MAX_SEEDS && !gfMaterialsHashed; seed++)
+		gfMaterialsHashed = PM_HashMaterials(seed * 0x9e3779b9u);
+
+	gfMaterialsLoaded = true;
+}
+
+bool PM_MaterialsLoaded()
+{
+	return gfMaterialsLoaded;
+}
+
+int PM_MaterialCount()
+{
+	return gcMaterials;
+}
+
+const char* PM_MaterialName(int index)
+{
+	return grgszMaterialName[index];
+}
+
+char PM_MaterialType(int index)
+{
+	return grgchMaterialType[index];
+}
+
+char PM_FindMaterialType(const char* name)
+{
+	if (gfMaterialsHashed)
+	{
+		const unsigned int hash = PM_MaterialHash(name, gMaterialSeed);
+		const int index = grgMaterialSlot[PM_MaterialSlot(hash, grgMaterialDisplacement[hash & (MATERIAL_BUCKETS - 1)])];
+
+		if (-1 != index && 0 == strnicmp(name, grgszMaterialName[index], CBTEXTURENAMEMAX - 1))
+			return grgchMaterialType[index];
+
+		return CHAR_TEX_CONCRETE;
+	}
+
+	for (int i = 0; i < gcMaterials; i++)
+	{
+		if (0 == strnicmp(name, grgszMaterialName[i], CBTEXTURENAMEMAX - 1))
+			return grgchMaterialType[i];
+	}
+
+	return CHAR_TEX_CONCRETE;
+}
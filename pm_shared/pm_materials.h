@@ -30,3 +30,15 @@
 #define CHAR_TEX_GLASS 'Y'
 #define CHAR_TEX_FLESH 'F'
 #define CHAR_TEX_SNOW 'N'
+
+// Parses materials.txt into the table shared by everything in this dll.
+// Only the first call does anything, later ones keep the table already loaded.
+void PM_LoadMaterials(const byte* pMemFile, int fileSize);
+bool PM_MaterialsLoaded();
+
+int PM_MaterialCount();
+const char* PM_MaterialName(int index);
+char PM_MaterialType(int index);
+
+// Material type of a texture, CHAR_TEX_CONCRETE if it isn't listed
+char PM_FindMaterialType(const char* name);
@@ -124,11 +124,6 @@ typedef struct hull_s
 static Vector rgv3tStuckTable[54];
 static int rgStuckLast[MAX_PLAYERS][2];
 
-// Texture names
-static int gcTextures = 0;
-static char grgszTextureName[CTEXTURESMAX][CBTEXTURENAMEMAX];
-static char grgchTextureType[CTEXTURESMAX];
-
 bool g_onladder = false;
 
 static void PM_InitTrace(trace_t* trace, const Vector& end)
@@ -145,141 +140,31 @@ static void PM_TraceModel(physent_t* pEnt, const Vector& start, const Vector& en
 	pmove->PM_TraceModel(pEnt, start, end, trace);
 }
 
-void PM_SwapTextures(int i, int j)
-{
-	char chTemp;
-	char szTemp[CBTEXTURENAMEMAX];
-
-	strcpy(szTemp, grgszTextureName[i]);
-	chTemp = grgchTextureType[i];
-
-	strcpy(grgszTextureName[i], grgszTextureName[j]);
-	grgchTextureType[i] = grgchTextureType[j];
-
-	strcpy(grgszTextureName[j], szTemp);
-	grgchTextureType[j] = chTemp;
-}
-
-void PM_SortTextures()
-{
-	// Bubble sort, yuck, but this only occurs at startup and it's only 512 elements...
-	//
-	int i, j;
-
-	for (i = 0; i < gcTextures; i++)
-	{
-		for (j = i + 1; j < gcTextures; j++)
-		{
-			if (stricmp(grgszTextureName[i], grgszTextureName[j]) > 0)
-			{
-				// Swap
-				//
-				PM_SwapTextures(i, j);
-			}
-		}
-	}
-}
-
 void PM_InitTextureTypes()
 {
-	char buffer[512];
-	int i, j;
 	byte* pMemFile;
-	int fileSize, filePos;
-	static bool bTextureTypeInit = false;
+	int fileSize;
 
-	if (bTextureTypeInit)
+	// the game dll may have loaded the table already
+	if (PM_MaterialsLoaded())
 		return;
 
-	memset(&(grgszTextureName[0][0]), 0, CTEXTURESMAX * CBTEXTURENAMEMAX);
-	memset(grgchTextureType, 0, CTEXTURESMAX);
-
-	gcTextures = 0;
-	memset(buffer, 0, 512);
-
 	fileSize = pmove->COM_FileSize("sound/materials.txt");
 	pMemFile = pmove->COM_LoadFile("sound/materials.txt", 5, NULL);
 	if (!pMemFile)
 		return;
 
-	filePos = 0;
-	// for each line in the file...
-	while (pmove->memfgets(pMemFile, fileSize, &filePos, buffer, 511) != NULL && (gcTextures < CTEXTURESMAX))
-	{
-		// skip whitespace
-		i = 0;
-		while ('\0' != buffer[i] && 0 != isspace(buffer[i]))
-			i++;
-
-		if ('\0' == buffer[i])
-			continue;
-
-		// skip comment lines
-		if (buffer[i] == '/' || 0 == isalpha(buffer[i]))
-			continue;
-
-		// get texture type
-		grgchTextureType[gcTextures] = toupper(buffer[i++]);
-
-		// skip whitespace
-		while ('\0' != buffer[i] && 0 != isspace(buffer[i]))
-			i++;
-
-		if ('\0' == buffer[i])
-			continue;
-
-		// get sentence name
-		j = i;
-		while ('\0' != buffer[j] && 0 == isspace(buffer[j]))
-			j++;
-
-		if ('\0' == buffer[j])
-			continue;
-
-		// null-terminate name and save in sentences array
-		j = V_min(j, CBTEXTURENAMEMAX - 1 + i);
-		buffer[j] = 0;
-		strcpy(&(grgszTextureName[gcTextures++][0]), &(buffer[i]));
-	}
+	PM_LoadMaterials(pMemFile, fileSize);
 
 	// Must use engine to free since we are in a .dll
 	pmove->COM_FreeFile(pMemFile);
-
-	PM_SortTextures();
-
-	bTextureTypeInit = true;
 }
 
 char PM_FindTextureType(const char* name)
 {
-	int left, right, pivot;
-	int val;
-
 	assert(pm_shared_initialized);
 
-	left = 0;
-	right = gcTextures - 1;
-
-	while (left <= right)
-	{
-		pivot = (left + right) / 2;
-
-		val = strnicmp(name, grgszTextureName[pivot], CBTEXTURENAMEMAX - 1);
-		if (val == 0)
-		{
-			return grgchTextureType[pivot];
-		}
-		else if (val > 0)
-		{
-			left = pivot + 1;
-		}
-		else if (val < 0)
-		{
-			right = pivot - 1;
-		}
-	}
-
-	return CHAR_TEX_CONCRETE;
+	return PM_FindMaterialType(name);
 }
 
 void PM_PlayStepSound(int step, float fvol)
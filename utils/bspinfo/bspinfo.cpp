@@ -16,8 +16,7 @@ void main(int argc, char** argv)
 {
 	int i;
 	char source[1024];
-	int size;
-	FILE* f;
+	bspmap_t map;
 
 	printf("bspinfo.exe v2.1 (%s)\n", __DATE__);
 	printf("---- bspinfo ----\n");
@@ -31,18 +30,13 @@ void main(int argc, char** argv)
 		printf("---------------------\n");
 		strcpy(source, argv[i]);
 		DefaultExtension(source, ".bsp");
-		f = fopen(source, "rb");
-		if (f)
-		{
-			size = filelength(f);
-			fclose(f);
-		}
-		else
-			size = 0;
-		printf("%s: %i\n", source, size);
 
-		LoadBSPFile(source);
-		PrintBSPFileSizes();
+		// the lumps are read straight from the mapping, so maps
+		// over the MAX_MAP_* limits are reported rather than refused
+		OpenBSPMap(source, &map);
+		printf("%s: %i\n", source, map.size);
+		PrintBSPMapSizes(&map);
+		CloseBSPMap(&map);
 		printf("---------------------\n");
 	}
 }
@@ -13,66 +13,101 @@
 #include "bspfile.h"
 #include "scriplib.h"
 
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 //=============================================================================
 
+template <typename T>
+static T* AllocLumpArray(int count)
+{
+	T* data = (T*)calloc(count, sizeof(T));
+
+	if (!data)
+		Error("AllocLumpArray: couldn't allocate %i entries", count);
+
+	return data;
+}
+
 int nummodels;
-dmodel_t dmodels[MAX_MAP_MODELS];
+dmodel_t* dmodels = AllocLumpArray<dmodel_t>(MAX_MAP_MODELS);
+static int dmodels_capacity = MAX_MAP_MODELS;
 int dmodels_checksum;
 
 int visdatasize;
-byte dvisdata[MAX_MAP_VISIBILITY];
+byte* dvisdata = AllocLumpArray<byte>(MAX_MAP_VISIBILITY);
+static int dvisdata_capacity = MAX_MAP_VISIBILITY;
 int dvisdata_checksum;
 
 int lightdatasize;
-byte dlightdata[MAX_MAP_LIGHTING];
+byte* dlightdata = AllocLumpArray<byte>(MAX_MAP_LIGHTING);
+static int dlightdata_capacity = MAX_MAP_LIGHTING;
 int dlightdata_checksum;
 
 int texdatasize;
-byte dtexdata[MAX_MAP_MIPTEX]; // (dmiptexlump_t)
+byte* dtexdata = AllocLumpArray<byte>(MAX_MAP_MIPTEX); // (dmiptexlump_t)
+static int dtexdata_capacity = MAX_MAP_MIPTEX;
 int dtexdata_checksum;
 
 int entdatasize;
-char dentdata[MAX_MAP_ENTSTRING];
+char* dentdata = AllocLumpArray<char>(MAX_MAP_ENTSTRING);
+static int dentdata_capacity = MAX_MAP_ENTSTRING;
 int dentdata_checksum;
 
 int numleafs;
-dleaf_t dleafs[MAX_MAP_LEAFS];
+dleaf_t* dleafs = AllocLumpArray<dleaf_t>(MAX_MAP_LEAFS);
+static int dleafs_capacity = MAX_MAP_LEAFS;
 int dleafs_checksum;
 
 int numplanes;
-dplane_t dplanes[MAX_MAP_PLANES];
+dplane_t* dplanes = AllocLumpArray<dplane_t>(MAX_MAP_PLANES);
+static int dplanes_capacity = MAX_MAP_PLANES;
 int dplanes_checksum;
 
 int numvertexes;
-dvertex_t dvertexes[MAX_MAP_VERTS];
+dvertex_t* dvertexes = AllocLumpArray<dvertex_t>(MAX_MAP_VERTS);
+static int dvertexes_capacity = MAX_MAP_VERTS;
 int dvertexes_checksum;
 
 int numnodes;
-dnode_t dnodes[MAX_MAP_NODES];
+dnode_t* dnodes = AllocLumpArray<dnode_t>(MAX_MAP_NODES);
+static int dnodes_capacity = MAX_MAP_NODES;
 int dnodes_checksum;
 
 int numtexinfo;
-texinfo_t texinfo[MAX_MAP_TEXINFO];
+texinfo_t* texinfo = AllocLumpArray<texinfo_t>(MAX_MAP_TEXINFO);
+static int texinfo_capacity = MAX_MAP_TEXINFO;
 int texinfo_checksum;
 
 int numfaces;
-dface_t dfaces[MAX_MAP_FACES];
+dface_t* dfaces = AllocLumpArray<dface_t>(MAX_MAP_FACES);
+static int dfaces_capacity = MAX_MAP_FACES;
 int dfaces_checksum;
 
 int numclipnodes;
-dclipnode_t dclipnodes[MAX_MAP_CLIPNODES];
+dclipnode_t* dclipnodes = AllocLumpArray<dclipnode_t>(MAX_MAP_CLIPNODES);
+static int dclipnodes_capacity = MAX_MAP_CLIPNODES;
 int dclipnodes_checksum;
 
 int numedges;
-dedge_t dedges[MAX_MAP_EDGES];
+dedge_t* dedges = AllocLumpArray<dedge_t>(MAX_MAP_EDGES);
+static int dedges_capacity = MAX_MAP_EDGES;
 int dedges_checksum;
 
 int nummarksurfaces;
-unsigned short dmarksurfaces[MAX_MAP_MARKSURFACES];
+unsigned short* dmarksurfaces = AllocLumpArray<unsigned short>(MAX_MAP_MARKSURFACES);
+static int dmarksurfaces_capacity = MAX_MAP_MARKSURFACES;
 int dmarksurfaces_checksum;
 
 int numsurfedges;
-int dsurfedges[MAX_MAP_SURFEDGES];
+int* dsurfedges = AllocLumpArray<int>(MAX_MAP_SURFEDGES);
+static int dsurfedges_capacity = MAX_MAP_SURFEDGES;
 int dsurfedges_checksum;
 
 int num_entities;
@@ -325,21 +360,145 @@ void SwapBSPFile(qboolean todisk)
 }
 
 
-dheader_t* header;
+/*
+=============
+OpenBSPMap
+
+Maps the file read only and validates the header and lump directory
+=============
+*/
+void OpenBSPMap(const char* filename, bspmap_t* map)
+{
+	int i;
+	lump_t* lump;
+
+	memset(map, 0, sizeof(*map));
+
+#ifdef WIN32
+	HANDLE file, mapping;
+	LARGE_INTEGER size;
+
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		Error("Error opening %s", filename);
+	if (!GetFileSizeEx(file, &size) || size.QuadPart > 0x7fffffff)
+		Error("%s: bad file size", filename);
+	map->size = (int)size.QuadPart;
+	if (map->size < (int)sizeof(dheader_t))
+		Error("%s is too small to be a bsp file", filename);
+
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping)
+		Error("Error mapping %s", filename);
+	map->base = (byte*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!map->base)
+		Error("Error mapping %s", filename);
+
+	map->file = file;
+	map->mapping = mapping;
+#else
+	int fd;
+	struct stat st;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		Error("Error opening %s: %s", filename, strerror(errno));
+	if (fstat(fd, &st) == -1 || st.st_size > 0x7fffffff)
+		Error("%s: bad file size", filename);
+	map->size = (int)st.st_size;
+	if (map->size < (int)sizeof(dheader_t))
+		Error("%s is too small to be a bsp file", filename);
+
+	map->base = (byte*)mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map->base == MAP_FAILED)
+		Error("Error mapping %s: %s", filename, strerror(errno));
+	close(fd); // the mapping keeps the file open
+#endif
+
+	// swap the header
+	memcpy(&map->header, map->base, sizeof(dheader_t));
+	for (i = 0; i < (int)(sizeof(dheader_t) / 4); i++)
+		((int*)&map->header)[i] = LittleLong(((int*)&map->header)[i]);
+
+	if (map->header.version != BSPVERSION)
+		Error("%s is version %i, not %i", filename, map->header.version, BSPVERSION);
+
+	for (i = 0, lump = map->header.lumps; i < HEADER_LUMPS; i++, lump++)
+	{
+		if (lump->fileofs < 0 || lump->filelen < 0 || lump->fileofs > map->size - lump->filelen)
+			Error("%s: lump %i (%i bytes at %i) is outside the file", filename, i, lump->filelen, lump->fileofs);
+	}
+}
+
+/*
+=============
+CloseBSPMap
+=============
+*/
+void CloseBSPMap(bspmap_t* map)
+{
+	if (!map->base)
+		return;
+
+#ifdef WIN32
+	UnmapViewOfFile(map->base);
+	CloseHandle((HANDLE)map->mapping);
+	CloseHandle((HANDLE)map->file);
+#else
+	munmap(map->base, map->size);
+#endif
+
+	memset(map, 0, sizeof(*map));
+}
+
+/*
+=============
+BSPMapLump
+
+Returns the lump in place and the number of size byte entries in it
+=============
+*/
+const void* BSPMapLump(const bspmap_t* map, int lump, int size, int* count)
+{
+	const lump_t* l;
+
+	if (lump < 0 || lump >= HEADER_LUMPS)
+		Error("BSPMapLump: bad lump %i", lump);
+
+	l = &map->header.lumps[lump];
+	if (l->filelen % size)
+		Error("BSPMapLump: lump %i is an odd size", lump);
+
+	*count = l->filelen / size;
+	return map->base + l->fileofs;
+}
+
+/*
+=============
+CopyLump
 
-int CopyLump(int lump, void* dest, int size)
+Copies a lump out of the mapping, growing the array when the lump
+holds more than it has room for
+=============
+*/
+template <typename T>
+static int CopyLump(const bspmap_t* map, int lump, T*& dest, int& capacity)
 {
-	int length, ofs;
+	int count;
+	const void* data;
 
-	length = header->lumps[lump].filelen;
-	ofs = header->lumps[lump].fileofs;
+	data = BSPMapLump(map, lump, sizeof(T), &count);
 
-	if (length % size)
-		Error("LoadBSPFile: odd lump size");
+	if (count > capacity)
+	{
+		free(dest);
+		dest = AllocLumpArray<T>(count);
+		capacity = count;
+	}
 
-	memcpy(dest, (byte*)header + ofs, length);
+	memcpy(dest, data, count * sizeof(T));
 
-	return length / size;
+	return count;
 }
 
 /*
@@ -349,38 +508,28 @@ LoadBSPFile
 */
 void LoadBSPFile(char* filename)
 {
-	int i;
+	bspmap_t map;
 
-	//
-	// load the file header
-	//
-	LoadFile(filename, (void**)&header);
+	OpenBSPMap(filename, &map);
 
-	// swap the header
-	for (i = 0; i < sizeof(dheader_t) / 4; i++)
-		((int*)header)[i] = LittleLong(((int*)header)[i]);
-
-	if (header->version != BSPVERSION)
-		Error("%s is version %i, not %i", filename, header->version, BSPVERSION);
-
-	nummodels = CopyLump(LUMP_MODELS, dmodels, sizeof(dmodel_t));
-	numvertexes = CopyLump(LUMP_VERTEXES, dvertexes, sizeof(dvertex_t));
-	numplanes = CopyLump(LUMP_PLANES, dplanes, sizeof(dplane_t));
-	numleafs = CopyLump(LUMP_LEAFS, dleafs, sizeof(dleaf_t));
-	numnodes = CopyLump(LUMP_NODES, dnodes, sizeof(dnode_t));
-	numtexinfo = CopyLump(LUMP_TEXINFO, texinfo, sizeof(texinfo_t));
-	numclipnodes = CopyLump(LUMP_CLIPNODES, dclipnodes, sizeof(dclipnode_t));
-	numfaces = CopyLump(LUMP_FACES, dfaces, sizeof(dface_t));
-	nummarksurfaces = CopyLump(LUMP_MARKSURFACES, dmarksurfaces, sizeof(dmarksurfaces[0]));
-	numsurfedges = CopyLump(LUMP_SURFEDGES, dsurfedges, sizeof(dsurfedges[0]));
-	numedges = CopyLump(LUMP_EDGES, dedges, sizeof(dedge_t));
-
-	texdatasize = CopyLump(LUMP_TEXTURES, dtexdata, 1);
-	visdatasize = CopyLump(LUMP_VISIBILITY, dvisdata, 1);
-	lightdatasize = CopyLump(LUMP_LIGHTING, dlightdata, 1);
-	entdatasize = CopyLump(LUMP_ENTITIES, dentdata, 1);
-
-	free(header); // everything has been copied out
+	nummodels = CopyLump(&map, LUMP_MODELS, dmodels, dmodels_capacity);
+	numvertexes = CopyLump(&map, LUMP_VERTEXES, dvertexes, dvertexes_capacity);
+	numplanes = CopyLump(&map, LUMP_PLANES, dplanes, dplanes_capacity);
+	numleafs = CopyLump(&map, LUMP_LEAFS, dleafs, dleafs_capacity);
+	numnodes = CopyLump(&map, LUMP_NODES, dnodes, dnodes_capacity);
+	numtexinfo = CopyLump(&map, LUMP_TEXINFO, texinfo, texinfo_capacity);
+	numclipnodes = CopyLump(&map, LUMP_CLIPNODES, dclipnodes, dclipnodes_capacity);
+	numfaces = CopyLump(&map, LUMP_FACES, dfaces, dfaces_capacity);
+	nummarksurfaces = CopyLump(&map, LUMP_MARKSURFACES, dmarksurfaces, dmarksurfaces_capacity);
+	numsurfedges = CopyLump(&map, LUMP_SURFEDGES, dsurfedges, dsurfedges_capacity);
+	numedges = CopyLump(&map, LUMP_EDGES, dedges, dedges_capacity);
+
+	texdatasize = CopyLump(&map, LUMP_TEXTURES, dtexdata, dtexdata_capacity);
+	visdatasize = CopyLump(&map, LUMP_VISIBILITY, dvisdata, dvisdata_capacity);
+	lightdatasize = CopyLump(&map, LUMP_LIGHTING, dlightdata, dlightdata_capacity);
+	entdatasize = CopyLump(&map, LUMP_ENTITIES, dentdata, dentdata_capacity);
+
+	CloseBSPMap(&map); // everything has been copied out
 
 	//
 	// swap everything
@@ -406,18 +555,41 @@ void LoadBSPFile(char* filename)
 
 //============================================================================
 
-FILE* wadfile;
-dheader_t outheader;
+/*
+=============
+OpenBSPWriter
+
+Writes a blank header, CloseBSPWriter fills it in
+=============
+*/
+void OpenBSPWriter(const char* filename, bspwriter_t* writer)
+{
+	memset(&writer->header, 0, sizeof(dheader_t));
+	writer->header.version = LittleLong(BSPVERSION);
 
-void AddLump(int lumpnum, void* data, int len)
+	writer->file = SafeOpenWrite(filename);
+	SafeWrite(writer->file, &writer->header, sizeof(dheader_t)); // overwritten later
+}
+
+void AddLump(bspwriter_t* writer, int lumpnum, const void* data, int len)
 {
+	static byte pad[4];
 	lump_t* lump;
 
-	lump = &header->lumps[lumpnum];
+	lump = &writer->header.lumps[lumpnum];
 
-	lump->fileofs = LittleLong(ftell(wadfile));
+	lump->fileofs = LittleLong(ftell(writer->file));
 	lump->filelen = LittleLong(len);
-	SafeWrite(wadfile, data, (len + 3) & ~3);
+	SafeWrite(writer->file, (void*)data, len);
+	SafeWrite(writer->file, pad, ((len + 3) & ~3) - len);
+}
+
+void CloseBSPWriter(bspwriter_t* writer)
+{
+	fseek(writer->file, 0, SEEK_SET);
+	SafeWrite(writer->file, &writer->header, sizeof(dheader_t));
+	fclose(writer->file);
+	writer->file = NULL;
 }
 
 /*
@@ -429,43 +601,34 @@ Swaps the bsp file in place, so it should not be referenced again
 */
 void WriteBSPFile(char* filename)
 {
-	header = &outheader;
-	memset(header, 0, sizeof(dheader_t));
+	bspwriter_t writer;
 
 	SwapBSPFile(true);
 
-	header->version = LittleLong(BSPVERSION);
-
-	wadfile = SafeOpenWrite(filename);
-	SafeWrite(wadfile, header, sizeof(dheader_t)); // overwritten later
-
-	AddLump(LUMP_PLANES, dplanes, numplanes * sizeof(dplane_t));
-	AddLump(LUMP_LEAFS, dleafs, numleafs * sizeof(dleaf_t));
-	AddLump(LUMP_VERTEXES, dvertexes, numvertexes * sizeof(dvertex_t));
-	AddLump(LUMP_NODES, dnodes, numnodes * sizeof(dnode_t));
-	AddLump(LUMP_TEXINFO, texinfo, numtexinfo * sizeof(texinfo_t));
-	AddLump(LUMP_FACES, dfaces, numfaces * sizeof(dface_t));
-	AddLump(LUMP_CLIPNODES, dclipnodes, numclipnodes * sizeof(dclipnode_t));
-	AddLump(LUMP_MARKSURFACES, dmarksurfaces, nummarksurfaces * sizeof(dmarksurfaces[0]));
-	AddLump(LUMP_SURFEDGES, dsurfedges, numsurfedges * sizeof(dsurfedges[0]));
-	AddLump(LUMP_EDGES, dedges, numedges * sizeof(dedge_t));
-	AddLump(LUMP_MODELS, dmodels, nummodels * sizeof(dmodel_t));
-
-	AddLump(LUMP_LIGHTING, dlightdata, lightdatasize);
-	AddLump(LUMP_VISIBILITY, dvisdata, visdatasize);
-	AddLump(LUMP_ENTITIES, dentdata, entdatasize);
-	AddLump(LUMP_TEXTURES, dtexdata, texdatasize);
-
-	fseek(wadfile, 0, SEEK_SET);
-	SafeWrite(wadfile, header, sizeof(dheader_t));
-	fclose(wadfile);
+	OpenBSPWriter(filename, &writer);
+
+	AddLump(&writer, LUMP_PLANES, dplanes, numplanes * sizeof(dplane_t));
+	AddLump(&writer, LUMP_LEAFS, dleafs, numleafs * sizeof(dleaf_t));
+	AddLump(&writer, LUMP_VERTEXES, dvertexes, numvertexes * sizeof(dvertex_t));
+	AddLump(&writer, LUMP_NODES, dnodes, numnodes * sizeof(dnode_t));
+	AddLump(&writer, LUMP_TEXINFO, texinfo, numtexinfo * sizeof(texinfo_t));
+	AddLump(&writer, LUMP_FACES, dfaces, numfaces * sizeof(dface_t));
+	AddLump(&writer, LUMP_CLIPNODES, dclipnodes, numclipnodes * sizeof(dclipnode_t));
+	AddLump(&writer, LUMP_MARKSURFACES, dmarksurfaces, nummarksurfaces * sizeof(dmarksurfaces[0]));
+	AddLump(&writer, LUMP_SURFEDGES, dsurfedges, numsurfedges * sizeof(dsurfedges[0]));
+	AddLump(&writer, LUMP_EDGES, dedges, numedges * sizeof(dedge_t));
+	AddLump(&writer, LUMP_MODELS, dmodels, nummodels * sizeof(dmodel_t));
+
+	AddLump(&writer, LUMP_LIGHTING, dlightdata, lightdatasize);
+	AddLump(&writer, LUMP_VISIBILITY, dvisdata, visdatasize);
+	AddLump(&writer, LUMP_ENTITIES, dentdata, entdatasize);
+	AddLump(&writer, LUMP_TEXTURES, dtexdata, texdatasize);
+
+	CloseBSPWriter(&writer);
 }
 
 //============================================================================
 
-#define ENTRIES(a) (sizeof(a) / sizeof(*(a)))
-#define ENTRYSIZE(a) (sizeof(*(a)))
-
 int ArrayUsage(char* szItem, int items, int maxitems, int itemsize)
 {
 	float percentage = maxitems ? items * 100.0 / maxitems : 0.0;
@@ -499,6 +662,75 @@ int GlobUsage(char* szItem, int itemstorage, int maxstorage)
 	return itemstorage;
 }
 
+// the engine limits each lump is measured against, in the order they are listed
+static struct
+{
+	char* name;
+	int lump;
+	int maxitems;
+	int itemsize; // 0 for the variable sized lumps
+} lumpusage[] =
+{
+	{"models", LUMP_MODELS, MAX_MAP_MODELS, sizeof(dmodel_t)},
+	{"planes", LUMP_PLANES, MAX_MAP_PLANES, sizeof(dplane_t)},
+	{"vertexes", LUMP_VERTEXES, MAX_MAP_VERTS, sizeof(dvertex_t)},
+	{"nodes", LUMP_NODES, MAX_MAP_NODES, sizeof(dnode_t)},
+	{"texinfos", LUMP_TEXINFO, MAX_MAP_TEXINFO, sizeof(texinfo_t)},
+	{"faces", LUMP_FACES, MAX_MAP_FACES, sizeof(dface_t)},
+	{"clipnodes", LUMP_CLIPNODES, MAX_MAP_CLIPNODES, sizeof(dclipnode_t)},
+	{"leaves", LUMP_LEAFS, MAX_MAP_LEAFS, sizeof(dleaf_t)},
+	{"marksurfaces", LUMP_MARKSURFACES, MAX_MAP_MARKSURFACES, sizeof(unsigned short)},
+	{"surfedges", LUMP_SURFEDGES, MAX_MAP_SURFEDGES, sizeof(int)},
+	{"edges", LUMP_EDGES, MAX_MAP_EDGES, sizeof(dedge_t)},
+	{"texdata", LUMP_TEXTURES, MAX_MAP_MIPTEX, 0},
+	{"lightdata", LUMP_LIGHTING, MAX_MAP_LIGHTING, 0},
+	{"visdata", LUMP_VISIBILITY, MAX_MAP_VISIBILITY, 0},
+	{"entdata", LUMP_ENTITIES, MAX_MAP_ENTSTRING, 0},
+};
+
+static void PrintLumpSizes(const int* lumpbytes)
+{
+	int i;
+	int totalmemory = 0;
+
+	printf("\n");
+	printf("Object names  Objects/Maxobjs  Memory / Maxmem  Fullness\n");
+	printf("------------  ---------------  ---------------  --------\n");
+
+	for (i = 0; i < (int)(sizeof(lumpusage) / sizeof(lumpusage[0])); i++)
+	{
+		int size = lumpusage[i].itemsize;
+		int bytes = lumpbytes[lumpusage[i].lump];
+
+		if (size)
+			totalmemory += ArrayUsage(lumpusage[i].name, bytes / size, lumpusage[i].maxitems, size);
+		else
+			totalmemory += GlobUsage(lumpusage[i].name, bytes, lumpusage[i].maxitems);
+	}
+
+	printf("=== Total BSP file data space used: %d bytes ===\n", totalmemory);
+}
+
+// the size of every lump in the loaded globals
+static void LoadedLumpBytes(int* lumpbytes)
+{
+	lumpbytes[LUMP_MODELS] = nummodels * sizeof(dmodel_t);
+	lumpbytes[LUMP_PLANES] = numplanes * sizeof(dplane_t);
+	lumpbytes[LUMP_VERTEXES] = numvertexes * sizeof(dvertex_t);
+	lumpbytes[LUMP_NODES] = numnodes * sizeof(dnode_t);
+	lumpbytes[LUMP_TEXINFO] = numtexinfo * sizeof(texinfo_t);
+	lumpbytes[LUMP_FACES] = numfaces * sizeof(dface_t);
+	lumpbytes[LUMP_CLIPNODES] = numclipnodes * sizeof(dclipnode_t);
+	lumpbytes[LUMP_LEAFS] = numleafs * sizeof(dleaf_t);
+	lumpbytes[LUMP_MARKSURFACES] = nummarksurfaces * sizeof(dmarksurfaces[0]);
+	lumpbytes[LUMP_SURFEDGES] = numsurfedges * sizeof(dsurfedges[0]);
+	lumpbytes[LUMP_EDGES] = numedges * sizeof(dedge_t);
+	lumpbytes[LUMP_TEXTURES] = texdatasize;
+	lumpbytes[LUMP_LIGHTING] = lightdatasize;
+	lumpbytes[LUMP_VISIBILITY] = visdatasize;
+	lumpbytes[LUMP_ENTITIES] = entdatasize;
+}
+
 /*
 =============
 PrintBSPFileSizes
@@ -508,33 +740,56 @@ Dumps info about current file
 */
 void PrintBSPFileSizes(void)
 {
-	//int	numtextures = texdatasize ? ((dmiptexlump_t*)dtexdata)->nummiptex : 0;
-	int totalmemory = 0;
+	int lumpbytes[HEADER_LUMPS];
 
-	printf("\n");
-	printf("Object names  Objects/Maxobjs  Memory / Maxmem  Fullness\n");
-	printf("------------  ---------------  ---------------  --------\n");
+	LoadedLumpBytes(lumpbytes);
+	PrintLumpSizes(lumpbytes);
+}
 
-	totalmemory += ArrayUsage("models", nummodels, ENTRIES(dmodels), ENTRYSIZE(dmodels));
-	totalmemory += ArrayUsage("planes", numplanes, ENTRIES(dplanes), ENTRYSIZE(dplanes));
-	totalmemory += ArrayUsage("vertexes", numvertexes, ENTRIES(dvertexes), ENTRYSIZE(dvertexes));
-	totalmemory += ArrayUsage("nodes", numnodes, ENTRIES(dnodes), ENTRYSIZE(dnodes));
-	totalmemory += ArrayUsage("texinfos", numtexinfo, ENTRIES(texinfo), ENTRYSIZE(texinfo));
-	totalmemory += ArrayUsage("faces", numfaces, ENTRIES(dfaces), ENTRYSIZE(dfaces));
-	totalmemory += ArrayUsage("clipnodes", numclipnodes, ENTRIES(dclipnodes), ENTRYSIZE(dclipnodes));
-	totalmemory += ArrayUsage("leaves", numleafs, ENTRIES(dleafs), ENTRYSIZE(dleafs));
-	totalmemory += ArrayUsage("marksurfaces", nummarksurfaces, ENTRIES(dmarksurfaces), ENTRYSIZE(dmarksurfaces));
-	totalmemory += ArrayUsage("surfedges", numsurfedges, ENTRIES(dsurfedges), ENTRYSIZE(dsurfedges));
-	totalmemory += ArrayUsage("edges", numedges, ENTRIES(dedges), ENTRYSIZE(dedges));
-
-	totalmemory += GlobUsage("texdata", texdatasize, sizeof(dtexdata));
-	totalmemory += GlobUsage("lightdata", lightdatasize, sizeof(dlightdata));
-	totalmemory += GlobUsage("visdata", visdatasize, sizeof(dvisdata));
-	totalmemory += GlobUsage("entdata", entdatasize, sizeof(dentdata));
+/*
+=============
+CheckBSPFileLimits
 
-	printf("=== Total BSP file data space used: %d bytes ===\n", totalmemory);
+LoadBSPFile takes lumps of any size, but the compilers keep tables
+of their own sized by the MAX_MAP_* limits. They call this after
+loading, so a map over the limits is an error instead of an overrun.
+=============
+*/
+void CheckBSPFileLimits(void)
+{
+	int i, items;
+	int lumpbytes[HEADER_LUMPS];
+
+	LoadedLumpBytes(lumpbytes);
+
+	for (i = 0; i < (int)(sizeof(lumpusage) / sizeof(lumpusage[0])); i++)
+	{
+		items = lumpbytes[lumpusage[i].lump];
+		if (lumpusage[i].itemsize)
+			items /= lumpusage[i].itemsize;
+
+		if (items > lumpusage[i].maxitems)
+			Error("map has %i %s, more than the limit of %i", items, lumpusage[i].name, lumpusage[i].maxitems);
+	}
 }
 
+/*
+=============
+PrintBSPMapSizes
+
+Dumps info about a mapped file without loading it
+=============
+*/
+void PrintBSPMapSizes(const bspmap_t* map)
+{
+	int i;
+	int lumpbytes[HEADER_LUMPS];
+
+	for (i = 0; i < HEADER_LUMPS; i++)
+		lumpbytes[i] = map->header.lumps[i].filelen;
+
+	PrintLumpSizes(lumpbytes);
+}
 
 /*
 =================
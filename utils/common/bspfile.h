@@ -225,66 +225,67 @@ typedef struct
 #define ANGLE_DOWN -2
 
 
-// the utilities get to be lazy and just use large static arrays
+// the lumps live in heap arrays that start at the MAX_MAP_* limits and grow
+// when LoadBSPFile reads a bigger lump, so existing maps over the limits still load
 
 extern int nummodels;
-extern dmodel_t dmodels[MAX_MAP_MODELS];
+extern dmodel_t* dmodels;
 extern int dmodels_checksum;
 
 extern int visdatasize;
-extern byte dvisdata[MAX_MAP_VISIBILITY];
+extern byte* dvisdata;
 extern int dvisdata_checksum;
 
 extern int lightdatasize;
-extern byte dlightdata[MAX_MAP_LIGHTING];
+extern byte* dlightdata;
 extern int dlightdata_checksum;
 
 extern int texdatasize;
-extern byte dtexdata[MAX_MAP_MIPTEX]; // (dmiptexlump_t)
+extern byte* dtexdata; // (dmiptexlump_t)
 extern int dtexdata_checksum;
 
 extern int entdatasize;
-extern char dentdata[MAX_MAP_ENTSTRING];
+extern char* dentdata;
 extern int dentdata_checksum;
 
 extern int numleafs;
-extern dleaf_t dleafs[MAX_MAP_LEAFS];
+extern dleaf_t* dleafs;
 extern int dleafs_checksum;
 
 extern int numplanes;
-extern dplane_t dplanes[MAX_MAP_PLANES];
+extern dplane_t* dplanes;
 extern int dplanes_checksum;
 
 extern int numvertexes;
-extern dvertex_t dvertexes[MAX_MAP_VERTS];
+extern dvertex_t* dvertexes;
 extern int dvertexes_checksum;
 
 extern int numnodes;
-extern dnode_t dnodes[MAX_MAP_NODES];
+extern dnode_t* dnodes;
 extern int dnodes_checksum;
 
 extern int numtexinfo;
-extern texinfo_t texinfo[MAX_MAP_TEXINFO];
+extern texinfo_t* texinfo;
 extern int texinfo_checksum;
 
 extern int numfaces;
-extern dface_t dfaces[MAX_MAP_FACES];
+extern dface_t* dfaces;
 extern int dfaces_checksum;
 
 extern int numclipnodes;
-extern dclipnode_t dclipnodes[MAX_MAP_CLIPNODES];
+extern dclipnode_t* dclipnodes;
 extern int dclipnodes_checksum;
 
 extern int numedges;
-extern dedge_t dedges[MAX_MAP_EDGES];
+extern dedge_t* dedges;
 extern int dedges_checksum;
 
 extern int nummarksurfaces;
-extern unsigned short dmarksurfaces[MAX_MAP_MARKSURFACES];
+extern unsigned short* dmarksurfaces;
 extern int dmarksurfaces_checksum;
 
 extern int numsurfedges;
-extern int dsurfedges[MAX_MAP_SURFEDGES];
+extern int* dsurfedges;
 extern int dsurfedges_checksum;
 
 int FastChecksum(void* buffer, int bytes);
@@ -295,6 +296,59 @@ int CompressVis(byte* vis, byte* dest);
 void LoadBSPFile(char* filename);
 void WriteBSPFile(char* filename);
 void PrintBSPFileSizes(void);
+void CheckBSPFileLimits(void); // Errors when a loaded lump is over its MAX_MAP_* limit
+
+//===============
+
+// A read only mapping of a bsp file.  Lumps are viewed in place, in file
+// byte order, so tools that only inspect a map never copy it.
+typedef struct
+{
+	byte* base;
+	int size;
+	dheader_t header; // swapped copy, the mapping can't be written
+	void* file;
+	void* mapping;
+} bspmap_t;
+
+void OpenBSPMap(const char* filename, bspmap_t* map);
+void CloseBSPMap(bspmap_t* map);
+const void* BSPMapLump(const bspmap_t* map, int lump, int size, int* count);
+void PrintBSPMapSizes(const bspmap_t* map);
+
+template <typename T>
+struct lumpview_t
+{
+	const T* data;
+	int count;
+
+	const T& operator[](int i) const
+	{
+		if (i < 0 || i >= count)
+			Error("lump index %i out of range (%i entries)", i, count);
+		return data[i];
+	}
+};
+
+template <typename T>
+lumpview_t<T> LumpView(const bspmap_t* map, int lump)
+{
+	lumpview_t<T> view;
+
+	view.data = (const T*)BSPMapLump(map, lump, sizeof(T), &view.count);
+	return view;
+}
+
+// Writes a bsp one lump at a time, straight from the caller's data
+typedef struct
+{
+	FILE* file;
+	dheader_t header;
+} bspwriter_t;
+
+void OpenBSPWriter(const char* filename, bspwriter_t* writer);
+void AddLump(bspwriter_t* writer, int lumpnum, const void* data, int len);
+void CloseBSPWriter(bspwriter_t* writer);
 
 //===============
 
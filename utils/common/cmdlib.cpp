@@ -135,7 +135,7 @@ void SetQdirFromPath()
 
 char* ExpandArg(char* path)
 {
-	static char full[1024];
+	static thread_local char full[1024];
 
 	if (path[0] != '/' && path[0] != '\\' && path[1] != ':')
 	{
@@ -150,7 +150,7 @@ char* ExpandArg(char* path)
 char* ExpandPath(char* path)
 {
 	const char* psz;
-	static char full[1024];
+	static thread_local char full[1024];
 	if (!qdir)
 		Error("ExpandPath called without qdir set");
 	if (path[0] == '/' || path[0] == '\\' || path[1] == ':')
@@ -35,7 +35,7 @@
 #define CMAPID ('C' + ('M' << 8) + ((int)'A' << 16) + ((int)'P' << 24))
 
 
-bmhd_t bmhd;
+thread_local bmhd_t bmhd;
 
 int Align(int l)
 {
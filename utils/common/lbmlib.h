@@ -46,7 +46,7 @@ typedef struct
 	WORD pageWidth, pageHeight;
 } bmhd_t;
 
-extern bmhd_t bmhd; // will be in native byte order
+extern thread_local bmhd_t bmhd; // will be in native byte order
 
 
 void LoadLBM(char* filename, byte** picture, byte** palette);
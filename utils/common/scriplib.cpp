@@ -29,13 +29,13 @@ typedef struct
 } script_t;
 
 #define MAX_INCLUDES 8
-script_t scriptstack[MAX_INCLUDES];
-script_t* script;
-int scriptline;
+thread_local script_t scriptstack[MAX_INCLUDES];
+thread_local script_t* script;
+thread_local int scriptline;
 
-char token[MAXTOKEN];
-qboolean endofscript;
-qboolean tokenready; // only true if UnGetToken was just called
+thread_local char token[MAXTOKEN];
+thread_local qboolean endofscript;
+thread_local qboolean tokenready; // only true if UnGetToken was just called
 
 /*
 ==============
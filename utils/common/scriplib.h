@@ -16,11 +16,12 @@
 
 #define MAXTOKEN 512
 
-extern char token[MAXTOKEN];
+// the parse state is per thread, so studiomdl can compile several scripts at once
+extern thread_local char token[MAXTOKEN];
 extern char *scriptbuffer, *script_p, *scriptend_p;
 extern int grabbed;
-extern int scriptline;
-extern qboolean endofscript;
+extern thread_local int scriptline;
+extern thread_local qboolean endofscript;
 
 
 void LoadScriptFile(char* filename);
@@ -12,100 +12,83 @@
 #define NO_THREAD_NAMES
 #include "threads.h"
 
-#define MAX_THREADS 64
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
 
-int dispatch;
-int workcount;
-int oldf;
-qboolean pacifier;
+#ifdef __linux__
+#include <sched.h>
+#endif
 
-qboolean threaded;
+#define MAX_THREADS 256
 
-/*
-=============
-GetThreadWork
+// Work is handed out in chunks so threads do not fight over the dispatch counter.
+// Chunks shrink as the work runs out, so the threads finish at about the same time.
+#define MAX_WORK_CHUNK 64
+#define WORK_CHUNKS_PER_THREAD 8
 
-=============
-*/
-int GetThreadWork(void)
-{
-	int r;
-	int f;
-
-	ThreadLock();
+int numthreads = -1;
 
-	if (dispatch == workcount)
-	{
-		ThreadUnlock();
-		return -1;
-	}
+std::atomic<int> dispatch;
+int workcount;
+std::atomic<int> oldf;
+qboolean pacifier;
 
-	f = 10 * dispatch / workcount;
-	if (f != oldf)
-	{
-		oldf = f;
-		if (pacifier)
-			printf("%i...", f);
-	}
+qboolean threaded;
 
-	r = dispatch;
-	dispatch++;
-	ThreadUnlock();
+static std::mutex crit;
+static std::mutex pacifiercrit;
 
-	return r;
-}
+// Set while this thread holds crit.  std::mutex can't be locked twice by
+// one thread, so a recursive ThreadLock has to be caught before it tries.
+static thread_local qboolean holdslock;
 
+// Bumped by each RunThreadsOn, so a thread never uses a chunk left over from the previous one
+static int workphase;
 
-void (*workfunction)(int);
-
-void ThreadWorkerFunction(int /*threadnum*/)
+struct threadchunk_t
 {
-	int work;
+	int phase;
+	int next;
+	int end;
+	int thread;
+};
 
-	while (1)
-	{
-		work = GetThreadWork();
-		if (work == -1)
-			break;
-		workfunction(work);
-	}
-}
+static thread_local threadchunk_t threadchunk = {-1, 0, 0, 0};
 
-void RunThreadsOnIndividual(int workcnt, qboolean showpacifier, void (*func)(int))
+struct threadstats_t
 {
-	workfunction = func;
-	RunThreadsOn(workcnt, showpacifier, ThreadWorkerFunction);
-}
+	int items;
+	double busy;
+};
 
+static threadstats_t threadstats[MAX_THREADS];
 
 /*
-===================================================================
-
-WIN32
+=============
+ThreadSetDefault
 
-===================================================================
+Uses one thread per processor unless -threads gave a count
+=============
 */
-#ifdef WIN32
-
-#define USED
-
-#include <windows.h>
-
-int numthreads = -1;
-CRITICAL_SECTION crit;
-static int enter;
-
 void ThreadSetDefault(void)
 {
-	SYSTEM_INFO info;
+#ifdef __linux__
+	// hardware_concurrency counts every processor, even the ones taskset or
+	// a container keeps this process off, which would oversubscribe the rest
+	cpu_set_t cpus;
+	if (numthreads <= 0 && sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+		numthreads = CPU_COUNT(&cpus);
+#endif
 
-	if (numthreads == -1) // not set manually
-	{
-		GetSystemInfo(&info);
-		numthreads = info.dwNumberOfProcessors;
-		if (numthreads < 1 || numthreads > 32)
-			numthreads = 1;
-	}
+	if (numthreads <= 0) // not set manually
+		numthreads = std::thread::hardware_concurrency();
+
+	if (numthreads < 1)
+		numthreads = 1;
+	if (numthreads > MAX_THREADS)
+		numthreads = MAX_THREADS;
 
 	qprintf("%i threads\n", numthreads);
 }
@@ -115,189 +98,145 @@ void ThreadLock(void)
 {
 	if (!threaded)
 		return;
-	EnterCriticalSection(&crit);
-	if (enter)
+	if (holdslock)
 		Error("Recursive ThreadLock\n");
-	enter = 1;
+	crit.lock();
+	holdslock = true;
 }
 
 void ThreadUnlock(void)
 {
 	if (!threaded)
 		return;
-	if (!enter)
+	if (!holdslock)
 		Error("ThreadUnlock without lock\n");
-	enter = 0;
-	LeaveCriticalSection(&crit);
+	holdslock = false;
+	crit.unlock();
 }
 
 /*
 =============
-RunThreadsOn
+GetThreadWork
+
+Returns the next work item for the calling thread, or -1 when
+there is none left. Items are taken from the thread's own chunk,
+and a new chunk is only claimed when that runs out.
 =============
 */
-void RunThreadsOn(int workcnt, qboolean showpacifier, void (*func)(int))
+int GetThreadWork(void)
 {
-	DWORD threadid[MAX_THREADS];
-	HANDLE threadhandle[MAX_THREADS];
-	int i;
-	int start, end;
+	threadchunk_t& chunk = threadchunk;
 
-	start = I_FloatTime();
-	dispatch = 0;
-	workcount = workcnt;
-	oldf = -1;
-	pacifier = showpacifier;
-	threaded = true;
-	//
-	// run threads in parallel
-	//
-	InitializeCriticalSection(&crit);
-	for (i = 0; i < numthreads; i++)
+	if (chunk.phase != workphase)
 	{
-		threadhandle[i] = CreateThread(
-			NULL,						  // LPSECURITY_ATTRIBUTES lpsa,
-			0,							  // DWORD cbStack,
-			(LPTHREAD_START_ROUTINE)func, // LPTHREAD_START_ROUTINE lpStartAddr,
-			(LPVOID)i,					  // LPVOID lpvThreadParm,
-			0,							  //   DWORD fdwCreate,
-			&threadid[i]);
+		chunk.phase = workphase;
+		chunk.next = chunk.end = 0;
 	}
 
-	for (i = 0; i < numthreads; i++)
-		WaitForSingleObject(threadhandle[i], INFINITE);
-	DeleteCriticalSection(&crit);
-
-	threaded = false;
-	end = I_FloatTime();
-	if (pacifier)
-		printf(" (%i)\n", end - start);
-}
+	if (chunk.next == chunk.end)
+	{
+		int start = dispatch.load();
+		int size;
+
+		do
+		{
+			if (start >= workcount)
+				return -1;
+
+			size = (workcount - start) / (numthreads * WORK_CHUNKS_PER_THREAD);
+			if (size < 1)
+				size = 1;
+			if (size > MAX_WORK_CHUNK)
+				size = MAX_WORK_CHUNK;
+		} while (!dispatch.compare_exchange_weak(start, start + size));
+
+		chunk.next = start;
+		chunk.end = start + size;
+
+		int f = 10 * start / workcount;
+		if (f > oldf)
+		{
+			std::lock_guard<std::mutex> lock(pacifiercrit);
+			while (oldf < f)
+			{
+				oldf++;
+				if (pacifier)
+					printf("%i...", oldf.load());
+			}
+		}
+	}
 
+	threadstats[chunk.thread].items++;
 
-#endif
-
-/*
-===================================================================
+	return chunk.next++;
+}
 
-OSF1
 
-===================================================================
-*/
+void (*workfunction)(int);
 
-#ifdef __osf__
-#define USED
+void ThreadWorkerFunction(int /*threadnum*/)
+{
+	int work;
 
-int numthreads = 4;
+	while (1)
+	{
+		work = GetThreadWork();
+		if (work == -1)
+			break;
+		workfunction(work);
+	}
+}
 
-void ThreadSetDefault(void)
+void RunThreadsOnIndividual(int workcnt, qboolean showpacifier, void (*func)(int))
 {
-	numthreads = 4;
+	workfunction = func;
+	RunThreadsOn(workcnt, showpacifier, ThreadWorkerFunction);
 }
 
 
-#include <pthread.h>
-
-pthread_mutex_t* my_mutex;
-
-void ThreadLock(void)
+static void RunThread(int threadnum, void (*func)(int), std::chrono::steady_clock::time_point start)
 {
-	if (my_mutex)
-		pthread_mutex_lock(my_mutex);
-}
+	threadchunk.thread = threadnum;
 
-void ThreadUnlock(void)
-{
-	if (my_mutex)
-		pthread_mutex_unlock(my_mutex);
-}
+	func(threadnum);
 
+	threadstats[threadnum].busy = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 
 /*
 =============
-RunThreadsOn
+PrintThreadStats
+
+A thread is busy from the start of the run until it finds no
+more work, so anything short of 100% is time spent waiting for
+the slowest thread to finish.
 =============
 */
-void RunThreadsOn(int workcnt, qboolean showpacifier, void (*func)(int))
+static void PrintThreadStats(int threads, double elapsed)
 {
 	int i;
-	pthread_t work_threads[MAX_THREADS];
-	pthread_addr_t status;
-	pthread_attr_t attrib;
-	pthread_mutexattr_t mattrib;
-	int start, end;
+	double total, least;
 
-	start = I_FloatTime();
-	dispatch = 0;
-	workcount = workcnt;
-	oldf = -1;
-	pacifier = showpacifier;
-	threaded = true;
-
-	if (pacifier)
-		setbuf(stdout, NULL);
+	if (threads < 2 || elapsed <= 0)
+		return;
 
-	if (!my_mutex)
+	total = 0;
+	least = 1;
+	for (i = 0; i < threads; i++)
 	{
-		my_mutex = malloc(sizeof(*my_mutex));
-		if (pthread_mutexattr_create(&mattrib) == -1)
-			Error("pthread_mutex_attr_create failed");
-		if (pthread_mutexattr_setkind_np(&mattrib, MUTEX_FAST_NP) == -1)
-			Error("pthread_mutexattr_setkind_np failed");
-		if (pthread_mutex_init(my_mutex, mattrib) == -1)
-			Error("pthread_mutex_init failed");
+		double used = threadstats[i].busy / elapsed;
+		total += used;
+		if (used < least)
+			least = used;
 	}
 
-	if (pthread_attr_create(&attrib) == -1)
-		Error("pthread_attr_create failed");
-	if (pthread_attr_setstacksize(&attrib, 0x100000) == -1)
-		Error("pthread_attr_setstacksize failed");
-
-	for (i = 0; i < numthreads; i++)
-	{
-		if (pthread_create(&work_threads[i], attrib, (pthread_startroutine_t)func, (pthread_addr_t)i) == -1)
-			Error("pthread_create failed");
-	}
+	printf("%-20s %i threads, %.0f%% utilisation, lowest %.0f%%\n", "", threads, 100 * total / threads, 100 * least);
 
-	for (i = 0; i < numthreads; i++)
+	if (verbose)
 	{
-		if (pthread_join(work_threads[i], &status) == -1)
-			Error("pthread_join failed");
+		for (i = 0; i < threads; i++)
+			printf("%-20s thread %3i: %8i items, %5.1f%%\n", "", i, threadstats[i].items, 100 * threadstats[i].busy / elapsed);
 	}
-
-	threaded = false;
-
-	end = I_FloatTime();
-	if (pacifier)
-		printf(" (%i)\n", end - start);
-}
-
-
-#endif
-
-/*
-=======================================================================
-
-  SINGLE THREAD
-
-=======================================================================
-*/
-
-#ifndef USED
-
-int numthreads = 1;
-
-void ThreadSetDefault(void)
-{
-	numthreads = 1;
-}
-
-void ThreadLock(void)
-{
-}
-
-void ThreadUnlock(void)
-{
 }
 
 /*
@@ -307,23 +246,61 @@ RunThreadsOn
 */
 void RunThreadsOn(int workcnt, qboolean showpacifier, void (*func)(int))
 {
+	std::thread threadhandle[MAX_THREADS];
 	int i;
 	int start, end;
+	int threads;
 
+	start = I_FloatTime();
 	dispatch = 0;
 	workcount = workcnt;
 	oldf = -1;
 	pacifier = showpacifier;
-	start = I_FloatTime();
-#ifdef NeXT
+	workphase++;
+
+	threads = numthreads;
+	if (threads < 1)
+		threads = 1;
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	for (i = 0; i < threads; i++)
+	{
+		threadstats[i].items = 0;
+		threadstats[i].busy = 0;
+	}
+
 	if (pacifier)
 		setbuf(stdout, NULL);
-#endif
-	func(0);
+
+	const std::chrono::steady_clock::time_point clockstart = std::chrono::steady_clock::now();
+
+	if (threads == 1)
+	{
+		RunThread(0, func, clockstart);
+	}
+	else
+	{
+		//
+		// run threads in parallel
+		//
+		threaded = true;
+
+		for (i = 0; i < threads; i++)
+			threadhandle[i] = std::thread(RunThread, i, func, clockstart);
+
+		for (i = 0; i < threads; i++)
+			threadhandle[i].join();
+
+		threaded = false;
+	}
+
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - clockstart).count();
 
 	end = I_FloatTime();
 	if (pacifier)
+	{
 		printf(" (%i)\n", end - start);
+		PrintThreadStats(threads, elapsed);
+	}
 }
-
-#endif
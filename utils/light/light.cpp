@@ -211,6 +211,7 @@ int main(int argc, char** argv)
 	DefaultExtension(source, ".bsp");
 
 	LoadBSPFile(source);
+	CheckBSPFileLimits();
 	LoadEntities();
 
 	MakeTnodes();
@@ -0,0 +1,777 @@
+/***
+*
+*	Copyright (c) 1996-2002, Valve LLC. All rights reserved.
+*
+*	This product contains software technology licensed from Id
+*	Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc.
+*	All Rights Reserved.
+*
+****/
+
+// pmreplay.cpp -- runs a stream of usercmds through the shared player movement
+// code against a bsp's clip hulls, with no engine.  It times the replay and can
+// write the resulting player states out, or check them against a golden trace,
+// so a change to pm_shared can be shown to move the player exactly as before.
+
+#include <chrono>
+#include <stdarg.h>
+#include <vector>
+
+#include "Platform.h"
+#include "mathlib.h"
+#include "cdll_dll.h"
+#include "const.h"
+#include "usercmd.h"
+#include "pm_defs.h"
+#include "pm_shared.h"
+#include "pm_materials.h"
+#include "pm_movevars.h"
+#include "pmreplay.h"
+
+// bsp hull for each pmove->usehull: standing, ducked, point, large
+static const int hullforusehull[4] = {1, 3, 0, 2};
+
+static playermove_t pm;
+movevars_t movevars;
+
+typedef struct
+{
+	char physinfo[MAX_PHYSINFO_STRING];
+	bool hasorigin;
+	Vector origin;
+	Vector angles;
+	std::vector<usercmd_t> cmds;
+} stream_t;
+
+static stream_t stream;
+static playermove_t startstate; // pm as it was before the first command
+
+static bool verbose = false;
+static double replaytime;
+static unsigned int randomseed;
+static int numtraces;
+
+/*
+==============================================================================
+
+ENGINE FUNCTIONS
+
+The part of the engine PM_Move calls back into.  Only the world is solid.
+
+==============================================================================
+*/
+
+static void HullOffset(int usehull, float* offset)
+{
+	float clip_mins[3];
+
+	WorldHullMins(hullforusehull[usehull], clip_mins);
+	for (int i = 0; i < 3; i++)
+		offset[i] = clip_mins[i] - pm.player_mins[usehull][i];
+}
+
+static pmtrace_t RP_PlayerTrace(float* start, float* end, int traceFlags, int ignore_pe)
+{
+	pmtrace_t trace;
+	hulltrace_t total;
+	float offset[3], start_l[3], end_l[3];
+	int i;
+
+	numtraces++;
+
+	memset(&trace, 0, sizeof(trace));
+	trace.fraction = 1;
+	trace.ent = -1;
+	VectorCopy(end, trace.endpos);
+
+	if (ignore_pe == 0)
+		return trace;
+
+	HullOffset(pm.usehull, offset);
+	for (i = 0; i < 3; i++)
+	{
+		start_l[i] = start[i] - offset[i];
+		end_l[i] = end[i] - offset[i];
+	}
+
+	WorldTrace(hullforusehull[pm.usehull], start_l, end_l, &total);
+
+	if (0 != total.allsolid)
+		total.startsolid = 1;
+	if (0 != total.startsolid)
+		total.fraction = 0;
+
+	if (total.fraction < trace.fraction)
+	{
+		trace.allsolid = total.allsolid;
+		trace.startsolid = total.startsolid;
+		trace.inopen = total.inopen;
+		trace.inwater = total.inwater;
+		trace.fraction = total.fraction;
+		for (i = 0; i < 3; i++)
+			trace.endpos[i] = total.endpos[i] + offset[i];
+		VectorCopy(total.normal, trace.plane.normal);
+		trace.plane.dist = total.dist;
+		trace.ent = 0;
+	}
+
+	return trace;
+}
+
+static int RP_PointContents(float* p, int* truecontents)
+{
+	return WorldPlayerContents(p, truecontents);
+}
+
+static int RP_TruePointContents(float* p)
+{
+	return WorldPointContents(0, p);
+}
+
+static int RP_TestPlayerPosition(float* pos, pmtrace_t* ptrace)
+{
+	float offset[3], test[3];
+
+	if (ptrace)
+		*ptrace = RP_PlayerTrace(pos, pos, PM_NORMAL, -1);
+
+	HullOffset(pm.usehull, offset);
+	VectorSubtract(pos, offset, test);
+
+	if (WorldPointContents(hullforusehull[pm.usehull], test) == CONTENTS_SOLID)
+		return 0;
+
+	return -1;
+}
+
+static const char* RP_Info_ValueForKey(const char* s, const char* key)
+{
+	static char value[2][MAX_PHYSINFO_STRING]; // two buffers so compares work
+	static int valueindex;
+	char pkey[MAX_PHYSINFO_STRING];
+	char* o;
+
+	valueindex ^= 1;
+	if (*s == '\\')
+		s++;
+
+	while (true)
+	{
+		o = pkey;
+		while (*s != '\\')
+		{
+			if ('\0' == *s)
+				return "";
+			*o++ = *s++;
+		}
+		*o = 0;
+		s++;
+
+		o = value[valueindex];
+		while (*s != '\\' && '\0' != *s)
+			*o++ = *s++;
+		*o = 0;
+
+		if (0 == strcmp(key, pkey))
+			return value[valueindex];
+
+		if ('\0' == *s)
+			return "";
+		s++;
+	}
+}
+
+// the same sequence on every replay, so repeats take the same path
+static int32 RP_RandomLong(int32 lLow, int32 lHigh)
+{
+	randomseed = randomseed * 1103515245 + 12345;
+
+	const unsigned int range = lHigh - lLow + 1;
+	if (range <= 1)
+		return lLow;
+
+	return lLow + (int32)((randomseed >> 8) % range);
+}
+
+static float RP_RandomFloat(float flLow, float flHigh)
+{
+	randomseed = randomseed * 1103515245 + 12345;
+
+	return flLow + (randomseed >> 8) * (1.0f / 16777216.0f) * (flHigh - flLow);
+}
+
+static double RP_Sys_FloatTime()
+{
+	return replaytime;
+}
+
+static void RP_Con_Printf(const char* fmt, ...)
+{
+	va_list argptr;
+
+	va_start(argptr, fmt);
+	vprintf(fmt, argptr);
+	va_end(argptr);
+}
+
+static void RP_Con_DPrintf(const char* fmt, ...)
+{
+	va_list argptr;
+
+	if (!verbose)
+		return;
+
+	va_start(argptr, fmt);
+	vprintf(fmt, argptr);
+	va_end(argptr);
+}
+
+static void RP_Con_NPrintf(int idx, const char* fmt, ...)
+{
+}
+
+// there are no textures in the clip hulls, so everything walks like concrete
+static const char* RP_TraceTexture(int ground, float* vstart, float* vend)
+{
+	return NULL;
+}
+
+static void RP_PlaySound(int channel, const char* sample, float volume, float attenuation, int fFlags, int pitch)
+{
+}
+
+static void RP_StuckTouch(int hitent, pmtrace_t* ptraceresult)
+{
+}
+
+static void RP_Particle(float* origin, int color, float life, int zpos, int zvel)
+{
+}
+
+static int RP_GetModelType(model_t* mod)
+{
+	return 0; // mod_brush
+}
+
+static void RP_GetModelBounds(model_t* mod, float* mins, float* maxs)
+{
+	VectorClear(mins);
+	VectorClear(maxs);
+}
+
+static int RP_COM_FileSize(const char* filename)
+{
+	return -1;
+}
+
+static byte* RP_COM_LoadFile(const char* path, int usehunk, int* pLength)
+{
+	return NULL;
+}
+
+static void RP_COM_FreeFile(void* buffer)
+{
+}
+
+static void InitPlayerMove(const char* bspname)
+{
+	memset(&pm, 0, sizeof(pm));
+
+	movevars.gravity = 800;
+	movevars.stopspeed = 100;
+	movevars.maxspeed = 320;
+	movevars.spectatormaxspeed = 500;
+	movevars.accelerate = 10;
+	movevars.airaccelerate = 10;
+	movevars.wateraccelerate = 10;
+	movevars.friction = 4;
+	movevars.edgefriction = 2;
+	movevars.waterfriction = 1;
+	movevars.entgravity = 1;
+	movevars.bounce = 1;
+	movevars.stepsize = 18;
+	movevars.maxvelocity = 2000;
+	movevars.footsteps = true;
+	movevars.rollspeed = 200;
+	pm.movevars = &movevars;
+
+	pm.PM_Info_ValueForKey = RP_Info_ValueForKey;
+	pm.PM_Particle = RP_Particle;
+	pm.PM_TestPlayerPosition = RP_TestPlayerPosition;
+	pm.Con_NPrintf = RP_Con_NPrintf;
+	pm.Con_DPrintf = RP_Con_DPrintf;
+	pm.Con_Printf = RP_Con_Printf;
+	pm.Sys_FloatTime = RP_Sys_FloatTime;
+	pm.PM_StuckTouch = RP_StuckTouch;
+	pm.PM_PointContents = RP_PointContents;
+	pm.PM_TruePointContents = RP_TruePointContents;
+	pm.PM_PlayerTrace = RP_PlayerTrace;
+	pm.RandomLong = RP_RandomLong;
+	pm.RandomFloat = RP_RandomFloat;
+	pm.PM_GetModelType = RP_GetModelType;
+	pm.PM_GetModelBounds = RP_GetModelBounds;
+	pm.COM_FileSize = RP_COM_FileSize;
+	pm.COM_LoadFile = RP_COM_LoadFile;
+	pm.COM_FreeFile = RP_COM_FreeFile;
+	pm.PM_PlaySound = RP_PlaySound;
+	pm.PM_TraceTexture = RP_TraceTexture;
+
+	// the world is the only physent, traced through the hulls above
+	pm.numphysent = 1;
+	strcpy(pm.physents[0].name, bspname);
+	pm.physents[0].model = (model_t*)&pm; // anything not NULL
+	pm.physents[0].solid = SOLID_BSP;
+	pm.physents[0].movetype = MOVETYPE_PUSH;
+
+	PM_Init(&pm);
+}
+
+static void ResetPlayer()
+{
+	pm.player_index = 0;
+	pm.server = true;
+	pm.multiplayer = false;
+	pm.runfuncs = true;
+	pm.movetype = MOVETYPE_WALK;
+	pm.gravity = 1;
+	pm.friction = 1;
+	pm.onground = -1;
+	pm.waterlevel = 0;
+	pm.watertype = CONTENTS_EMPTY;
+	pm.view_ofs = VEC_VIEW;
+	pm.chtexturetype = CHAR_TEX_CONCRETE;
+
+	pm.origin = stream.origin;
+	pm.angles = stream.angles;
+	pm.oldangles = stream.angles;
+	strcpy(pm.physinfo, stream.physinfo);
+}
+
+/*
+==============================================================================
+
+STREAMS
+
+A stream is a text file of usercmds, one per line:
+
+// comment
+origin x y z             (optional, the map's info_player_start otherwise)
+angles pitch yaw roll    (optional)
+physinfo \key\value...   (optional)
+cmd msec pitch yaw roll forwardmove sidemove upmove buttons impulse
+
+==============================================================================
+*/
+
+static void LoadStream(const char* filename)
+{
+	char line[1024];
+	char* s;
+	int linenum = 0;
+	float f[8];
+	int buttons, impulse, msec;
+	usercmd_t cmd;
+
+	FILE* f_in = SafeOpenRead(filename);
+
+	while (fgets(line, sizeof(line), f_in))
+	{
+		linenum++;
+
+		s = line;
+		while (isspace(*s))
+			s++;
+		if ('\0' == *s || (s[0] == '/' && s[1] == '/'))
+			continue;
+
+		if (0 == strncmp(s, "cmd ", 4))
+		{
+			if (sscanf(s + 4, "%i %f %f %f %f %f %f %i %i", &msec, &f[0], &f[1], &f[2], &f[3], &f[4], &f[5], &buttons, &impulse) != 9)
+				Error("%s:%i: bad cmd line", filename, linenum);
+			if (msec < 0 || msec > 255)
+				Error("%s:%i: msec %i out of range", filename, linenum, msec);
+
+			memset(&cmd, 0, sizeof(cmd));
+			cmd.msec = msec;
+			cmd.viewangles = Vector(f[0], f[1], f[2]);
+			cmd.forwardmove = f[3];
+			cmd.sidemove = f[4];
+			cmd.upmove = f[5];
+			cmd.buttons = buttons;
+			cmd.impulse = impulse;
+			stream.cmds.push_back(cmd);
+		}
+		else if (0 == strncmp(s, "origin ", 7))
+		{
+			if (sscanf(s + 7, "%f %f %f", &f[0], &f[1], &f[2]) != 3)
+				Error("%s:%i: bad origin line", filename, linenum);
+			stream.origin = Vector(f[0], f[1], f[2]);
+			stream.hasorigin = true;
+		}
+		else if (0 == strncmp(s, "angles ", 7))
+		{
+			if (sscanf(s + 7, "%f %f %f", &f[0], &f[1], &f[2]) != 3)
+				Error("%s:%i: bad angles line", filename, linenum);
+			stream.angles = Vector(f[0], f[1], f[2]);
+		}
+		else if (0 == strncmp(s, "physinfo ", 9))
+		{
+			s += 9;
+			while (isspace(*s))
+				s++;
+			s[strcspn(s, "\r\n")] = 0;
+			if (strlen(s) >= MAX_PHYSINFO_STRING)
+				Error("%s:%i: physinfo is longer than %i characters", filename, linenum, MAX_PHYSINFO_STRING - 1);
+			strcpy(stream.physinfo, s);
+		}
+		else
+			Error("%s:%i: unknown line", filename, linenum);
+	}
+
+	fclose(f_in);
+}
+
+static unsigned int genseed;
+
+static unsigned int GenRandom()
+{
+	// xorshift, so a seed makes the same stream on every platform
+	genseed ^= genseed << 13;
+	genseed ^= genseed >> 17;
+	genseed ^= genseed << 5;
+	return genseed;
+}
+
+static float GenFloat(float low, float high)
+{
+	return low + (GenRandom() >> 8) * (1.0f / 16777216.0f) * (high - low);
+}
+
+// A wander around the map: runs in bursts, turning as it goes, and now and
+// then jumps, ducks, or does both, so the walk, air, step and duck code all run.
+static void GenerateStream(const char* filename, int count, unsigned int seed)
+{
+	float forward = 0, side = 0, turn = 0, pitch = 0, yaw = stream.angles.y;
+	int burst = 0, buttons, held = 0, heldbuttons = 0;
+
+	genseed = seed ? seed : 1;
+
+	FILE* f = SafeOpenWrite(filename);
+	fprintf(f, "// %i commands generated by pmreplay, seed %u\n", count, seed);
+	if (stream.hasorigin)
+		fprintf(f, "origin %g %g %g\n", stream.origin[0], stream.origin[1], stream.origin[2]);
+	fprintf(f, "angles %g %g %g\n", stream.angles[0], stream.angles.y, stream.angles[2]);
+
+	for (int i = 0; i < count; i++)
+	{
+		if (--burst <= 0)
+		{
+			static const float speeds[] = {400, 400, 400, 200, 0, -200};
+
+			burst = 20 + GenRandom() % 100;
+			forward = speeds[GenRandom() % 6];
+			side = (GenRandom() % 3 - 1.0f) * 400 * ((GenRandom() & 3) == 0);
+			turn = GenFloat(-3, 3);
+			pitch = GenFloat(-30, 30);
+		}
+
+		if (held > 0)
+			held--;
+		else
+		{
+			heldbuttons = 0;
+			if (GenRandom() % 60 == 0)
+			{
+				heldbuttons = IN_JUMP;
+				held = 1 + GenRandom() % 30;
+			}
+			if (GenRandom() % 150 == 0)
+			{
+				heldbuttons |= IN_DUCK;
+				held = 20 + GenRandom() % 80;
+			}
+		}
+
+		buttons = heldbuttons;
+		if (forward > 0)
+			buttons |= IN_FORWARD;
+		else if (forward < 0)
+			buttons |= IN_BACK;
+		if (side > 0)
+			buttons |= IN_MOVERIGHT;
+		else if (side < 0)
+			buttons |= IN_MOVELEFT;
+
+		yaw = anglemod(yaw + turn);
+		fprintf(f, "cmd %i %g %g 0 %g %g 0 %i 0\n", 8 + GenRandom() % 5, pitch, yaw, forward, side, buttons);
+	}
+
+	fclose(f);
+}
+
+/*
+==============================================================================
+
+REPLAY
+
+==============================================================================
+*/
+
+#define TRACE_FLOATS 6
+
+typedef struct
+{
+	int move;
+	float v[TRACE_FLOATS]; // origin, velocity
+	int flags, onground, waterlevel, usehull;
+} movestate_t;
+
+static void GetMoveState(int move, movestate_t* state)
+{
+	state->move = move;
+	for (int i = 0; i < 3; i++)
+	{
+		state->v[i] = pm.origin[i];
+		state->v[3 + i] = pm.velocity[i];
+	}
+	state->flags = pm.flags;
+	state->onground = pm.onground;
+	state->waterlevel = pm.waterlevel;
+	state->usehull = pm.usehull;
+}
+
+static void WriteMoveState(FILE* f, const movestate_t* state)
+{
+	fprintf(f, "%i", state->move);
+	for (int i = 0; i < TRACE_FLOATS; i++)
+		fprintf(f, " %.9g", state->v[i]);
+	fprintf(f, " %i %i %i %i\n", state->flags, state->onground, state->waterlevel, state->usehull);
+}
+
+static bool ReadMoveState(FILE* f, movestate_t* state)
+{
+	char line[1024];
+	float* v = state->v;
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if (line[0] == '/' || line[0] == '\n' || line[0] == '\r')
+			continue;
+		if (sscanf(line, "%i %f %f %f %f %f %f %i %i %i %i", &state->move, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5],
+				&state->flags, &state->onground, &state->waterlevel, &state->usehull) != 11)
+			Error("bad golden trace line: %s", line);
+		return true;
+	}
+	return false;
+}
+
+// the name of the first field that differs, or NULL
+static const char* CompareMoveState(const movestate_t* a, const movestate_t* b, float epsilon)
+{
+	static const char* names[TRACE_FLOATS] = {"origin x", "origin y", "origin z", "velocity x", "velocity y", "velocity z"};
+
+	for (int i = 0; i < TRACE_FLOATS; i++)
+	{
+		if (fabs(a->v[i] - b->v[i]) > epsilon)
+			return names[i];
+	}
+	if (a->flags != b->flags)
+		return "flags";
+	if (a->onground != b->onground)
+		return "onground";
+	if (a->waterlevel != b->waterlevel)
+		return "waterlevel";
+	if (a->usehull != b->usehull)
+		return "usehull";
+	return NULL;
+}
+
+static void RunCommand(const usercmd_t* cmd)
+{
+	pm.cmd = *cmd;
+	pm.oldangles = pm.angles;
+	pm.angles = cmd->viewangles;
+	pm.maxspeed = movevars.maxspeed;
+	pm.time = replaytime * 1000;
+
+	PM_Move(&pm, true);
+
+	pm.oldbuttons = cmd->buttons;
+	replaytime += cmd->msec * 0.001;
+}
+
+static void StartReplay()
+{
+	pm = startstate;
+	replaytime = 0;
+	randomseed = 0;
+	numtraces = 0;
+}
+
+// runs the stream once, writing and checking the states, returns the mismatches
+static int ReplayStream(FILE* tracefile, FILE* goldenfile, float epsilon)
+{
+	movestate_t state, golden;
+	const char* field;
+	int mismatches = 0;
+	int numcmds = (int)stream.cmds.size();
+
+	StartReplay();
+
+	for (int i = 0; i < numcmds; i++)
+	{
+		RunCommand(&stream.cmds[i]);
+
+		if (!tracefile && !goldenfile)
+			continue;
+
+		GetMoveState(i, &state);
+		if (tracefile)
+			WriteMoveState(tracefile, &state);
+
+		if (!goldenfile)
+			continue;
+
+		if (!ReadMoveState(goldenfile, &golden))
+		{
+			if (0 == mismatches)
+				printf("golden trace ends after %i moves, the stream has %i\n", i, numcmds);
+			mismatches += numcmds - i;
+			goldenfile = NULL;
+			continue;
+		}
+
+		field = CompareMoveState(&state, &golden, epsilon);
+		if (field || golden.move != i)
+		{
+			if (0 == mismatches)
+			{
+				printf("first divergence at move %i (%s)\n", i, field ? field : "move number");
+				printf("  golden: ");
+				WriteMoveState(stdout, &golden);
+				printf("  replay: ");
+				WriteMoveState(stdout, &state);
+			}
+			mismatches++;
+		}
+	}
+
+	if (goldenfile && ReadMoveState(goldenfile, &golden))
+	{
+		if (0 == mismatches)
+			printf("golden trace has more moves than the stream's %i\n", numcmds);
+		mismatches++;
+	}
+
+	return mismatches;
+}
+
+int main(int argc, char** argv)
+{
+	int i;
+	int generate = 0, repeat = 0;
+	unsigned int seed = 1;
+	float epsilon = 0.01f;
+	const char* tracename = NULL;
+	const char* goldenname = NULL;
+	char bspname[1024];
+	float origin[3], yaw;
+
+	printf("pmreplay.exe v1.0 (%s)\n", __DATE__);
+	printf("---- pmreplay ----\n");
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-gen"))
+			generate = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-seed"))
+			seed = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-repeat"))
+			repeat = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-trace"))
+			tracename = argv[++i];
+		else if (!strcmp(argv[i], "-golden"))
+			goldenname = argv[++i];
+		else if (!strcmp(argv[i], "-epsilon"))
+			epsilon = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-v"))
+			verbose = true;
+		else if (argv[i][0] == '-')
+			Error("Unknown option \"%s\"", argv[i]);
+		else
+			break;
+	}
+
+	if (i != argc - 2)
+		Error("usage: pmreplay [-gen count] [-seed n] [-repeat count] [-trace file] [-golden file] [-epsilon e] [-v] bspfile streamfile\n"
+			  "    -gen writes a generated stream to streamfile before replaying it");
+
+	strcpy(bspname, argv[i]);
+	DefaultExtension(bspname, ".bsp");
+	LoadWorldHulls(bspname);
+
+	if (FindPlayerStart(origin, &yaw))
+	{
+		// the game spawns players one unit up
+		stream.origin = Vector(origin[0], origin[1], origin[2] + 1);
+		stream.angles = Vector(0, yaw, 0);
+		stream.hasorigin = true;
+	}
+
+	if (0 != generate)
+		GenerateStream(argv[i + 1], generate, seed);
+
+	// an origin in the stream overrides the player start
+	LoadStream(argv[i + 1]);
+	if (!stream.hasorigin)
+		Error("%s has no info_player_start and %s has no origin", bspname, argv[i + 1]);
+	if (stream.cmds.empty())
+		Error("%s has no commands", argv[i + 1]);
+
+	InitPlayerMove(bspname);
+	ResetPlayer();
+	startstate = pm;
+
+	FILE* tracefile = tracename ? SafeOpenWrite(tracename) : NULL;
+	if (tracefile)
+		fprintf(tracefile, "// move origin velocity flags onground waterlevel usehull\n");
+	FILE* goldenfile = goldenname ? SafeOpenRead(goldenname) : NULL;
+
+	const int mismatches = ReplayStream(tracefile, goldenfile, epsilon);
+
+	if (tracefile)
+		fclose(tracefile);
+	if (goldenfile)
+		fclose(goldenfile);
+
+	printf("%i moves, %.1f seconds of play, %.2f traces/move\n",
+		(int)stream.cmds.size(), replaytime, numtraces / (double)stream.cmds.size());
+	printf("end: origin %.3f %.3f %.3f, velocity %.3f %.3f %.3f\n",
+		pm.origin[0], pm.origin[1], pm.origin[2], pm.velocity[0], pm.velocity[1], pm.velocity[2]);
+
+	if (0 != repeat)
+	{
+		const auto start = std::chrono::steady_clock::now();
+
+		for (i = 0; i < repeat; i++)
+			ReplayStream(NULL, NULL, 0);
+
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		const double moves = (double)stream.cmds.size() * repeat;
+
+		printf("%i replays in %.3f seconds, %.0f moves/sec, %.2f usec/move\n",
+			repeat, seconds, moves / seconds, seconds * 1e6 / moves);
+	}
+
+	if (goldenfile)
+	{
+		if (0 != mismatches)
+		{
+			printf("%i moves differ from %s\n", mismatches, goldenname);
+			return 1;
+		}
+		printf("matches %s\n", goldenname);
+	}
+
+	return 0;
+}
@@ -0,0 +1,47 @@
+/***
+*
+*	Copyright (c) 1996-2002, Valve LLC. All rights reserved.
+*
+*	This product contains software technology licensed from Id
+*	Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc.
+*	All Rights Reserved.
+*
+****/
+
+// pmreplay.h -- what the movement side of pmreplay needs from the bsp side.
+// The two halves include different mathlib.h headers, so only plain types
+// cross between them.
+
+#pragma once
+
+#include <stdio.h>
+
+// from cmdlib, whose headers can't be included next to the game's
+[[noreturn]] void Error(const char* error, ...);
+FILE* SafeOpenWrite(const char* filename);
+FILE* SafeOpenRead(const char* filename);
+void DefaultExtension(char* path, const char* extension);
+
+typedef struct
+{
+	int allsolid;	// if true, plane is not valid
+	int startsolid; // if true, the initial point was in a solid area
+	int inopen, inwater;
+	float fraction; // 1.0 = didn't hit anything
+	float endpos[3];
+	float normal[3]; // surface normal at impact
+	float dist;
+} hulltrace_t;
+
+// loads the world model's four hulls, hull 0 made from the draw nodes
+void LoadWorldHulls(const char* filename);
+
+// origin and yaw of the first info_player_start, false if there isn't one
+bool FindPlayerStart(float* origin, float* yaw);
+
+// bsp hull numbers, not pmove->usehull
+void WorldHullMins(int hullnum, float* mins);
+int WorldPointContents(int hullnum, const float* p);
+// hull 0 with the currents counted as water, like the engine's PM_PointContents
+int WorldPlayerContents(const float* p, int* truecontents);
+void WorldTrace(int hullnum, const float* start, const float* end, hulltrace_t* trace);
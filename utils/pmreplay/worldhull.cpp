@@ -0,0 +1,276 @@
+/***
+*
+*	Copyright (c) 1996-2002, Valve LLC. All rights reserved.
+*
+*	This product contains software technology licensed from Id
+*	Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc.
+*	All Rights Reserved.
+*
+****/
+
+// worldhull.cpp -- the world's clip hulls, traced the way the engine traces
+// them for player movement
+
+#include <vector>
+
+#include "../common/cmdlib.h"
+#include "../common/mathlib.h"
+#include "../common/bspfile.h"
+#include "pmreplay.h"
+
+#define DIST_EPSILON (0.03125)
+
+typedef struct
+{
+	float normal[3];
+	float dist;
+	int type;
+} hullplane_t;
+
+typedef struct
+{
+	int planenum;
+	int children[2]; // negative numbers are contents
+} hullnode_t;
+
+typedef struct
+{
+	hullnode_t* nodes;
+	int headnode;
+	float clip_mins[3];
+} worldhull_t;
+
+// hull sizes the compile tools expand the brushes by
+static const float hull_mins[MAX_MAP_HULLS][3] =
+	{
+		{0, 0, 0},
+		{-16, -16, -36},
+		{-32, -32, -32},
+		{-16, -16, -18}};
+
+static std::vector<hullplane_t> hullplanes;
+static std::vector<hullnode_t> drawnodes;
+static std::vector<hullnode_t> clipnodes;
+static worldhull_t hulls[MAX_MAP_HULLS];
+
+void LoadWorldHulls(const char* filename)
+{
+	int i, j, child;
+
+	LoadBSPFile((char*)filename);
+	ParseEntities();
+
+	if (nummodels < 1)
+		Error("%s has no world model", filename);
+
+	hullplanes.resize(numplanes);
+	for (i = 0; i < numplanes; i++)
+	{
+		VectorCopy(dplanes[i].normal, hullplanes[i].normal);
+		hullplanes[i].dist = dplanes[i].dist;
+		hullplanes[i].type = dplanes[i].type;
+	}
+
+	// hull 0 is the draw tree, with the leafs turned into their contents
+	drawnodes.resize(numnodes);
+	for (i = 0; i < numnodes; i++)
+	{
+		drawnodes[i].planenum = dnodes[i].planenum;
+		for (j = 0; j < 2; j++)
+		{
+			child = dnodes[i].children[j];
+			drawnodes[i].children[j] = child < 0 ? dleafs[-1 - child].contents : child;
+		}
+	}
+
+	clipnodes.resize(numclipnodes);
+	for (i = 0; i < numclipnodes; i++)
+	{
+		clipnodes[i].planenum = dclipnodes[i].planenum;
+		clipnodes[i].children[0] = dclipnodes[i].children[0];
+		clipnodes[i].children[1] = dclipnodes[i].children[1];
+	}
+
+	for (i = 0; i < MAX_MAP_HULLS; i++)
+	{
+		hulls[i].nodes = i == 0 ? drawnodes.data() : clipnodes.data();
+		hulls[i].headnode = dmodels[0].headnode[i];
+		VectorCopy(hull_mins[i], hulls[i].clip_mins);
+	}
+}
+
+bool FindPlayerStart(float* origin, float* yaw)
+{
+	for (int i = 0; i < num_entities; i++)
+	{
+		if (strcmp(ValueForKey(&entities[i], "classname"), "info_player_start"))
+			continue;
+
+		vec3_t v;
+		GetVectorForKey(&entities[i], "origin", v);
+		VectorCopy(v, origin);
+		*yaw = FloatForKey(&entities[i], "angle");
+		return true;
+	}
+	return false;
+}
+
+void WorldHullMins(int hullnum, float* mins)
+{
+	VectorCopy(hulls[hullnum].clip_mins, mins);
+}
+
+static int HullPointContents(const worldhull_t* hull, int num, const float* p)
+{
+	const hullnode_t* node;
+	const hullplane_t* plane;
+	float d;
+
+	while (num >= 0)
+	{
+		node = &hull->nodes[num];
+		plane = &hullplanes[node->planenum];
+
+		if (plane->type < 3)
+			d = p[plane->type] - plane->dist;
+		else
+			d = DotProduct(plane->normal, p) - plane->dist;
+
+		num = node->children[d < 0];
+	}
+
+	return num;
+}
+
+int WorldPointContents(int hullnum, const float* p)
+{
+	return HullPointContents(&hulls[hullnum], hulls[hullnum].headnode, p);
+}
+
+int WorldPlayerContents(const float* p, int* truecontents)
+{
+	int contents = HullPointContents(&hulls[0], hulls[0].headnode, p);
+
+	if (truecontents)
+		*truecontents = contents;
+
+	if (contents <= CONTENTS_CURRENT_0 && contents >= CONTENTS_CURRENT_DOWN)
+		contents = CONTENTS_WATER;
+
+	return contents;
+}
+
+// returns false once the trace has hit something, so the callers stop looking
+static bool RecursiveHullTrace(const worldhull_t* hull, int num, float p1f, float p2f, const float* p1, const float* p2, hulltrace_t* trace)
+{
+	const hullnode_t* node;
+	const hullplane_t* plane;
+	float t1, t2, frac, midf;
+	float mid[3];
+	int i, side;
+
+	// reached a leaf
+	if (num < 0)
+	{
+		if (num != CONTENTS_SOLID)
+		{
+			trace->allsolid = false;
+			if (num == CONTENTS_EMPTY)
+				trace->inopen = true;
+			else
+				trace->inwater = true;
+		}
+		else
+			trace->startsolid = true;
+		return true;
+	}
+
+	node = &hull->nodes[num];
+	plane = &hullplanes[node->planenum];
+
+	if (plane->type < 3)
+	{
+		t1 = p1[plane->type] - plane->dist;
+		t2 = p2[plane->type] - plane->dist;
+	}
+	else
+	{
+		t1 = DotProduct(plane->normal, p1) - plane->dist;
+		t2 = DotProduct(plane->normal, p2) - plane->dist;
+	}
+
+	// both ends on one side
+	if (t1 >= 0 && t2 >= 0)
+		return RecursiveHullTrace(hull, node->children[0], p1f, p2f, p1, p2, trace);
+	if (t1 < 0 && t2 < 0)
+		return RecursiveHullTrace(hull, node->children[1], p1f, p2f, p1, p2, trace);
+
+	// split where the line crosses, pulled back DIST_EPSILON toward p1
+	if (t1 < 0)
+		frac = (t1 + DIST_EPSILON) / (t1 - t2);
+	else
+		frac = (t1 - DIST_EPSILON) / (t1 - t2);
+	if (frac < 0)
+		frac = 0;
+	if (frac > 1)
+		frac = 1;
+
+	midf = p1f + (p2f - p1f) * frac;
+	for (i = 0; i < 3; i++)
+		mid[i] = p1[i] + frac * (p2[i] - p1[i]);
+
+	side = t1 < 0;
+
+	// the near side first
+	if (!RecursiveHullTrace(hull, node->children[side], p1f, midf, p1, mid, trace))
+		return false;
+
+	// then the far side, unless the line goes straight into solid there
+	if (HullPointContents(hull, node->children[side ^ 1], mid) != CONTENTS_SOLID)
+		return RecursiveHullTrace(hull, node->children[side ^ 1], midf, p2f, mid, p2, trace);
+
+	if (trace->allsolid)
+		return false; // never got out of the solid area
+
+	// the other side of the node is solid, this is the impact point
+	if (!side)
+	{
+		VectorCopy(plane->normal, trace->normal);
+		trace->dist = plane->dist;
+	}
+	else
+	{
+		VectorScale(plane->normal, -1, trace->normal);
+		trace->dist = -plane->dist;
+	}
+
+	// the epsilon can leave mid in solid on thin brushes, back it up
+	while (HullPointContents(hull, hull->headnode, mid) == CONTENTS_SOLID)
+	{
+		frac -= 0.1;
+		if (frac < 0)
+		{
+			trace->fraction = midf;
+			VectorCopy(mid, trace->endpos);
+			return false;
+		}
+		midf = p1f + (p2f - p1f) * frac;
+		for (i = 0; i < 3; i++)
+			mid[i] = p1[i] + frac * (p2[i] - p1[i]);
+	}
+
+	trace->fraction = midf;
+	VectorCopy(mid, trace->endpos);
+
+	return false;
+}
+
+void WorldTrace(int hullnum, const float* start, const float* end, hulltrace_t* trace)
+{
+	memset(trace, 0, sizeof(*trace));
+	trace->fraction = 1;
+	trace->allsolid = true;
+	VectorCopy(end, trace->endpos);
+
+	RecursiveHullTrace(&hulls[hullnum], hulls[hullnum].headnode, 0, 1, start, end, trace);
+}
@@ -114,10 +114,18 @@ void SplitFaceTmp(face_t* in, dplane_t* split, face_t** front, face_t** back);
 
 // solidbsp.c
 
+typedef struct
+{
+	int splitnodes;
+	int nodefaces;
+	int leaffaces;
+} bspstats_t;
+
 void DivideFacet(face_t* in, dplane_t* split, face_t** front, face_t** back);
 void CalcSurfaceInfo(surface_t* surf);
 void SubdivideFace(face_t* f, face_t** prevptr);
-node_t* SolidBSP(surfchain_t* surfhead);
+node_t* SolidBSP(surfchain_t* surfhead, bspstats_t* stats, qboolean warnclipped);
+void MakeTreePortals(node_t* headnode, surfchain_t* surfhead);
 int FaceSide(face_t* in, dplane_t* split);
 
 //=============================================================================
@@ -164,6 +172,7 @@ extern node_t outside_node; // portals outside the world face this
 
 void AddPortalToNodes(portal_t* p, node_t* front, node_t* back);
 void RemovePortalFromNode(portal_t* portal, node_t* l);
+void MakeHeadnodeWindings(vec3_t mins, vec3_t maxs, dplane_t planes[6], winding_t* windings[6]);
 void MakeHeadnodePortals(node_t* node, vec3_t mins, vec3_t maxs);
 void FreePortals(node_t* node);
 
@@ -259,6 +268,11 @@ surface_t* AllocSurface(void);
 void FreeSurface(surface_t* s);
 
 node_t* AllocNode(void);
+void FreeNode(node_t* n);
+
+void PoolStage(const char* stage);
+void ReleasePools(void);
+void PrintMemory(void);
 
 //=============================================================================
 
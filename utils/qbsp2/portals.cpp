@@ -89,19 +89,17 @@ void PrintPortal(portal_t* p)
 
 /*
 ================
-MakeHeadnodePortals
+MakeHeadnodeWindings
 
-The created portals will face the global outside_node
+The six planes that enclose the whole model, facing in, and
+their windings
 ================
 */
-void MakeHeadnodePortals(node_t* node, vec3_t mins, vec3_t maxs)
+void MakeHeadnodeWindings(vec3_t mins, vec3_t maxs, dplane_t planes[6], winding_t* windings[6])
 {
 	vec3_t bounds[2];
 	int i, j, n;
-	portal_t *p, *portals[6];
-	dplane_t bplanes[6], *pl;
-
-	Draw_ClearWindow();
+	dplane_t* pl;
 
 	// pad with some space so there will never be null volume leafs
 	for (i = 0; i < 3; i++)
@@ -110,18 +108,12 @@ void MakeHeadnodePortals(node_t* node, vec3_t mins, vec3_t maxs)
 		bounds[1][i] = maxs[i] + SIDESPACE;
 	}
 
-	outside_node.contents = CONTENTS_SOLID;
-	outside_node.portals = NULL;
-
 	for (i = 0; i < 3; i++)
 		for (j = 0; j < 2; j++)
 		{
 			n = j * 3 + i;
 
-			p = AllocPortal();
-			portals[n] = p;
-
-			pl = &bplanes[n];
+			pl = &planes[n];
 			memset(pl, 0, sizeof(*pl));
 			if (j)
 			{
@@ -133,9 +125,7 @@ void MakeHeadnodePortals(node_t* node, vec3_t mins, vec3_t maxs)
 				pl->normal[i] = 1;
 				pl->dist = bounds[j][i];
 			}
-			p->plane = *pl;
-			p->winding = BaseWindingForPlane(pl);
-			AddPortalToNodes(p, node, &outside_node);
+			windings[n] = BaseWindingForPlane(pl);
 		}
 
 	// clip the basewindings by all the other planes
@@ -145,11 +135,44 @@ void MakeHeadnodePortals(node_t* node, vec3_t mins, vec3_t maxs)
 		{
 			if (j == i)
 				continue;
-			portals[i]->winding = ClipWinding(portals[i]->winding, &bplanes[j], true);
+			windings[i] = ClipWinding(windings[i], &planes[j], true);
 		}
 	}
 }
 
+/*
+================
+MakeHeadnodePortals
+
+The created portals will face the global outside_node
+================
+*/
+void MakeHeadnodePortals(node_t* node, vec3_t mins, vec3_t maxs)
+{
+	int i, j, n;
+	portal_t* p;
+	dplane_t planes[6];
+	winding_t* windings[6];
+
+	Draw_ClearWindow();
+
+	MakeHeadnodeWindings(mins, maxs, planes, windings);
+
+	outside_node.contents = CONTENTS_SOLID;
+	outside_node.portals = NULL;
+
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < 2; j++)
+		{
+			n = j * 3 + i;
+
+			p = AllocPortal();
+			p->plane = planes[n];
+			p->winding = windings[n];
+			AddPortalToNodes(p, node, &outside_node);
+		}
+}
+
 //============================================================================
 
 void CheckWindingInNode(winding_t* w, node_t* node)
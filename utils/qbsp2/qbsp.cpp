@@ -12,6 +12,10 @@
 
 #include "bsp5.h"
 
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
 //
 // command line flags
 //
@@ -153,12 +157,10 @@ CopyWinding
 */
 winding_t* CopyWinding(winding_t* w)
 {
-	int size;
 	winding_t* c;
 
-	size = (int)((winding_t*)0)->points[w->numpoints];
-	c = reinterpret_cast<winding_t*>(malloc(size));
-	memcpy(c, w, size);
+	c = NewWinding(w->numpoints);
+	memcpy(c, w, offsetof(winding_t, points) + w->numpoints * sizeof(vec3_t));
 	return c;
 }
 
@@ -547,17 +549,266 @@ void SplitFace(face_t* in, dplane_t* split, face_t** front, face_t** back)
 
 //===========================================================================
 
-int c_activefaces, c_peakfaces;
-int c_activesurfaces, c_peaksurfaces;
-int c_activewindings, c_peakwindings;
-int c_activeportals, c_peakportals;
+/*
+===================================================================
+
+POOLS
+
+SplitFace, DivideWinding and tjunc make and throw away faces,
+windings, surfaces, portals and nodes by the million. Each type gets
+a pool that carves blocks out of large arenas, and keeps the freed
+blocks on a free list for reuse. Windings are pooled by size, up to
+MAX_POINTS_ON_WINDING points.
+
+The trees are built on several threads at once, so every thread has
+a set of pools of its own and never has to lock. A block freed by
+another thread than the one that made it just goes on the free list
+of the thread that frees it. The sets outlive their threads and are
+handed on to the next thread that starts.
+
+Nothing is kept once a tree is written, so ReleasePools throws all
+of the arenas away at once after each window of hull trees.
+
+===================================================================
+*/
+
+#define POOL_ARENA_SIZE (1024 * 1024)
+
+typedef struct poolblock_s
+{
+	struct poolblock_s* next;
+} poolblock_t;
+
+typedef struct
+{
+	const char* name;
+	size_t blocksize;
+} pooltype_t;
+
+typedef struct
+{
+	std::vector<byte*> arenas;
+	size_t arenaused; // bytes handed out from the last arena
+	poolblock_t* freelist;
+	int active, peak, allocs;
+	int stagepeak, stageallocs; // since the last PoolStage
+} pool_t;
+
+// the pool a winding came from is stored in front of it
+typedef struct
+{
+	int pool;
+	int pad; // keeps the points aligned
+} windingheader_t;
+
+#define NUM_WINDING_POOLS 6 // up to 4, 8, 16, 32, 64 and 128 points
+#define WINDING_POOL_POINTS(n) (4 << (n))
+#define WINDING_POOL_SIZE(n) (sizeof(windingheader_t) + offsetof(winding_t, points) + WINDING_POOL_POINTS(n) * sizeof(vec3_t))
+
+enum
+{
+	POOL_FACES,
+	POOL_SURFACES,
+	POOL_PORTALS,
+	POOL_NODES,
+	POOL_WINDINGS,
+	NUM_POOLS = POOL_WINDINGS + NUM_WINDING_POOLS
+};
+
+static const pooltype_t pooltypes[NUM_POOLS] = {
+	{"faces", sizeof(face_t)},
+	{"surfaces", sizeof(surface_t)},
+	{"portals", sizeof(portal_t)},
+	{"nodes", sizeof(node_t)},
+	{"windings 4", WINDING_POOL_SIZE(0)},
+	{"windings 8", WINDING_POOL_SIZE(1)},
+	{"windings 16", WINDING_POOL_SIZE(2)},
+	{"windings 32", WINDING_POOL_SIZE(3)},
+	{"windings 64", WINDING_POOL_SIZE(4)},
+	{"windings 128", WINDING_POOL_SIZE(5)}};
+
+typedef struct
+{
+	pool_t pools[NUM_POOLS];
+} poolset_t;
+
+static std::mutex poolsetlock;
+static std::vector<poolset_t*> poolsets;	 // every set ever made
+static std::vector<poolset_t*> freepoolsets; // sets left by threads that are done
+
+// gives the set back when the thread exits
+struct threadpools_t
+{
+	poolset_t* set = nullptr;
+
+	~threadpools_t()
+	{
+		if (set)
+		{
+			std::lock_guard<std::mutex> lock(poolsetlock);
+			freepoolsets.push_back(set);
+		}
+	}
+};
+
+static thread_local threadpools_t threadpools;
+
+static pool_t* ThreadPool(int type)
+{
+	if (!threadpools.set)
+	{
+		std::lock_guard<std::mutex> lock(poolsetlock);
+
+		if (!freepoolsets.empty())
+		{
+			threadpools.set = freepoolsets.back();
+			freepoolsets.pop_back();
+		}
+		else
+		{
+			threadpools.set = new poolset_t();
+			poolsets.push_back(threadpools.set);
+		}
+	}
+
+	return &threadpools.set->pools[type];
+}
+
+static void* PoolAlloc(int type)
+{
+	pool_t* pool = ThreadPool(type);
+	void* block;
+
+	if (pool->freelist)
+	{
+		block = pool->freelist;
+		pool->freelist = pool->freelist->next;
+	}
+	else
+	{
+		// keep every block 16 byte aligned
+		size_t size = (pooltypes[type].blocksize + 15) & ~(size_t)15;
+
+		if (pool->arenas.empty() || pool->arenaused + size > POOL_ARENA_SIZE)
+		{
+			byte* arena = reinterpret_cast<byte*>(malloc(POOL_ARENA_SIZE));
+			if (!arena)
+				Error("PoolAlloc: out of memory for %s", pooltypes[type].name);
+			pool->arenas.push_back(arena);
+			pool->arenaused = 0;
+		}
+
+		block = pool->arenas.back() + pool->arenaused;
+		pool->arenaused += size;
+	}
+
+	pool->allocs++;
+	pool->stageallocs++;
+	pool->active++;
+	if (pool->active > pool->peak)
+		pool->peak = pool->active;
+	if (pool->active > pool->stagepeak)
+		pool->stagepeak = pool->active;
+
+	return block;
+}
+
+static void PoolFree(int type, void* block)
+{
+	pool_t* pool = ThreadPool(type);
+	poolblock_t* b = reinterpret_cast<poolblock_t*>(block);
+
+	b->next = pool->freelist;
+	pool->freelist = b;
+	pool->active--;
+}
+
+static double PoolMegs(int type, int blocks)
+{
+	return (double)blocks * pooltypes[type].blocksize / (1024 * 1024);
+}
+
+/*
+==================
+PoolStage
+
+Prints what each pool did since the last stage. The counts are
+summed over all of the threads, so the peaks are an upper bound.
+Only call this while no trees are being built.
+==================
+*/
+void PoolStage(const char* stage)
+{
+	int i;
+	int allocs, peak;
+
+	qprintf("---- memory: %s ----\n", stage);
+	for (i = 0; i < NUM_POOLS; i++)
+	{
+		allocs = peak = 0;
+		for (poolset_t* set : poolsets)
+		{
+			pool_t* pool = &set->pools[i];
+			allocs += pool->stageallocs;
+			peak += pool->stagepeak;
+			pool->stageallocs = 0;
+			pool->stagepeak = pool->active;
+		}
+		if (allocs)
+			qprintf("%-12s: %8i allocs, peak %7i (%6.1f megs)\n", pooltypes[i].name, allocs, peak, PoolMegs(i, peak));
+	}
+}
+
+/*
+==================
+ReleasePools
+
+Frees everything in the pools at once, when a window of hull trees is done
+==================
+*/
+void ReleasePools(void)
+{
+	int i;
+	int active;
+
+	for (i = 0; i < NUM_POOLS; i++)
+	{
+		active = 0;
+		for (poolset_t* set : poolsets)
+		{
+			pool_t* pool = &set->pools[i];
+			active += pool->active;
+
+			for (byte* arena : pool->arenas)
+				free(arena);
+			pool->arenas.clear();
+			pool->arenaused = 0;
+			pool->freelist = NULL;
+			pool->active = 0;
+			pool->stagepeak = 0;
+		}
+		if (active)
+			qprintf("%i %s reclaimed\n", active, pooltypes[i].name);
+	}
+}
 
 void PrintMemory(void)
 {
-	printf("faces   : %6i (%6i)\n", c_activefaces, c_peakfaces);
-	printf("surfaces: %6i (%6i)\n", c_activesurfaces, c_peaksurfaces);
-	printf("windings: %6i (%6i)\n", c_activewindings, c_peakwindings);
-	printf("portals : %6i (%6i)\n", c_activeportals, c_peakportals);
+	int i;
+	int active, peak, allocs;
+
+	for (i = 0; i < NUM_POOLS; i++)
+	{
+		active = peak = allocs = 0;
+		for (poolset_t* set : poolsets)
+		{
+			active += set->pools[i].active;
+			peak += set->pools[i].peak;
+			allocs += set->pools[i].allocs;
+		}
+		if (allocs)
+			printf("%-12s: %6i (%6i, %6.1f megs), %i allocs\n", pooltypes[i].name, active, peak, PoolMegs(i, peak), allocs);
+	}
 }
 
 /*
@@ -567,19 +818,21 @@ NewWinding
 */
 winding_t* NewWinding(int points)
 {
+	windingheader_t* header;
 	winding_t* w;
-	int size;
+	int pool;
 
 	if (points > MAX_POINTS_ON_WINDING)
 		Error("NewWinding: %i points", points);
 
-	c_activewindings++;
-	if (c_activewindings > c_peakwindings)
-		c_peakwindings = c_activewindings;
+	for (pool = 0; WINDING_POOL_POINTS(pool) < points; pool++)
+		;
+
+	header = reinterpret_cast<windingheader_t*>(PoolAlloc(POOL_WINDINGS + pool));
+	header->pool = pool;
 
-	size = (int)((winding_t*)0)->points[points];
-	w = reinterpret_cast<winding_t*>(malloc(size));
-	memset(w, 0, size);
+	w = reinterpret_cast<winding_t*>(header + 1);
+	memset(w, 0, offsetof(winding_t, points) + points * sizeof(vec3_t));
 
 	return w;
 }
@@ -587,8 +840,9 @@ winding_t* NewWinding(int points)
 
 void FreeWinding(winding_t* w)
 {
-	c_activewindings--;
-	free(w);
+	windingheader_t* header = reinterpret_cast<windingheader_t*>(w) - 1;
+
+	PoolFree(POOL_WINDINGS + header->pool, header);
 }
 
 
@@ -602,11 +856,7 @@ face_t* AllocFace(void)
 {
 	face_t* f;
 
-	c_activefaces++;
-	if (c_activefaces > c_peakfaces)
-		c_peakfaces = c_activefaces;
-
-	f = reinterpret_cast<face_t*>(malloc(sizeof(face_t)));
+	f = reinterpret_cast<face_t*>(PoolAlloc(POOL_FACES));
 	memset(f, 0, sizeof(face_t));
 	f->planenum = -1;
 
@@ -616,8 +866,7 @@ face_t* AllocFace(void)
 
 void FreeFace(face_t* f)
 {
-	c_activefaces--;
-	free(f);
+	PoolFree(POOL_FACES, f);
 }
 
 
@@ -630,20 +879,15 @@ surface_t* AllocSurface(void)
 {
 	surface_t* s;
 
-	s = reinterpret_cast<surface_t*>(malloc(sizeof(surface_t)));
+	s = reinterpret_cast<surface_t*>(PoolAlloc(POOL_SURFACES));
 	memset(s, 0, sizeof(surface_t));
 
-	c_activesurfaces++;
-	if (c_activesurfaces > c_peaksurfaces)
-		c_peaksurfaces = c_activesurfaces;
-
 	return s;
 }
 
 void FreeSurface(surface_t* s)
 {
-	c_activesurfaces--;
-	free(s);
+	PoolFree(POOL_SURFACES, s);
 }
 
 /*
@@ -655,11 +899,7 @@ portal_t* AllocPortal(void)
 {
 	portal_t* p;
 
-	c_activeportals++;
-	if (c_activeportals > c_peakportals)
-		c_peakportals = c_activeportals;
-
-	p = reinterpret_cast<portal_t*>(malloc(sizeof(portal_t)));
+	p = reinterpret_cast<portal_t*>(PoolAlloc(POOL_PORTALS));
 	memset(p, 0, sizeof(portal_t));
 
 	return p;
@@ -667,8 +907,7 @@ portal_t* AllocPortal(void)
 
 void FreePortal(portal_t* p)
 {
-	c_activeportals--;
-	free(p);
+	PoolFree(POOL_PORTALS, p);
 }
 
 
@@ -681,12 +920,17 @@ node_t* AllocNode(void)
 {
 	node_t* n;
 
-	n = reinterpret_cast<node_t*>(malloc(sizeof(node_t)));
+	n = reinterpret_cast<node_t*>(PoolAlloc(POOL_NODES));
 	memset(n, 0, sizeof(node_t));
 
 	return n;
 }
 
+void FreeNode(node_t* n)
+{
+	PoolFree(POOL_NODES, n);
+}
+
 
 //===========================================================================
 
@@ -814,79 +1058,168 @@ surfchain_t* ReadSurfs(FILE* file)
 
 /*
 ===============
-ProcessModel
+ReadHulls
+
+Reads the surfaces of up to count hulls, the next window of trees
+to build. The hulls come in the order they are written, every hull
+of one model before the next model. Returns the number read.
 ===============
 */
-qboolean ProcessModel(void)
+typedef struct
 {
+	int modelnum, hull;
 	surfchain_t* surfs;
 	node_t* nodes;
-	dmodel_t* model;
-	int startleafs;
+	bspstats_t stats;
+} hulltree_t;
 
-	surfs = ReadSurfs(polyfiles[0]);
+static std::vector<hulltree_t> hulltrees;
+static int readmodels; // models started so far
+static int readhull;   // the hull to read next
 
-	if (!surfs)
-		return false; // all models are done
+int ReadHulls(int count)
+{
+	hulltree_t tree;
 
-	VectorCopy(surfs->mins, draw_mins);
-	VectorCopy(surfs->maxs, draw_maxs);
+	hulltrees.clear();
 
-	if (nummodels >= MAX_MAP_MODELS)
-		Error("nummodels == MAX_MAP_MODELS");
+	while ((int)hulltrees.size() < count)
+	{
+		memset(&tree, 0, sizeof(tree));
 
-	startleafs = numleafs;
-	model = &dmodels[nummodels];
-	nummodels++;
+		tree.hull = readhull;
+		tree.surfs = ReadSurfs(polyfiles[readhull]);
+		if (readhull == 0)
+		{
+			if (!tree.surfs)
+				break; // all models are done
 
-	VectorCopy(surfs->mins, model->mins);
-	VectorCopy(surfs->maxs, model->maxs);
+			if (readmodels >= MAX_MAP_MODELS)
+				Error("nummodels == MAX_MAP_MODELS");
+			readmodels++;
+		}
+		tree.modelnum = readmodels - 1;
 
-	//
-	// SolidBSP generates a node tree
-	//
-	nodes = SolidBSP(surfs);
+		readhull++;
+		if (readhull == NUM_HULLS || noclip)
+			readhull = 0;
 
-	//
-	// build all the portals in the bsp tree
-	// some portals are solid polygons, and some are paths to other leafs
-	//
-	if (nummodels == 1 && !nofill)		  // assume non-world bmodels are simple
-		nodes = FillOutside(nodes, true); // make a leakfile if bad
+		hulltrees.push_back(tree);
+	}
+
+	return (int)hulltrees.size();
+}
+
+/*
+===============
+BuildHullTree
+
+Builds the tree for one hull of one model. Every hull in the
+window is a separate work item, and SolidBSP may also hand part
+of a big tree to another thread when one is free.
+===============
+*/
+void BuildHullTree(int work)
+{
+	hulltree_t* tree = &hulltrees[work];
 
-	FreePortals(nodes);
+	if (drawflag && tree->hull == 0)
+	{
+		VectorCopy(tree->surfs->mins, draw_mins);
+		VectorCopy(tree->surfs->maxs, draw_maxs);
+	}
+
+	// only the world gets portals, which warn about clipped sides themselves
+	tree->nodes = SolidBSP(tree->surfs, &tree->stats, tree->modelnum != 0 || nofill);
+}
+
+/*
+===============
+PrintBspStats
+===============
+*/
+void PrintBspStats(bspstats_t* stats)
+{
+	qprintf("----- SolidBSP -----\n");
+	qprintf("%5i split nodes\n", stats->splitnodes);
+	qprintf("%5i node faces\n", stats->nodefaces);
+	qprintf("%5i leaf faces\n", stats->leaffaces);
+}
+
+/*
+===============
+ProcessHull
+
+Fills and writes out one hull tree. This is done one hull at a
+time, in the order they were read, so the bsp file comes out the
+same whatever the number of threads.
+===============
+*/
+void ProcessHull(hulltree_t* tree)
+{
+	surfchain_t* surfs;
+	node_t* nodes;
+	dmodel_t* model;
+	int startleafs;
+	char stage[16];
+
+	surfs = tree->surfs;
+	nodes = tree->nodes;
+	hullnum = tree->hull;
+	PrintBspStats(&tree->stats);
 
-	// fix tjunctions
-	tjunc(nodes);
+	if (hullnum == 0)
+	{
+		startleafs = numleafs;
+		model = &dmodels[nummodels];
+		nummodels++;
 
-	MakeFaceEdges();
+		VectorCopy(surfs->mins, model->mins);
+		VectorCopy(surfs->maxs, model->maxs);
 
-	// emit the faces for the bsp file
-	model->headnode[0] = numnodes;
-	model->firstface = numfaces;
-	WriteDrawNodes(nodes);
-	model->numfaces = numfaces - model->firstface;
-	;
-	model->visleafs = numleafs - startleafs;
+		//
+		// build all the portals in the bsp tree
+		// some portals are solid polygons, and some are paths to other leafs
+		//
+		if (nummodels == 1 && !nofill) // assume non-world bmodels are simple
+		{
+			MakeTreePortals(nodes, surfs);
+			nodes = FillOutside(nodes, true); // make a leakfile if bad
+			FreePortals(nodes);
+		}
+		PoolStage("FillOutside");
 
-	if (noclip)
-		return true;
+		// fix tjunctions
+		tjunc(nodes);
+		PoolStage("tjunc");
+
+		MakeFaceEdges();
+
+		// emit the faces for the bsp file
+		model->headnode[0] = numnodes;
+		model->firstface = numfaces;
+		WriteDrawNodes(nodes);
+		model->numfaces = numfaces - model->firstface;
+		;
+		model->visleafs = numleafs - startleafs;
+		PoolStage("WriteDrawNodes");
+		return;
+	}
 
 	//
 	// the clipping hulls are simpler
 	//
-	for (hullnum = 1; hullnum < NUM_HULLS; hullnum++)
+	model = &dmodels[nummodels - 1];
+	if (nummodels == 1 && !nofill) // assume non-world bmodels are simple
 	{
-		surfs = ReadSurfs(polyfiles[hullnum]);
-		nodes = SolidBSP(surfs);
-		if (nummodels == 1 && !nofill) // assume non-world bmodels are simple
-			nodes = FillOutside(nodes, false);
+		MakeTreePortals(nodes, surfs);
+		nodes = FillOutside(nodes, false);
 		FreePortals(nodes);
-		model->headnode[hullnum] = numclipnodes;
-		WriteClipNodes(nodes);
 	}
-
-	return true;
+	model->headnode[hullnum] = numclipnodes;
+	WriteClipNodes(nodes);
+	sprintf(stage, "hull %i", hullnum);
+	PoolStage(stage);
 }
 
 /*
@@ -919,17 +1252,34 @@ void ProcessFile(char* bspfilename)
 	// load the output of qcsg
 	strcat(bspfilename, ".bsp");
 	LoadBSPFile(bspfilename);
+	CheckBSPFileLimits();
 	ParseEntities();
 
 	// init the tables to be shared by all models
 	BeginBSPFile();
 
-	// process each model individually
-	while (ProcessModel())
-		;
+	// read in a window of hulls, one for each thread, build all of
+	// their trees at once, then write them out one hull at a time.
+	// The pools are emptied after each window, so no more than a
+	// window's worth of trees is ever kept
+	while (ReadHulls(numthreads))
+	{
+		PoolStage("ReadSurfs");
+
+		RunThreadsOnIndividual((int)hulltrees.size(), false, BuildHullTree);
+		PoolStage("SolidBSP");
+
+		for (hulltree_t& tree : hulltrees)
+			ProcessHull(&tree);
+
+		ReleasePools();
+	}
 
 	// write the updated bsp file out
 	FinishBSPFile();
+
+	if (verbose)
+		PrintMemory();
 }
 
 
@@ -1001,6 +1351,10 @@ int main(int argc, char** argv)
 
 	ThreadSetDefault();
 
+	// the drawing can only be done from one thread
+	if (drawflag)
+		numthreads = 1;
+
 	SetQdirFromPath();
 	strcpy(g_bspfilename, ExpandArg(argv[i]));
 	StripExtension(g_bspfilename);
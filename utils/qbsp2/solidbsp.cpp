@@ -12,16 +12,37 @@
 
 #include "bsp5.h"
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 /*
 
   Each node or leaf will have a set of portals that completely enclose
   the volume of the node and pass into an adjacent node.
 
+  Portals are shared by the two nodes they connect, so two subtrees
+  that touch would fight over them if they were built at the same
+  time. While the tree is built each node keeps a private copy of
+  the sides that enclose it instead, which is all the partitioning
+  needs. The real portals are only made afterwards, by
+  MakeTreePortals, for the trees that get filled.
+
 */
 
-int c_leaffaces;
-int c_nodefaces;
-int c_splitnodes;
+typedef struct
+{
+	dplane_t plane; // the node is on the front side
+	winding_t* winding;
+} cellside_t;
+
+typedef std::vector<cellside_t> cell_t;
+
+// a subtree is handed to another thread when both children have
+// at least this many surfaces and a thread is free
+#define PARALLEL_SURFACES 32
+
+static std::atomic<int> bspthreads; // threads building trees right now
 
 //============================================================================
 
@@ -565,7 +586,7 @@ original faces that have some fragment inside this leaf
 ==================
 */
 #define MAX_LEAF_FACES 1024
-void LinkLeafFaces(surface_t* planelist, node_t* leafnode)
+void LinkLeafFaces(surface_t* planelist, node_t* leafnode, bspstats_t* stats)
 {
 	face_t* f;
 	surface_t* surf;
@@ -603,7 +624,7 @@ void LinkLeafFaces(surface_t* planelist, node_t* leafnode)
 			}
 		}
 
-		c_leaffaces += nummarkfaces;
+		stats->leaffaces += nummarkfaces;
 		markfaces[nummarkfaces] = NULL; // end marker
 		nummarkfaces++;
 
@@ -751,42 +772,117 @@ void SplitNodePortals(node_t* node)
 }
 
 
+/*
+==================
+SplitNodeCell
+
+Makes the new side between the node's children by clipping the
+full plane winding for the cutting plane by all of the node's sides,
+then carves the sides of the node into sides of the children.
+The node's own sides are used up.
+
+Trees that get real portals afterwards are warned about by
+MakeNodePortal instead, so warnclipped is only set for the rest.
+==================
+*/
+void SplitNodeCell(node_t* node, cell_t& cell, cell_t& front, cell_t& back, qboolean warnclipped)
+{
+	dplane_t* plane;
+	cellside_t side;
+	winding_t *w, *frontwinding, *backwinding;
+	size_t i;
+
+	plane = &dplanes[node->planenum];
+	w = BaseWindingForPlane(plane);
+
+	for (i = 0; i < cell.size(); i++)
+	{
+		w = ClipWinding(w, &cell[i].plane, true);
+		if (!w)
+		{
+			if (warnclipped)
+				printf("WARNING: MakeNodePortal:new portal was clipped away from node@(%.0f,%.0f,%.0f)-(%.0f,%.0f,%.0f)\n",
+					node->mins[0], node->mins[1], node->mins[2],
+					node->maxs[0], node->maxs[1], node->maxs[2]);
+			break;
+		}
+	}
+
+	// the sides go to the children in reverse, the way SplitNodePortals
+	// links the portals, so they are clipped against in a similar order
+	for (i = cell.size(); i-- > 0;)
+	{
+		side = cell[i];
+		DivideWinding(side.winding, plane, &frontwinding, &backwinding);
+
+		if (frontwinding)
+		{
+			side.winding = frontwinding;
+			front.push_back(side);
+		}
+		if (backwinding)
+		{
+			side.winding = backwinding;
+			back.push_back(side);
+		}
+		if (frontwinding && backwinding)
+			FreeWinding(cell[i].winding);
+	}
+	cell.clear();
+
+	if (!w)
+		return;
+
+	side.plane = *plane;
+	side.winding = w;
+	front.push_back(side);
+
+	side.plane.dist = -plane->dist;
+	VectorSubtract(vec3_origin, plane->normal, side.plane.normal);
+	side.winding = CopyWinding(w);
+	back.push_back(side);
+}
+
+/*
+==================
+FreeCell
+==================
+*/
+void FreeCell(cell_t& cell)
+{
+	for (cellside_t& side : cell)
+		FreeWinding(side.winding);
+	cell.clear();
+}
+
 /*
 ==================
 CalcNodeBounds
 
 Determines the boundaries of a node by
-minmaxing all the portal points, whcih
+minmaxing all the side points, which
 completely enclose the node.
 
  Returns true if the node should be midsplit.(very large)
 ==================
 */
-qboolean CalcNodeBounds(node_t* node)
+qboolean CalcNodeBounds(node_t* node, cell_t& cell)
 {
 	int i, j;
 	vec_t v;
-	portal_t *p, *next_portal;
-	int side;
+	winding_t* w;
 
 	node->mins[0] = node->mins[1] = node->mins[2] = 9999;
 	node->maxs[0] = node->maxs[1] = node->maxs[2] = -9999;
 
-	for (p = node->portals; p; p = next_portal)
+	for (cellside_t& side : cell)
 	{
-		if (p->nodes[0] == node)
-			side = 0;
-		else if (p->nodes[1] == node)
-			side = 1;
-		else
-			Error("CutNodePortals_r: mislinked portal");
-		next_portal = p->next[side];
-
-		for (i = 0; i < p->winding->numpoints; i++)
+		w = side.winding;
+		for (i = 0; i < w->numpoints; i++)
 		{
 			for (j = 0; j < 3; j++)
 			{
-				v = p->winding->points[i][j];
+				v = w->points[i][j];
 				if (v < node->mins[j])
 					node->mins[j] = v;
 				if (v > node->maxs[j])
@@ -813,7 +909,7 @@ Copies of these faces are further chopped up into the leafs,
 but they will reference these originals.
 ==================
 */
-void CopyFacesToNode(node_t* node, surface_t* surf)
+void CopyFacesToNode(node_t* node, surface_t* surf, bspstats_t* stats)
 {
 	face_t **prevptr, *f, *newf;
 
@@ -844,7 +940,7 @@ void CopyFacesToNode(node_t* node, surface_t* surf)
 			f->original = newf;
 			newf->next = node->faces;
 			node->faces = newf;
-			c_nodefaces++;
+			stats->nodefaces++;
 		}
 	}
 }
@@ -868,18 +964,66 @@ void DrawSurfaces(surface_t* surf)
 	}
 }
 
+/*
+==================
+CountSurfaces
+
+Counts up to max surfaces
+==================
+*/
+int CountSurfaces(surface_t* surfaces, int max)
+{
+	int count;
+
+	for (count = 0; surfaces && count < max; surfaces = surfaces->next)
+		count++;
+
+	return count;
+}
+
+/*
+==================
+ClaimBspThread
+
+Returns true if the children of node are big enough to be built
+on two threads, and there is a thread to spare for it
+==================
+*/
+qboolean ClaimBspThread(node_t* node)
+{
+	if (drawflag || bspthreads >= numthreads)
+		return false;
+
+	if (CountSurfaces(node->children[0]->surfaces, PARALLEL_SURFACES) < PARALLEL_SURFACES || CountSurfaces(node->children[1]->surfaces, PARALLEL_SURFACES) < PARALLEL_SURFACES)
+		return false;
+
+	if (++bspthreads > numthreads)
+	{
+		bspthreads--;
+		return false;
+	}
+
+	return true;
+}
+
 /*
 ==================
 BuildBspTree_r
+
+The children only touch their own surfaces, faces and sides, so
+the front one can be built on another thread while this one does
+the back, and the tree comes out the same either way.
 ==================
 */
-void BuildBspTree_r(node_t* node)
+void BuildBspTree_r(node_t* node, cell_t& cell, bspstats_t* stats, qboolean warnclipped)
 {
 	surface_t* split;
 	qboolean midsplit;
 	surface_t* allsurfs;
+	cell_t frontcell, backcell;
+	bspstats_t frontstats;
 
-	midsplit = CalcNodeBounds(node);
+	midsplit = CalcNodeBounds(node, cell);
 
 	DrawSurfaces(node->surfaces);
 
@@ -887,7 +1031,8 @@ void BuildBspTree_r(node_t* node)
 	if (!split)
 	{ // this is a leaf node
 		node->planenum = PLANENUM_LEAF;
-		LinkLeafFaces(node->surfaces, node);
+		LinkLeafFaces(node->surfaces, node, stats);
+		FreeCell(cell);
 		return;
 	}
 
@@ -898,8 +1043,8 @@ void BuildBspTree_r(node_t* node)
 	allsurfs = node->surfaces;
 	node->planenum = split->planenum;
 	node->faces = NULL;
-	CopyFacesToNode(node, split);
-	c_splitnodes++;
+	CopyFacesToNode(node, split, stats);
+	stats->splitnodes++;
 
 	node->children[0] = AllocNode();
 	node->children[1] = AllocNode();
@@ -910,20 +1055,29 @@ void BuildBspTree_r(node_t* node)
 	SplitNodeSurfaces(allsurfs, node);
 
 	//
-	// create the portal that seperates the two children
+	// carve the sides of the node into sides of the children
 	//
-	MakeNodePortal(node);
-
-	//
-	// carve the portals on the boundaries of the node
-	//
-	SplitNodePortals(node);
+	SplitNodeCell(node, cell, frontcell, backcell, warnclipped);
 
 	//
 	// recursively do the children
 	//
-	BuildBspTree_r(node->children[0]);
-	BuildBspTree_r(node->children[1]);
+	if (ClaimBspThread(node))
+	{
+		memset(&frontstats, 0, sizeof(frontstats));
+		std::thread front(BuildBspTree_r, node->children[0], std::ref(frontcell), &frontstats, warnclipped);
+		BuildBspTree_r(node->children[1], backcell, stats, warnclipped);
+		front.join();
+		bspthreads--;
+
+		stats->splitnodes += frontstats.splitnodes;
+		stats->nodefaces += frontstats.nodefaces;
+		stats->leaffaces += frontstats.leaffaces;
+		return;
+	}
+
+	BuildBspTree_r(node->children[0], frontcell, stats, warnclipped);
+	BuildBspTree_r(node->children[1], backcell, stats, warnclipped);
 }
 
 /*
@@ -934,21 +1088,22 @@ Takes a chain of surfaces plus a split type, and
 returns a bsp tree with faces off the nodes.
 
 The original surface chain will be completely freed.
+Safe to call from several threads at once, for different trees.
 ==================
 */
-node_t* SolidBSP(surfchain_t* surfhead)
+node_t* SolidBSP(surfchain_t* surfhead, bspstats_t* stats, qboolean warnclipped)
 {
 	node_t* headnode;
-
-	qprintf("----- SolidBSP -----\n");
+	dplane_t planes[6];
+	winding_t* windings[6];
+	cell_t cell;
+	int i, j;
 
 	headnode = AllocNode();
 	headnode->surfaces = surfhead->surfaces;
 
 	Draw_ClearWindow();
-	c_splitnodes = 0;
-	c_nodefaces = 0;
-	c_leaffaces = 0;
+	memset(stats, 0, sizeof(*stats));
 
 	if (!surfhead->surfaces)
 	{
@@ -959,18 +1114,65 @@ node_t* SolidBSP(surfchain_t* surfhead)
 	}
 
 	//
-	// generate six portals that enclose the entire world
+	// generate six sides that enclose the entire world
 	//
-	MakeHeadnodePortals(headnode, surfhead->mins, surfhead->maxs);
+	// in the order MakeHeadnodePortals links them
+	MakeHeadnodeWindings(surfhead->mins, surfhead->maxs, planes, windings);
+	for (i = 2; i >= 0; i--)
+		for (j = 1; j >= 0; j--)
+			cell.push_back({planes[j * 3 + i], windings[j * 3 + i]});
 
 	//
 	// recursively partition everything
 	//
-	BuildBspTree_r(headnode);
-
-	qprintf("%5i split nodes\n", c_splitnodes);
-	qprintf("%5i node faces\n", c_nodefaces);
-	qprintf("%5i leaf faces\n", c_leaffaces);
+	bspthreads++;
+	BuildBspTree_r(headnode, cell, stats, warnclipped);
+	bspthreads--;
 
 	return headnode;
 }
+
+/*
+==================
+MakeTreePortals_r
+==================
+*/
+void MakeTreePortals_r(node_t* node)
+{
+	if (node->planenum == PLANENUM_LEAF)
+		return;
+
+	//
+	// create the portal that seperates the two children
+	//
+	MakeNodePortal(node);
+
+	//
+	// carve the portals on the boundaries of the node
+	//
+	SplitNodePortals(node);
+
+	MakeTreePortals_r(node->children[0]);
+	MakeTreePortals_r(node->children[1]);
+}
+
+/*
+==================
+MakeTreePortals
+
+Builds the portals of a finished tree, in the same order
+the tree was partitioned in
+==================
+*/
+void MakeTreePortals(node_t* headnode, surfchain_t* surfhead)
+{
+	if (!surfhead->surfaces)
+		return;
+
+	//
+	// generate six portals that enclose the entire world
+	//
+	MakeHeadnodePortals(headnode, surfhead->mins, surfhead->maxs);
+
+	MakeTreePortals_r(headnode);
+}
@@ -11,6 +11,9 @@
 // divide.h
 
 #include "bsp5.h"
+
+#include <atomic>
+
 int TexelDelta(face_t* f, dplane_t* plane);
 int TexelSize(face_t* f);
 
@@ -24,7 +27,7 @@ the outside filling stage can remove some of them so a better bsp can be generat
 
 */
 
-int subdivides;
+std::atomic<int> subdivides; // SolidBSP runs on several threads
 
 
 /*
@@ -12,6 +12,13 @@
 
 #include "csg.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdarg>
+#include <string>
+#include <vector>
+
 /*
 
 
@@ -22,12 +29,12 @@ NOTES
 
 */
 
-int brushfaces;
-int c_csgfaces;
+std::atomic<int> brushfaces;
+std::atomic<int> c_csgfaces;
 FILE* out[NUM_HULLS];
 
-int c_tiny, c_tiny_clip;
-int c_outfaces;
+std::atomic<int> c_tiny, c_tiny_clip;
+std::atomic<int> c_outfaces;
 
 qboolean hullfile = false;
 static char qhullfile[256];
@@ -165,19 +172,42 @@ bface_t* ClipFace(brush_t* /*b*/, bface_t* f, bface_t** outside,
 	return f;
 }
 
+/*
+===========
+BufferPrintf
+===========
+*/
+void BufferPrintf(std::string& buffer, const char* format, ...)
+{
+	char text[256];
+	va_list argptr;
+	int length;
+
+	va_start(argptr, format);
+	length = vsnprintf(text, sizeof(text), format, argptr);
+	va_end(argptr);
+
+	if (length < 0 || length >= (int)sizeof(text))
+		Error("BufferPrintf: line too long");
+
+	buffer.append(text, length);
+}
+
 /*
 ===========
 WriteFace
+
+Adds the face to the output of the brush, which is written
+out once the whole entity is done
 ===========
 */
-void WriteFace(int hull, bface_t* f)
+void WriteFace(int hull, bface_t* f, std::string& output)
 {
 	int i;
 	winding_t* w;
 	static int level = 128;
 	vec_t light;
 
-	ThreadLock();
 	if (!hull)
 		c_csgfaces++;
 
@@ -185,12 +215,14 @@ void WriteFace(int hull, bface_t* f)
 	{
 		// .gl format
 		w = f->w;
-		fprintf(out[hull], "%i\n", w->numpoints);
+		BufferPrintf(output, "%i\n", w->numpoints);
+		ThreadLock();
 		level += 28;
 		light = (level & 255) / 255.0;
+		ThreadUnlock();
 		for (i = 0; i < w->numpoints; i++)
 		{
-			fprintf(out[hull], "%5.2f %5.2f %5.2f %5.3f %5.3f %5.3f\n",
+			BufferPrintf(output, "%5.2f %5.2f %5.2f %5.3f %5.3f %5.3f\n",
 				w->p[i][0],
 				w->p[i][1],
 				w->p[i][2],
@@ -198,24 +230,22 @@ void WriteFace(int hull, bface_t* f)
 				light,
 				light);
 		}
-		fprintf(out[hull], "\n");
+		BufferPrintf(output, "\n");
 	}
 	else
 	{
 		// .p0 format
 		w = f->w;
-		fprintf(out[hull], "%i %i %i %i\n", f->planenum, f->texinfo, f->contents, w->numpoints);
+		BufferPrintf(output, "%i %i %i %i\n", f->planenum, f->texinfo, f->contents, w->numpoints);
 		for (i = 0; i < w->numpoints; i++)
 		{
-			fprintf(out[hull], "%5.2f %5.2f %5.2f\n",
+			BufferPrintf(output, "%5.2f %5.2f %5.2f\n",
 				w->p[i][0],
 				w->p[i][1],
 				w->p[i][2]);
 		}
-		fprintf(out[hull], "\n");
+		BufferPrintf(output, "\n");
 	}
-
-	ThreadUnlock();
 }
 
 /*
@@ -229,7 +259,7 @@ Passable contents (water, lava, etc) will generate
 a mirrored copy of the face to be seen from the inside.
 ==================
 */
-void SaveOutside(brush_t* b, int hull, bface_t* outside, int mirrorcontents)
+void SaveOutside(brush_t* b, int hull, bface_t* outside, int mirrorcontents, std::string& output)
 {
 	bface_t *f, *next, *f2;
 	int i;
@@ -263,7 +293,7 @@ void SaveOutside(brush_t* b, int hull, bface_t* outside, int mirrorcontents)
 			}
 		}
 
-		WriteFace(hull, f);
+		WriteFace(hull, f, output);
 
 		//		if (mirrorcontents != CONTENTS_SOLID)
 		{
@@ -278,7 +308,7 @@ void SaveOutside(brush_t* b, int hull, bface_t* outside, int mirrorcontents)
 				VectorCopy(f->w->p[f->w->numpoints - 1 - i], f->w->p[i]);
 				VectorCopy(temp, f->w->p[f->w->numpoints - 1 - i]);
 			}
-			WriteFace(hull, f);
+			WriteFace(hull, f, output);
 		}
 
 		FreeFace(f);
@@ -360,136 +390,309 @@ bface_t* CopyFacesToOutside(brushhull_t* bh)
 //============================================================
 
 
+/*
+===================================================================
+
+BRUSH GRID
+
+Every hull of the entity being processed gets a uniform grid over
+its brush bounds, so a brush is only checked against the brushes
+in the cells it touches instead of every brush in the entity.
+
+===================================================================
+*/
+
+#define MIN_GRID_CELL 64   // world units
+#define MAX_GRID_CELLS 128 // along each axis
+
+typedef struct
+{
+	vec3_t origin;
+	vec3_t cellsize;
+	int size[3];
+	std::vector<std::vector<int>> cells; // brush numbers within the entity
+} brushgrid_t;
+
+static brushgrid_t brushgrids[NUM_HULLS];
+
 /*
 ===========
-CSGBrush
+GridCell
+===========
+*/
+int GridCell(brushgrid_t* grid, int axis, vec_t v)
+{
+	int cell;
+
+	cell = (int)floor((v - grid->origin[axis]) / grid->cellsize[axis]);
+	if (cell < 0)
+		return 0;
+	if (cell >= grid->size[axis])
+		return grid->size[axis] - 1;
+	return cell;
+}
+
+/*
+===========
+GridRange
+
+Finds the cells that a box touches. Boxes that touch, even
+if only on an edge, always share a cell.
+===========
+*/
+void GridRange(brushgrid_t* grid, vec3_t mins, vec3_t maxs, int lo[3], int hi[3])
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+	{
+		lo[i] = GridCell(grid, i, mins[i]);
+		hi[i] = GridCell(grid, i, maxs[i]);
+	}
+}
+
+/*
+===========
+BuildBrushGrid
+===========
+*/
+void BuildBrushGrid(entity_t* e, int hull)
+{
+	brushgrid_t* grid;
+	brushhull_t* bh;
+	vec3_t mins, maxs;
+	vec_t volume, cell;
+	int count, bn, i, x, y, z;
+	int lo[3], hi[3];
+
+	grid = &brushgrids[hull];
+	grid->cells.clear();
+
+	ClearBounds(mins, maxs);
+	count = 0;
+	for (bn = 0; bn < e->numbrushes; bn++)
+	{
+		bh = &mapbrushes[e->firstbrush + bn].hulls[hull];
+		if (!bh->faces)
+			continue; // brush isn't in this hull
+		AddPointToBounds(bh->mins, mins, maxs);
+		AddPointToBounds(bh->maxs, mins, maxs);
+		count++;
+	}
+
+	if (!count)
+		return;
+
+	// aim for about one brush per cell
+	volume = 1;
+	for (i = 0; i < 3; i++)
+		volume *= std::max(maxs[i] - mins[i], (vec_t)MIN_GRID_CELL);
+	cell = std::max((vec_t)cbrt(volume / count), (vec_t)MIN_GRID_CELL);
+
+	VectorCopy(mins, grid->origin);
+	for (i = 0; i < 3; i++)
+	{
+		grid->size[i] = std::min((int)((maxs[i] - mins[i]) / cell) + 1, MAX_GRID_CELLS);
+		grid->cellsize[i] = std::max((maxs[i] - mins[i]) / grid->size[i], (vec_t)1);
+	}
+
+	grid->cells.resize(grid->size[0] * grid->size[1] * grid->size[2]);
+
+	for (bn = 0; bn < e->numbrushes; bn++)
+	{
+		bh = &mapbrushes[e->firstbrush + bn].hulls[hull];
+		if (!bh->faces)
+			continue;
+
+		GridRange(grid, bh->mins, bh->maxs, lo, hi);
+		for (z = lo[2]; z <= hi[2]; z++)
+			for (y = lo[1]; y <= hi[1]; y++)
+				for (x = lo[0]; x <= hi[0]; x++)
+					grid->cells[(z * grid->size[1] + y) * grid->size[0] + x].push_back(bn);
+	}
+}
+
+/*
+===========
+TouchingBrushes
+
+Lists the brushes of the entity whose cells overlap the box,
+in brush order
+===========
+*/
+void TouchingBrushes(int hull, vec3_t mins, vec3_t maxs, std::vector<int>& touching)
+{
+	brushgrid_t* grid;
+	int x, y, z;
+	int lo[3], hi[3];
+
+	grid = &brushgrids[hull];
+	touching.clear();
+
+	if (grid->cells.empty())
+		return;
+
+	GridRange(grid, mins, maxs, lo, hi);
+	for (z = lo[2]; z <= hi[2]; z++)
+		for (y = lo[1]; y <= hi[1]; y++)
+			for (x = lo[0]; x <= hi[0]; x++)
+			{
+				std::vector<int>& cell = grid->cells[(z * grid->size[1] + y) * grid->size[0] + x];
+				touching.insert(touching.end(), cell.begin(), cell.end());
+			}
+
+	std::sort(touching.begin(), touching.end());
+	touching.erase(std::unique(touching.begin(), touching.end()), touching.end());
+}
+
+//============================================================
+
+// the output of every brush in every hull of the entity being
+// processed, written out in brush order once the entity is done
+static std::vector<std::string> brushoutput[NUM_HULLS];
+static int csgfirstbrush;
+
+/*
+===========
+CSGBrushHull
 ===========
 */
-void CSGBrush(int brushnum)
+void CSGBrushHull(int brushnum, int hull, std::string& output)
 {
-	int hull;
 	brush_t *b1, *b2;
 	brushhull_t *bh1, *bh2;
-	int bn;
 	qboolean overwrite;
 	int i;
 	bface_t *f, *f2, *next, *fcopy;
 	bface_t *outside, *oldoutside;
 	entity_t* e;
 	vec_t area;
-
-	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_ABOVE_NORMAL);
+	std::vector<int> touching;
 
 	b1 = &mapbrushes[brushnum];
 
 	e = &entities[b1->entitynum];
 
-	for (hull = 0; hull < NUM_HULLS; hull++)
+	bh1 = &b1->hulls[hull];
+	if (!bh1->faces)
+		return; // brush isn't in this hull
+
+	// set outside to a copy of the brush's faces
+	outside = CopyFacesToOutside(bh1);
+
+	TouchingBrushes(hull, bh1->mins, bh1->maxs, touching);
+
+	for (int bn : touching)
 	{
-		bh1 = &b1->hulls[hull];
+		// see if b2 needs to clip a chunk out of b1
 
-		// set outside to a copy of the brush's faces
-		outside = CopyFacesToOutside(bh1);
-		overwrite = false;
+		if (bn == brushnum)
+			continue;
+		overwrite = bn > brushnum; // later brushes overwrite
 
-		for (bn = 0; bn < e->numbrushes; bn++)
-		{
-			// see if b2 needs to clip a chunk out of b1
+		b2 = &mapbrushes[e->firstbrush + bn];
+		bh2 = &b2->hulls[hull];
 
-			if (bn == brushnum)
-			{
-				overwrite = true; // later brushes now overwrite
-				continue;
-			}
+		// check brush bounding box first
+		for (i = 0; i < 3; i++)
+			if (bh1->mins[i] > bh2->maxs[i] || bh1->maxs[i] < bh2->mins[i])
+				break;
+		if (i < 3)
+			continue;
 
-			b2 = &mapbrushes[e->firstbrush + bn];
-			bh2 = &b2->hulls[hull];
+		// divide faces by the planes of the b2 to find which
+		// fragments are inside
 
-			if (!bh2->faces)
-				continue; // brush isn't in this hull
+		f = outside;
+		outside = NULL;
+		for (; f; f = next)
+		{
+			next = f->next;
 
-			// check brush bounding box first
+			// check face bounding box first
 			for (i = 0; i < 3; i++)
-				if (bh1->mins[i] > bh2->maxs[i] || bh1->maxs[i] < bh2->mins[i])
+				if (bh2->mins[i] > f->maxs[i] || bh2->maxs[i] < f->mins[i])
 					break;
 			if (i < 3)
+			{ // this face doesn't intersect brush2's bbox
+				f->next = outside;
+				outside = f;
 				continue;
+			}
 
-			// divide faces by the planes of the b2 to find which
-			// fragments are inside
+			oldoutside = outside;
+			fcopy = CopyFace(f); // save to avoid fake splits
 
-			f = outside;
-			outside = NULL;
-			for (; f; f = next)
+			// throw pieces on the front sides of the planes
+			// into the outside list, return the remains on the inside
+			for (f2 = bh2->faces; f2 && f; f2 = f2->next)
+				f = ClipFace(b1, f, &outside, f2->planenum, overwrite);
+
+			area = f ? WindingArea(f->w) : 0;
+			if (f && area < 1.0)
+			{
+				qprintf("Entity %i, Brush %i: tiny penetration\n", b1->entitynum, b1->brushnum);
+				c_tiny_clip++;
+				FreeFace(f);
+				f = NULL;
+			}
+			if (f)
 			{
-				next = f->next;
-
-				// check face bounding box first
-				for (i = 0; i < 3; i++)
-					if (bh2->mins[i] > f->maxs[i] || bh2->maxs[i] < f->mins[i])
-						break;
-				if (i < 3)
-				{ // this face doesn't intersect brush2's bbox
+				// there is one convex fragment of the original
+				// face left inside brush2
+				FreeFace(fcopy);
+
+				if (b1->contents > b2->contents)
+				{ // inside a water brush
+					f->contents = b2->contents;
 					f->next = outside;
 					outside = f;
-					continue;
 				}
+				else			 // inside a solid brush
+					FreeFace(f); // throw it away
+			}
+			else
+			{ // the entire thing was on the outside, even
+				// though the bounding boxes intersected,
+				// which will never happen with axial planes
 
-				oldoutside = outside;
-				fcopy = CopyFace(f); // save to avoid fake splits
-
-				// throw pieces on the front sides of the planes
-				// into the outside list, return the remains on the inside
-				for (f2 = bh2->faces; f2 && f; f2 = f2->next)
-					f = ClipFace(b1, f, &outside, f2->planenum, overwrite);
-
-				area = f ? WindingArea(f->w) : 0;
-				if (f && area < 1.0)
-				{
-					qprintf("Entity %i, Brush %i: tiny penetration\n", b1->entitynum, b1->brushnum);
-					c_tiny_clip++;
-					FreeFace(f);
-					f = NULL;
-				}
-				if (f)
+				// free the fragments chopped to the outside
+				while (outside != oldoutside)
 				{
-					// there is one convex fragment of the original
-					// face left inside brush2
-					FreeFace(fcopy);
-
-					if (b1->contents > b2->contents)
-					{ // inside a water brush
-						f->contents = b2->contents;
-						f->next = outside;
-						outside = f;
-					}
-					else			 // inside a solid brush
-						FreeFace(f); // throw it away
+					f2 = outside->next;
+					FreeFace(outside);
+					outside = f2;
 				}
-				else
-				{ // the entire thing was on the outside, even
-					// though the bounding boxes intersected,
-					// which will never happen with axial planes
-
-					// free the fragments chopped to the outside
-					while (outside != oldoutside)
-					{
-						f2 = outside->next;
-						FreeFace(outside);
-						outside = f2;
-					}
 
-					// revert to the original face to avoid
-					// unneeded false cuts
-					fcopy->next = outside;
-					outside = fcopy;
-				}
+				// revert to the original face to avoid
+				// unneeded false cuts
+				fcopy->next = outside;
+				outside = fcopy;
 			}
 		}
-
-		// all of the faces left in outside are real surface faces
-		SaveOutside(b1, hull, outside, b1->contents);
 	}
+
+	// all of the faces left in outside are real surface faces
+	SaveOutside(b1, hull, outside, b1->contents, output);
+}
+
+/*
+===========
+CSGBrush
+
+Each hull of each brush is a work item of its own
+===========
+*/
+void CSGBrush(int work)
+{
+	int brush, hull;
+
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_ABOVE_NORMAL);
+
+	brush = work / NUM_HULLS;
+	hull = work % NUM_HULLS;
+
+	CSGBrushHull(csgfirstbrush + brush, hull, brushoutput[hull][brush]);
 }
 
 //======================================================================
@@ -643,24 +846,30 @@ void ProcessModels(void)
 				if (mapbrushes[first + j].contents == contents)
 				{
 					temp = mapbrushes[first + placed];
-					mapbrushes[first + placed] = mapbrushes[j];
-					mapbrushes[j] = temp;
+					mapbrushes[first + placed] = mapbrushes[first + j];
+					mapbrushes[first + j] = temp;
 					placed++;
 				}
 			}
 		}
 
 		//
-		// csg them in order
+		// csg them, then write them out in order
 		//
-		if (i == 0)
+		for (j = 0; j < NUM_HULLS; j++)
 		{
-			RunThreadsOnIndividual(entities[i].numbrushes, 1, CSGBrush);
+			BuildBrushGrid(&entities[i], j);
+			brushoutput[j].assign(entities[i].numbrushes, std::string());
 		}
-		else
+
+		csgfirstbrush = first;
+		RunThreadsOnIndividual(entities[i].numbrushes * NUM_HULLS, i == 0, CSGBrush);
+
+		for (j = 0; j < NUM_HULLS; j++)
 		{
-			for (j = 0; j < entities[i].numbrushes; j++)
-				CSGBrush(first + j);
+			for (std::string& output : brushoutput[j])
+				fwrite(output.data(), 1, output.size(), out[j]);
+			brushoutput[j].clear();
 		}
 
 		// write end of model marker
@@ -844,10 +1053,10 @@ int main(int argc, char** argv)
 
 	ProcessModels();
 
-	qprintf("%5i csg faces\n", c_csgfaces);
-	qprintf("%5i used faces\n", c_outfaces);
-	qprintf("%5i tiny faces\n", c_tiny);
-	qprintf("%5i tiny clips\n", c_tiny_clip);
+	qprintf("%5i csg faces\n", c_csgfaces.load());
+	qprintf("%5i used faces\n", c_outfaces.load());
+	qprintf("%5i tiny faces\n", c_tiny.load());
+	qprintf("%5i tiny clips\n", c_tiny_clip.load());
 
 	for (i = 0; i < NUM_HULLS; i++)
 		fclose(out[i]);
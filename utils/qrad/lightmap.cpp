@@ -10,6 +10,11 @@
 
 #include "qrad.h"
 
+#include <cstddef>
+#include <vector>
+
+extern qboolean incremental;
+
 typedef struct
 {
 	dface_t* faces[2];
@@ -810,6 +815,45 @@ entity_t* FindTargetEntity(char* target)
 	return NULL;
 }
 
+/*
+=============
+HashLightData
+
+FNV-1a, used for the light cache keys
+=============
+*/
+#define LIGHT_HASH_BASIS 2166136261u
+
+static unsigned HashLightData(unsigned hash, const void* data, size_t size)
+{
+	const byte* p = reinterpret_cast<const byte*>(data);
+
+	while (size--)
+		hash = (hash ^ *p++) * 16777619u;
+
+	return hash;
+}
+
+/*
+=============
+HashDirectLight
+=============
+*/
+static unsigned HashDirectLight(const directlight_t* dl)
+{
+	unsigned hash = LIGHT_HASH_BASIS;
+
+	hash = HashLightData(hash, &dl->type, sizeof(dl->type));
+	hash = HashLightData(hash, &dl->style, sizeof(dl->style));
+	hash = HashLightData(hash, dl->origin, sizeof(vec3_t));
+	hash = HashLightData(hash, dl->intensity, sizeof(vec3_t));
+	hash = HashLightData(hash, dl->normal, sizeof(vec3_t));
+	hash = HashLightData(hash, &dl->stopdot, sizeof(dl->stopdot));
+	hash = HashLightData(hash, &dl->stopdot2, sizeof(dl->stopdot2));
+
+	return hash;
+}
+
 /*
 =============
 CreateDirectLights
@@ -1014,6 +1058,11 @@ void CreateDirectLights(void)
 		}
 	}
 
+	// the light cache keys each face on the lights that can reach it
+	for (i = 0; i < (unsigned)numleafs; i++)
+		for (dl = directlights[i]; dl; dl = dl->next)
+			dl->hash = HashDirectLight(dl);
+
 	qprintf("%i direct lights\n", numdlights);
 }
 
@@ -1048,6 +1097,64 @@ float r_avertexnormals[NUMVERTEXNORMALS][3] = {
 
 #define VectorMaximum(a) (max((a)[0], max((a)[1], (a)[2])))
 
+// a light that reaches a sample if nothing is in the way
+typedef struct
+{
+	directlight_t* light;
+	vec3_t add;
+	vec3_t stop;
+	int contents; // what the line has to end in for the light to count
+} lighttest_t;
+
+/*
+=============
+AddTestedLights
+
+Traces the lines for a batch of lights, and adds the ones that are
+not occluded to the sample, in the order they were gathered
+=============
+*/
+static void AddTestedLights(vec3_t pos, lighttest_t* tests, int count, vec3_t* sample, byte* styles)
+{
+	vec_t* starts[TRACE_BATCH];
+	vec_t* stops[TRACE_BATCH];
+	int contents[TRACE_BATCH];
+	int i;
+	int style_index;
+
+	for (i = 0; i < count; i++)
+	{
+		starts[i] = pos;
+		stops[i] = tests[i].stop;
+	}
+
+	TestLines(0, count, starts, stops, contents);
+
+	for (i = 0; i < count; i++)
+	{
+		directlight_t* l = tests[i].light;
+
+		if (contents[i] != tests[i].contents)
+			continue; // occluded
+
+		for (style_index = 0; style_index < MAXLIGHTMAPS; style_index++)
+			if (styles[style_index] == l->style || styles[style_index] == 255)
+				break;
+
+		if (style_index == MAXLIGHTMAPS)
+		{
+			printf("WARNING: Too many direct light styles on a face(%f,%f,%f)\n",
+				pos[0], pos[1], pos[2]);
+			continue;
+		}
+
+		if (styles[style_index] == 255)
+			styles[style_index] = l->style;
+
+		VectorAdd(sample[style_index], tests[i].add, sample[style_index]);
+	}
+}
+
 void GatherSampleLight(vec3_t pos, byte* pvs, vec3_t normal, vec3_t* sample, byte* styles)
 {
 	int i;
@@ -1059,7 +1166,12 @@ void GatherSampleLight(vec3_t pos, byte* pvs, vec3_t normal, vec3_t* sample, byt
 	float ratio;
 	int style_index;
 	directlight_t* sky_used = NULL;
+	lighttest_t tests[TRACE_BATCH];
+	int numtests = 0;
 
+	//
+	// lights are gathered into batches, and their lines are traced together
+	//
 	for (i = 1; i < numleafs; i++)
 	{
 		if (l = directlights[i]; l != nullptr && (pvs[(i - 1) >> 3] & (1 << ((i - 1) & 7))))
@@ -1079,12 +1191,6 @@ void GatherSampleLight(vec3_t pos, byte* pvs, vec3_t normal, vec3_t* sample, byt
 					if (dot <= ON_EPSILON / 10)
 						continue;
 
-					// search back to see if we can hit a sky brush
-					VectorScale(l->normal, -10000, delta);
-					VectorAdd(pos, delta, delta);
-					if (TestLine_r(0, pos, delta) != CONTENTS_SKY)
-						continue; // occluded
-
 					VectorScale(l->intensity, dot, add);
 				}
 				else
@@ -1129,38 +1235,50 @@ void GatherSampleLight(vec3_t pos, byte* pvs, vec3_t normal, vec3_t* sample, byt
 
 				if (VectorMaximum(add) > (l->style ? coring : 0))
 				{
-					if (l->type != emittype_t::skylight && TestLine_r(0, pos, l->origin) != CONTENTS_EMPTY)
-						continue; // occluded
-
+					lighttest_t* test = &tests[numtests++];
 
-					for (style_index = 0; style_index < MAXLIGHTMAPS; style_index++)
-						if (styles[style_index] == l->style || styles[style_index] == 255)
-							break;
+					test->light = l;
+					VectorCopy(add, test->add);
 
-					if (style_index == MAXLIGHTMAPS)
+					if (l->type == emittype_t::skylight)
 					{
-						printf("WARNING: Too many direct light styles on a face(%f,%f,%f)\n",
-							pos[0], pos[1], pos[2]);
-						continue;
+						// search back to see if we can hit a sky brush
+						VectorScale(l->normal, -10000, test->stop);
+						VectorAdd(pos, test->stop, test->stop);
+						test->contents = CONTENTS_SKY;
+					}
+					else
+					{
+						VectorCopy(l->origin, test->stop);
+						test->contents = CONTENTS_EMPTY;
 					}
 
-					if (styles[style_index] == 255)
-						styles[style_index] = l->style;
-
-					VectorAdd(sample[style_index], add, sample[style_index]);
+					if (numtests == TRACE_BATCH)
+					{
+						AddTestedLights(pos, tests, numtests, sample, styles);
+						numtests = 0;
+					}
 				}
 			}
 		}
 	}
+
+	AddTestedLights(pos, tests, numtests, sample, styles);
+
 	if (sky_used && indirect_sun != 0.0)
 	{
 		vec3_t total;
 		int j;
 		vec3_t sky_intensity;
+		vec3_t skystops[NUMVERTEXNORMALS];
+		vec_t* starts[NUMVERTEXNORMALS];
+		vec_t* stops[NUMVERTEXNORMALS];
+		float dots[NUMVERTEXNORMALS];
+		int contents[NUMVERTEXNORMALS];
+		int numsky = 0;
 
 		VectorScale(sky_used->intensity, indirect_sun / (NUMVERTEXNORMALS * 2), sky_intensity);
 
-		total[0] = total[1] = total[2] = 0.0;
 		for (j = 0; j < NUMVERTEXNORMALS; j++)
 		{
 			// make sure the angle is okay
@@ -1169,12 +1287,23 @@ void GatherSampleLight(vec3_t pos, byte* pvs, vec3_t normal, vec3_t* sample, byt
 				continue;
 
 			// search back to see if we can hit a sky brush
-			VectorScale(r_avertexnormals[j], -10000, delta);
-			VectorAdd(pos, delta, delta);
-			if (TestLine_r(0, pos, delta) != CONTENTS_SKY)
+			VectorScale(r_avertexnormals[j], -10000, skystops[numsky]);
+			VectorAdd(pos, skystops[numsky], skystops[numsky]);
+			starts[numsky] = pos;
+			stops[numsky] = skystops[numsky];
+			dots[numsky] = dot;
+			numsky++;
+		}
+
+		TestLines(0, numsky, starts, stops, contents);
+
+		total[0] = total[1] = total[2] = 0.0;
+		for (j = 0; j < numsky; j++)
+		{
+			if (contents[j] != CONTENTS_SKY)
 				continue; // occluded
 
-			VectorScale(sky_intensity, dot, add);
+			VectorScale(sky_intensity, dots[j], add);
 			VectorAdd(total, add, total);
 		}
 		if (VectorMaximum(total) > 0)
@@ -1332,6 +1461,262 @@ void GetPhongNormal(int facenum, vec3_t spot, vec3_t phongnormal)
 }
 
 
+/*
+===================================================================
+
+LIGHT CACHE
+
+Incremental runs keep the direct light of every face in a cache file,
+so that relighting a map after a light entity changes only gathers
+light again for the faces that the change can reach.
+
+A face is keyed on its offset, its plane, the position of every
+sample, and every light in the PVS of its samples, in the order
+GatherSampleLight visits them.
+The cache is only loaded when the geometry and vis data match the
+incremental save file, so a face with an unchanged key would gather
+exactly the same light. The bounce passes always run in full.
+
+===================================================================
+*/
+
+#define LIGHTCACHE_IDENT (('L' << 24) + ('R' << 16) + ('A' << 8) + 'Q') // little-endian "QARL"
+#define LIGHTCACHE_VERSION 2
+
+typedef struct
+{
+	int ident;
+	int version;
+	int numfaces;
+	unsigned settings; // hash of the options that change direct light
+	unsigned check;	   // of the fields above
+} lightcacheheader_t;
+
+// followed by the light of each style in use, numsamples at a time
+typedef struct
+{
+	unsigned key;
+	int numsamples;
+	byte styles[MAXLIGHTMAPS];
+} lightcacheface_t;
+
+typedef struct
+{
+	lightcacheface_t face;
+	qboolean valid;	 // face and light can be used
+	qboolean reused; // the light was not gathered this run
+	std::vector<float> light;
+} facecache_t;
+
+static facecache_t facecache[MAX_MAP_FACES];
+
+/*
+=============
+LightCacheSettings
+=============
+*/
+static unsigned LightCacheSettings(void)
+{
+	unsigned hash = LIGHT_HASH_BASIS;
+	int lightmaps = MAXLIGHTMAPS;
+
+	hash = HashLightData(hash, &lightmaps, sizeof(lightmaps));
+	hash = HashLightData(hash, &extra, sizeof(extra));
+	hash = HashLightData(hash, &indirect_sun, sizeof(indirect_sun));
+	hash = HashLightData(hash, &coring, sizeof(coring));
+	hash = HashLightData(hash, &smoothing_threshold, sizeof(smoothing_threshold));
+
+	return hash;
+}
+
+/*
+=============
+LightCacheHeaderCheck
+=============
+*/
+static unsigned LightCacheHeaderCheck(const lightcacheheader_t* header)
+{
+	return HashLightData(LIGHT_HASH_BASIS, header, offsetof(lightcacheheader_t, check));
+}
+
+/*
+=============
+LightCacheFloats
+=============
+*/
+static size_t LightCacheFloats(const lightcacheface_t* face)
+{
+	int numstyles;
+
+	for (numstyles = 0; numstyles < MAXLIGHTMAPS && face->styles[numstyles] != 255; numstyles++)
+		;
+
+	return (size_t)numstyles * face->numsamples * 3;
+}
+
+/*
+=============
+FaceLightKey
+
+Hashes where the samples of a face are, and the direct lights they can see
+=============
+*/
+static unsigned FaceLightKey(int facenum, lightinfo_t* l)
+{
+	byte pvs[(MAX_MAP_LEAFS + 7) / 8];
+	byte facepvs[(MAX_MAP_LEAFS + 7) / 8];
+	int i, j, offset, lastoffset = -1;
+	int pvssize = (numleafs + 7) / 8;
+	unsigned key = LIGHT_HASH_BASIS;
+	directlight_t* dl;
+
+	key = HashLightData(key, face_offset[facenum], sizeof(vec3_t));
+	key = HashLightData(key, l->facenormal, sizeof(vec3_t));
+	key = HashLightData(key, &l->facedist, sizeof(l->facedist));
+	key = HashLightData(key, &l->numsurfpt, sizeof(l->numsurfpt));
+
+	// moving a face, or its texture alignment or scale, moves its samples
+	key = HashLightData(key, l->surfpt, l->numsurfpt * sizeof(vec3_t));
+
+	// the samples of a face can see more than one leaf
+	if (!visdatasize)
+	{
+		memset(facepvs, 255, pvssize);
+	}
+	else
+	{
+		memset(facepvs, 0, pvssize);
+		for (i = 0; i < l->numsurfpt; i++)
+		{
+			offset = PointInLeaf(l->surfpt[i])->visofs;
+			if (offset == lastoffset)
+				continue;
+			if (offset == -1)
+				Error("leaf->visofs == -1");
+
+			DecompressVis(&dvisdata[offset], pvs);
+			for (j = 0; j < pvssize; j++)
+				facepvs[j] |= pvs[j];
+			lastoffset = offset;
+		}
+	}
+
+	for (i = 1; i < numleafs; i++)
+		if (facepvs[(i - 1) >> 3] & (1 << ((i - 1) & 7)))
+			for (dl = directlights[i]; dl; dl = dl->next)
+				key = HashLightData(key, &dl->hash, sizeof(dl->hash));
+
+	return key;
+}
+
+/*
+=============
+LoadLightCache
+=============
+*/
+void LoadLightCache(char* filename)
+{
+	lightcacheheader_t header;
+	facecache_t* cache;
+	FILE* f;
+	int i;
+
+	f = fopen(filename, "rb");
+	if (!f)
+		return;
+
+	if (fread(&header, sizeof(header), 1, f) != 1 || header.ident != LIGHTCACHE_IDENT || header.version != LIGHTCACHE_VERSION || header.check != LightCacheHeaderCheck(&header) || header.numfaces != numfaces)
+	{
+		printf("Light cache [%s] is out of date!  All faces will be relit.\n", filename);
+		fclose(f);
+		return;
+	}
+
+	if (header.settings != LightCacheSettings())
+	{
+		printf("Light cache [%s] was built with other options!  All faces will be relit.\n", filename);
+		fclose(f);
+		return;
+	}
+
+	for (i = 0; i < numfaces; i++)
+	{
+		cache = &facecache[i];
+		if (fread(&cache->face, sizeof(cache->face), 1, f) != 1 || cache->face.numsamples < 0 || cache->face.numsamples > SINGLEMAP)
+			break;
+
+		cache->light.resize(LightCacheFloats(&cache->face));
+		if (fread(cache->light.data(), sizeof(float), cache->light.size(), f) != cache->light.size())
+			break;
+
+		cache->valid = true;
+	}
+
+	if (i != numfaces)
+	{
+		printf("Light cache [%s] is truncated!  All faces will be relit.\n", filename);
+		for (i = 0; i < numfaces; i++)
+		{
+			facecache[i].valid = false;
+			std::vector<float>().swap(facecache[i].light);
+		}
+	}
+
+	fclose(f);
+}
+
+/*
+=============
+SaveLightCache
+
+Writes the direct light that BuildFacelights kept, and frees it
+=============
+*/
+void SaveLightCache(char* filename)
+{
+	lightcacheheader_t header;
+	lightcacheface_t empty;
+	facecache_t* cache;
+	FILE* f;
+	int i, lit = 0, reused = 0;
+
+	header.ident = LIGHTCACHE_IDENT;
+	header.version = LIGHTCACHE_VERSION;
+	header.numfaces = numfaces;
+	header.settings = LightCacheSettings();
+	header.check = LightCacheHeaderCheck(&header);
+
+	memset(&empty, 0, sizeof(empty));
+	memset(empty.styles, 255, sizeof(empty.styles));
+
+	f = SafeOpenWrite(filename);
+	SafeWrite(f, &header, sizeof(header));
+
+	for (i = 0; i < numfaces; i++)
+	{
+		cache = &facecache[i];
+		if (!cache->valid)
+		{
+			SafeWrite(f, &empty, sizeof(empty));
+			continue;
+		}
+
+		SafeWrite(f, &cache->face, sizeof(cache->face));
+		SafeWrite(f, cache->light.data(), cache->light.size() * sizeof(float));
+
+		lit++;
+		if (cache->reused)
+			reused++;
+
+		cache->valid = false;
+		std::vector<float>().swap(cache->light);
+	}
+
+	fclose(f);
+
+	printf("%i of %i faces relit, %i from the light cache\n", lit - reused, lit, reused);
+}
+
 /*
 =============
 BuildFacelights
@@ -1349,9 +1734,20 @@ void BuildFacelights(int facenum)
 	int thisoffset = -1, lastoffset = -1;
 	int lightmapwidth, lightmapheight, size;
 	vec3_t centroid = {0, 0, 0};
+	facecache_t* cache = NULL;
+	unsigned key = 0;
+	qboolean reused = false;
 
 	f = &dfaces[facenum];
 
+	// the cached light is only kept if the face is lit the same way again
+	if (incremental)
+	{
+		cache = &facecache[facenum];
+		reused = cache->valid;
+		cache->valid = false;
+	}
+
 	//
 	// some surfaces don't need lightmaps
 	//
@@ -1395,8 +1791,38 @@ void BuildFacelights(int facenum)
 	for (k = 0; k < MAXLIGHTMAPS; k++)
 		facelight[facenum].samples[k] = reinterpret_cast<sample_t*>(calloc(l.numsurfpt, sizeof(sample_t)));
 
+	//
+	// an unchanged face takes its light from the light cache
+	//
+	if (cache)
+	{
+		key = FaceLightKey(facenum, &l);
+		reused = reused && cache->face.key == key && cache->face.numsamples == l.numsurfpt;
+	}
+
+	if (reused)
+	{
+		memcpy(f->styles, cache->face.styles, sizeof(f->styles));
+
+		spot = l.surfpt[0];
+		for (i = 0; i < l.numsurfpt; i++, spot += 3)
+		{
+			for (k = 0; k < MAXLIGHTMAPS; k++)
+				VectorCopy(spot, facelight[facenum].samples[k][i].pos);
+
+			for (j = 0; j < MAXLIGHTMAPS && (f->styles[j] != 255); j++)
+			{
+				VectorCopy(&cache->light[(j * l.numsurfpt + i) * 3], facelight[facenum].samples[j][i].light);
+				if (f->styles[j] == 0)
+				{
+					AddSampleToPatch(&facelight[facenum].samples[j][i], facenum);
+				}
+			}
+		}
+	}
+
 	spot = l.surfpt[0];
-	for (i = 0; i < l.numsurfpt; i++, spot += 3)
+	for (i = 0; i < l.numsurfpt && !reused; i++, spot += 3)
 	{
 		vec3_t pointnormal = {0, 0, 0};
 
@@ -1480,6 +1906,23 @@ void BuildFacelights(int facenum)
 		}
 	}
 
+	// keep the gathered light before the ambient and texture light is added
+	if (cache)
+	{
+		if (!reused)
+		{
+			cache->face.key = key;
+			cache->face.numsamples = l.numsurfpt;
+			memcpy(cache->face.styles, f->styles, sizeof(cache->face.styles));
+			cache->light.resize(LightCacheFloats(&cache->face));
+			for (j = 0; j < MAXLIGHTMAPS && (f->styles[j] != 255); j++)
+				for (i = 0; i < l.numsurfpt; i++)
+					VectorCopy(facelight[facenum].samples[j][i].light, &cache->light[(j * l.numsurfpt + i) * 3]);
+		}
+		cache->valid = true;
+		cache->reused = reused;
+	}
+
 	// average up the direct light on each patch for radiosity
 	if (numbounce > 0)
 	{
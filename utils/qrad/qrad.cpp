@@ -12,6 +12,15 @@
 
 #include "qrad.h"
 
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_FUNCTION
+#else
+#define AVX2_FUNCTION __attribute__((target("avx2,fma")))
+#endif
+
 
 /*
 
@@ -26,7 +35,7 @@ patch_t* face_patches[MAX_MAP_FACES];
 entity_t* face_entity[MAX_MAP_FACES];
 patch_t patches[MAX_PATCHES];
 unsigned num_patches;
-vec3_t emitlight[MAX_PATCHES];
+float emitlight[3][MAX_PATCHES]; // red, green and blue planes, for the gather kernels
 vec3_t addlight[MAX_PATCHES];
 vec3_t face_offset[MAX_MAP_FACES]; // for rotating bmodels
 dplane_t backplanes[MAX_MAP_PLANES];
@@ -64,6 +73,8 @@ float smoothing_threshold = 0; // default: cos(45.0*(Q_PI/180));
 // Cosine of smoothing angle(in radians)
 float coring = 1.0; // Light threshold to force to blackness(minimizes lightmaps)
 qboolean texscale = true;
+int tracebench = 0; // number of rays for BenchmarkTrace, or 0 for none
+qboolean noavx2 = false; // gather with the scalar GatherTransfers even if the CPU has AVX2
 
 /*
 ===================================================================
@@ -691,9 +702,14 @@ void MakeScales(int /*threadnum*/)
 	vec3_t origin;
 	vec_t area;
 	transfer_t transfers[MAX_PATCHES], *all_transfers;
+	byte* list;
 
 	count = 0;
 
+	list = reinterpret_cast<byte*>(malloc(MAX_TRANSFER_LIST));
+	if (!list)
+		Error("Memory allocation failure");
+
 	while (1)
 	{
 		i = GetThreadWork();
@@ -759,31 +775,26 @@ void MakeScales(int /*threadnum*/)
 			count++;
 		}
 
-		// copy the transfers out
 		if (patch->numtransfers)
 		{
-			transfer_t *t, *t2;
-
-			patch->transfers = reinterpret_cast<transfer_t*>(calloc(patch->numtransfers, sizeof(transfer_t)));
-
-			if (!patch->transfers)
-				Error("Memory allocation failure");
+			transfer_t* t;
 
 			//
 			// normalize all transfers so exactly 50% of the light
 			// is transfered to the surroundings
 			//
 			total = 0.5f / total;
-			t = patch->transfers;
-			t2 = transfers;
-			for (j = 0; j < (unsigned)patch->numtransfers; j++, t++, t2++)
-			{
-				t->transfer = (unsigned short)(t2->transfer * total);
-				t->patch = t2->patch;
-			}
+			t = transfers;
+			for (j = 0; j < (unsigned)patch->numtransfers; j++, t++)
+				t->transfer = (unsigned short)(t->transfer * total);
 		}
+
+		// send the transfers out to the store
+		WriteScatterTransfers(i, transfers, patch->numtransfers, list);
 	}
 
+	free(list);
+
 	ThreadLock();
 	total_transfer += count;
 	ThreadUnlock();
@@ -827,83 +838,6 @@ void WriteWorld(char* name)
 	fclose(out);
 }
 
-/*
-=============
-SwapTransfersTask
-
-Change transfers from light sent out to light collected in.
-In an ideal world, they would be exactly symetrical, but
-because the form factors are only aproximated, then normalized,
-they will actually be rather different.
-=============
-*/
-void SwapTransfersTask(int patchnum)
-{
-	int j, k, l, m, n, h;
-	patch_t *patch, *patch2;
-	transfer_t *t, *t2;
-	int transfer;
-
-	patch = patches + patchnum;
-
-	t = patch->transfers;
-	for (j = 0; j < patch->numtransfers; j++, t++)
-	{
-		k = t->patch;
-		if (k > patchnum)
-			break; // done with this list
-		patch2 = &patches[k];
-		t2 = patch2->transfers;
-
-		if (!patch2->numtransfers)
-		{
-			printf("WARNING: SwapTransfers: unmatched\n");
-			continue;
-		}
-		//
-		// binary search for match
-		//
-		l = 0;
-		h = patch2->numtransfers - 1;
-		while (1)
-		{
-			m = (l + h) >> 1;
-			n = t2[m].patch;
-			if (n < patchnum)
-			{
-				l = m + 1;
-				continue;
-			}
-			if (n > patchnum)
-			{
-				h = m - 1;
-				continue;
-			}
-
-			t2 += m;
-			transfer = t2->transfer;
-			t2->transfer = t->transfer;
-			t->transfer = transfer;
-			break;
-		}
-
-#if 0
-		for (l=0 ; l<patch2->numtransfers ; l++, t2++)
-		{
-			if (t2->patch == i)
-			{
-				transfer = t2->transfer;
-				t2->transfer = t->transfer;
-				t->transfer = transfer;
-				break;
-			}
-		}
-#endif
-		if (l == patch2->numtransfers)
-			Error("Didn't match transfer");
-	}
-}
-
 /*
 =============
 CollectLight
@@ -921,226 +855,196 @@ void CollectLight(vec3_t total)
 		// sky's never collect light, it is just dropped
 		if (patch->sky)
 		{
-			VectorFill(emitlight[i], 0);
+			emitlight[0][i] = emitlight[1][i] = emitlight[2][i] = 0;
 			VectorFill(addlight[i], 0);
 			continue;
 		}
 
 		VectorAdd(patch->totallight, addlight[i], patch->totallight);
-		VectorScale(addlight[i], TRANSFER_SCALE, emitlight[i]);
-		VectorAdd(total, emitlight[i], total);
+		VectorAdd(total, addlight[i], total);
+		emitlight[0][i] = addlight[i][0] * TRANSFER_SCALE;
+		emitlight[1][i] = addlight[i][1] * TRANSFER_SCALE;
+		emitlight[2][i] = addlight[i][2] * TRANSFER_SCALE;
 		VectorFill(addlight[i], 0);
 	}
-
-	VectorScale(total, INVERSE_TRANSFER_SCALE, total);
 }
 
 /*
 =============
-GatherLight
+GatherTransfers
 
-Get light from other patches
-  Run multi-threaded
+The sum of emitlight over a gather list, weighted by its transfers.
+Adds in list order with a separate multiply and add, so the sums are
+bit-identical to the gather before the kernels were split out.
 =============
 */
-void GatherLight(int /*threadnum*/)
+static void GatherTransfers(unsigned count, const unsigned short* patchnums, const unsigned short* transfers, vec3_t sum)
 {
-	int j, k;
-	transfer_t* trans;
-	int num;
-	patch_t* patch;
-	vec3_t sum, v;
+	float r = 0, g = 0, b = 0;
+	unsigned k;
 
-	while (1)
+	for (k = 0; k < count; k++)
 	{
-		j = GetThreadWork();
-		if (j == -1)
-			break;
-
-		patch = &patches[j];
-
-		trans = patch->transfers;
-		num = patch->numtransfers;
-
-		VectorFill(sum, 0)
+		const unsigned p = patchnums[k];
+		const float t = transfers[k];
+		r += emitlight[0][p] * t;
+		g += emitlight[1][p] * t;
+		b += emitlight[2][p] * t;
+	}
 
-			for (k = 0; k < num; k++, trans++)
-		{
-			VectorScale(emitlight[trans->patch], trans->transfer, v);
-			VectorAdd(sum, v, sum);
-		}
+	sum[0] = r;
+	sum[1] = g;
+	sum[2] = b;
+}
 
-		VectorCopy(sum, addlight[j]);
-	}
+AVX2_FUNCTION static float HorizontalSum(__m256 v)
+{
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
 }
 
 /*
 =============
-BounceLight
+GatherTransfersAVX2
+
+GatherTransfers eight transfers at a time.
+The products are fused into the sums, and the eight lanes are summed
+separately and added together at the end, so the result may differ from
+GatherTransfers in the last bits. -noavx2 turns it off.
 =============
 */
-void BounceLight(void)
+AVX2_FUNCTION static void GatherTransfersAVX2(unsigned count, const unsigned short* patchnums, const unsigned short* transfers, vec3_t sum)
 {
-	unsigned i;
-	vec3_t added;
-	char name[64];
+	__m256 r = _mm256_setzero_ps();
+	__m256 g = _mm256_setzero_ps();
+	__m256 b = _mm256_setzero_ps();
+	unsigned k;
 
-	for (i = 0; i < num_patches; i++)
-		VectorScale(patches[i].totallight, TRANSFER_SCALE, emitlight[i]);
-
-	for (i = 0; i < numbounce; i++)
+	for (k = 0; k + 8 <= count; k += 8)
 	{
-		RunThreadsOn(num_patches, true, GatherLight);
-		CollectLight(added);
+		const __m256i p = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(patchnums + k)));
+		const __m256 t = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(transfers + k))));
 
-		qprintf("\tBounce #%i added RGB(%.0f, %.0f, %.0f)\n", i + 1, added[0], added[1], added[2]);
-		if (dumppatches && (i == 0 || i == (unsigned)numbounce - 1))
-		{
-			sprintf(name, "bounce%i.txt", i);
-			WriteWorld(name);
-		}
+		r = _mm256_fmadd_ps(_mm256_i32gather_ps(emitlight[0], p, 4), t, r);
+		g = _mm256_fmadd_ps(_mm256_i32gather_ps(emitlight[1], p, 4), t, g);
+		b = _mm256_fmadd_ps(_mm256_i32gather_ps(emitlight[2], p, 4), t, b);
 	}
-}
 
+	GatherTransfers(count - k, patchnums + k, transfers + k, sum);
+	sum[0] += HorizontalSum(r);
+	sum[1] += HorizontalSum(g);
+	sum[2] += HorizontalSum(b);
+}
 
 /*
 =============
-writetransfers
+CPUHasAVX2
+
+AVX2 and FMA, and an OS that saves the AVX registers
 =============
 */
-
-long writetransfers(char* transferfile, long total_patches)
+static qboolean CPUHasAVX2(void)
 {
-	int handle;
-	long writtenpatches = 0, writtentransfers = 0, totalbytes = 0;
-	int spacerequired = sizeof(long) + total_patches * sizeof(long) + total_transfer * sizeof(transfer_t);
-
-	if (spacerequired - getfilesize(transferfile) < getfreespace(transferfile))
-	{
-		if ((handle = _open(transferfile, _O_WRONLY | _O_BINARY | _O_CREAT | _O_TRUNC, _S_IREAD | _S_IWRITE)) != -1)
-		{
-			unsigned byteswritten;
-			qprintf("Writing [%s] with new saved qrad data", transferfile);
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	__cpuid(info, 1);
+	const bool fma = (info[2] & (1 << 12)) != 0;
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	if (!fma || !osxsave || !avx || (_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
 
-			if ((byteswritten = _write(handle, &total_patches, sizeof(total_patches))) == sizeof(total_patches))
-			{
-				patch_t* patch;
+/*
+=============
+GatherLight
 
-				totalbytes += byteswritten;
+Get light from other patches
+  Run multi-threaded
+=============
+*/
+unsigned gatherfirst; // first patch of the transfer window being gathered
+static void (*gathertransfers)(unsigned count, const unsigned short* patchnums, const unsigned short* transfers, vec3_t sum);
 
-				for (patch = patches; total_patches-- > 0; patch++)
-				{
-					if ((byteswritten = _write(handle, &patch->numtransfers, sizeof(patch->numtransfers))) == sizeof(patch->numtransfers))
-					{
-						totalbytes += byteswritten;
-
-						if (patch->numtransfers &&
-							(byteswritten = _write(handle, patch->transfers, patch->numtransfers * sizeof(transfer_t))) == patch->numtransfers * sizeof(transfer_t))
-						{
-							totalbytes += byteswritten;
-							writtentransfers += patch->numtransfers;
-						}
-						writtenpatches++;
-					}
-					else
-					{
-						break;
-					}
-				}
-			}
+void GatherLight(int /*threadnum*/)
+{
+	int j;
+	unsigned num;
+	const unsigned short* patchnums;
+	const unsigned short* transfers;
 
-			qprintf("(%d)\n", totalbytes);
+	while (1)
+	{
+		j = GetThreadWork();
+		if (j == -1)
+			break;
+		j += gatherfirst;
 
-			_close(handle);
-		}
+		num = GetPatchTransfers(j, &patchnums, &transfers);
+		gathertransfers(num, patchnums, transfers, addlight[j]);
 	}
-	else
-		printf("Insufficient disk space(%ld) for 'QRAD save file'[%s]!\n",
-			spacerequired - getfilesize(transferfile), transferfile);
-
-
-	return writtenpatches;
 }
 
 /*
 =============
-readtransfers
+BounceLight
 =============
 */
-
-long readtransfers(char* transferfile, long numpatches)
+void BounceLight(void)
 {
-	int handle;
-	long readpatches = 0, readtransfers = 0, totalbytes = 0;
-	time_t start, end;
-	time(&start);
-	if ((handle = _open(transferfile, _O_RDONLY | _O_BINARY)) != -1)
-	{
-		long filepatches;
-		unsigned long bytesread;
+	unsigned i;
+	vec3_t added;
+	char name[64];
 
-		printf("%-20s Restoring [%-13s - ", "MakeAllScales:", transferfile);
+	for (i = 0; i < num_patches; i++)
+	{
+		emitlight[0][i] = patches[i].totallight[0] * TRANSFER_SCALE;
+		emitlight[1][i] = patches[i].totallight[1] * TRANSFER_SCALE;
+		emitlight[2][i] = patches[i].totallight[2] * TRANSFER_SCALE;
+	}
 
-		if ((bytesread = _read(handle, &filepatches, sizeof(filepatches))) == sizeof(filepatches))
-		{
-			if (filepatches == numpatches)
-			{
+	if (!noavx2 && CPUHasAVX2())
+	{
+		qprintf("gathering with AVX2\n");
+		gathertransfers = GatherTransfersAVX2;
+	}
+	else
+		gathertransfers = GatherTransfers;
 
-				patch_t* patch;
+	for (i = 0; i < numbounce; i++)
+	{
+		unsigned numgather;
 
-				totalbytes += bytesread;
+		// the transfers are gathered a window at a time
+		BeginTransferWindows();
+		while (NextTransferWindow(&gatherfirst, &numgather))
+		{
+			if (numgather != num_patches)
+				printf("patches %u to %u\n", gatherfirst, gatherfirst + numgather - 1);
+			RunThreadsOn(numgather, true, GatherLight);
+		}
+		CollectLight(added);
 
-				for (patch = patches; readpatches < numpatches; patch++)
-				{
-					if ((bytesread = _read(handle, &patch->numtransfers, sizeof(patch->numtransfers))) == sizeof(patch->numtransfers))
-					{
-						if (patch->transfers = reinterpret_cast<transfer_t*>(calloc(patch->numtransfers, sizeof(patch->transfers[0]))); patch->transfers != nullptr)
-						{
-							totalbytes += bytesread;
-
-							if (patch->numtransfers)
-							{
-								if ((bytesread = _read(handle, patch->transfers, patch->numtransfers * sizeof(transfer_t))) == patch->numtransfers * sizeof(transfer_t))
-								{
-									totalbytes += bytesread;
-									readtransfers += patch->numtransfers;
-								}
-								else
-								{
-									printf("\nMissing transfer count!  Save file will now be rebuilt.");
-									break;
-								}
-							}
-							readpatches++;
-						}
-						else
-						{
-							printf("\nMemory allocation failure creating transfer lists(%d*%d)!\n",
-								patch->numtransfers, sizeof(transfer_t));
-							break;
-						}
-					}
-					else
-					{
-						printf("\nMissing patch count!  Save file will now be rebuilt.");
-						break;
-					}
-				}
-			}
-			else
-				printf("\nIncorrect transfer patch count found!  Save file will now be rebuilt.");
+		qprintf("\tBounce #%i added RGB(%.0f, %.0f, %.0f)\n", i + 1, added[0], added[1], added[2]);
+		if (dumppatches && (i == 0 || i == (unsigned)numbounce - 1))
+		{
+			sprintf(name, "bounce%i.txt", i);
+			WriteWorld(name);
 		}
-		_close(handle);
-		time(&end);
-		printf("%10.3fMB] (%d)\n", totalbytes / (1024.0 * 1024.0), static_cast<int>(end - start));
 	}
-
-	if (readpatches != numpatches)
-		unlink(transferfile);
-	else
-		total_transfer = readtransfers;
-
-	return readpatches;
 }
 
 
@@ -1148,26 +1052,32 @@ long readtransfers(char* transferfile, long numpatches)
 
 void MakeAllScales(void)
 {
+	char scatterfile[MAX_PATH];
+
 	strcpy(g_transferfile, source);
 	StripExtension(g_transferfile);
 	DefaultExtension(g_transferfile, ".r2");
 
-	if (!incremental || !IsIncremental(incrementfile) || (unsigned)readtransfers(g_transferfile, num_patches) != num_patches)
+	if (!incremental || !IsIncremental(incrementfile) || !OpenGatherTransfers(g_transferfile, num_patches))
 	{
+		strcpy(scatterfile, source);
+		StripExtension(scatterfile);
+		DefaultExtension(scatterfile, ".r3");
+
 		// determine visibility between patches
 		BuildVisMatrix();
 
+		OpenScatterTransfers(scatterfile);
 		RunThreadsOn(num_patches, true, MakeScales);
-		if (incremental)
-			writetransfers(g_transferfile, num_patches);
-		else
-			unlink(g_transferfile);
 
 		// release visibility matrix
 		FreeVisMatrix();
+
+		// invert the transfers for gather vs scatter
+		BuildGatherTransfers(scatterfile, g_transferfile);
 	}
 
-	qprintf("transfer lists: %5.1f megs\n", (float)total_transfer * sizeof(transfer_t) / (1024 * 1024));
+	qprintf("transfer lists: %5.1f megs, %5.1f megs stored\n", (float)total_transfer * sizeof(transfer_t) / (1024 * 1024), (float)GatherTransferSize() / (1024 * 1024));
 }
 
 /*
@@ -1177,10 +1087,19 @@ RadWorld
 */
 void RadWorld(void)
 {
+	char lightcachefile[MAX_PATH];
+
+	strcpy(lightcachefile, source);
+	StripExtension(lightcachefile);
+	DefaultExtension(lightcachefile, ".r4");
+
 	MakeBackplanes();
 	MakeParents(0, -1);
 	MakeTnodes();
 
+	if (tracebench)
+		BenchmarkTrace(tracebench);
+
 	// turn each face into a single patch
 	MakePatches();
 	PairEdges();
@@ -1188,6 +1107,10 @@ void RadWorld(void)
 	// subdivide patches to a maximum dimension
 	SubdividePatches();
 
+	// unchanged faces reuse the direct light of the last incremental run
+	if (incremental && IsIncremental(incrementfile))
+		LoadLightCache(lightcachefile);
+
 	do
 	{
 		// create directlights out of patches and lights
@@ -1200,17 +1123,24 @@ void RadWorld(void)
 		DeleteDirectLights();
 	} while (numbounce != 0 && ProgressiveRefinement());
 
+	if (incremental)
+		SaveLightCache(lightcachefile);
+	else
+		unlink(lightcachefile);
+
 	if (numbounce > 0)
 	{
 		// build transfer lists
 		MakeAllScales();
 
-		// invert the transfers for gather vs scatter
-		RunThreadsOnIndividual(num_patches, true, SwapTransfersTask);
-
 		// spread light around
 		BounceLight();
 
+		// the transfers are only kept for incremental runs
+		CloseGatherTransfers();
+		if (!incremental)
+			unlink(g_transferfile);
+
 		for (unsigned int i = 0; i < num_patches; i++)
 			if (!VectorCompare(patches[i].directlight, vec3_origin))
 				VectorSubtract(patches[i].totallight, patches[i].directlight, patches[i].totallight);
@@ -1463,6 +1393,48 @@ int main(int argc, char** argv)
 		{
 			texscale = false;
 		}
+		else if (!strcmp(argv[i], "-transfermem"))
+		{
+			if (++i < argc)
+			{
+				transfermem = (float)atof(argv[i]);
+				if (transfermem <= 0)
+				{
+					fprintf(stderr, "Error: expected positive value after '-transfermem'\n");
+					return 1;
+				}
+			}
+			else
+			{
+				fprintf(stderr, "Error: expected a value after '-transfermem'\n");
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[i], "-verifytrace"))
+		{
+			verifytrace = true;
+		}
+		else if (!strcmp(argv[i], "-noavx2"))
+		{
+			noavx2 = true;
+		}
+		else if (!strcmp(argv[i], "-tracebench"))
+		{
+			if (++i < argc)
+			{
+				tracebench = atoi(argv[i]);
+				if (tracebench <= 0)
+				{
+					fprintf(stderr, "Error: expected positive value after '-tracebench'\n");
+					return 1;
+				}
+			}
+			else
+			{
+				fprintf(stderr, "Error: expected a value after '-tracebench'\n");
+				return 1;
+			}
+		}
 		else
 		{
 			break;
@@ -1475,7 +1447,7 @@ int main(int argc, char** argv)
 		maxlight = 255;
 
 	if (i != argc - 1)
-		Error("usage: qrad [-dump] [-inc] [-bounce n] [-threads n] [-verbose] [-terse] [-chop n] [-maxchop n] [-scale n] [-ambient red green blue] [-proj file] [-maxlight n] [-threads n] [-lights file] [-gamma n] [-dlight n] [-extra] [-smooth n] [-coring n] [-notexscale] bspfile");
+		Error("usage: qrad [-dump] [-inc] [-bounce n] [-threads n] [-verbose] [-terse] [-chop n] [-maxchop n] [-scale n] [-ambient red green blue] [-proj file] [-maxlight n] [-threads n] [-lights file] [-gamma n] [-dlight n] [-extra] [-smooth n] [-coring n] [-notexscale] [-transfermem megs] [-noavx2] [-verifytrace] [-tracebench n] bspfile");
 
 	start = I_FloatTime();
 
@@ -1514,6 +1486,7 @@ int main(int argc, char** argv)
 	DefaultExtension(source, ".bsp");
 
 	LoadBSPFile(source);
+	CheckBSPFileLimits();
 	ParseEntities();
 
 	if (!visdatasize)
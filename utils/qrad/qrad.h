@@ -52,6 +52,7 @@ typedef struct directlight_s
 	vec3_t normal;	// for surfaces and spotlights
 	float stopdot;	// for spotlights
 	float stopdot2; // for spotlights
+	unsigned hash;	// of the fields above, for the light cache
 } directlight_t;
 
 
@@ -72,8 +73,7 @@ typedef struct patch_s
 	winding_t* winding;
 	vec3_t mins, maxs, face_mins, face_maxs;
 	struct patch_s* next; // next in face
-	int numtransfers;
-	transfer_t* transfers;
+	int numtransfers;	  // the lists themselves are in the transfer store
 	vec3_t origin;
 	vec3_t normal;
 
@@ -127,6 +127,26 @@ void TouchVMFFile(void);
 
 //==============================================
 
+// transfers.c
+
+extern float transfermem;
+extern int total_transfer;
+
+// an encoded transfer list is at most this big
+#define MAX_TRANSFER_LIST (5 + MAX_PATCHES * 6)
+
+void OpenScatterTransfers(char* filename);
+void WriteScatterTransfers(int patchnum, transfer_t* transfers, int count, byte* buffer);
+void BuildGatherTransfers(char* scatterfilename, char* gatherfilename);
+qboolean OpenGatherTransfers(char* filename, unsigned numpatches);
+void CloseGatherTransfers(void);
+void BeginTransferWindows(void);
+qboolean NextTransferWindow(unsigned* firstpatch, unsigned* numpatches);
+unsigned GetPatchTransfers(unsigned patchnum, const unsigned short** patchnums, const unsigned short** transfers);
+size_t GatherTransferSize(void);
+
+//==============================================
+
 extern qboolean extra;
 extern vec3_t ambient;
 extern float maxlight;
@@ -147,8 +167,17 @@ void PrecompLightmapOffsets();
 void FinalLightFace(int facenum);
 void PvsForOrigin(vec3_t org, byte* pvs);
 int TestLine_r(int node, vec3_t start, vec3_t stop);
+
+// lines are gathered up to this many at a time for TestLines
+#define TRACE_BATCH 64
+
+void TestLines(int head, int count, vec_t* const* starts, vec_t* const* stops, int* contents);
+void BenchmarkTrace(int count);
+extern qboolean verifytrace;
 void CreateDirectLights(void);
 void DeleteDirectLights(void);
+void LoadLightCache(char* filename);
+void SaveLightCache(char* filename);
 int ProgressiveRefinement(void);
 vec_t PatchPlaneDist(patch_t* patch);
 void GetPhongNormal(int facenum, vec3_t spot, vec3_t phongnormal);
@@ -15,6 +15,16 @@
 #include "bspfile.h"
 #include "polylib.h"
 
+#include <chrono>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#ifndef DOUBLEVEC_T
+#define TRACE_SIMD
+#include <xmmintrin.h>
+#endif
+#endif
+
 // #define	ON_EPSILON	0.001
 
 typedef struct tnode_s
@@ -182,6 +192,251 @@ int TestLine(vec3_t start, vec3_t stop)
 /*
 ==============================================================================
 
+PACKET TRACING
+
+TestLines traces up to TRACE_PACKET lines together. The lines go down
+the tree as a packet for as long as each of them lies entirely on one
+side of every plane, which takes the same comparisons TestLine_r makes.
+A line that crosses a plane leaves the packet and is finished by
+TestLine_r from that node. It has not been clipped yet, so it gets
+exactly the result it would have got from the root.
+
+==============================================================================
+*/
+
+#define TRACE_PACKET 4
+
+qboolean verifytrace;
+
+#ifdef TRACE_SIMD
+
+// The smallest float that is not below d. For a float f, f >= d and f < d
+// give the same answers against this as against the double d.
+static float FloatCeiling(double d)
+{
+	float f = (float)d;
+	if ((double)f < d)
+		f = nextafterf(f, HUGE_VALF);
+	return f;
+}
+
+static void TestLinePacket(int head, int count, vec_t* const* starts, vec_t* const* stops, int* contents)
+{
+	float sx[TRACE_PACKET], sy[TRACE_PACKET], sz[TRACE_PACKET];
+	float ex[TRACE_PACKET], ey[TRACE_PACKET], ez[TRACE_PACKET];
+	int stacknode[TRACE_PACKET], stackmask[TRACE_PACKET];
+	int stackdepth;
+	int node, mask, frontmask, backmask, splitmask;
+	int i, c;
+	tnode_t* tnode;
+	__m128 front, back, dist;
+
+	static const __m128 frontepsilon = _mm_set1_ps(FloatCeiling(-ON_EPSILON));
+	static const __m128 backepsilon = _mm_set1_ps(FloatCeiling(ON_EPSILON));
+
+	// unused lanes repeat the first line, and are masked off
+	for (i = 0; i < TRACE_PACKET; i++)
+	{
+		const vec_t* start = starts[i < count ? i : 0];
+		const vec_t* stop = stops[i < count ? i : 0];
+		sx[i] = start[0];
+		sy[i] = start[1];
+		sz[i] = start[2];
+		ex[i] = stop[0];
+		ey[i] = stop[1];
+		ez[i] = stop[2];
+	}
+
+	const __m128 startx = _mm_loadu_ps(sx), starty = _mm_loadu_ps(sy), startz = _mm_loadu_ps(sz);
+	const __m128 stopx = _mm_loadu_ps(ex), stopy = _mm_loadu_ps(ey), stopz = _mm_loadu_ps(ez);
+
+	stackdepth = 0;
+	node = head;
+	mask = (1 << count) - 1;
+
+	while (1)
+	{
+		if (node < 0)
+		{
+			c = (node == CONTENTS_SOLID || node == CONTENTS_SKY) ? node : CONTENTS_EMPTY;
+			for (i = 0; i < count; i++)
+				if (mask & (1 << i))
+					contents[i] = c;
+
+			if (!stackdepth)
+				return;
+			stackdepth--;
+			node = stacknode[stackdepth];
+			mask = stackmask[stackdepth];
+			continue;
+		}
+
+		tnode = &tnodes[node];
+		dist = _mm_set1_ps(tnode->dist);
+
+		switch (tnode->type)
+		{
+		case PLANE_X:
+			front = _mm_sub_ps(startx, dist);
+			back = _mm_sub_ps(stopx, dist);
+			break;
+		case PLANE_Y:
+			front = _mm_sub_ps(starty, dist);
+			back = _mm_sub_ps(stopy, dist);
+			break;
+		case PLANE_Z:
+			front = _mm_sub_ps(startz, dist);
+			back = _mm_sub_ps(stopz, dist);
+			break;
+		default:
+		{
+			// same order of operations as TestLine_r
+			const __m128 nx = _mm_set1_ps(tnode->normal[0]);
+			const __m128 ny = _mm_set1_ps(tnode->normal[1]);
+			const __m128 nz = _mm_set1_ps(tnode->normal[2]);
+			front = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(startx, nx), _mm_mul_ps(starty, ny)), _mm_mul_ps(startz, nz)), dist);
+			back = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(stopx, nx), _mm_mul_ps(stopy, ny)), _mm_mul_ps(stopz, nz)), dist);
+			break;
+		}
+		}
+
+		frontmask = _mm_movemask_ps(_mm_and_ps(_mm_cmpge_ps(front, frontepsilon), _mm_cmpge_ps(back, frontepsilon))) & mask;
+		backmask = _mm_movemask_ps(_mm_and_ps(_mm_cmplt_ps(front, backepsilon), _mm_cmplt_ps(back, backepsilon))) & mask & ~frontmask;
+		splitmask = mask & ~(frontmask | backmask);
+
+		for (i = 0; splitmask; i++)
+		{
+			if (splitmask & (1 << i))
+			{
+				contents[i] = TestLine_r(node, starts[i], stops[i]);
+				splitmask &= ~(1 << i);
+			}
+		}
+
+		if (frontmask)
+		{
+			if (backmask)
+			{
+				stacknode[stackdepth] = tnode->children[1];
+				stackmask[stackdepth] = backmask;
+				stackdepth++;
+			}
+			node = tnode->children[0];
+			mask = frontmask;
+		}
+		else if (backmask)
+		{
+			node = tnode->children[1];
+			mask = backmask;
+		}
+		else
+		{
+			if (!stackdepth)
+				return;
+			stackdepth--;
+			node = stacknode[stackdepth];
+			mask = stackmask[stackdepth];
+		}
+	}
+}
+
+#endif
+
+/*
+==============
+TestLines
+
+Traces count lines from node head, setting contents to what
+TestLine_r would return for each. With -verifytrace, every line is
+traced again by TestLine_r, and any difference is an error.
+==============
+*/
+void TestLines(int head, int count, vec_t* const* starts, vec_t* const* stops, int* contents)
+{
+	int i;
+
+#ifdef TRACE_SIMD
+	for (i = 0; i < count; i += TRACE_PACKET)
+		TestLinePacket(head, count - i < TRACE_PACKET ? count - i : TRACE_PACKET, starts + i, stops + i, contents + i);
+#else
+	for (i = 0; i < count; i++)
+		contents[i] = TestLine_r(head, starts[i], stops[i]);
+#endif
+
+	if (verifytrace)
+	{
+		for (i = 0; i < count; i++)
+		{
+			int c = TestLine_r(head, starts[i], stops[i]);
+			if (c != contents[i])
+				Error("TestLines: (%f %f %f) to (%f %f %f) gave %i, TestLine_r gave %i\n",
+					starts[i][0], starts[i][1], starts[i][2], stops[i][0], stops[i][1], stops[i][2], contents[i], c);
+		}
+	}
+}
+
+/*
+==============
+BenchmarkTrace
+
+Traces count random lines through the world with TestLine_r and
+with TestLines, and prints the rays per second of each. The lines
+are grouped four to a start point, like the lights of a sample.
+==============
+*/
+void BenchmarkTrace(int count)
+{
+	std::vector<vec_t> points(count * 2 * 3);
+	std::vector<vec_t*> starts(count), stops(count);
+	std::vector<int> scalar(count), packet(count);
+	dmodel_t* world = &dmodels[0];
+	unsigned int seed = 1;
+	int i, j, mismatches;
+
+	for (i = 0; i < count * 2; i++)
+	{
+		for (j = 0; j < 3; j++)
+		{
+			seed = seed * 1103515245 + 12345;
+			points[i * 3 + j] = world->mins[j] + (world->maxs[j] - world->mins[j]) * ((seed >> 8) & 0xffff) / 65535.0f;
+		}
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		starts[i] = &points[(i & ~3) * 3];
+		stops[i] = &points[(count + i) * 3];
+	}
+
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+	for (i = 0; i < count; i++)
+		scalar[i] = TestLine_r(0, starts[i], stops[i]);
+
+	std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+	TestLines(0, count, starts.data(), stops.data(), packet.data());
+
+	std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+	mismatches = 0;
+	for (i = 0; i < count; i++)
+		if (scalar[i] != packet[i])
+			mismatches++;
+
+	const double scalartime = std::chrono::duration<double>(t1 - t0).count();
+	const double packettime = std::chrono::duration<double>(t2 - t1).count();
+
+	printf("trace benchmark: %i rays\n", count);
+	printf("  TestLine_r: %10.0f rays/sec\n", scalartime > 0 ? count / scalartime : 0);
+	printf("  TestLines:  %10.0f rays/sec\n", packettime > 0 ? count / packettime : 0);
+	if (mismatches)
+		printf("  WARNING: %i rays differ\n", mismatches);
+}
+
+/*
+==============================================================================
+
 LINE TRACING
 
 The major lighting operation is a point to point visibility test, performed
@@ -0,0 +1,724 @@
+/***
+*
+*	Copyright (c) 1996-2002, Valve LLC. All rights reserved.
+*
+*	This product contains software technology licensed from Id
+*	Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc.
+*	All Rights Reserved.
+*
+****/
+
+// transfers.c
+
+#include "qrad.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+/*
+===================================================================
+
+TRANSFER STORE
+
+The transfer lists are far too big to keep in memory on large maps,
+so they live on disk, and are read back a window at a time.
+
+MakeScales appends each patch's list to a scatter file as it is
+finished. BuildGatherTransfers then turns the scatter lists into
+gather lists, a window of patches at a time, and writes them to the
+gather file in chunks. BounceLight reads the gather file back a
+window of chunks at a time.
+
+A list is a count followed by (patch delta, transfer) pairs, all
+stored as variable length integers. The patches in a list are in
+increasing order, so most deltas fit in a byte.
+
+A window is decoded as it is read, into one array of patches and
+one of transfers, which is the layout the gather kernels want.
+
+The gather file starts with a header and the transfer count of every
+patch, so a reused file restores patches[].numtransfers as well.
+
+transfermem caps the memory used for each window, in megabytes.
+With no cap, everything is loaded in one window and kept.
+
+===================================================================
+*/
+
+#define TRANSFER_IDENT (('T' << 24) + ('R' << 16) + ('A' << 8) + 'Q') // little-endian "QART"
+#define TRANSFER_VERSION 3
+
+// gather lists are written in chunks of about this many bytes
+#define TRANSFER_CHUNK_SIZE (1024 * 1024)
+
+typedef struct
+{
+	int ident;
+	int version;
+	int numpatches;
+	int numchunks;
+	int totaltransfers;
+	int countcrc; // of the numpatches transfer counts that follow the header
+	int crc;	  // of the fields above
+} transferheader_t;
+
+typedef struct
+{
+	int firstpatch;
+	int numpatches;
+	int size; // row offsets and rows
+	int numtransfers;
+	int crc;
+} transferchunk_t;
+
+typedef struct
+{
+	int patch;
+	int numtransfers;
+	int size;
+} scatterrecord_t;
+
+float transfermem = 0;
+
+static FILE* scatterfile;
+
+static FILE* gatherfile;
+static std::vector<transferchunk_t> gatherchunks;
+static std::vector<byte> gatherchunkdata;		  // the encoded chunk being decoded
+static std::vector<unsigned short> gatherpatches; // the decoded window
+static std::vector<unsigned short> gathertransfers;
+static std::vector<unsigned> gatherrows; // start of each patch's list in the window, and the end of the last
+static unsigned nextgatherchunk;
+static qboolean gatherresident;
+
+
+static size_t TransferBudget(void)
+{
+	if (transfermem <= 0)
+		return (size_t)-1;
+
+	return (size_t)(transfermem * 1024 * 1024);
+}
+
+static int TransferCRC(const byte* data, size_t size)
+{
+	unsigned short crc;
+
+	CRC_Init(&crc);
+	for (size_t i = 0; i < size; i++)
+		CRC_ProcessByte(&crc, data[i]);
+
+	return CRC_Value(crc);
+}
+
+static byte* WriteTransferInt(byte* data, unsigned value)
+{
+	while (value >= 0x80)
+	{
+		*data++ = (byte)(value | 0x80);
+		value >>= 7;
+	}
+	*data++ = (byte)value;
+
+	return data;
+}
+
+static unsigned ReadTransferInt(const byte*& data)
+{
+	unsigned value = 0;
+	int shift = 0;
+
+	while (*data & 0x80)
+	{
+		value |= (*data++ & 0x7f) << shift;
+		shift += 7;
+	}
+	value |= *data++ << shift;
+
+	return value;
+}
+
+/*
+=============
+EncodeTransfers
+
+Returns the number of bytes written to data, which must have room
+for MAX_TRANSFER_LIST bytes
+=============
+*/
+static int EncodeTransfers(const transfer_t* transfers, int count, byte* data)
+{
+	byte* p = data;
+	int last = 0;
+
+	p = WriteTransferInt(p, count);
+	for (int i = 0; i < count; i++)
+	{
+		p = WriteTransferInt(p, transfers[i].patch - last);
+		p = WriteTransferInt(p, transfers[i].transfer);
+		last = transfers[i].patch;
+	}
+
+	return p - data;
+}
+
+/*
+===================================================================
+
+SCATTER FILE
+
+===================================================================
+*/
+
+void OpenScatterTransfers(char* filename)
+{
+	scatterfile = SafeOpenWrite(filename);
+}
+
+/*
+=============
+WriteScatterTransfers
+
+Called by MakeScales threads as each patch is finished
+=============
+*/
+void WriteScatterTransfers(int patchnum, transfer_t* transfers, int count, byte* buffer)
+{
+	scatterrecord_t record;
+
+	record.patch = patchnum;
+	record.numtransfers = count;
+	record.size = EncodeTransfers(transfers, count, buffer);
+
+	ThreadLock();
+	SafeWrite(scatterfile, &record, sizeof(record));
+	SafeWrite(scatterfile, buffer, record.size);
+	ThreadUnlock();
+}
+
+// the scatter records being worked on, and the window of patches they are gathered into
+static std::vector<byte> scatterblock;
+static std::vector<size_t> scatterrecords;
+static qboolean scatterblockcomplete; // the block holds the whole file
+static scatterrecord_t pendingrecord;	 // read, but did not fit in the last block
+static qboolean haspendingrecord;
+static unsigned windowfirst, windowend;
+static std::vector<transfer_t> windowtransfers;
+static std::vector<size_t> windowrows;
+
+/*
+=============
+ReadScatterBlock
+
+Reads as many whole records as fit in the block, starting from the
+current position of the scatter file. Returns false at the end of
+the file.
+=============
+*/
+static bool ReadScatterBlock(size_t blocksize)
+{
+	scatterrecord_t record;
+	size_t used = 0;
+
+	scatterrecords.clear();
+
+	while (1)
+	{
+		if (haspendingrecord)
+		{
+			record = pendingrecord;
+			haspendingrecord = false;
+		}
+		else if (fread(&record, sizeof(record), 1, scatterfile) != 1)
+			break;
+
+		if (used && used + sizeof(record) + record.size > blocksize)
+		{
+			pendingrecord = record;
+			haspendingrecord = true;
+			break;
+		}
+
+		if (scatterblock.size() < used + sizeof(record) + record.size)
+			scatterblock.resize(used + sizeof(record) + record.size);
+
+		memcpy(&scatterblock[used], &record, sizeof(record));
+		SafeRead(scatterfile, &scatterblock[used + sizeof(record)], record.size);
+
+		scatterrecords.push_back(used);
+		used += sizeof(record) + record.size;
+	}
+
+	return !scatterrecords.empty();
+}
+
+// Copies a scatter list of a patch in the window into the window
+static void LoadWindowRowTask(int recordnum)
+{
+	const scatterrecord_t* record = (const scatterrecord_t*)&scatterblock[scatterrecords[recordnum]];
+	const byte* data = (const byte*)(record + 1);
+	transfer_t* t;
+	unsigned patch = 0;
+
+	if ((unsigned)record->patch < windowfirst || (unsigned)record->patch >= windowend)
+		return;
+
+	ReadTransferInt(data); // count
+	t = &windowtransfers[windowrows[record->patch - windowfirst]];
+	for (int i = 0; i < record->numtransfers; i++, t++)
+	{
+		patch += ReadTransferInt(data);
+		t->patch = patch;
+		t->transfer = ReadTransferInt(data);
+	}
+}
+
+/*
+=============
+SwapWindowTransfersTask
+
+Change transfers from light sent out to light collected in.
+In an ideal world, they would be exactly symetrical, but
+because the form factors are only aproximated, then normalized,
+they will actually be rather different.
+
+Each patch of a scatter list that is in the window gets the
+transfer from the list's patch in its own list. Each pair of patches
+is only written by one thread, so no locking is needed.
+=============
+*/
+static void SwapWindowTransfersTask(int recordnum)
+{
+	const scatterrecord_t* record = (const scatterrecord_t*)&scatterblock[scatterrecords[recordnum]];
+	const byte* data = (const byte*)(record + 1);
+	unsigned patch = 0;
+	unsigned short transfer;
+
+	ReadTransferInt(data); // count
+	for (int i = 0; i < record->numtransfers; i++)
+	{
+		patch += ReadTransferInt(data);
+		transfer = ReadTransferInt(data);
+
+		if (patch < windowfirst)
+			continue;
+		if (patch >= windowend)
+			break;
+
+		// binary search for match
+		transfer_t* first = &windowtransfers[windowrows[patch - windowfirst]];
+		transfer_t* last = first + patches[patch].numtransfers;
+		transfer_t* t = std::lower_bound(first, last, record->patch, [](const transfer_t& a, int b)
+			{ return a.patch < b; });
+
+		if (t != last && t->patch == record->patch)
+			t->transfer = transfer;
+	}
+}
+
+static void RunScatterRecords(size_t blocksize, void (*func)(int))
+{
+	if (scatterblockcomplete)
+	{
+		RunThreadsOnIndividual((int)scatterrecords.size(), false, func);
+		return;
+	}
+
+	fseek(scatterfile, 0, SEEK_SET);
+	haspendingrecord = false;
+
+	while (ReadScatterBlock(blocksize))
+	{
+		RunThreadsOnIndividual((int)scatterrecords.size(), false, func);
+
+		// keep it for next time if it is all there
+		if (scatterrecords.size() == num_patches)
+		{
+			scatterblockcomplete = true;
+			break;
+		}
+	}
+}
+
+/*
+=============
+WriteGatherChunk
+
+Writes the gather lists of patches [first, end) of the window
+=============
+*/
+static void WriteGatherChunk(unsigned first, unsigned end, int* unmatched)
+{
+	transferchunk_t chunk;
+	std::vector<byte> data((end - first) * sizeof(unsigned));
+	static std::vector<byte> list(MAX_TRANSFER_LIST);
+	unsigned i;
+
+	for (i = first; i < end; i++)
+	{
+		const transfer_t* t = &windowtransfers[windowrows[i - windowfirst]];
+		int count = patches[i].numtransfers;
+
+		// a patch that sees this one but has no list of its own, counted once per pair as SwapTransfers did
+		for (int j = 0; j < count && t[j].patch <= i; j++)
+			if (!patches[t[j].patch].numtransfers)
+				(*unmatched)++;
+
+		unsigned offset = data.size();
+		memcpy(&data[(i - first) * sizeof(unsigned)], &offset, sizeof(offset));
+
+		int size = EncodeTransfers(t, count, list.data());
+		data.insert(data.end(), list.begin(), list.begin() + size);
+	}
+
+	chunk.firstpatch = first;
+	chunk.numpatches = end - first;
+	chunk.size = data.size();
+	chunk.numtransfers = 0;
+	for (i = first; i < end; i++)
+		chunk.numtransfers += patches[i].numtransfers;
+	chunk.crc = TransferCRC(data.data(), data.size());
+
+	SafeWrite(gatherfile, &chunk, sizeof(chunk));
+	SafeWrite(gatherfile, data.data(), data.size());
+
+	gatherchunks.push_back(chunk);
+}
+
+// where the chunks start, after the header and the transfer counts
+static long GatherChunksOffset(void)
+{
+	return sizeof(transferheader_t) + num_patches * sizeof(int);
+}
+
+static void WriteGatherHeader(int totaltransfers)
+{
+	transferheader_t header;
+	std::vector<int> counts(num_patches);
+
+	for (unsigned i = 0; i < num_patches; i++)
+		counts[i] = patches[i].numtransfers;
+
+	header.ident = TRANSFER_IDENT;
+	header.version = TRANSFER_VERSION;
+	header.numpatches = num_patches;
+	header.numchunks = gatherchunks.size();
+	header.totaltransfers = totaltransfers;
+	header.countcrc = TransferCRC((const byte*)counts.data(), counts.size() * sizeof(int));
+	header.crc = TransferCRC((const byte*)&header, offsetof(transferheader_t, crc));
+
+	fseek(gatherfile, 0, SEEK_SET);
+	SafeWrite(gatherfile, &header, sizeof(header));
+	SafeWrite(gatherfile, counts.data(), counts.size() * sizeof(int));
+}
+
+/*
+=============
+BuildGatherTransfers
+
+Turns the scatter file written by MakeScales into the gather file
+=============
+*/
+void BuildGatherTransfers(char* scatterfilename, char* gatherfilename)
+{
+	const size_t budget = TransferBudget();
+	const size_t windowbudget = budget / 2;
+	const size_t blocksize = budget - windowbudget;
+	int unmatched = 0;
+	unsigned i;
+
+	fclose(scatterfile);
+	scatterfile = SafeOpenRead(scatterfilename);
+	scatterblockcomplete = false;
+
+	gatherchunks.clear();
+	gatherfile = SafeOpenWrite(gatherfilename);
+	WriteGatherHeader(0);
+
+	for (windowfirst = 0; windowfirst < num_patches; windowfirst = windowend)
+	{
+		//
+		// take as many patches as will fit
+		//
+		size_t count = 0;
+
+		windowrows.clear();
+		for (windowend = windowfirst; windowend < num_patches; windowend++)
+		{
+			size_t rowsize = patches[windowend].numtransfers;
+			if (windowend > windowfirst && (count + rowsize) * sizeof(transfer_t) > windowbudget)
+				break;
+			windowrows.push_back(count);
+			count += rowsize;
+		}
+		windowtransfers.resize(count);
+
+		qprintf("gathering transfers for patches %u to %u\n", windowfirst, windowend - 1);
+
+		// get the lists of the patches in the window, then swap in the transfers from the others
+		RunScatterRecords(blocksize, LoadWindowRowTask);
+		RunScatterRecords(blocksize, SwapWindowTransfersTask);
+
+		//
+		// write the window out in chunks
+		//
+		unsigned chunkfirst = windowfirst;
+		size_t chunksize = 0;
+		for (i = windowfirst; i < windowend; i++)
+		{
+			chunksize += patches[i].numtransfers * 3;
+			if (chunksize >= TRANSFER_CHUNK_SIZE || i == windowend - 1)
+			{
+				WriteGatherChunk(chunkfirst, i + 1, &unmatched);
+				chunkfirst = i + 1;
+				chunksize = 0;
+			}
+		}
+	}
+
+	WriteGatherHeader(total_transfer);
+	fclose(gatherfile);
+
+	fclose(scatterfile);
+	scatterfile = NULL;
+	unlink(scatterfilename);
+
+	if (unmatched)
+		printf("WARNING: SwapTransfers: %i unmatched\n", unmatched);
+
+	std::vector<byte>().swap(scatterblock);
+	std::vector<size_t>().swap(scatterrecords);
+	std::vector<transfer_t>().swap(windowtransfers);
+	std::vector<size_t>().swap(windowrows);
+
+	gatherfile = SafeOpenRead(gatherfilename);
+	gatherresident = false;
+	gatherrows.resize(num_patches + 1);
+}
+
+/*
+===================================================================
+
+GATHER FILE
+
+===================================================================
+*/
+
+/*
+=============
+OpenGatherTransfers
+
+Opens a gather file saved by an earlier run, if it is for the same
+patches. Returns false if it can't be used.
+=============
+*/
+qboolean OpenGatherTransfers(char* filename, unsigned numpatches)
+{
+	transferheader_t header;
+	transferchunk_t chunk;
+	int i;
+
+	gatherfile = fopen(filename, "rb");
+	if (!gatherfile)
+		return false;
+
+	if (fread(&header, sizeof(header), 1, gatherfile) != 1 || header.ident != TRANSFER_IDENT || header.version != TRANSFER_VERSION || header.crc != TransferCRC((const byte*)&header, offsetof(transferheader_t, crc)))
+	{
+		printf("Transfer file [%s] is out of date!  Save file will now be rebuilt.\n", filename);
+		CloseGatherTransfers();
+		return false;
+	}
+
+	if ((unsigned)header.numpatches != numpatches)
+	{
+		printf("Incorrect transfer patch count found!  Save file will now be rebuilt.\n");
+		CloseGatherTransfers();
+		return false;
+	}
+
+	std::vector<int> counts(numpatches);
+	if (fread(counts.data(), sizeof(int), numpatches, gatherfile) != numpatches || header.countcrc != TransferCRC((const byte*)counts.data(), counts.size() * sizeof(int)))
+	{
+		printf("Missing transfer counts!  Save file will now be rebuilt.\n");
+		CloseGatherTransfers();
+		return false;
+	}
+
+	gatherchunks.clear();
+	for (i = 0; i < header.numchunks; i++)
+	{
+		if (fread(&chunk, sizeof(chunk), 1, gatherfile) != 1 || fseek(gatherfile, chunk.size, SEEK_CUR) != 0)
+		{
+			printf("Missing transfer chunk!  Save file will now be rebuilt.\n");
+			CloseGatherTransfers();
+			return false;
+		}
+		gatherchunks.push_back(chunk);
+	}
+
+	for (i = 0; i < (int)numpatches; i++)
+		patches[i].numtransfers = counts[i];
+
+	total_transfer = header.totaltransfers;
+	gatherresident = false;
+	gatherrows.resize(num_patches + 1);
+
+	return true;
+}
+
+void CloseGatherTransfers(void)
+{
+	if (gatherfile)
+		fclose(gatherfile);
+	gatherfile = NULL;
+
+	gatherchunks.clear();
+	std::vector<byte>().swap(gatherchunkdata);
+	std::vector<unsigned short>().swap(gatherpatches);
+	std::vector<unsigned short>().swap(gathertransfers);
+	std::vector<unsigned>().swap(gatherrows);
+	gatherresident = false;
+}
+
+void BeginTransferWindows(void)
+{
+	nextgatherchunk = 0;
+
+	if (!gatherresident)
+		fseek(gatherfile, GatherChunksOffset(), SEEK_SET);
+}
+
+static unsigned decodefirst; // first patch of the chunk being decoded
+
+// Decodes one list of the chunk in gatherchunkdata into the window
+static void DecodeGatherRowTask(int i)
+{
+	unsigned offset;
+	unsigned patch = 0;
+	const byte* data;
+	unsigned short* p = &gatherpatches[gatherrows[decodefirst + i]];
+	unsigned short* t = &gathertransfers[gatherrows[decodefirst + i]];
+
+	memcpy(&offset, &gatherchunkdata[i * sizeof(unsigned)], sizeof(offset));
+	data = &gatherchunkdata[offset];
+
+	unsigned count = ReadTransferInt(data);
+	for (unsigned k = 0; k < count; k++)
+	{
+		patch += ReadTransferInt(data);
+		p[k] = patch;
+		t[k] = ReadTransferInt(data);
+	}
+}
+
+/*
+=============
+NextTransferWindow
+
+Loads the next window of gather lists, and returns the patches it
+covers. Returns false when all of them have been seen. If every
+chunk fits in one window, it is only read once.
+=============
+*/
+qboolean NextTransferWindow(unsigned* firstpatch, unsigned* numpatches)
+{
+	const size_t budget = TransferBudget();
+	transferchunk_t chunk;
+	size_t size = 0;
+	unsigned count = 0;
+	unsigned last;
+	int i;
+
+	if (nextgatherchunk >= gatherchunks.size())
+		return false;
+
+	*firstpatch = gatherchunks[nextgatherchunk].firstpatch;
+
+	if (gatherresident)
+	{
+		nextgatherchunk = gatherchunks.size();
+		*numpatches = num_patches - *firstpatch;
+		return true;
+	}
+
+	for (last = nextgatherchunk; last < gatherchunks.size(); last++)
+	{
+		size_t chunksize = (size_t)gatherchunks[last].numtransfers * 2 * sizeof(unsigned short);
+		if (last > nextgatherchunk && size + chunksize > budget)
+			break;
+		size += chunksize;
+		count += gatherchunks[last].numtransfers;
+	}
+
+	gatherpatches.resize(count);
+	gathertransfers.resize(count);
+	count = 0;
+
+	for (; nextgatherchunk < last; nextgatherchunk++)
+	{
+		SafeRead(gatherfile, &chunk, sizeof(chunk));
+		gatherchunkdata.resize(chunk.size);
+		SafeRead(gatherfile, gatherchunkdata.data(), chunk.size);
+
+		if (chunk.crc != TransferCRC(gatherchunkdata.data(), chunk.size))
+			Error("Transfer chunk for patches %i to %i is corrupt", chunk.firstpatch, chunk.firstpatch + chunk.numpatches - 1);
+
+		// find where each list goes, then decode them all at once
+		for (i = 0; i < chunk.numpatches; i++)
+		{
+			unsigned offset;
+			const byte* data;
+
+			memcpy(&offset, &gatherchunkdata[i * sizeof(unsigned)], sizeof(offset));
+			data = &gatherchunkdata[offset];
+
+			gatherrows[chunk.firstpatch + i] = count;
+			count += ReadTransferInt(data);
+		}
+		gatherrows[chunk.firstpatch + chunk.numpatches] = count;
+
+		if (count > gatherpatches.size())
+			Error("Transfer chunk for patches %i to %i has too many transfers", chunk.firstpatch, chunk.firstpatch + chunk.numpatches - 1);
+
+		decodefirst = chunk.firstpatch;
+		RunThreadsOnIndividual(chunk.numpatches, false, DecodeGatherRowTask);
+
+		*numpatches = chunk.firstpatch + chunk.numpatches - *firstpatch;
+	}
+
+	std::vector<byte>().swap(gatherchunkdata);
+
+	if (*firstpatch == 0 && nextgatherchunk == gatherchunks.size())
+		gatherresident = true;
+
+	return true;
+}
+
+/*
+=============
+GetPatchTransfers
+
+Returns the number of transfers in the gather list of a patch in
+the current window, and where its patches and transfers are
+=============
+*/
+unsigned GetPatchTransfers(unsigned patchnum, const unsigned short** patchnums, const unsigned short** transfers)
+{
+	unsigned first = gatherrows[patchnum];
+
+	*patchnums = gatherpatches.data() + first;
+	*transfers = gathertransfers.data() + first;
+
+	return gatherrows[patchnum + 1] - first;
+}
+
+size_t GatherTransferSize(void)
+{
+	size_t size = 0;
+
+	for (size_t i = 0; i < gatherchunks.size(); i++)
+		size += gatherchunks[i].size;
+
+	return size;
+}
@@ -99,6 +99,12 @@ void TestPatchToFace(unsigned patchnum, int facenum, int head, unsigned bitpos)
 
 	if (patch2 && DotProduct(patch->origin, patch2->normal) > PatchPlaneDist(patch2) + 1.01)
 	{
+		vec_t* starts[TRACE_BATCH];
+		vec_t* stops[TRACE_BATCH];
+		unsigned tested[TRACE_BATCH];
+		int contents[TRACE_BATCH];
+		int count = 0;
+
 		// we need to do a real test
 		for (; patch2; patch2 = patch2->next)
 		{
@@ -107,12 +113,29 @@ void TestPatchToFace(unsigned patchnum, int facenum, int head, unsigned bitpos)
 			// check vis between patch and patch2
 			// if bit has not already been set
 			//  && v2 is not behind light plane
-			//  && v2 is visible from v1
-			if (m > patchnum && DotProduct(patch2->origin, patch->normal) > PatchPlaneDist(patch) + 1.01 && TestLine_r(head, patch->origin, patch2->origin) == CONTENTS_EMPTY)
+			if (m > patchnum && DotProduct(patch2->origin, patch->normal) > PatchPlaneDist(patch) + 1.01)
+			{
+				starts[count] = patch->origin;
+				stops[count] = patch2->origin;
+				tested[count] = m;
+				count++;
+			}
+
+			// && v2 is visible from v1
+			if (count == TRACE_BATCH || (count && !patch2->next))
 			{
-				// patchnum can see patch m
-				int bitset = bitpos + m;
-				vismatrix[bitset >> 3] |= 1 << (bitset & 7);
+				TestLines(head, count, starts, stops, contents);
+
+				for (int i = 0; i < count; i++)
+				{
+					if (contents[i] == CONTENTS_EMPTY)
+					{
+						// patchnum can see patch m
+						int bitset = bitpos + tested[i];
+						vismatrix[bitset >> 3] |= 1 << (bitset & 7);
+					}
+				}
+				count = 0;
 			}
 		}
 	}
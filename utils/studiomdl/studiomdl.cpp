@@ -19,6 +19,13 @@
 #pragma warning(disable : 4305)
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,14 +38,14 @@
 #include "scriplib.h"
 #include "mathlib.h"
 #define Vector vec3_t
-#define EXTERN
+#define EXTERN thread_local
 #include "../../engine/studio.h"
 #include "studiomdl.h"
 #include "../../dlls/activity.h"
 #include "../../dlls/activitymap.h"
 
 
-static int force_powerof2_textures = 0;
+static thread_local int force_powerof2_textures = 0;
 
 void clip_rotations(vec3_t rot);
 
@@ -49,13 +56,45 @@ void clip_rotations(vec3_t rot);
 =================
 */
 
-int k_memtotal;
+thread_local int k_memtotal;
+thread_local std::unordered_set<void*> k_allocs; // so a batch job can free its model
+
 void* kalloc(int num, int size)
 {
+	void* ptr;
+
 	// printf( "calloc( %d, %d )\n", num, size );
 	// printf( "%d ", num * size );
 	k_memtotal += num * size;
-	return calloc(num, size);
+	ptr = calloc(num, size);
+	if (!ptr && num && size)
+		Error("kalloc: out of memory for %d x %d bytes\n", num, size);
+	k_allocs.insert(ptr);
+	return ptr;
+}
+
+void* krealloc(void* ptr, int size)
+{
+	k_allocs.erase(ptr);
+	ptr = realloc(ptr, size);
+	if (!ptr && size)
+		Error("krealloc: out of memory for %d bytes\n", size);
+	k_allocs.insert(ptr);
+	return ptr;
+}
+
+void kfree(void* ptr)
+{
+	k_allocs.erase(ptr);
+	free(ptr);
+}
+
+void kfreeall(void)
+{
+	for (void* ptr : k_allocs)
+		free(ptr);
+	k_allocs.clear();
+	k_memtotal = 0;
 }
 
 void kmemset(void* ptr, int value, int size)
@@ -65,6 +104,29 @@ void kmemset(void* ptr, int value, int size)
 	return;
 }
 
+double StageClock(void)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void PrintStageTimes(const double* times)
+{
+	static const char* stagenames[NUM_STAGES] = {
+		"Grab_Triangles",
+		"Grab_Animation",
+		"Grab_Skin",
+		"SimplifyModel",
+		"  OptimizeAnimations",
+		"  BuildTris",
+		"WriteFile",
+	};
+	int i;
+
+	printf("---------------------\n");
+	for (i = 0; i < NUM_STAGES; i++)
+		printf("%-22s %8.3f seconds\n", stagenames[i], times[i]);
+}
+
 
 /*
 =================
@@ -383,8 +445,11 @@ void SimplifyModel(void)
 	vec3_t* defaultpos[MAXSTUDIOSRCBONES];
 	vec3_t* defaultrot[MAXSTUDIOSRCBONES];
 	int iError = 0;
+	double start;
 
+	start = StageClock();
 	OptimizeAnimations();
+	stagetime[STAGE_OPTIMIZE] += StageClock() - start;
 	ExtractMotion();
 	MakeTransitions();
 
@@ -1232,7 +1297,7 @@ s_trianglevert_t* lookup_triangle(s_mesh_t* pmesh, int index)
 		pmesh->alloctris = index + 256;
 		if (pmesh->triangle)
 		{
-			pmesh->triangle = reinterpret_cast<s_trianglevert_t(*)[3]>(realloc(pmesh->triangle, pmesh->alloctris * sizeof(*pmesh->triangle)));
+			pmesh->triangle = reinterpret_cast<s_trianglevert_t(*)[3]>(krealloc(pmesh->triangle, pmesh->alloctris * sizeof(*pmesh->triangle)));
 			kmemset(&pmesh->triangle[start], 0, (pmesh->alloctris - start) * sizeof(*pmesh->triangle));
 		}
 		else
@@ -1244,17 +1309,76 @@ s_trianglevert_t* lookup_triangle(s_mesh_t* pmesh, int index)
 	return pmesh->triangle[index];
 }
 
+static unsigned int WeldHash(const int* key, int count)
+{
+	unsigned int hash = 2166136261u;
+
+	for (int i = 0; i < count; i++)
+		hash = (hash ^ (unsigned int)key[i]) * 16777619u;
+
+	return hash & (WELD_HASH_SIZE - 1);
+}
+
+// Normals weld when their dot product is over normal_blend, so they are
+// hashed by grid cells a little wider than the chord between two normals
+// that just weld, and a lookup checks the neighbouring cells as well
+static float NormalCellSize(void)
+{
+	float chord = sqrt(std::max(2.0 - 2.0 * normal_blend, 0.0));
+
+	return std::max(chord * 1.01f, 0.001f);
+}
+
+static void NormalCellKey(vec3_t org, float cellsize, int bone, int skinref, int* key)
+{
+	key[0] = (int)floor((org[0] + 1.0) / cellsize);
+	key[1] = (int)floor((org[1] + 1.0) / cellsize);
+	key[2] = (int)floor((org[2] + 1.0) / cellsize);
+	key[3] = bone;
+	key[4] = skinref;
+}
+
 int lookup_normal(s_model_t* pmodel, s_normal_t* pnormal)
 {
-	int i;
-	for (i = 0; i < pmodel->numnorms; i++)
+	int i, j, x, y, z;
+	int cell[5], key[5];
+	unsigned int hash;
+	float cellsize = NormalCellSize();
+	int best = -1;
+
+	NormalCellKey(pnormal->org, cellsize, pnormal->bone, pnormal->skinref, cell);
+
+	// keep the lowest matching index, as the old linear scan did
+	for (x = -1; x <= 1; x++)
 	{
-		// if (VectorCompare( pmodel->normal[i].org, pnormal->org )
-		if (DotProduct(pmodel->normal[i].org, pnormal->org) > normal_blend && pmodel->normal[i].bone == pnormal->bone && pmodel->normal[i].skinref == pnormal->skinref)
+		for (y = -1; y <= 1; y++)
 		{
-			return i;
+			for (z = -1; z <= 1; z++)
+			{
+				key[0] = cell[0] + x;
+				key[1] = cell[1] + y;
+				key[2] = cell[2] + z;
+				key[3] = cell[3];
+				key[4] = cell[4];
+
+				for (j = pmodel->normhash[WeldHash(key, 5)]; j; j = pmodel->normchain[j - 1])
+				{
+					i = j - 1;
+					if (best != -1 && i >= best)
+						continue;
+					// if (VectorCompare( pmodel->normal[i].org, pnormal->org )
+					if (DotProduct(pmodel->normal[i].org, pnormal->org) > normal_blend && pmodel->normal[i].bone == pnormal->bone && pmodel->normal[i].skinref == pnormal->skinref)
+						best = i;
+				}
+			}
 		}
 	}
+	if (best != -1)
+	{
+		return best;
+	}
+
+	i = pmodel->numnorms;
 	if (i >= MAXSTUDIOVERTS)
 	{
 		Error("too many normals in model: \"%s\"\n", pmodel->name);
@@ -1263,26 +1387,52 @@ int lookup_normal(s_model_t* pmodel, s_normal_t* pnormal)
 	pmodel->normal[i].bone = pnormal->bone;
 	pmodel->normal[i].skinref = pnormal->skinref;
 	pmodel->numnorms = i + 1;
+
+	hash = WeldHash(cell, 5);
+	pmodel->normchain[i] = pmodel->normhash[hash];
+	pmodel->normhash[hash] = i + 1;
 	return i;
 }
 
 
-int lookup_vertex(s_model_t* pmodel, s_vertex_t* pv)
+static unsigned int VertexHash(s_vertex_t* pv)
 {
 	int i;
+	int key[4];
+
+	// the positions are already rounded to 2 digits, so welded vertexes are bitwise equal
+	for (i = 0; i < 3; i++)
+	{
+		float f = pv->org[i];
+		memcpy(&key[i], &f, sizeof(f));
+	}
+	key[3] = pv->bone;
+
+	return WeldHash(key, 4);
+}
+
+int lookup_vertex(s_model_t* pmodel, s_vertex_t* pv)
+{
+	int i, j;
+	unsigned int hash;
 
 	// assume 2 digits of accuracy
 	pv->org[0] = (int)(pv->org[0] * 100) / 100.0;
 	pv->org[1] = (int)(pv->org[1] * 100) / 100.0;
 	pv->org[2] = (int)(pv->org[2] * 100) / 100.0;
 
-	for (i = 0; i < pmodel->numverts; i++)
+	hash = VertexHash(pv);
+
+	for (j = pmodel->verthash[hash]; j; j = pmodel->vertchain[j - 1])
 	{
+		i = j - 1;
 		if (VectorCompare(pmodel->vert[i].org, pv->org) && pmodel->vert[i].bone == pv->bone)
 		{
 			return i;
 		}
 	}
+
+	i = pmodel->numverts;
 	if (i >= MAXSTUDIOVERTS)
 	{
 		Error("too many vertices in model: \"%s\"\n", pmodel->name);
@@ -1290,6 +1440,9 @@ int lookup_vertex(s_model_t* pmodel, s_vertex_t* pv)
 	VectorCopy(pv->org, pmodel->vert[i].org);
 	pmodel->vert[i].bone = pv->bone;
 	pmodel->numverts = i + 1;
+
+	pmodel->vertchain[i] = pmodel->verthash[hash];
+	pmodel->verthash[hash] = i + 1;
 	return i;
 }
 
@@ -1623,7 +1776,7 @@ void ResizeTexture(s_texture_t* ptexture)
 		printf("%.0f %.0f %.0f %.0f\n", ptexture->min_s, ptexture->max_s, ptexture->min_t, ptexture->max_t);
 		Error("texture too large\n");
 	}
-	pdest = reinterpret_cast<byte*>(malloc(ptexture->size));
+	pdest = reinterpret_cast<byte*>(kalloc(1, ptexture->size));
 	ptexture->pdata = pdest;
 
 	// data is saved as a multiple of 4
@@ -1710,7 +1863,9 @@ void SetSkinValues()
 
 	for (i = 0; i < numtextures; i++)
 	{
+		double start = StageClock();
 		Grab_Skin(&texture[i]);
+		stagetime[STAGE_GRAB_SKIN] += StageClock() - start;
 
 		texture[i].max_s = -9999999;
 		texture[i].min_s = 9999999;
@@ -1800,10 +1955,10 @@ void SetSkinValues()
 =================
 */
 
-char filename[1024];
-FILE* input;
-char line[1024];
-int linecount;
+thread_local char filename[1024];
+thread_local FILE* input;
+thread_local char line[1024];
+thread_local int linecount;
 
 
 void Build_Reference(s_model_t* pmodel)
@@ -2194,7 +2349,9 @@ void Grab_Studio(s_model_t* pmodel)
 		}
 		else if (strcmp(cmd, "triangles") == 0)
 		{
+			double start = StageClock();
 			Grab_Triangles(pmodel);
+			stagetime[STAGE_GRAB_TRIANGLES] += StageClock() - start;
 		}
 		else
 		{
@@ -2495,8 +2652,8 @@ void Shift_Animation(s_animation_t* panim)
 		memmove(ppos, &panim->pos[j][panim->startframe], size);
 		memmove(prot, &panim->rot[j][panim->startframe], size);
 
-		free(panim->pos[j]);
-		free(panim->rot[j]);
+		kfree(panim->pos[j]);
+		kfree(panim->rot[j]);
 
 		panim->pos[j] = ppos;
 		panim->rot[j] = prot;
@@ -2544,7 +2701,9 @@ void Option_Animation(char* name, s_animation_t* panim)
 		}
 		else if (strcmp(cmd, "skeleton") == 0)
 		{
+			double start = StageClock();
 			Grab_Animation(panim);
+			stagetime[STAGE_GRAB_ANIMATION] += StageClock() - start;
 			Shift_Animation(panim);
 		}
 		else
@@ -2755,6 +2914,32 @@ int lookupActivity(char* szActivity)
 }
 
 
+/*
+=================
+AllocSequence
+
+Makes room for sequence[numseq].  Each s_sequence_t is over 100K, so
+the array grows as $sequence is parsed instead of holding
+MAXSTUDIOSEQUENCES of them for every model.
+=================
+*/
+static thread_local int maxseq;
+
+void AllocSequence(void)
+{
+	if (numseq >= maxseq)
+	{
+		if (numseq >= MAXSTUDIOSEQUENCES)
+			Error("too many sequences in model, max %d\n", MAXSTUDIOSEQUENCES);
+
+		maxseq = std::min(std::max(maxseq * 2, 16), MAXSTUDIOSEQUENCES);
+		sequence = reinterpret_cast<s_sequence_t*>(krealloc(sequence, maxseq * sizeof(s_sequence_t)));
+	}
+
+	// only clear the one in use, the rest may never be touched
+	memset(&sequence[numseq], 0, sizeof(s_sequence_t));
+}
+
 int Cmd_Sequence()
 {
 	int depth = 0;
@@ -2767,6 +2952,7 @@ int Cmd_Sequence()
 	if (!GetToken(false))
 		return 0;
 
+	AllocSequence();
 	strcpyn(sequence[numseq].name, token);
 
 	VectorCopy(defaultadjust, adjust);
@@ -3453,31 +3639,237 @@ void ParseScript(void)
 	}
 }
 
+// command line settings, applied to each model compiled
+typedef struct
+{
+	int numrep;
+	char defaulttexture[16][256];
+	char sourcetexture[16][256];
+	int tag_reversed;
+	int tag_normals;
+	int flip_triangles;
+	float normal_blend;
+	int dump_hboxes;
+	int maxseqgroupsize;
+	int force_powerof2_textures;
+	int ignore_warnings;
+} s_options_t;
+
 /*
 ==============
-main
+ApplyOptions
+
+Sets up a fresh compile with the command line settings
 ==============
 */
-int main(int argc, char** argv)
+void ApplyOptions(const s_options_t* options)
 {
 	int i;
-	char path[1024];
 
 	default_scale = 1.0;
 	defaultzrotation = Q_PI / 2;
 
-	numrep = 0;
-	tag_reversed = 0;
-	tag_normals = 0;
-	flip_triangles = 1;
-	maxseqgroupsize = 1024 * 1024;
-
-	normal_blend = cos(2.0 * (Q_PI / 180.0));
+	numrep = options->numrep;
+	for (i = 0; i < numrep; i++)
+	{
+		strcpy(defaulttexture[i], options->defaulttexture[i]);
+		strcpy(sourcetexture[i], options->sourcetexture[i]);
+	}
+	tag_reversed = options->tag_reversed;
+	tag_normals = options->tag_normals;
+	flip_triangles = options->flip_triangles;
+	normal_blend = options->normal_blend;
+	dump_hboxes = options->dump_hboxes;
+	maxseqgroupsize = options->maxseqgroupsize;
+	force_powerof2_textures = options->force_powerof2_textures;
+	ignore_warnings = options->ignore_warnings;
 
 	gamma = 1.8;
 
+	// allocated as the sequences are parsed
+	sequence = NULL;
+	maxseq = 0;
+
+	strcpy(sequencegroup[numseqgroups].label, "default");
+	numseqgroups = 1;
+}
+
+/*
+==============
+CompileModel
+
+Compiles one .qc on the calling thread and returns the bytes written
+==============
+*/
+int CompileModel(const char* qcfile, const s_options_t* options)
+{
+	char path[1024];
+	double start;
+	int bytes;
+
+	ApplyOptions(options);
+
+	//
+	// load the script
+	//
+	strcpy(path, qcfile);
+	DefaultExtension(path, ".qc");
+	// SetQdirFromPath ();
+	LoadScriptFile(path);
+
+	//
+	// parse it
+	//
+
+	ClearModel();
+	strcpy(outname, qcfile);
+
+	ParseScript();
+	SetSkinValues();
+
+	start = StageClock();
+	SimplifyModel();
+	stagetime[STAGE_SIMPLIFY] += StageClock() - start;
+
+	start = StageClock();
+	bytes = WriteFile();
+	stagetime[STAGE_WRITE] += StageClock() - start;
+
+	return bytes;
+}
+
+// the .qc each batch thread is compiling, for ReportBatchError
+static thread_local const char* batchqcfile;
+
+/*
+==============
+ReportBatchError
+
+Error exits from the thread that hit it, and this runs there at exit,
+so it can still tell which model of the batch stopped it
+==============
+*/
+void ReportBatchError(void)
+{
+	if (batchqcfile)
+		printf("batch stopped by an error compiling %s\n", batchqcfile);
+}
+
+/*
+==============
+CompileBatch
+
+Compiles every .qc listed in listfile, numjobs at a time.  Each model is
+compiled on a new thread, so it starts with the same clean state as a
+standalone run.  Paths in the .qc files resolve against the current
+directory, as they would for a standalone run from here.
+
+An error in any model exits the whole batch, as it would a standalone
+run.  Models finished before it are kept, and the ones being compiled
+leave only their .tmp files, never a partial .mdl.
+==============
+*/
+int CompileBatch(const char* listfile, const s_options_t* options, int numjobs)
+{
+	std::vector<std::string> qcfiles;
+	std::vector<std::thread> workers;
+	std::atomic<int> nextjob(0);
+	std::mutex lock;
+	double totalstagetime[NUM_STAGES] = {};
+	double totalbytes = 0;
+	int numdone = 0;
+	char* buffer;
+	char* p;
+	double start;
+	int i;
+
+	LoadFile(listfile, reinterpret_cast<void**>(&buffer));
+	for (p = strtok(buffer, "\r\n"); p; p = strtok(NULL, "\r\n"))
+	{
+		while (isspace(*p))
+			p++;
+		if (*p && strncmp(p, "//", 2))
+			qcfiles.push_back(p);
+	}
+	free(buffer);
+
+	if (qcfiles.empty())
+		Error("no .qc files listed in %s\n", listfile);
+
+	if (numjobs <= 0)
+		numjobs = std::max<int>(std::thread::hardware_concurrency(), 1);
+	numjobs = std::min<int>(numjobs, qcfiles.size());
+
+	printf("compiling %d models, %d at a time\n", (int)qcfiles.size(), numjobs);
+
+	atexit(ReportBatchError);
+
+	start = StageClock();
+
+	for (i = 0; i < numjobs; i++)
+	{
+		workers.emplace_back([&]()
+			{
+				int job;
+
+				while ((job = nextjob++) < (int)qcfiles.size())
+				{
+					// a new thread per model, so no state carries over from the last one
+					std::thread compile([&, job]()
+						{
+							batchqcfile = qcfiles[job].c_str();
+
+							double jobstart = StageClock();
+							int bytes = CompileModel(qcfiles[job].c_str(), options);
+							double jobtime = StageClock() - jobstart;
+
+							batchqcfile = NULL;
+
+							std::lock_guard<std::mutex> guard(lock);
+							for (int j = 0; j < NUM_STAGES; j++)
+								totalstagetime[j] += stagetime[j];
+							totalbytes += bytes;
+							numdone++;
+							printf("[%d/%d] %s: %d bytes in %.3f seconds\n", numdone, (int)qcfiles.size(), qcfiles[job].c_str(), bytes, jobtime);
+
+							kfreeall();
+						});
+					compile.join();
+				}
+			});
+	}
+
+	for (auto& worker : workers)
+		worker.join();
+
+	double elapsed = StageClock() - start;
+
+	PrintStageTimes(totalstagetime);
+	printf("%d models, %.0f KB in %.3f seconds (%.2f models/s, %.0f KB/s, %d jobs)\n",
+		numdone, totalbytes / 1024, elapsed, numdone / elapsed, totalbytes / 1024 / elapsed, numjobs);
+
+	return 0;
+}
+
+/*
+==============
+main
+==============
+*/
+int main(int argc, char** argv)
+{
+	int i;
+	s_options_t options;
+	qboolean batch = false;
+	int numjobs = 0;
+
+	memset(&options, 0, sizeof(options));
+	options.flip_triangles = 1;
+	options.maxseqgroupsize = 1024 * 1024;
+	options.normal_blend = cos(2.0 * (Q_PI / 180.0));
+
 	if (argc == 1)
-		Error("usage: studiomdl [-t texture] -r(tag reversed) -n(tag bad normals) -f(flip all triangles) [-a normal_blend_angle] -h(dump hboxes) -i(ignore warnings) -p(force power of 2 textures) [-g max_sequencegroup_size(K)] file.qc");
+		Error("usage: studiomdl [-t texture] -r(tag reversed) -n(tag bad normals) -f(flip all triangles) [-a normal_blend_angle] -h(dump hboxes) -i(ignore warnings) -p(force power of 2 textures) [-g max_sequencegroup_size(K)] [-b(file is a list of .qc files, an error in any one stops the batch) [-j jobs]] file.qc");
 
 	for (i = 1; i < argc - 1; i++)
 	{
@@ -3487,69 +3879,60 @@ int main(int argc, char** argv)
 			{
 			case 't':
 				i++;
-				strcpy(defaulttexture[numrep], argv[i]);
+				strcpy(options.defaulttexture[options.numrep], argv[i]);
 				if (i < argc - 2 && argv[i + 1][0] != '-')
 				{
 					i++;
-					strcpy(sourcetexture[numrep], argv[i]);
-					printf("Replaceing %s with %s\n", sourcetexture[numrep], defaulttexture[numrep]);
+					strcpy(options.sourcetexture[options.numrep], argv[i]);
+					printf("Replaceing %s with %s\n", options.sourcetexture[options.numrep], options.defaulttexture[options.numrep]);
 				}
-				printf("Using default texture: %s\n", defaulttexture[numrep]);
-				numrep++;
+				printf("Using default texture: %s\n", options.defaulttexture[options.numrep]);
+				options.numrep++;
 				break;
 			case 'r':
-				tag_reversed = 1;
+				options.tag_reversed = 1;
 				break;
 			case 'n':
-				tag_normals = 1;
+				options.tag_normals = 1;
 				break;
 			case 'f':
-				flip_triangles = 0;
+				options.flip_triangles = 0;
 				break;
 			case 'a':
 				i++;
-				normal_blend = cos(atof(argv[i]) * (Q_PI / 180.0));
+				options.normal_blend = cos(atof(argv[i]) * (Q_PI / 180.0));
 				break;
 			case 'h':
-				dump_hboxes = 1;
+				options.dump_hboxes = 1;
 				break;
 			case 'g':
 				i++;
-				maxseqgroupsize = 1024 * atoi(argv[i]);
+				options.maxseqgroupsize = 1024 * atoi(argv[i]);
 				break;
 			case 'p':
 			case '2':
-				force_powerof2_textures = 1;
+				options.force_powerof2_textures = 1;
 				break;
 			case 'i':
-				ignore_warnings = 1;
+				options.ignore_warnings = 1;
+				break;
+			case 'b':
+				batch = true;
+				break;
+			case 'j':
+				i++;
+				numjobs = atoi(argv[i]);
 				break;
 			}
 		}
 	}
 
-	strcpy(sequencegroup[numseqgroups].label, "default");
-	numseqgroups = 1;
+	if (batch)
+		return CompileBatch(argv[i], &options, numjobs);
 
-	//
-	// load the script
-	//
-	strcpy(path, argv[i]);
-	DefaultExtension(path, ".qc");
-	// SetQdirFromPath ();
-	LoadScriptFile(path);
-
-	//
-	// parse it
-	//
+	CompileModel(argv[i], &options);
 
-	ClearModel();
-	strcpy(outname, argv[i]);
-
-	ParseScript();
-	SetSkinValues();
-	SimplifyModel();
-	WriteFile();
+	PrintStageTimes(stagetime);
 
 	return 0;
 }
@@ -21,8 +21,10 @@
 #define IDSTUDIOSEQHEADER (('Q' << 24) + ('S' << 16) + ('D' << 8) + 'I')
 // little-endian "IDSQ"
 
+// All compiler state is per thread, so a batch can run each model on its
+// own thread and every model still starts from a clean slate
 #ifndef EXTERN
-#define EXTERN extern
+#define EXTERN extern thread_local
 #endif
 
 EXTERN char outname[1024];
@@ -66,11 +68,34 @@ EXTERN int clip_texcoords;
 #define PITCH 0
 #define YAW 1
 
+#define WELD_HASH_SIZE 4096 // power of two
+
+// compile time spent in each stage, printed once the model is written
+enum
+{
+	STAGE_GRAB_TRIANGLES,
+	STAGE_GRAB_ANIMATION,
+	STAGE_GRAB_SKIN,
+	STAGE_SIMPLIFY,
+	STAGE_OPTIMIZE, // part of STAGE_SIMPLIFY
+	STAGE_BUILDTRIS, // part of STAGE_WRITE
+	STAGE_WRITE,
+	NUM_STAGES
+};
+
+EXTERN double stagetime[NUM_STAGES];
+
+double StageClock(void);
+void PrintStageTimes(const double* times);
+
 
 extern vec_t Q_rint(vec_t in);
 
-extern void WriteFile(void);
+extern int WriteFile(void);
 void* kalloc(int num, int size);
+void* krealloc(void* ptr, int size);
+void kfree(void* ptr);
+void kfreeall(void);
 
 typedef struct
 {
@@ -264,7 +289,7 @@ typedef struct
 	int exitnode;
 	int nodeflags;
 } s_sequence_t;
-EXTERN s_sequence_t sequence[MAXSTUDIOSEQUENCES];
+EXTERN s_sequence_t* sequence; // [numseq], grown by AllocSequence as $sequence is parsed
 
 
 EXTERN int numseqgroups;
@@ -367,6 +392,12 @@ typedef struct s_model_s
 	int numnorms;
 	s_normal_t normal[MAXSTUDIOVERTS];
 
+	// weld lookups, chained by index + 1 so an empty (zeroed) table needs no setup
+	int verthash[WELD_HASH_SIZE];
+	int vertchain[MAXSTUDIOVERTS];
+	int normhash[WELD_HASH_SIZE];
+	int normchain[MAXSTUDIOVERTS];
+
 	int nummesh;
 	s_mesh_t* pmesh[MAXSTUDIOMESHES];
 
@@ -28,65 +28,164 @@
 #include "..\..\engine\studio.h"
 #include "studiomdl.h"
 
-int used[MAXSTUDIOTRIANGLES];
+thread_local int used[MAXSTUDIOTRIANGLES];
 
 // the command list holds counts and s/t values that are valid for
 // every frame
-short commands[MAXSTUDIOTRIANGLES * 13];
-int numcommands;
+thread_local short commands[MAXSTUDIOTRIANGLES * 13];
+thread_local int numcommands;
 
 // all frames will have their vertexes rearranged and expanded
 // so they are in the order expected by the command list
 
-int allverts, alltris;
+thread_local int allverts, alltris;
 
-int stripverts[MAXSTUDIOTRIANGLES + 2];
-int striptris[MAXSTUDIOTRIANGLES + 2];
-int stripcount;
+thread_local int stripverts[MAXSTUDIOTRIANGLES + 2];
+thread_local int striptris[MAXSTUDIOTRIANGLES + 2];
+thread_local int stripcount;
 
-int neighbortri[MAXSTUDIOTRIANGLES][3];
-int neighboredge[MAXSTUDIOTRIANGLES][3];
+thread_local int neighbortri[MAXSTUDIOTRIANGLES][3];
+thread_local int neighboredge[MAXSTUDIOTRIANGLES][3];
 
 
-s_trianglevert_t (*triangles)[3];
-s_mesh_t* pmesh;
+thread_local s_trianglevert_t (*triangles)[3];
+thread_local s_mesh_t* pmesh;
 
+// every distinct triangle vertex gets an id, so edges can be hashed
+#define TRISTRIP_HASH_SIZE 8192 // power of two
 
-void FindNeighbor(int starttri, int startv)
+thread_local int vertid[MAXSTUDIOTRIANGLES][3];
+thread_local int vertfirst[MAXSTUDIOTRIANGLES * 3]; // tri * 3 + corner of each id's first use
+thread_local int vertchain[MAXSTUDIOTRIANGLES * 3];
+thread_local int verthash[TRISTRIP_HASH_SIZE];
+thread_local int numvertids;
+
+// corners of all triangles, chained by the ids of the edge they start
+thread_local int edgechain[MAXSTUDIOTRIANGLES * 3];
+thread_local int edgehash[TRISTRIP_HASH_SIZE];
+
+// StripLength and FanLength mark the triangles they walk with the current
+// pass, so nothing has to be cleared between tries
+thread_local int stripmark[MAXSTUDIOTRIANGLES];
+thread_local int strippass;
+
+// longest strip or fan found from each triangle; triangles only get used up,
+// so it never grows and anything shorter than the best so far can be skipped
+thread_local int peak[MAXSTUDIOTRIANGLES];
+
+// triangles to start the next strip from, the last strip's neighbours first
+thread_local int starttris[MAXSTUDIOTRIANGLES];
+thread_local int numstarttris;
+
+// simulated post-transform vertex cache, first in first out
+#define VERTEX_CACHE_SIZE 16
+
+thread_local int vertexcache[VERTEX_CACHE_SIZE];
+thread_local int vertexcachehead;
+thread_local int numcachemisses;
+
+
+static unsigned int TriVertHash(const s_trianglevert_t* v)
 {
-	s_trianglevert_t m1, m2;
-	int j;
-	s_trianglevert_t *last, *check;
-	int k;
+	unsigned int hash = 2166136261u;
+	const byte* p = (const byte*)v;
 
-	// used[starttri] |= (1 << startv);
+	for (int i = 0; i < sizeof(*v); i++)
+		hash = (hash ^ p[i]) * 16777619u;
+
+	return hash & (TRISTRIP_HASH_SIZE - 1);
+}
+
+static unsigned int EdgeHash(int v0, int v1)
+{
+	return ((unsigned int)v0 * 2654435761u ^ (unsigned int)v1 * 40503u) & (TRISTRIP_HASH_SIZE - 1);
+}
+
+/*
+================
+HashTriangles
 
-	last = &triangles[starttri][0];
+Gives every distinct vertex an id and chains each corner by its edge
+================
+*/
+void HashTriangles(void)
+{
+	int i, k, id;
+	unsigned int hash;
 
-	m1 = last[(startv + 1) % 3];
-	m2 = last[(startv + 0) % 3];
+	numvertids = 0;
+	memset(verthash, -1, sizeof(verthash));
+	memset(edgehash, -1, sizeof(edgehash));
 
-	for (j = starttri + 1, check = &triangles[starttri + 1][0]; j < pmesh->numtris; j++, check += 3)
+	for (i = 0; i < pmesh->numtris; i++)
 	{
-		if (used[j] == 7)
-			continue;
 		for (k = 0; k < 3; k++)
 		{
-			if (memcmp(&check[k], &m1, sizeof(m1)))
-				continue;
-			if (memcmp(&check[(k + 1) % 3], &m2, sizeof(m2)))
-				continue;
+			hash = TriVertHash(&triangles[i][k]);
+			for (id = verthash[hash]; id != -1; id = vertchain[id])
+			{
+				if (!memcmp(&triangles[vertfirst[id] / 3][vertfirst[id] % 3], &triangles[i][k], sizeof(s_trianglevert_t)))
+					break;
+			}
+			if (id == -1)
+			{
+				id = numvertids++;
+				vertfirst[id] = i * 3 + k;
+				vertchain[id] = verthash[hash];
+				verthash[hash] = id;
+			}
+			vertid[i][k] = id;
+		}
+	}
 
-			neighbortri[starttri][startv] = j;
-			neighboredge[starttri][startv] = k;
+	// walked backwards so each chain runs in triangle order
+	for (i = pmesh->numtris - 1; i >= 0; i--)
+	{
+		for (k = 2; k >= 0; k--)
+		{
+			hash = EdgeHash(vertid[i][k], vertid[i][(k + 1) % 3]);
+			edgechain[i * 3 + k] = edgehash[hash];
+			edgehash[hash] = i * 3 + k;
+		}
+	}
+}
 
-			neighbortri[j][k] = starttri;
-			neighboredge[j][k] = startv;
+/*
+================
+FindNeighbor
 
-			used[starttri] |= (1 << startv);
-			used[j] |= (1 << k);
-			return;
-		}
+Pairs the edge with the first later triangle that runs it the other way
+================
+*/
+void FindNeighbor(int starttri, int startv)
+{
+	int corner, j, k;
+	int v0, v1;
+
+	// used[starttri] |= (1 << startv);
+
+	v0 = vertid[starttri][(startv + 1) % 3];
+	v1 = vertid[starttri][startv];
+
+	for (corner = edgehash[EdgeHash(v0, v1)]; corner != -1; corner = edgechain[corner])
+	{
+		j = corner / 3;
+		k = corner % 3;
+
+		if (j <= starttri || used[j] == 7)
+			continue;
+		if (vertid[j][k] != v0 || vertid[j][(k + 1) % 3] != v1)
+			continue;
+
+		neighbortri[starttri][startv] = j;
+		neighboredge[starttri][startv] = k;
+
+		neighbortri[j][k] = starttri;
+		neighboredge[j][k] = startv;
+
+		used[starttri] |= (1 << startv);
+		used[j] |= (1 << k);
+		return;
 	}
 }
 
@@ -101,7 +200,8 @@ int StripLength(int starttri, int startv)
 	int j;
 	int k;
 
-	used[starttri] = 2;
+	strippass++;
+	stripmark[starttri] = strippass;
 
 	stripverts[0] = (startv) % 3;
 	stripverts[1] = (startv + 1) % 3;
@@ -112,7 +212,8 @@ int StripLength(int starttri, int startv)
 	striptris[2] = starttri;
 	stripcount = 3;
 
-	while (1)
+	// longer strips are more than a command can hold
+	while (stripcount < 127)
 	{
 		if (stripcount & 1)
 		{
@@ -124,26 +225,19 @@ int StripLength(int starttri, int startv)
 			j = neighbortri[starttri][(startv + 2) % 3];
 			k = neighboredge[starttri][(startv + 2) % 3];
 		}
-		if (j == -1 || used[j])
-			goto done;
+		if (j == -1 || used[j] || stripmark[j] == strippass)
+			break;
 
 		stripverts[stripcount] = (k + 2) % 3;
 		striptris[stripcount] = j;
 		stripcount++;
 
-		used[j] = 2;
+		stripmark[j] = strippass;
 
 		starttri = j;
 		startv = k;
 	}
 
-done:
-
-	// clear the temp used flags
-	for (j = 0; j < pmesh->numtris; j++)
-		if (used[j] == 2)
-			used[j] = 0;
-
 	return stripcount;
 }
 
@@ -157,7 +251,8 @@ int FanLength(int starttri, int startv)
 	int j;
 	int k;
 
-	used[starttri] = 2;
+	strippass++;
+	stripmark[starttri] = strippass;
 
 	stripverts[0] = (startv) % 3;
 	stripverts[1] = (startv + 1) % 3;
@@ -168,32 +263,105 @@ int FanLength(int starttri, int startv)
 	striptris[2] = starttri;
 	stripcount = 3;
 
-	while (1)
+	while (stripcount < 127)
 	{
 		j = neighbortri[starttri][(startv + 2) % 3];
 		k = neighboredge[starttri][(startv + 2) % 3];
 
-		if (j == -1 || used[j])
-			goto done;
+		if (j == -1 || used[j] || stripmark[j] == strippass)
+			break;
 
 		stripverts[stripcount] = (k + 2) % 3;
 		striptris[stripcount] = j;
 		stripcount++;
 
-		used[j] = 2;
+		stripmark[j] = strippass;
 
 		starttri = j;
 		startv = k;
 	}
 
-done:
+	return stripcount;
+}
+
+
+static qboolean InVertexCache(int id)
+{
+	for (int i = 0; i < VERTEX_CACHE_SIZE; i++)
+	{
+		if (vertexcache[i] == id)
+			return true;
+	}
+	return false;
+}
+
+static void AddToVertexCache(int id)
+{
+	if (InVertexCache(id))
+		return;
 
-	// clear the temp used flags
-	for (j = 0; j < pmesh->numtris; j++)
-		if (used[j] == 2)
-			used[j] = 0;
+	vertexcache[vertexcachehead] = id;
+	vertexcachehead = (vertexcachehead + 1) % VERTEX_CACHE_SIZE;
+	numcachemisses++;
+}
 
-	return stripcount;
+// vertexes of the current strip that would miss the cache if it were sent now
+static int StripCacheMisses(void)
+{
+	int i, j, id;
+	int misses = 0;
+
+	for (i = 0; i < stripcount; i++)
+	{
+		id = vertid[striptris[i]][stripverts[i]];
+		if (InVertexCache(id))
+			continue;
+
+		// only the first use of a vertex in the strip can miss
+		for (j = 0; j < i; j++)
+		{
+			if (vertid[striptris[j]][stripverts[j]] == id)
+				break;
+		}
+		if (j == i)
+			misses++;
+	}
+	return misses;
+}
+
+/*
+================
+FindStartTriangles
+
+Lists the unused triangles, the neighbours of the last strip first so
+that a tie goes to the strip that picks up where the last one ended
+================
+*/
+void FindStartTriangles(int laststrip)
+{
+	int i, k, j;
+
+	numstarttris = 0;
+	strippass++;
+
+	for (i = 0; i < laststrip; i++)
+	{
+		for (k = 0; k < 3; k++)
+		{
+			j = neighbortri[striptris[i]][k];
+			if (j == -1 || used[j] || stripmark[j] == strippass)
+				continue;
+
+			stripmark[j] = strippass;
+			starttris[numstarttris++] = j;
+		}
+	}
+
+	for (i = 0; i < pmesh->numtris; i++)
+	{
+		if (!used[i] && stripmark[i] != strippass)
+			starttris[numstarttris++] = i;
+	}
 }
 
 
@@ -205,20 +373,19 @@ Generate a list of trifans or strips
 for the model, which holds for all frames
 ================
 */
-int numcommandnodes;
+thread_local int numcommandnodes;
 
 int BuildTris(s_trianglevert_t (*x)[3], s_mesh_t* y, byte** ppdata)
 {
 	int i, j, k, m;
 	int startv;
-	int len, bestlen, besttype = 0;
-	int bestverts[MAXSTUDIOTRIANGLES];
-	int besttris[MAXSTUDIOTRIANGLES];
-	int peak[MAXSTUDIOTRIANGLES];
-	int type;
+	int len, bestlen, besttype = 0, bestmisses = 0;
+	int bestverts[128];
+	int besttris[128];
+	int type, misses;
 	int total = 0;
+	int laststrip = 0;
 	long t;
-	int maxlen;
 
 	triangles = x;
 	pmesh = y;
@@ -231,7 +398,11 @@ int BuildTris(s_trianglevert_t (*x)[3], s_mesh_t* y, byte** ppdata)
 		neighbortri[i][0] = neighbortri[i][1] = neighbortri[i][2] = -1;
 		used[i] = 0;
 		peak[i] = pmesh->numtris;
+		stripmark[i] = 0;
 	}
+	strippass = 0;
+
+	HashTriangles();
 
 	// printf("finding neighbors\n");
 	for (i = 0; i < pmesh->numtris; i++)
@@ -252,31 +423,27 @@ int BuildTris(s_trianglevert_t (*x)[3], s_mesh_t* y, byte** ppdata)
 	//
 	numcommandnodes = 0;
 	numcommands = 0;
-	memset(used, 0, sizeof(used));
+	memset(used, 0, pmesh->numtris * sizeof(used[0]));
+
+	memset(vertexcache, -1, sizeof(vertexcache));
+	vertexcachehead = 0;
+	numcachemisses = 0;
 
-	for (i = 0; i < pmesh->numtris;)
+	while (total < pmesh->numtris)
 	{
-		// pick an unused triangle and start the trifan
-		if (used[i])
-		{
-			i++;
-			continue;
-		}
+		FindStartTriangles(laststrip);
 
-		maxlen = 9999;
+		// take the longest strip or fan, and of those the same length the one
+		// that misses the vertex cache least
 		bestlen = 0;
-		m = 0;
-		for (k = i; k < pmesh->numtris && bestlen < 127; k++)
+		for (m = 0; m < numstarttris && bestlen < 127; m++)
 		{
 			int localpeak = 0;
 
-			if (used[k])
+			k = starttris[m];
+			if (peak[k] < bestlen)
 				continue;
 
-			if (peak[k] <= bestlen)
-				continue;
-
-			m++;
 			for (type = 0; type < 2; type++)
 			{
 				for (startv = 0; startv < 3; startv++)
@@ -285,34 +452,31 @@ int BuildTris(s_trianglevert_t (*x)[3], s_mesh_t* y, byte** ppdata)
 						len = FanLength(k, startv);
 					else
 						len = StripLength(k, startv);
-					if (len > 127)
-					{
-						// skip these, they are too long to encode
-					}
-					else if (len > bestlen)
+					if (len > localpeak)
+						localpeak = len;
+					if (len < bestlen)
+						continue;
+
+					misses = StripCacheMisses();
+					if (len > bestlen || misses < bestmisses)
 					{
 						besttype = type;
 						bestlen = len;
+						bestmisses = misses;
 						for (j = 0; j < bestlen; j++)
 						{
 							besttris[j] = striptris[j];
 							bestverts[j] = stripverts[j];
 						}
-						// printf("%d %d\n", k, bestlen );
 					}
-					if (len > localpeak)
-						localpeak = len;
 				}
 			}
 			peak[k] = localpeak;
-			if (localpeak == maxlen)
-				break;
 		}
-		total += (bestlen - 2);
 
-		// printf("%d (%d) %d\n", bestlen, pmesh->numtris - total, i );
+		total += (bestlen - 2);
 
-		maxlen = bestlen;
+		// printf("%d (%d) %d\n", bestlen, pmesh->numtris - total, m );
 
 		// mark the tris on the best strip as used
 		for (j = 0; j < bestlen; j++)
@@ -333,10 +497,17 @@ int BuildTris(s_trianglevert_t (*x)[3], s_mesh_t* y, byte** ppdata)
 			commands[numcommands++] = tri->normindex;
 			commands[numcommands++] = tri->s;
 			commands[numcommands++] = tri->t;
+
+			AddToVertexCache(vertid[besttris[j]][bestverts[j]]);
 		}
 		// printf("%d ", bestlen - 2 );
 		numcommandnodes++;
 
+		// FindStartTriangles looks around the strip just sent
+		for (j = 0; j < bestlen; j++)
+			striptris[j] = besttris[j];
+		laststrip = bestlen;
+
 		if (t != time(NULL))
 		{
 			printf("%2d%%\r", (total * 100) / pmesh->numtris);
@@ -33,9 +33,10 @@
 #include "studiomdl.h"
 
 
-int totalframes = 0;
-float totalseconds = 0;
-extern int numcommandnodes;
+thread_local int totalframes = 0;
+thread_local float totalseconds = 0;
+extern thread_local int numcommandnodes;
+extern thread_local int numcachemisses;
 
 
 
@@ -44,10 +45,10 @@ extern int numcommandnodes;
 WriteModel
 ============
 */
-byte* pData;
-byte* pStart;
-studiohdr_t* phdr;
-studioseqhdr_t* pseqhdr;
+thread_local byte* pData;
+thread_local byte* pStart;
+thread_local studiohdr_t* phdr;
+thread_local studioseqhdr_t* pseqhdr;
 
 #define ALIGN(a) a = (byte*)((int)((byte*)a + 3) & ~3)
 void WriteBoneInfo()
@@ -398,6 +399,7 @@ void WriteModel()
 	byte* cur;
 	int total_tris = 0;
 	int total_strips = 0;
+	int total_misses = 0;
 
 	pbodypart = (mstudiobodyparts_t*)pData;
 	phdr->numbodyparts = numbodyparts;
@@ -496,10 +498,12 @@ void WriteModel()
 
 		total_tris = 0;
 		total_strips = 0;
+		total_misses = 0;
 		for (j = 0; j < model[i]->nummesh; j++)
 		{
 			int numCmdBytes;
 			byte* pCmdSrc;
+			double start;
 
 			pmesh[j].numtris = model[i]->pmesh[j]->numtris;
 			pmesh[j].skinref = model[i]->pmesh[j]->skinref;
@@ -512,7 +516,9 @@ void WriteModel()
 				psrctri++;
 			}
 
+			start = StageClock();
 			numCmdBytes = BuildTris(model[i]->pmesh[j]->triangle, model[i]->pmesh[j], &pCmdSrc);
+			stagetime[STAGE_BUILDTRIS] += StageClock() - start;
 
 			pmesh[j].triindex = (pData - pStart);
 			memcpy(pData, pCmdSrc, numCmdBytes);
@@ -520,8 +526,14 @@ void WriteModel()
 			ALIGN(pData);
 			total_tris += pmesh[j].numtris;
 			total_strips += numcommandnodes;
+			total_misses += numcachemisses;
 		}
 		printf("mesh      %6d bytes (%d tris, %d strips)\n", pData - cur, total_tris, total_strips);
+		if (total_strips)
+		{
+			// misses per triangle of a 16 entry FIFO vertex cache, 0.5 is ideal and 3 is none
+			printf("          %.1f tris/strip, %.3f cache misses/tri\n", (float)total_tris / total_strips, (float)total_misses / total_tris);
+		}
 		cur = pData;
 	}
 }
@@ -531,10 +543,37 @@ void WriteModel()
 #define FILEBUFFER (16 * 1024 * 1024)
 
 
-void WriteFile(void)
+/*
+============
+OpenModelOutput
+
+Output files are written under a temporary name and renamed when they are
+complete, so a run that is stopped part way leaves no partial .mdl behind
+============
+*/
+static FILE* OpenModelOutput(const char* filename, char* tempname)
+{
+	sprintf(tempname, "%s.tmp", filename);
+	return SafeOpenWrite(tempname);
+}
+
+static void CloseModelOutput(FILE* f, const char* tempname, const char* filename)
+{
+	fclose(f);
+
+	// rename does not replace an existing file on Windows
+	remove(filename);
+	if (rename(tempname, filename))
+		Error("Error renaming %s to %s", tempname, filename);
+}
+
+
+int WriteFile(void)
 {
 	FILE* modelouthandle;
+	char tempname[1024 + 4];
 	int total = 0;
+	int written = 0;
 	int i;
 
 	pStart = reinterpret_cast<byte*>(kalloc(1, FILEBUFFER));
@@ -549,7 +588,7 @@ void WriteFile(void)
 		sprintf(groupname, "%s%02d.mdl", outname, i);
 
 		printf("writing %s:\n", groupname);
-		modelouthandle = SafeOpenWrite(groupname);
+		modelouthandle = OpenModelOutput(groupname, tempname);
 
 		pseqhdr = (studioseqhdr_t*)pStart;
 		pseqhdr->id = IDSTUDIOSEQHEADER;
@@ -567,8 +606,9 @@ void WriteFile(void)
 		printf("total     %6d\n", pseqhdr->length);
 
 		SafeWrite(modelouthandle, pStart, pseqhdr->length);
+		written += pseqhdr->length;
 
-		fclose(modelouthandle);
+		CloseModelOutput(modelouthandle, tempname, groupname);
 		memset(pStart, 0, pseqhdr->length);
 	}
 
@@ -580,7 +620,7 @@ void WriteFile(void)
 		sprintf(texname, "%sT.mdl", outname);
 
 		printf("writing %s:\n", texname);
-		modelouthandle = SafeOpenWrite(texname);
+		modelouthandle = OpenModelOutput(texname, tempname);
 
 		phdr = (studiohdr_t*)pStart;
 		phdr->id = IDSTUDIOHEADER;
@@ -594,8 +634,9 @@ void WriteFile(void)
 		printf("textures  %6d bytes\n", phdr->length);
 
 		SafeWrite(modelouthandle, pStart, phdr->length);
+		written += phdr->length;
 
-		fclose(modelouthandle);
+		CloseModelOutput(modelouthandle, tempname, texname);
 		memset(pStart, 0, phdr->length);
 		pData = pStart;
 	}
@@ -607,7 +648,7 @@ void WriteFile(void)
 
 	printf("---------------------\n");
 	printf("writing %s:\n", outname);
-	modelouthandle = SafeOpenWrite(outname);
+	modelouthandle = OpenModelOutput(outname, tempname);
 
 	phdr = (studiohdr_t*)pStart;
 
@@ -649,6 +690,9 @@ void WriteFile(void)
 	printf("total     %6d\n", phdr->length);
 
 	SafeWrite(modelouthandle, pStart, phdr->length);
+	written += phdr->length;
+
+	CloseModelOutput(modelouthandle, tempname, outname);
 
-	fclose(modelouthandle);
+	return written;
 }
@@ -13,6 +13,11 @@
 #include "vis.h"
 #include "threads.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
 #define MAX_THREADS 4
 
 int numportals;
@@ -38,6 +43,10 @@ int bitlongs;
 
 qboolean fastvis;
 
+// portals in the order PortalFlow should process them, least complex first
+std::vector<portal_t*> sortedportals;
+std::atomic<int> nextportal;
+
 //=============================================================================
 
 void PlaneFromWinding(winding_t* w, plane_t* plane)
@@ -110,35 +119,65 @@ the earlier information.
 */
 portal_t* GetNextPortal(void)
 {
-	int j;
-	portal_t *p, *tp;
-	int min;
+	portal_t* p;
 	int i;
 
 	i = GetThreadWork(); // bump the pacifier
 	if (i == -1)
 		return NULL;
 
-	ThreadLock();
+	// nummightsee does not change once BasePortalVis is done, so the order
+	// is fixed up front and each thread just takes the next one in line
+	i = nextportal++;
+	if (i >= (int)sortedportals.size())
+		return NULL;
 
-	min = 99999;
-	p = NULL;
+	p = sortedportals[i];
+	p->status = vstatus_t::working;
 
-	for (j = 0, tp = portals; j < numportals * 2; j++, tp++)
-	{
-		if (tp->nummightsee < min && tp->status == vstatus_t::none)
-		{
-			min = tp->nummightsee;
-			p = tp;
-		}
-	}
+	return p;
+}
 
-	if (p)
-		p->status = vstatus_t::working;
+/*
+=============
+SortPortals
 
-	ThreadUnlock();
+Orders the portals for GetNextPortal by nummightsee. Portals that
+tie stay in portal order, which is the order a linear scan for the
+smallest would have picked them in.
+=============
+*/
+void SortPortals(void)
+{
+	int i;
 
-	return p;
+	sortedportals.resize(numportals * 2);
+	for (i = 0; i < numportals * 2; i++)
+		sortedportals[i] = &portals[i];
+
+	std::stable_sort(sortedportals.begin(), sortedportals.end(), [](const portal_t* a, const portal_t* b)
+		{ return a->nummightsee < b->nummightsee; });
+
+	nextportal = 0;
+}
+
+/*
+=============
+PhaseTime
+
+Returns the seconds since the previous call
+=============
+*/
+double PhaseTime(void)
+{
+	static std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	const double seconds = std::chrono::duration<double>(now - last).count();
+
+	last = now;
+
+	return seconds;
 }
 
 /*
@@ -288,6 +327,8 @@ void CalcPortalVis(void)
 
 	leafon = 0;
 
+	SortPortals();
+
 	RunThreadsOn(numportals * 2, true, LeafThread);
 
 	qprintf("portalcheck: %i  portaltest: %i  portalpass: %i\n", c_portalcheck, c_portaltest, c_portalpass);
@@ -304,10 +345,16 @@ void CalcVis(void)
 {
 	int i;
 
+	PhaseTime();
+
 	RunThreadsOn(numportals * 2, true, BasePortalVis);
 
+	printf("BasePortalVis:     %7.2f seconds\n", PhaseTime());
+
 	CalcPortalVis();
 
+	printf("PortalFlow:        %7.2f seconds\n", PhaseTime());
+
 	//
 	// assemble the leaf vis lists by oring and compressing the portal lists
 	//
@@ -489,6 +536,7 @@ int main(int argc, char** argv)
 	DefaultExtension(source, ".bsp");
 
 	LoadBSPFile(source);
+	CheckBSPFileLimits();
 
 	strcpy(portalfile, argv[i]);
 	StripExtension(portalfile);
@@ -506,8 +554,12 @@ int main(int argc, char** argv)
 	visdatasize = vismap_p - dvisdata;
 	printf("visdatasize:%i  compressed from %i\n", visdatasize, originalvismapsize);
 
+	PhaseTime();
+
 	CalcAmbientSounds();
 
+	printf("CalcAmbientSounds: %7.2f seconds\n", PhaseTime());
+
 	WriteBSPFile(source);
 
 	//	unlink (portalfile);